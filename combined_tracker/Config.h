@@ -7,6 +7,9 @@
 
 // LoRa Configuration
 #define LORA_FREQ 433E6
+#define LORA_BW 125E3                // Hz
+#define LORA_CR 5                    // coding rate 4/5
+#define LORA_PREAMBLE 8              // symbols
 
 // GPS Pins (Serial 0 - USB Serial)
 #define GPS_RX_PIN 3   // RX0
@@ -15,6 +18,8 @@
 // SIM800L Pins
 #define SIM_RX_PIN 25
 #define SIM_TX_PIN 26
+#define SIM_DTR_PIN -1   // wired DTR allows CSCLK=1; -1 wakes the module with "AT" (CSCLK=2)
+#define SIM_RI_PIN -1    // ring indicator, wakes the modem task on SMS/calls; -1 if not wired
 
 // LoRa Pins
 #define LORA_SS 5
@@ -29,13 +34,99 @@
 #define NUM_RECEIVERS 2
 extern const char* RECEIVER_PHONES[];
 
+// SIM800L UART (boots at 9600, negotiated up to MODEM_BAUD_MAX)
+#define MODEM_BAUD_INITIAL 9600
+#define MODEM_BAUD_MAX 115200
+
 // Timing Configuration
-#define GPS_UPDATE_INTERVAL 100      // ms
-#define LORA_UPDATE_INTERVAL 50      // ms (faster for better reception)
-#define SMS_UPDATE_INTERVAL 3000     // ms (reduced priority, check every 3s)
+#define GPS_UPDATE_INTERVAL 1000     // ms (longest GPS task sleep, NMEA lines wake it)
+#define LORA_UPDATE_INTERVAL 50      // ms (ACK/send timer check; reception is DIO0 driven)
+#define SMS_UPDATE_INTERVAL 500      // ms (longest modem task sleep, modem lines and requests wake it)
+#define SMS_SWEEP_INTERVAL 60000     // ms (safety sweep of unread SMS)
+#define MODEM_HEALTH_INTERVAL 15000  // ms (AT+CSQ;+CREG? sample)
+#define MODEM_HEALTH_TTL 45000       // ms (older samples count as unknown)
+#define MODEM_HEALTH_EWMA 4          // signal smoothing: avg += (sample - avg) / N
+#define MODEM_BOOT_RETRY 30000       // ms (soft reset after a failed bring-up step)
+#define MODEM_SLEEP 1                // slow-clock sleep between jobs once ready
+#define MODEM_HEALTH_INTERVAL_SLEEP 30000  // ms (health sample while sleep is on, < MODEM_HEALTH_TTL)
 #define DISPLAY_UPDATE_INTERVAL 200  // ms
 #define KEYBOARD_SCAN_INTERVAL 50    // ms
 #define GPS_SEND_INTERVAL 5000      // ms (10 seconds)
 #define LORA_ACK_TIMEOUT 5000        // ms (5 seconds)
 
+// GPRS uplink to the ground server (empty UPLINK_HOST disables it;
+// build_flags can set it per deployment: -DUPLINK_HOST=\"host\")
+#define UPLINK_APN ""
+#ifndef UPLINK_HOST
+#define UPLINK_HOST ""
+#endif
+#define UPLINK_PORT 5010
+#define UPLINK_UDP 0                 // 1: UDP beacons instead of the TCP stream (BT "uplink udp/tcp")
+#define UPLINK_QUEUE 32              // fixes kept until the server's TCP ACK covers them
+#define UPLINK_BATCH 4               // fixes per frame
+#define UPLINK_BATCH_WAIT 20000      // ms (send a partial frame once its oldest fix is this old)
+#define UPLINK_ACK_POLL 2000         // ms (AT+CIPACK while bytes are unacknowledged)
+#define UPLINK_ACK_TIMEOUT 60000     // ms (no ACK progress: reconnect)
+#define UPLINK_CONNECT_TIMEOUT 30000 // ms (CONNECT OK after AT+CIPSTART)
+#define UPLINK_RETRY_MIN 5000        // ms (reconnect backoff, doubles up to UPLINK_RETRY_MAX)
+#define UPLINK_RETRY_MAX 300000
+#define UPLINK_UDP_ACK_EVERY 10      // UDP: ask for an application ACK every N datagrams (0: never)
+#define UPLINK_UDP_ACK_WAIT 10000    // ms (answer to an ACK request)
+#define UPLINK_UDP_ACK_MISSES 3      // unanswered requests in a row before GPRS is restarted
+
+// LoRa adaptive data rate (the ground station assigns SF and TX power per tracker)
+#define LORA_ADR 1
+#define LORA_SF_DEFAULT 7            // start and fallback (library default, what gps_tracker uses)
+#define LORA_SF_MAX 12
+#define LORA_POWER_MAX 17            // dBm (library default)
+#define LORA_POWER_MIN 2
+#define LORA_ADR_MARGIN 5            // dB of SNR kept above the demodulation floor
+#define LORA_ADR_HYSTERESIS 6        // dB of surplus margin before stepping down
+#define LORA_ADR_STEP 3              // dB per SF or power step
+#define LORA_ADR_SAMPLES 4           // packets at the current setting before a step down
+#define LORA_ADR_EWMA 4              // SNR smoothing: avg += (sample - avg) / N
+#define LORA_ADR_REFRESH 20000       // ms (repeat the assignment so the tracker knows it is heard)
+#define LORA_ADR_SILENCE 60000       // ms (no traffic from the other end: back to the defaults)
+#define LORA_ADR_FALLBACK 3          // tracker: missed ACKs in a row before the defaults
+
+// LoRa duty cycle (token bucket per regulatory sub-band, limit from LORA_FREQ)
+#define LORA_DUTY_PERMILLE 0         // 0: regional table, otherwise override (10 = 1%)
+#define LORA_DUTY_WINDOW 3600000     // ms (averaging period; the bucket holds one window of budget)
+#define LORA_DUTY_RESERVE 10         // % of the budget position reports leave for ACKs and control
+
+// LoRa listen-before-talk (CAD before every transmit, random exponential backoff while busy)
+#define LORA_LBT 1
+#define LORA_LBT_TRIES 5             // channel checks before a transmit gives up
+#define LORA_LBT_BACKOFF_MAX 2000    // ms (largest backoff window; the first is one packet's airtime)
+
+// LoRa ARQ (ACK mode: reports retransmitted before the SMS fallback)
+#define LORA_ARQ_WINDOW 4            // reports in flight at once
+#define LORA_ARQ_RETRIES 3           // retransmissions before a report goes by SMS
+#define LORA_ARQ_GAP 400             // ms (between transmits, leaves the station room to ACK)
+#define LORA_ARQ_MEMORY 120000       // ms (station forgets a tracker's sequence after this silence)
+
+// LoRa TDMA (GPS_SEND_INTERVAL is one frame of slots on GPS time)
+#define LORA_TDMA 1
+#define LORA_TDMA_SLOTS 8            // 625 ms slots at the 5 s send interval
+#define LORA_TDMA_SLOT -1            // this tracker's slot, -1: hash of SOLDIER_ID
+#define LORA_TDMA_GUARD 100          // ms (each end of a slot: NMEA latency and clock drift)
+#define LORA_TDMA_HOLDOVER 600000    // ms (no GPS time for this long: back to unslotted)
+
+// LoRa batching: fixes sampled at the GPS rate, sent together as one track frame
+#define LORA_BATCH 0                 // 1: track frames instead of one fix per GPS_SEND_INTERVAL
+#define LORA_BATCH_SAMPLE 1000       // ms (one fix per second)
+#define LORA_BATCH_LATENCY 20000     // ms (oldest fix in a batch waits at most this long)
+
+// LoRa relay (trackers re-broadcast reports they hear, and the station's ACKs for them)
+#define LORA_RELAY 0
+#define LORA_RELAY_HOPS 2            // relays a frame may cross
+#define LORA_RELAY_JITTER 1000       // ms (random wait before forwarding; the station's ACK heard meanwhile cancels it)
+#define LORA_RELAY_MEMORY 4000       // ms (copies not forwarded twice; below LORA_ACK_TIMEOUT so ARQ retries still are)
+#define LORA_RELAY_LOAD 10           // % of airtime per LORA_RELAY_WINDOW spent forwarding, at most
+#define LORA_RELAY_WINDOW 60000      // ms
+
+// Ground station: reports arriving over both LoRa and SMS are shown once
+#define REPORT_DEDUP_SLOTS 256       // recent reports remembered (power of two, ~5 KB)
+#define REPORT_DEDUP_TTL 120000      // ms (longest SMS lag still matched)
+
 #endif
@@ -6,14 +6,15 @@
 #include <LoRa.h>
 #include "BluetoothSerial.h"
 #include "SIM800L.h"
+#include "LineSource.h"
 #include <U8g2lib.h>
 
 // Forward declarations for global objects
 extern TinyGPSPlus gps;
 extern BluetoothSerial BT;
 extern SIM800L sim800l;
-extern HardwareSerial &SerialGPS;
-extern HardwareSerial SerialSIM;
+extern UartLineSource SerialGPS;
+extern UartLineSource SerialSIM;
 
 // Operating Mode
 enum OperatingMode {
@@ -28,6 +29,8 @@ struct GPSData {
   bool isValid;
   uint32_t satellites;
   String timestamp;
+  uint32_t epoch;          // UTC seconds, 0 without a GPS date
+  int32_t hdop;            // hundredths, -1 unknown
 };
 
 // System Status Structure
@@ -46,8 +49,8 @@ struct SystemStatus {
 extern TinyGPSPlus gps;
 extern BluetoothSerial BT;
 extern SIM800L sim800l;
-// SerialGPS is defined as Serial in main file
-extern HardwareSerial SerialSIM;
+// SerialGPS owns UART0 (GPS RX, console TX) in place of Serial
+extern UartLineSource SerialSIM;
 
 extern GPSData currentGPS;
 extern SystemStatus systemStatus;
@@ -57,7 +60,6 @@ extern bool acknowledgmentEnabled;
 // FreeRTOS Mutexes
 extern SemaphoreHandle_t gpsMutex;
 extern SemaphoreHandle_t loraMutex;
-extern SemaphoreHandle_t smsMutex;
 
 // Display and Keyboard States (forward declarations)
 struct DisplayState;
@@ -65,7 +67,6 @@ struct KeyboardState;
 extern DisplayState displayState;
 extern KeyboardState keyboardState;
 extern SemaphoreHandle_t loraMutex;
-extern SemaphoreHandle_t smsMutex;
 
 // Display and Keyboard
 extern U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2;
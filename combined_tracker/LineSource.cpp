@@ -0,0 +1,178 @@
+#include "LineSource.h"
+
+// Synthetic event posted by wake(); the driver never produces it
+#define UART_EVENT_WAKE UART_EVENT_MAX
+
+// Where a scan is within the current line
+enum : uint8_t { SCAN_LINE_START, SCAN_MID_LINE, SCAN_PROMPT };
+
+UartLineSource::UartLineSource(uart_port_t port, bool prompts)
+  : _port(port), _prompts(prompts), _pullScan(SCAN_LINE_START), _readScan(SCAN_LINE_START) {
+}
+
+// True when c ends a line, or completes a "> " prompt at the start of one
+bool UartLineSource::terminates(uint8_t c, uint8_t &scan) {
+  if (c == '\n') {
+    scan = SCAN_LINE_START;
+    return true;
+  }
+  if (!_prompts) return false;
+  bool prompt = scan == SCAN_PROMPT && c == ' ';
+  scan = (scan == SCAN_LINE_START && c == '>') ? SCAN_PROMPT : SCAN_MID_LINE;
+  return prompt;
+}
+
+bool UartLineSource::begin(uint32_t baud, int rxPin, int txPin) {
+  uart_config_t config = {};
+  config.baud_rate = baud;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity = UART_PARITY_DISABLE;
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  config.source_clk = UART_SCLK_APB;
+
+  if (uart_driver_install(_port, UART_LINE_RX_BUF, UART_LINE_TX_BUF, UART_LINE_EVENTS, &_events, 0) != ESP_OK) return false;
+  if (uart_param_config(_port, &config) != ESP_OK) return false;
+  if (uart_set_pin(_port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) return false;
+
+  // One UART_PATTERN_DET event per '\n'. The SIM800L "> " prompt has no newline;
+  // it is caught by the rx-timeout UART_DATA event that follows it.
+  uart_enable_pattern_det_baud_intr(_port, '\n', 1, 9, 0, 0);
+  uart_pattern_queue_reset(_port, UART_LINE_EVENTS);
+  _baud = baud;
+  return true;
+}
+
+void UartLineSource::updateBaudRate(uint32_t baud) {
+  uart_wait_tx_done(_port, pdMS_TO_TICKS(100));
+  uart_set_baudrate(_port, baud);
+  _baud = baud;
+}
+
+uint32_t UartLineSource::baudRate() {
+  return _baud;
+}
+
+// Move whatever the driver holds into _local, counting line terminators
+void UartLineSource::pull() {
+  size_t buffered = 0;
+  uart_get_buffered_data_len(_port, &buffered);
+  while (buffered > 0 && _len < UART_LINE_LOCAL) {
+    uint16_t tail = (_head + _len) % UART_LINE_LOCAL;
+    // Read up to the end of the ring or the free space, whichever is first
+    size_t chunk = UART_LINE_LOCAL - tail;
+    size_t room = UART_LINE_LOCAL - _len;
+    if (chunk > room) chunk = room;
+    if (chunk > buffered) chunk = buffered;
+    int got = uart_read_bytes(_port, &_local[tail], chunk, 0);
+    if (got <= 0) break;
+    for (int i = 0; i < got; i++) {
+      if (terminates(_local[tail + i], _pullScan)) _terminators++;
+    }
+    _len += got;
+    buffered -= got;
+  }
+}
+
+void UartLineSource::handleEvent(const uart_event_t &event) {
+  _stats.events++;
+  switch (event.type) {
+    case UART_PATTERN_DET:
+      _stats.patterns++;
+      // Positions are not needed (pull() scans), keep the pattern queue from filling
+      while (uart_pattern_pop_pos(_port) != -1) {}
+      pull();
+      break;
+    case UART_DATA:
+      pull();
+      break;
+    case UART_FIFO_OVF:
+    case UART_BUFFER_FULL:
+      // Reader fell behind; drop the backlog as the IDF examples do
+      _stats.overflows++;
+      uart_flush_input(_port);
+      xQueueReset(_events);
+      break;
+    case UART_FRAME_ERR:
+    case UART_PARITY_ERR:
+      _stats.frameErrors++;
+      break;
+    default:
+      break;
+  }
+}
+
+bool UartLineSource::waitLine(uint32_t timeoutMs) {
+  pull();
+
+  unsigned long start = millis();
+  while (_terminators == 0 && _len < UART_LINE_LOCAL) {
+    unsigned long elapsed = millis() - start;
+    uart_event_t event;
+    if (elapsed >= timeoutMs ||
+        xQueueReceive(_events, &event, pdMS_TO_TICKS(timeoutMs - elapsed)) != pdTRUE) {
+      _stats.timeouts++;
+      return false;
+    }
+    if (event.type == UART_EVENT_WAKE) {
+      _stats.events++;
+      return false;
+    }
+    handleEvent(event);
+  }
+
+  _stats.wakeups++;
+  return true;
+}
+
+void UartLineSource::wake() {
+  if (_events == NULL) return;   // nothing waits before begin()
+  uart_event_t event = {};
+  event.type = UART_EVENT_WAKE;
+  xQueueSend(_events, &event, 0);
+}
+
+void IRAM_ATTR UartLineSource::wakeFromISR() {
+  if (_events == NULL) return;   // interrupt attached before begin()
+  uart_event_t event = {};
+  event.type = UART_EVENT_WAKE;
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(_events, &event, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+int UartLineSource::available() {
+  size_t buffered = 0;
+  uart_get_buffered_data_len(_port, &buffered);
+  return _len + buffered;
+}
+
+int UartLineSource::read() {
+  if (_len == 0) pull();
+  if (_len == 0) return -1;
+
+  uint8_t c = _local[_head];
+  _head = (_head + 1) % UART_LINE_LOCAL;
+  _len--;
+  if (terminates(c, _readScan)) _terminators--;
+  return c;
+}
+
+int UartLineSource::peek() {
+  if (_len == 0) pull();
+  if (_len == 0) return -1;
+  return _local[_head];
+}
+
+void UartLineSource::flush() {
+  uart_wait_tx_done(_port, portMAX_DELAY);
+}
+
+size_t UartLineSource::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t UartLineSource::write(const uint8_t *buffer, size_t size) {
+  int written = uart_write_bytes(_port, buffer, size);
+  return written > 0 ? written : 0;
+}
@@ -0,0 +1,78 @@
+#ifndef LINE_SOURCE_H
+#define LINE_SOURCE_H
+
+#include <Arduino.h>
+#include "driver/uart.h"
+
+// A byte stream whose reader can sleep until a complete line has arrived.
+// The SIM800L driver and the NMEA feed read it like any other Stream.
+class LineSource : public Stream {
+public:
+  // Block until a '\n' terminated line (or, on a modem port, a "> " prompt) is buffered.
+  // Returns false on timeout or when released by wake().
+  virtual bool waitLine(uint32_t timeoutMs) = 0;
+  // Release a waiting reader early (new work for the consuming task)
+  virtual void wake() = 0;
+  virtual void wakeFromISR() = 0;
+};
+
+#define UART_LINE_RX_BUF 2048   // ESP-IDF driver ring buffer
+#define UART_LINE_TX_BUF 256    // logging does not block on the FIFO
+#define UART_LINE_LOCAL 512     // bytes pulled out of the driver while scanning for terminators
+#define UART_LINE_EVENTS 20     // driver event queue depth
+
+struct LineSourceStats {
+  unsigned long events;       // UART driver events received
+  unsigned long patterns;     // '\n' pattern detections
+  unsigned long wakeups;      // waitLine() returned with a line ready
+  unsigned long timeouts;     // waitLine() returned empty
+  unsigned long overflows;    // FIFO or ring buffer overflow, input flushed
+  unsigned long frameErrors;
+};
+
+// LineSource on an ESP-IDF UART driver with an event queue and '\n' pattern
+// detection. Replaces HardwareSerial for the port; do not begin() both.
+// With prompts set, a "> " at the start of a line also ends a wait (SIM800L
+// send prompt). Other ports leave it off so '>' in data is just a byte.
+class UartLineSource : public LineSource {
+public:
+  explicit UartLineSource(uart_port_t port, bool prompts = false);
+  bool begin(uint32_t baud, int rxPin, int txPin);
+  void updateBaudRate(uint32_t baud);
+  uint32_t baudRate();
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  void flush() override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  bool waitLine(uint32_t timeoutMs) override;
+  void wake() override;
+  void wakeFromISR() override;
+  const LineSourceStats &stats() { return _stats; }
+
+private:
+  void pull();
+  void handleEvent(const uart_event_t &event);
+  bool terminates(uint8_t c, uint8_t &scan);
+
+  uart_port_t _port;
+  bool _prompts;
+  QueueHandle_t _events = NULL;
+  uint32_t _baud = 0;
+  // Bytes already taken from the driver, oldest at _head
+  uint8_t _local[UART_LINE_LOCAL];
+  uint16_t _head = 0;
+  uint16_t _len = 0;
+  uint16_t _terminators = 0;   // '\n' and "> " prompts in _local not yet read
+  // Position within the current line as seen by pull() and by read(). Both
+  // walk the same bytes, so they agree on which ones were terminators.
+  uint8_t _pullScan;
+  uint8_t _readScan;
+  LineSourceStats _stats = {};
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "LoRaArq.h"
+#include "Config.h"
+
+#define ARQ_PEERS 8             // trackers the station keeps a sequence for
+#define ARQ_HISTORY 32          // seqs below the newest remembered per tracker
+
+static ArqFrame window[LORA_ARQ_WINDOW];
+static ArqFrame givenUp[LORA_ARQ_WINDOW];
+static uint8_t givenUpHead = 0;
+static uint8_t givenUpCount = 0;
+static unsigned long lastTxAt = 0;
+static int timeoutsPending = 0;
+
+static ArqStats stats = {};
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Station side: receive history per tracker
+struct ArqPeer {
+  char id[POS_ID_LEN + 1];
+  uint16_t top;                 // newest seq heard
+  uint32_t seen;                // bit n: top - n was received
+  unsigned long heardAt;
+};
+
+static ArqPeer peers[ARQ_PEERS];
+static int peerCount = 0;
+
+static void countInFlight() {
+  uint8_t n = 0;
+  for (int i = 0; i < LORA_ARQ_WINDOW; i++) {
+    if (window[i].used) n++;
+  }
+  portENTER_CRITICAL(&statsMux);
+  stats.inFlight = n;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+// Move a slot to the give-up ring (the oldest entry is lost if loraTask fell behind)
+static void giveUp(ArqFrame &frame) {
+  uint8_t tail = (givenUpHead + givenUpCount) % LORA_ARQ_WINDOW;
+  if (givenUpCount == LORA_ARQ_WINDOW) {
+    givenUpHead = (givenUpHead + 1) % LORA_ARQ_WINDOW;
+  } else {
+    givenUpCount++;
+  }
+  givenUp[tail] = frame;
+  frame.used = false;
+  frame.payload = "";
+}
+
+void arqQueue(const uint8_t *frame, size_t len, uint16_t seq, bool wantAck, const String &payload) {
+  int slot = -1;
+  for (int i = 0; i < LORA_ARQ_WINDOW; i++) {
+    if (!window[i].used) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    // Window full: the oldest report makes room for the newest fix
+    slot = 0;
+    for (int i = 1; i < LORA_ARQ_WINDOW; i++) {
+      if (window[i].queuedAt - window[slot].queuedAt > 0x7FFFFFFFUL) slot = i;
+    }
+    giveUp(window[slot]);
+    portENTER_CRITICAL(&statsMux);
+    stats.evicted++;
+    portEXIT_CRITICAL(&statsMux);
+  }
+
+  ArqFrame &f = window[slot];
+  f.used = true;
+  f.wantAck = wantAck;
+  f.seq = seq;
+  f.length = len > TRACK_FRAME_MAX ? TRACK_FRAME_MAX : len;
+  memcpy(f.data, frame, f.length);
+  f.payload = payload;
+  f.tries = 0;
+  f.queuedAt = millis();
+  f.sentAt = 0;
+  f.timeout = 0;
+
+  portENTER_CRITICAL(&statsMux);
+  stats.queued++;
+  portEXIT_CRITICAL(&statsMux);
+  countInFlight();
+}
+
+ArqFrame *arqDue() {
+  unsigned long now = millis();
+  ArqFrame *due = NULL;
+  for (int i = 0; i < LORA_ARQ_WINDOW; i++) {
+    ArqFrame &f = window[i];
+    if (!f.used) continue;
+    if (f.tries > 0) {
+      // Sent and waiting for its ACK
+      if (now - f.sentAt < f.timeout) continue;
+      if (f.timeout != 0) {
+        // Count the miss once; timeout 0 marks a retry already owed
+        timeoutsPending++;
+        f.timeout = 0;
+      }
+      if (f.tries > LORA_ARQ_RETRIES) {
+        giveUp(f);
+        portENTER_CRITICAL(&statsMux);
+        stats.escalated++;
+        portEXIT_CRITICAL(&statsMux);
+        continue;
+      }
+    }
+    // Oldest report first
+    if (due == NULL || f.queuedAt - due->queuedAt > 0x7FFFFFFFUL) due = &f;
+  }
+  countInFlight();
+
+  if (due != NULL && lastTxAt != 0 && now - lastTxAt < LORA_ARQ_GAP) return NULL;
+  return due;
+}
+
+void arqSent(ArqFrame *frame) {
+  unsigned long now = millis();
+  lastTxAt = now;
+  frame->tries++;
+  frame->sentAt = now;
+
+  portENTER_CRITICAL(&statsMux);
+  if (frame->tries == 1) {
+    stats.sent++;
+  } else {
+    stats.retransmits++;
+  }
+  portEXIT_CRITICAL(&statsMux);
+
+  if (!frame->wantAck) {
+    frame->used = false;
+    frame->payload = "";
+  } else {
+    // Exponential backoff; jitter keeps trackers that lost the same ACK apart
+    frame->timeout = (unsigned long)LORA_ACK_TIMEOUT << (frame->tries - 1);
+    if (frame->tries > 1) frame->timeout += random(LORA_ACK_TIMEOUT / 2);
+  }
+  countInFlight();
+}
+
+int arqAcked(const AckFrame &ack) {
+  unsigned long now = millis();
+  int released = 0;
+  for (int i = 0; i < LORA_ARQ_WINDOW; i++) {
+    ArqFrame &f = window[i];
+    if (!f.used || !f.wantAck || f.tries == 0) continue;
+    uint16_t behind = ack.seq - f.seq;
+    if (behind == 0 || (behind <= 8 && (ack.mask & (1 << (behind - 1))))) {
+      unsigned long rtt = now - f.sentAt;
+      f.used = false;
+      f.payload = "";
+      released++;
+      portENTER_CRITICAL(&statsMux);
+      stats.acked++;
+      stats.rttLast = rtt;
+      if (rtt > stats.rttMax) stats.rttMax = rtt;
+      portEXIT_CRITICAL(&statsMux);
+    }
+  }
+  portENTER_CRITICAL(&statsMux);
+  stats.ackFrames++;
+  portEXIT_CRITICAL(&statsMux);
+  countInFlight();
+  return released;
+}
+
+bool arqGiveUp(ArqFrame &out) {
+  if (givenUpCount == 0) return false;
+  out = givenUp[givenUpHead];
+  givenUp[givenUpHead].payload = "";
+  givenUpHead = (givenUpHead + 1) % LORA_ARQ_WINDOW;
+  givenUpCount--;
+  return true;
+}
+
+int arqTimeouts() {
+  int n = timeoutsPending;
+  timeoutsPending = 0;
+  return n;
+}
+
+bool arqReceive(const char *id, uint16_t seq, AckFrame &ack) {
+  unsigned long now = millis();
+  ArqPeer *peer = NULL;
+  for (int i = 0; i < peerCount; i++) {
+    if (strncmp(peers[i].id, id, POS_ID_LEN) == 0) {
+      peer = &peers[i];
+      break;
+    }
+  }
+
+  bool fresh = true;
+  if (peer != NULL && now - peer->heardAt > LORA_ARQ_MEMORY) {
+    // Silent long enough to have restarted its sequence
+    peer->top = seq;
+    peer->seen = 1;
+  } else if (peer != NULL) {
+    int16_t ahead = (int16_t)(seq - peer->top);
+    if (ahead > 0) {
+      peer->seen = ahead >= ARQ_HISTORY ? 1 : (peer->seen << ahead) | 1;
+      peer->top = seq;
+    } else if (-ahead < ARQ_HISTORY) {
+      uint32_t bit = 1UL << -ahead;
+      fresh = (peer->seen & bit) == 0;
+      peer->seen |= bit;
+    } else {
+      // Far behind: the tracker restarted
+      peer->top = seq;
+      peer->seen = 1;
+    }
+  } else {
+    // New tracker, replacing the longest silent one when the table is full
+    if (peerCount < ARQ_PEERS) {
+      peer = &peers[peerCount++];
+    } else {
+      peer = &peers[0];
+      for (int i = 1; i < ARQ_PEERS; i++) {
+        if (now - peers[i].heardAt > now - peer->heardAt) peer = &peers[i];
+      }
+    }
+    memset(peer->id, 0, sizeof(peer->id));
+    strncpy(peer->id, id, POS_ID_LEN);
+    peer->top = seq;
+    peer->seen = 1;
+  }
+  peer->heardAt = now;
+
+  memset(ack.id, 0, sizeof(ack.id));
+  strncpy(ack.id, id, POS_ID_LEN);
+  ack.seq = seq;
+  uint16_t behind = peer->top - seq;
+  ack.mask = (peer->seen >> (behind + 1)) & 0xFF;
+
+  if (!fresh) {
+    portENTER_CRITICAL(&statsMux);
+    stats.duplicates++;
+    portEXIT_CRITICAL(&statsMux);
+  }
+  return fresh;
+}
+
+ArqStats arqStats() {
+  portENTER_CRITICAL(&statsMux);
+  ArqStats copy = stats;
+  portEXIT_CRITICAL(&statsMux);
+  return copy;
+}
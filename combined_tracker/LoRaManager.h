@@ -0,0 +1,189 @@
+#ifndef LORA_MANAGER_H
+#define LORA_MANAGER_H
+
+#include <Arduino.h>
+#include "PositionFrame.h"
+
+// LoRa reception is interrupt driven. DIO0 (RX done) wakes the LoRa RX
+// task, which copies the packet out of the radio FIFO into a ring and
+// notifies the consumer (loraTask). Nothing polls the radio.
+//
+// Transmission is too: loraSend() only queues. The RX task listens before
+// talking, starts the packet with endPacket(true) and, on the TX done edge
+// of DIO0, puts the radio back in receive and posts a completion event.
+// loraMutex is held for SPI work, never for a packet's airtime.
+
+#define LORA_RX_RING 8          // packets held for the consumer
+#define LORA_PACKET_MAX 255     // SX127x FIFO payload limit
+#define LORA_TX_QUEUE 6         // packets (and settings changes) waiting for the air
+#define LORA_TX_EVENTS 8        // completions held for the consumer
+#define LORA_TX_OVERDUE 100     // ms past the airtime before TX done is read without DIO0
+
+struct LoRaPacket {
+  uint8_t data[LORA_PACKET_MAX];
+  uint8_t length;
+  int16_t rssi;                 // dBm
+  float snr;                    // dB
+  unsigned long receivedAt;     // millis() at the DIO0 edge
+};
+
+// Reception statistics (ring counters written by the RX task only)
+struct LoRaRxStats {
+  volatile unsigned long interrupts;   // DIO0 edges (RX done, and TX done which shares the line)
+  unsigned long packets;               // copied into the ring
+  unsigned long overwritten;           // oldest ring entry replaced before the consumer read it
+  unsigned long missed;                // DIO0 edges folded into one FIFO read (radio overwrote a packet)
+  unsigned long empty;                 // woke without a valid packet (TX done, CRC error)
+  unsigned long copyLast;              // DIO0 edge to packet in the ring (us)
+  unsigned long copyMax;
+  unsigned int ringHigh;               // ring high-water mark
+};
+
+extern LoRaRxStats loraRxStats;
+
+// LoRa RX task only: arm DIO0 and put the radio in continuous receive
+void loraRxAttach(TaskHandle_t consumer);
+// LoRa RX task only: sleep until DIO0 or a queued transmit; move a received
+// packet into the ring, finish a transmit, start the next one
+void loraRxService();
+
+// Consumer: oldest packet first, false when the ring is empty
+bool loraRxPop(LoRaPacket &packet);
+// Holder of loraMutex: back to continuous receive, DIO0 to RX done
+void loraRxResume();
+
+// Every transmit is charged against a duty-cycle token bucket for the
+// sub-band of LORA_FREQ. Position reports must leave LORA_DUTY_RESERVE of
+// the budget for ACKs, ADR and operator messages.
+enum LoRaPriority {
+  LORA_PRIO_CONTROL,      // ACKs, ADR assignments and confirmations
+  LORA_PRIO_OPERATOR,     // operator messages from BT / keyboard
+  LORA_PRIO_REPORT,       // position reports
+  LORA_PRIO_COUNT
+};
+
+enum LoRaTxResult {
+  LORA_TX_SENT,           // queued (loraSend), or on air and done (event)
+  LORA_TX_DEFERRED,       // not enough budget, loraDutyWait() says for how long
+  LORA_TX_BUSY,           // transmit queue full
+  LORA_TX_CHANNEL         // event: channel still busy after LORA_LBT_TRIES checks, dropped
+};
+
+struct LoRaTxEvent {
+  LoRaPriority priority;
+  uint16_t tag;                        // the caller's, e.g. a report seq
+  LoRaTxResult result;
+  uint32_t airtimeUs;
+  unsigned long latencyMs;             // loraSend() to TX done
+};
+
+struct LoRaTxStats {
+  unsigned long queued;
+  unsigned long done;                  // on air and finished
+  unsigned long overdue;               // no TX done edge, finished by timeout
+  unsigned long full;                  // refused, queue full
+  unsigned int queueHigh;
+  unsigned long latencyMaxMs;
+  unsigned long mutexHolds;            // loraMutex, every holder
+  unsigned long mutexHoldLastUs;
+  unsigned long mutexHoldMaxUs;
+  unsigned long mutexHoldTotalUs;
+};
+
+struct LoRaDutyStats {
+  uint16_t limitPermille;              // regulatory limit in force
+  unsigned long capacityMs;            // bucket size (one LORA_DUTY_WINDOW of budget)
+  unsigned long tokensMs;              // budget left now
+  unsigned long airtimeMs;             // total time on air
+  unsigned long airtimeLastUs;         // last packet
+  unsigned long sent[LORA_PRIO_COUNT];
+  unsigned long deferred[LORA_PRIO_COUNT];
+  unsigned long dropped[LORA_PRIO_COUNT];   // given up by the caller after a deferral
+};
+
+// Listen-before-talk, run by the RX task. Each check looks at the modem status (a packet being
+// received) and then runs a CAD; a busy channel backs off a random time in
+// a window that starts at the packet's airtime and doubles per check.
+struct LoRaLbtStats {
+  unsigned long checks;                // channel checks (one per transmit when clear)
+  unsigned long busy;                  // found busy: receiving, or CAD detected a preamble
+  unsigned long backoffs;
+  unsigned long backoffMs;             // total time spent backing off
+  unsigned long gaveUp;                // LORA_TX_CHANNEL returned
+  unsigned long lastMinuteChecks;      // the last full minute, for the busy share
+  unsigned long lastMinuteBusy;
+};
+
+LoRaLbtStats loraLbtStats();
+
+// Setup: apply LORA_BW/CR/PREAMBLE and the ADR defaults, select the duty-cycle sub-band
+void loraRadioBegin();
+// Any task: charge the budget and queue; returns without waiting for the air
+LoRaTxResult loraSend(const uint8_t *data, size_t len, LoRaPriority priority, uint16_t tag = 0);
+// Consumer: completions, oldest first, false when there are none
+bool loraTxPop(LoRaTxEvent &event);
+LoRaTxStats loraTxStats();
+// Time on air (us) of a len byte payload at the current settings
+uint32_t loraAirtime(size_t len);
+// ms until a len byte packet of this priority fits the budget, 0 if it fits now
+unsigned long loraDutyWait(size_t len, LoRaPriority priority);
+void loraDutyDropped(LoRaPriority priority);
+LoRaDutyStats loraDutyStats();
+// e.g. "433 MHz band"
+const char *loraSubBandName();
+
+// Before the tasks start; later changes go through the transmit queue
+void loraRadioSet(uint8_t sf, int8_t power);
+uint8_t loraSf();
+int8_t loraPower();
+
+// Adaptive data rate. The ground station smooths the SNR of every tracker
+// it hears and assigns the lowest SF and TX power that keep LORA_ADR_MARGIN
+// above the demodulation floor. SF is shared by the link (the station can
+// only listen on one), power is per tracker. Trackers confirm, then switch;
+// the station switches once every active tracker has confirmed. Either end
+// goes back to the defaults when the other falls silent.
+
+#define LORA_ADR_PEERS 8
+#define LORA_SF_MIN 7
+
+struct LoRaAdrPeer {
+  char id[POS_ID_LEN + 1];
+  float snrAvg;                // dB
+  float margin;                // snrAvg above the floor of the confirmed SF
+  unsigned long samples;       // since the last change
+  uint8_t sf;                  // confirmed settings
+  int8_t power;
+  uint8_t needSf;              // what this tracker alone would need
+  int8_t needPower;
+  uint8_t sentSf;              // last assignment sent, and how often without a confirmation
+  int8_t sentPower;
+  uint8_t tries;
+  unsigned long heardAt;
+  unsigned long commandAt;
+};
+
+struct LoRaAdrStats {
+  unsigned long commands;      // assignments sent (station)
+  unsigned long confirms;      // assignments confirmed (station) or taken (tracker)
+  unsigned long sfChanges;     // radio SF switched
+  unsigned long powerChanges;  // tracker TX power changed
+  unsigned long fallbacks;     // back to the defaults after silence or missed ACKs
+};
+
+LoRaAdrStats loraAdrStats();
+// Snapshot of the station's peer table, returns the number copied
+int loraAdrPeers(LoRaAdrPeer *out, int max);
+
+// loraTask, ground station: a position frame from id arrived. True when an
+// assignment should be sent to it now (cmd filled in)
+bool loraAdrObserve(const char *id, float snr, LinkCommand &cmd);
+void loraAdrConfirmed(const LinkCommand &cmd);
+// loraTask, tracker: an assignment for this tracker arrived (confirms, then switches)
+void loraAdrAssign(const LinkCommand &cmd);
+// loraTask, tracker: a report was ACKed or timed out
+void loraAdrReport(bool acked);
+// loraTask, every pass: silence fallback, role changes
+void loraAdrPoll(bool station);
+
+#endif
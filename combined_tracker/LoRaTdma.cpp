@@ -0,0 +1,176 @@
+#include "LoRaTdma.h"
+#include "LoRaManager.h"
+#include "PositionFrame.h"
+#include "Config.h"
+
+#define TDMA_PEERS 16           // trackers the station books to slots
+
+// Tracker: UTC (ms) at millis() == syncAt
+static uint64_t syncUtc = 0;
+static unsigned long syncAt = 0;
+static bool syncValid = false;
+
+// Station: a millis() at which a frame started
+static unsigned long frameAt = 0;
+static bool frameLocked = false;
+
+struct TdmaPeer {
+  char id[POS_ID_LEN + 1];
+  uint8_t slot;                 // where its id hashes to
+  unsigned long heardAt;
+};
+
+static TdmaPeer peers[TDMA_PEERS];
+static int peerCount = 0;
+static TdmaSlot slots[LORA_TDMA_SLOTS];
+static TdmaStats stats = {};
+static portMUX_TYPE tdmaMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint8_t tdmaSlotOf(const char *id) {
+  // FNV-1a over the id as it travels in the frame (at most POS_ID_LEN bytes)
+  uint32_t hash = 2166136261UL;
+  for (int i = 0; i < POS_ID_LEN && id[i] != '\0'; i++) {
+    hash ^= (uint8_t)id[i];
+    hash *= 16777619UL;
+  }
+  return hash % LORA_TDMA_SLOTS;
+}
+
+uint8_t tdmaOwnSlot() {
+  if (LORA_TDMA_SLOT >= 0) return LORA_TDMA_SLOT % LORA_TDMA_SLOTS;
+  return tdmaSlotOf(SOLDIER_ID);
+}
+
+void tdmaSync(uint32_t epoch, uint8_t centisecond, unsigned long committedAt) {
+  if (epoch == 0) return;
+  portENTER_CRITICAL(&tdmaMux);
+  syncUtc = (uint64_t)epoch * 1000 + centisecond * 10;
+  syncAt = committedAt;
+  syncValid = true;
+  portEXIT_CRITICAL(&tdmaMux);
+}
+
+// Caller holds tdmaMux
+static bool syncedLocked(unsigned long now) {
+  return syncValid && now - syncAt < LORA_TDMA_HOLDOVER;
+}
+
+bool tdmaSynced() {
+  portENTER_CRITICAL(&tdmaMux);
+  bool synced = LORA_TDMA && syncedLocked(millis());
+  portEXIT_CRITICAL(&tdmaMux);
+  return synced;
+}
+
+unsigned long tdmaWait(uint32_t airtimeUs) {
+  if (!LORA_TDMA) return 0;
+  unsigned long now = millis();
+  portENTER_CRITICAL(&tdmaMux);
+  if (!syncedLocked(now)) {
+    portEXIT_CRITICAL(&tdmaMux);
+    return 0;
+  }
+  uint32_t inFrame = (syncUtc + (now - syncAt)) % GPS_SEND_INTERVAL;
+  portEXIT_CRITICAL(&tdmaMux);
+
+  uint32_t open = tdmaOwnSlot() * TDMA_SLOT_MS + LORA_TDMA_GUARD;
+  uint32_t into = (inFrame + GPS_SEND_INTERVAL - open) % GPS_SEND_INTERVAL;
+  uint32_t airtime = airtimeUs / 1000 + 1;
+  uint32_t room = TDMA_SLOT_MS - 2 * LORA_TDMA_GUARD;
+  // A packet longer than the slot (high SF) still goes, right at the opening
+  uint32_t latest = airtime <= room ? room - airtime : 2 * LORA_UPDATE_INTERVAL;
+  if (into <= latest) return 0;
+  return GPS_SEND_INTERVAL - into;
+}
+
+// Caller holds tdmaMux; slot the middle of a packet falls in
+static int arrivalSlot(unsigned long middle) {
+  if (!frameLocked) return -1;
+  return ((middle - frameAt) % GPS_SEND_INTERVAL) / TDMA_SLOT_MS;
+}
+
+void tdmaHeard(const char *id, bool slotted, size_t len, unsigned long receivedAt) {
+  unsigned long now = millis();
+  uint8_t home = tdmaSlotOf(id);
+  unsigned long middle = receivedAt - loraAirtime(len) / 2000;
+
+  portENTER_CRITICAL(&tdmaMux);
+  if (slotted) {
+    // Slotted senders start anywhere from the opening to the last moment
+    // that still ends before the guard, so on average their packets are
+    // centred in the slot. Track slowly (clock drift, send times); a sender
+    // more than half a slot out is misaligned and does not pull the frame
+    unsigned long estimate = middle - TDMA_SLOT_MS / 2 - home * TDMA_SLOT_MS;
+    long diff = (long)((estimate - frameAt) % GPS_SEND_INTERVAL);
+    if (diff > GPS_SEND_INTERVAL / 2) diff -= GPS_SEND_INTERVAL;
+    if (!frameLocked) {
+      frameAt = estimate;
+      frameLocked = true;
+    } else if (diff > -TDMA_SLOT_MS / 2 && diff < TDMA_SLOT_MS / 2) {
+      frameAt += diff / 8;
+    }
+  } else {
+    stats.unslotted++;
+  }
+  int slot = arrivalSlot(middle);
+  if (slot < 0) {
+    stats.unplaced++;
+  } else {
+    slots[slot].reports++;
+    if (slotted && slot != home) slots[slot].foreign++;
+  }
+
+  TdmaPeer *peer = NULL;
+  for (int i = 0; i < peerCount; i++) {
+    if (strncmp(peers[i].id, id, POS_ID_LEN) == 0) peer = &peers[i];
+  }
+  if (peer == NULL) {
+    if (peerCount < TDMA_PEERS) {
+      peer = &peers[peerCount++];
+    } else {
+      peer = &peers[0];
+      for (int i = 1; i < TDMA_PEERS; i++) {
+        if (now - peers[i].heardAt > now - peer->heardAt) peer = &peers[i];
+      }
+    }
+    memset(peer->id, 0, sizeof(peer->id));
+    strncpy(peer->id, id, POS_ID_LEN);
+    peer->slot = home;
+  }
+  peer->heardAt = now;
+  portEXIT_CRITICAL(&tdmaMux);
+}
+
+void tdmaCorrupt(size_t len, unsigned long receivedAt) {
+  unsigned long middle = receivedAt - loraAirtime(len) / 2000;
+  portENTER_CRITICAL(&tdmaMux);
+  int slot = arrivalSlot(middle);
+  if (slot < 0) {
+    stats.unplaced++;
+  } else {
+    slots[slot].corrupt++;
+  }
+  portEXIT_CRITICAL(&tdmaMux);
+}
+
+TdmaStats tdmaStats() {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&tdmaMux);
+  TdmaStats copy = stats;
+  copy.synced = LORA_TDMA && syncedLocked(now);
+  copy.syncAge = syncValid ? now - syncAt : 0;
+  copy.locked = frameLocked;
+  portEXIT_CRITICAL(&tdmaMux);
+  return copy;
+}
+
+void tdmaSlots(TdmaSlot *out) {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&tdmaMux);
+  memcpy(out, slots, sizeof(slots));
+  for (int s = 0; s < LORA_TDMA_SLOTS; s++) out[s].trackers = 0;
+  for (int i = 0; i < peerCount; i++) {
+    if (now - peers[i].heardAt < LORA_ARQ_MEMORY) out[peers[i].slot].trackers++;
+  }
+  portEXIT_CRITICAL(&tdmaMux);
+}
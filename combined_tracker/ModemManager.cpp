@@ -0,0 +1,683 @@
+#include "ModemManager.h"
+#include "Globals.h"
+#include "Config.h"
+#include "Utils.h"
+#include "DisplayManager.h"
+#include "Uplink.h"
+#include "ReportDedup.h"
+#include "PositionFrame.h"
+
+// Request pool and one FIFO per priority
+static ModemRequest modemPool[MODEM_POOL_SIZE];
+static QueueHandle_t modemQueues[MODEM_PRIO_COUNT];
+static portMUX_TYPE modemPoolMux = portMUX_INITIALIZER_UNLOCKED;
+
+ModemQueueStats modemStats = {};
+
+static ModemHealth health = {-1, -1.0f, -1, false, 0, 0, 0, 0};
+static portMUX_TYPE healthMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Fold a registration state into the cache and announce changes
+static void updateRegistration(int stat) {
+  bool registered = (stat == 1 || stat == 5);
+  bool changed;
+  portENTER_CRITICAL(&healthMux);
+  changed = (health.regStat != stat);
+  health.regStat = stat;
+  health.registered = registered;
+  if (changed) health.changes++;
+  portEXIT_CRITICAL(&healthMux);
+  
+  systemStatus.networkConnected = registered;
+  if (changed) {
+    logToBoth("[GSM] Registration: " + String(stat) + (registered ? " (registered)" : " (not registered)"));
+  }
+}
+
+// One AT+CSQ;+CREG? round trip refreshes signal and registration
+static void sampleHealth() {
+  int8_t rssi, stat;
+  if (!sim800l.networkHealth(&rssi, &stat)) {
+    portENTER_CRITICAL(&healthMux);
+    health.failures++;
+    portEXIT_CRITICAL(&healthMux);
+    return;
+  }
+  
+  // Log only when the smoothed signal crosses a 0-3 bar boundary
+  int oldBars = -1;
+  int newBars = -1;
+  portENTER_CRITICAL(&healthMux);
+  if (health.rssiAvg >= 0) oldBars = (int)(health.rssiAvg + 0.5f) / 8;
+  health.rssi = rssi;
+  if (rssi >= 0) {
+    if (health.rssiAvg < 0) {
+      health.rssiAvg = rssi;
+    } else {
+      health.rssiAvg += (rssi - health.rssiAvg) / MODEM_HEALTH_EWMA;
+    }
+    newBars = (int)(health.rssiAvg + 0.5f) / 8;
+  }
+  health.sampledAt = millis();
+  health.samples++;
+  portEXIT_CRITICAL(&healthMux);
+  
+  systemStatus.signalStrength = (newBars >= 0) ? (int)(health.rssiAvg + 0.5f) : -1;
+  if (newBars != oldBars) {
+    logToBoth("[GSM] Signal: " + String(systemStatus.signalStrength) + "/31");
+  }
+  updateRegistration(stat);
+}
+
+ModemHealth modemHealth() {
+  ModemHealth copy;
+  portENTER_CRITICAL(&healthMux);
+  copy = health;
+  portEXIT_CRITICAL(&healthMux);
+  return copy;
+}
+
+bool modemHealthFresh(const ModemHealth &h) {
+  return h.sampledAt != 0 && millis() - h.sampledAt < MODEM_HEALTH_TTL;
+}
+
+bool modemGsmUsable() {
+  if (!sim800l.ready()) return false;
+  ModemHealth h = modemHealth();
+  return !modemHealthFresh(h) || h.registered;
+}
+
+String modemBootTimeline() {
+  static const char *names[] = {"", "AT", "SIM", "NET", "SMS"};
+  BootStage stage = sim800l.bootStage();
+  String line = "";
+  for (int s = BOOT_AT; s < BOOT_READY; s++) {
+    uint32_t at = sim800l.bootTime((BootStage)s);
+    if (at == 0) break;
+    if (line.length() > 0) line += ", ";
+    line += String(names[s]) + " " + String(at / 1000.0, 1) + "s";
+  }
+  if (stage == BOOT_READY) {
+    line += " (READY)";
+  } else if (stage == BOOT_FAILED) {
+    line += " (FAILED at " + String(names[sim800l.bootFailedStage()]) + ")";
+  } else {
+    line += " (waiting for " + String(names[stage]) + ")";
+  }
+  return line;
+}
+
+String modemSleepReport() {
+  SleepMode mode = sim800l.sleepMode();
+  if (mode == SLEEP_OFF) return "off (always awake)";
+  // The first hour reports the running one
+  uint32_t awakeMs = sim800l.awakeLastHour();
+  String window = "last hour";
+  if (awakeMs == 0) {
+    awakeMs = sim800l.awakeThisHour();
+    window = "this hour";
+  }
+  return String(mode == SLEEP_DTR ? "DTR" : "AT") + " wake, " + String(sim800l.awake() ? "awake" : "asleep") + ", awake " +
+         String(awakeMs / 60000.0, 1) + " min " + window + " (" + String(awakeMs / 36000) + "%), " +
+         String(sim800l.wakeups()) + " wakeups, " + String(modemStats.ringWakes) + " RI";
+}
+
+// Bring-up supervision: SMS settings once ready, soft reset after a failed step
+static bool trackBoot() {
+  static bool configured = false;
+  static unsigned long failedAt = 0;
+  
+  BootStage stage = sim800l.bootStage();
+  if (stage == BOOT_READY) {
+    failedAt = 0;
+    if (!configured) {
+      configured = true;
+      logToBoth("[GSM] Ready: " + modemBootTimeline());
+      // Store SMS in SIM memory and announce each one with +CMTI; reads use
+      // PDU mode so long and binary messages arrive intact
+      sim800l.setSMSFormat(false);
+      sim800l.command("AT+CNMI=2,1,0,0,0", 2000);
+      sim800l.command("AT+CPMS=\"SM\",\"SM\",\"SM\"", 5000);
+      // Slow clock between jobs; +CMTI and RI still come through while asleep
+      if (MODEM_SLEEP && sim800l.sleepEnable(SIM_DTR_PIN)) {
+        logToBoth("[GSM] Sleep on (" + String(SIM_DTR_PIN >= 0 ? "DTR" : "AT") + " wake)");
+      }
+    }
+    return true;
+  }
+  
+  configured = false;
+  if (stage == BOOT_FAILED) {
+    if (failedAt == 0) {
+      failedAt = millis();
+      logToBoth("[GSM] Bring-up failed: " + modemBootTimeline());
+    } else if (millis() - failedAt >= MODEM_BOOT_RETRY) {
+      failedAt = 0;
+      logToBoth("[GSM] Soft reset, retrying bring-up");
+      sim800l.softReset();
+    }
+  }
+  return false;
+}
+
+// SMS indices announced by +CMTI, read right after the notification
+#define SMS_PENDING_MAX 8
+struct PendingSMS {
+  int index;
+  unsigned long notifiedAt;
+};
+static PendingSMS pendingSMS[SMS_PENDING_MAX];
+static int pendingSMSCount = 0;
+
+// Largest +CMGL listing handled in one purge
+#define SMS_BATCH_MAX 16
+
+// Read messages left in storage (undecodable or read before we started), recounted
+// by every sweep; "delete all read" would take them too
+static int smsKept = 0;
+
+SMSIntakeStats smsStats = {};
+
+// Parts of concatenated messages wait here for the rest (modem task only)
+static SMSReassembler smsReassembler;
+static SMSMessage smsMessage;
+static SMSPart smsPart;
+
+// Log and display one received SMS (shared by URC driven reads and the inbox sweep)
+static void handleReceivedSMS(const String &senderNumber, const String &messageBody, unsigned long notifiedAt = 0) {
+  // A report already delivered over LoRa is dropped before anything is shown
+  char reportId[POS_ID_LEN + 1];
+  uint16_t reportSeq;
+  if (reportParseSms(messageBody, reportId, reportSeq) &&
+      !reportFirst(reportId, reportSeq, REPORT_VIA_SMS, notifiedAt != 0 ? notifiedAt : millis())) {
+    return;
+  }
+  
+  systemStatus.lastSMS = messageBody;
+  systemStatus.lastSMSTime = millis();
+  
+  logToBoth("[SMS RX] From: " + senderNumber);
+  logToBoth("[SMS RX] Msg: " + messageBody);
+  
+  if (BT.hasClient()) {
+    BT.println("\n📱 SMS RECEIVED");
+    BT.println("From: " + senderNumber);
+    BT.println("Msg: " + messageBody + "\n");
+  }
+  
+  // Only show on display in TRACKER mode
+  if (displayState.initialized && currentMode == MODE_TRACKER) {
+    displayReceivedMessage("SMS", senderNumber, messageBody);
+  }
+  
+  if (notifiedAt != 0) {
+    smsStats.latencyLast = millis() - notifiedAt;
+    smsStats.latencyTotal += smsStats.latencyLast;
+    smsStats.latencyCount++;
+    if (smsStats.latencyLast > smsStats.latencyMax) smsStats.latencyMax = smsStats.latencyLast;
+  }
+}
+
+// Hand on one decoded PDU; a part of a longer message waits for the others
+static void deliverPart(const SMSPart &part, unsigned long notifiedAt) {
+  if (part.total > 1) smsStats.concatParts++;
+  bool complete = smsReassembler.add(part, &smsMessage);
+  smsStats.concatDropped = smsReassembler.dropped();
+  if (!complete) return;
+  
+  String body;
+  if (smsMessage.coding == SMS_8BIT) {
+    body = "[bin " + String(smsMessage.length) + "B] ";
+    char hex[3];
+    for (int i = 0; i < smsMessage.length; i++) {
+      snprintf(hex, sizeof(hex), "%02X", smsMessage.data[i]);
+      body += hex;
+    }
+  } else {
+    body = String((const char *)smsMessage.data);
+  }
+  if (smsMessage.parts > 1) {
+    smsStats.concatMessages++;
+    logToBoth("[SMS RX] Reassembled " + String(smsMessage.parts) + " parts");
+  }
+  handleReceivedSMS(String(smsMessage.sender), body, notifiedAt);
+}
+
+// Unsolicited result codes from the SIM800L, dispatched from sim800l.poll()
+static void onModemURC(URCType type, const char *line, const char *body, void *) {
+  char field[32];
+  switch (type) {
+    case URC_CMTI:
+      // Queue the index; if the queue is full the safety sweep picks it up
+      if (pendingSMSCount < SMS_PENDING_MAX) {
+        pendingSMS[pendingSMSCount].index = SIM800L::intField(line, 1);
+        pendingSMS[pendingSMSCount].notifiedAt = millis();
+        pendingSMSCount++;
+      }
+      break;
+    case URC_CMT:
+      // PDU mode: +CMT: [<alpha>],<length> with the PDU as body
+      if (SMSPdu::decodeDeliver(body, &smsPart)) {
+        deliverPart(smsPart, millis());
+        break;
+      }
+      SIM800L::textField(line, 0, field, sizeof(field));
+      handleReceivedSMS(String(field), String(body), millis());
+      break;
+    case URC_CREG:
+      updateRegistration(SIM800L::intField(line, 0));
+      break;
+    case URC_RING:
+      logToBoth("[GSM] Incoming call");
+      break;
+    case URC_CLTS:
+      SIM800L::textField(line, 0, field, sizeof(field));
+      logToBoth("[GSM] Network time: " + String(field));
+      break;
+    default:
+      break;
+  }
+}
+
+// Delete consumed messages: a single "delete all read" when the batch is complete, else one by one.
+// Complete means every read message in storage was consumed, so nothing else goes with it
+static void purgeConsumed(const int *indices, int consumed, bool complete) {
+  if (consumed == 0) return;
+  
+  if (complete && smsKept == 0 && sim800l.command("AT+CMGD=1,1", 5000) == AT_OK) {
+    smsStats.purgeBatches++;
+    smsStats.roundTripsSaved += consumed - 1;
+    if (consumed > 1) {
+      logToBoth("[SMS] Purged " + String(consumed) + " msgs in 1 command (saved " + String(consumed - 1) + " round trips)");
+    }
+    return;
+  }
+  
+  char cmd[20];
+  for (int i = 0; i < consumed; i++) {
+    snprintf(cmd, sizeof(cmd), "AT+CMGD=%d", indices[i]);
+    sim800l.command(cmd, 5000);
+  }
+}
+
+// Count the read messages in storage. Consumed ones are deleted straight away,
+// so whatever is read and still there is kept: read before we started (never
+// ours to consume) or undecodable. Taken after bring-up and again by every
+// sweep, so a kept message that has since gone no longer rules out "delete all read"
+static bool surveyStorage(bool recount) {
+  static bool surveyed = false;
+  if (surveyed && !recount) return true;
+  if (!sim800l.setSMSFormat(false) || sim800l.command("AT+CMGL=1", 5000) != AT_OK) return false;
+  const char *at = sim800l.response();
+  int found = 0;
+  while ((at = strstr(at, "+CMGL:")) != NULL) {
+    found++;
+    at += 6;
+  }
+  // A truncated listing still proves there is something
+  if (found == 0 && sim800l.truncated()) found = 1;
+  smsKept = found;
+  if (!surveyed && found > 0) logToBoth("[SMS] " + String(found) + " read message(s) already in storage, left alone");
+  surveyed = true;
+  return true;
+}
+
+// Read a single stored SMS announced by +CMTI; true once it has been handed on
+static bool readStoredSMS(int msgIndex, unsigned long notifiedAt) {
+  if (!sim800l.readPDU(msgIndex, &smsPart)) {
+    // Possibly read but not understood: it stays in storage for the operator
+    smsKept++;
+    smsStats.undecodable++;
+    logToBoth("[SMS] Message " + String(msgIndex) + " not read or not decodable, left in storage");
+    return false;
+  }
+  deliverPart(smsPart, notifiedAt);
+  return true;
+}
+
+// Slow safety sweep for anything stored without (or before) a +CMTI notification
+static void sweepInbox() {
+  static unsigned long checkCount = 0;
+  if (!surveyStorage(true)) return;
+  
+  checkCount++;
+  if (BT.hasClient()) {
+    BT.println("[SMS] Safety sweep (#" + String(checkCount) + ")...");
+  }
+  
+  // AT+CMGL marks everything it lists as read. If the listing did not fit,
+  // a second pass over "REC READ" (1) picks up what was marked but never parsed.
+  if (!sim800l.setSMSFormat(false)) return;
+  int status = 0;
+  for (int pass = 0; pass < 4; pass++) {
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "AT+CMGL=%d", status);
+    if (sim800l.command(cmd, 5000) != AT_OK) return;
+    
+    bool listedAll = !sim800l.truncated();
+    bool complete = listedAll;
+    String response = sim800l.response();
+    int indices[SMS_BATCH_MAX];
+    int consumed = 0;
+    
+    int index = 0;
+    while (true) {
+      int msgStart = response.indexOf("+CMGL:", index);
+      if (msgStart == -1) break;
+      if (consumed == SMS_BATCH_MAX) {
+        listedAll = false;
+        complete = false;
+        break;
+      }
+      
+      // Header: +CMGL: <index>,<stat>,[<alpha>],<length> followed by the PDU line
+      int headerEnd = response.indexOf('\n', msgStart);
+      if (headerEnd == -1) break;
+      String header = response.substring(msgStart, headerEnd);
+      
+      int bodyStart = headerEnd + 1;
+      int bodyEnd = response.indexOf('\n', bodyStart);
+      if (bodyEnd == -1) bodyEnd = response.length();
+      String pdu = response.substring(bodyStart, bodyEnd);
+      
+      int msgIndex = SIM800L::intField(header.c_str(), 0);
+      if (SMSPdu::decodeDeliver(pdu.c_str(), &smsPart)) {
+        deliverPart(smsPart, 0);
+        indices[consumed++] = msgIndex;
+      } else {
+        // Not deleted: left in storage and shown raw, once (the unread listing)
+        complete = false;
+        if (status == 0) {
+          smsKept++;
+          smsStats.undecodable++;
+          logToBoth("[SMS] Undecodable PDU kept at index " + String(msgIndex) + ": " + pdu);
+        }
+      }
+      
+      index = bodyEnd + 1;
+      if (index >= (int)response.length()) break;
+    }
+    
+    purgeConsumed(indices, consumed, complete);
+    if (listedAll) return;
+    status = 1;
+  }
+}
+
+// Decoded listing of storage for the operator (BT "checksms"). Mode 1 of
+// AT+CMGL leaves the read status alone, so the sweep still finds unread ones.
+static bool listInbox(ModemRequest *req) {
+  static const char *const statNames[] = {"unread", "read", "unsent", "sent"};
+  if (!sim800l.setSMSFormat(false) || sim800l.command("AT+CMGL=4,1", 5000) != AT_OK) return false;
+  
+  bool truncated = sim800l.truncated();
+  String response = sim800l.response();
+  String listing;
+  int listed = 0;
+  int index = 0;
+  while (true) {
+    int msgStart = response.indexOf("+CMGL:", index);
+    if (msgStart == -1) break;
+    int headerEnd = response.indexOf('\n', msgStart);
+    if (headerEnd == -1) break;
+    String header = response.substring(msgStart, headerEnd);
+    int bodyStart = headerEnd + 1;
+    int bodyEnd = response.indexOf('\n', bodyStart);
+    if (bodyEnd == -1) bodyEnd = response.length();
+    String pdu = response.substring(bodyStart, bodyEnd);
+    pdu.trim();
+    
+    int msgIndex = SIM800L::intField(header.c_str(), 0);
+    int stat = SIM800L::intField(header.c_str(), 1);
+    listing += "#" + String(msgIndex) + " " + String(stat >= 0 && stat <= 3 ? statNames[stat] : "?");
+    if (SMSPdu::decodeDeliver(pdu.c_str(), &smsPart)) {
+      listing += " from " + String(smsPart.sender);
+      if (smsPart.total > 1) listing += " part " + String(smsPart.seq) + "/" + String(smsPart.total);
+      if (smsPart.coding == SMS_8BIT) {
+        listing += ": [bin " + String(smsPart.length) + "B]\n";
+      } else {
+        listing += ": " + String((const char *)smsPart.data) + "\n";
+      }
+    } else {
+      listing += ": undecodable " + pdu + "\n";
+    }
+    listed++;
+    
+    index = bodyEnd + 1;
+    if (index >= (int)response.length()) break;
+  }
+  
+  if (listed == 0) listing = "No stored messages\n";
+  if (truncated) listing += "(listing truncated)\n";
+  strncpy(req->response, listing.c_str(), MODEM_RESPONSE_MAX);
+  req->response[MODEM_RESPONSE_MAX] = '\0';
+  return true;
+}
+
+// Read every announced message first, then purge the batch in one command
+static void drainPendingSMS() {
+  if (pendingSMSCount == 0 || !surveyStorage(false)) return;
+  int indices[SMS_PENDING_MAX];
+  int consumed = 0;
+  bool complete = true;
+  while (pendingSMSCount > 0) {
+    PendingSMS next = pendingSMS[0];
+    pendingSMSCount--;
+    for (int i = 0; i < pendingSMSCount; i++) {
+      pendingSMS[i] = pendingSMS[i + 1];
+    }
+    if (readStoredSMS(next.index, next.notifiedAt) && consumed < SMS_PENDING_MAX) {
+      indices[consumed++] = next.index;
+    } else {
+      complete = false;
+    }
+  }
+  purgeConsumed(indices, consumed, complete);
+}
+
+static void IRAM_ATTR onModemRing() {
+  modemStats.ringWakes++;
+  SerialSIM.wakeFromISR();
+}
+
+void modemRingBegin(int pin) {
+  if (pin < 0) return;
+  pinMode(pin, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(pin), onModemRing, FALLING);
+}
+
+void modemInit() {
+  for (int i = 0; i < MODEM_POOL_SIZE; i++) {
+    modemPool[i].inUse = false;
+    modemPool[i].doneSem = xSemaphoreCreateBinary();
+  }
+  for (int p = 0; p < MODEM_PRIO_COUNT; p++) {
+    modemQueues[p] = xQueueCreate(MODEM_POOL_SIZE, sizeof(ModemRequest *));
+  }
+}
+
+static void freeRequest(ModemRequest *req) {
+  portENTER_CRITICAL(&modemPoolMux);
+  req->inUse = false;
+  portEXIT_CRITICAL(&modemPoolMux);
+}
+
+ModemRequest *modemSubmit(ModemRequestType type, ModemPriority priority, const char *number, const char *text) {
+  ModemRequest *req = NULL;
+  portENTER_CRITICAL(&modemPoolMux);
+  for (int i = 0; i < MODEM_POOL_SIZE; i++) {
+    if (!modemPool[i].inUse) {
+      req = &modemPool[i];
+      req->inUse = true;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&modemPoolMux);
+  
+  if (req == NULL) {
+    modemStats.rejected++;
+    return NULL;
+  }
+  
+  req->type = type;
+  req->priority = priority;
+  strncpy(req->number, number ? number : "", sizeof(req->number) - 1);
+  req->number[sizeof(req->number) - 1] = '\0';
+  strncpy(req->text, text ? text : "", sizeof(req->text) - 1);
+  req->text[sizeof(req->text) - 1] = '\0';
+  req->response[0] = '\0';
+  req->queuedAt = millis();
+  req->done = false;
+  req->abandoned = false;
+  req->success = false;
+  xSemaphoreTake(req->doneSem, 0);   // drop a stale completion
+  
+  if (xQueueSend(modemQueues[priority], &req, 0) != pdTRUE) {
+    freeRequest(req);
+    modemStats.rejected++;
+    return NULL;
+  }
+  // Release the modem task from its wait for modem output
+  SerialSIM.wake();
+  return req;
+}
+
+bool modemWaitDone(ModemRequest *req, uint32_t timeoutMs) {
+  if (req == NULL) return false;
+  return req->done || xSemaphoreTake(req->doneSem, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+}
+
+bool modemWait(ModemRequest *req, uint32_t timeoutMs) {
+  return modemWaitDone(req, timeoutMs) && req->success;
+}
+
+void modemRelease(ModemRequest *req) {
+  if (req == NULL) return;
+  bool release;
+  portENTER_CRITICAL(&modemPoolMux);
+  release = req->done;
+  if (!release) req->abandoned = true;   // still queued or in flight
+  portEXIT_CRITICAL(&modemPoolMux);
+  if (release) freeRequest(req);
+}
+
+bool modemPost(ModemRequestType type, ModemPriority priority, const char *number, const char *text) {
+  ModemRequest *req = modemSubmit(type, priority, number, text);
+  modemRelease(req);
+  return req != NULL;
+}
+
+static void completeRequest(ModemRequest *req, bool success) {
+  bool release;
+  req->success = success;
+  portENTER_CRITICAL(&modemPoolMux);
+  req->done = true;
+  release = req->abandoned;
+  portEXIT_CRITICAL(&modemPoolMux);
+  if (release) {
+    freeRequest(req);
+  } else {
+    xSemaphoreGive(req->doneSem);
+  }
+}
+
+static void executeRequest(ModemRequest *req) {
+  bool success = false;
+  switch (req->type) {
+    case MODEM_REQ_SMS_ALL: {
+      unsigned long start = millis();
+      success = sendSMSToAll(String(req->text));
+      if (req->priority == MODEM_PRIO_REPORT) {
+        modemStats.smsReports++;
+        modemStats.smsReportMs += millis() - start;
+      }
+      break;
+    }
+    case MODEM_REQ_SMS:
+      success = sendSMSToNumber(req->number, String(req->text));
+      break;
+    case MODEM_REQ_AT:
+      success = sim800l.command(req->text, 5000) == AT_OK;
+      strncpy(req->response, sim800l.response(), MODEM_RESPONSE_MAX);
+      req->response[MODEM_RESPONSE_MAX] = '\0';
+      break;
+    case MODEM_REQ_INBOX_SWEEP:
+      sweepInbox();
+      success = true;
+      break;
+    case MODEM_REQ_INBOX_LIST:
+      success = listInbox(req);
+      break;
+  }
+  completeRequest(req, success);
+}
+
+// Serve at most one queued request of the given priority
+static bool serveQueue(ModemPriority priority) {
+  ModemRequest *req;
+  if (xQueueReceive(modemQueues[priority], &req, 0) != pdTRUE) return false;
+  
+  unsigned long waited = millis() - req->queuedAt;
+  if (waited > modemStats.waitMax[priority]) modemStats.waitMax[priority] = waited;
+  modemStats.served[priority]++;
+  
+  executeRequest(req);
+  // Keep URCs flowing between back-to-back requests
+  sim800l.poll();
+  return true;
+}
+
+void modemAttach() {
+  sim800l.onURC(URC_CMT, onModemURC);
+  sim800l.onURC(URC_CMTI, onModemURC);
+  sim800l.onURC(URC_RING, onModemURC);
+  sim800l.onURC(URC_CREG, onModemURC);
+  sim800l.onURC(URC_CLTS, onModemURC);
+}
+
+void modemService(uint32_t idleMs) {
+  static unsigned long lastSweep = 0;
+  static unsigned long lastHealth = 0;
+  
+  // Sleep until the modem sends a line or modemSubmit() wakes us, at most idleMs
+  SerialSIM.waitLine(idleMs);
+  
+  // Pump modem output (also advances bring-up); +CMTI lands in pendingSMS
+  sim800l.poll();
+  
+  // Until the modem is ready only raw AT debugging is served, everything else stays queued
+  if (!trackBoot()) {
+    serveQueue(MODEM_PRIO_DEBUG);
+    return;
+  }
+  
+  // Emergency and report traffic go out before any inbox work
+  while (serveQueue(MODEM_PRIO_EMERGENCY)) {}
+  while (serveQueue(MODEM_PRIO_REPORT)) {}
+  
+  // Persistent GPRS link: reconnect, acknowledgements and batched position frames
+  uplinkService();
+  
+  // Background health sample; UI and transport selection only read the cache
+  // (less often while sleep is on: every sample wakes the module)
+  unsigned long healthInterval = (sim800l.sleepMode() != SLEEP_OFF) ? MODEM_HEALTH_INTERVAL_SLEEP : MODEM_HEALTH_INTERVAL;
+  if (lastHealth == 0 || millis() - lastHealth >= healthInterval) {
+    lastHealth = millis();
+    sampleHealth();
+  }
+  
+  drainPendingSMS();
+  if (lastSweep == 0 || millis() - lastSweep >= SMS_SWEEP_INTERVAL) {
+    lastSweep = millis();
+    sweepInbox();
+  }
+  while (serveQueue(MODEM_PRIO_INBOX)) {}
+  
+  // One debug request per cycle so operators cannot starve the rest
+  serveQueue(MODEM_PRIO_DEBUG);
+  
+  // Framing errors at the negotiated rate: step the modem UART down one rate
+  if (sim800l.baudWatch()) {
+    logToBoth("[GSM] UART errors - fell back to " + String(sim800l.baud()) + " baud");
+  }
+}
@@ -0,0 +1,161 @@
+#ifndef POSITION_FRAME_H
+#define POSITION_FRAME_H
+
+#include <Arduino.h>
+
+// Binary position report sent over LoRa, shared by the tracker and the
+// ground station. JSON is rendered only where a host reads the report.
+//
+// Version 1, 28 bytes, multi-byte fields little-endian:
+//    0  header  0xB0 | version (never '{' or 'A', so text packets still pass)
+//    1  id      device id, ASCII, NUL padded to 8
+//    9  seq     uint16
+//   11  lat     int32, 1e-7 degree
+//   15  lon     int32, 1e-7 degree
+//   19  epoch   uint32, UTC seconds since 1970, 0 unknown
+//   23  sats    uint8
+//   24  hdop    uint8, 0.1 units, 255 unknown
+//   25  flags   POS_FLAG_*
+//   26  crc     CRC16-CCITT (poly 0x1021, init 0xFFFF) of bytes 0-25
+
+#define POS_FRAME_MAGIC 0xB0
+#define POS_FRAME_VERSION 1
+#define POS_FRAME_LEN 28
+#define POS_ID_LEN 8
+#define POS_HDOP_UNKNOWN 255
+
+#define POS_FLAG_FIX 0x01       // lat/lon valid
+#define POS_FLAG_ACK 0x02       // sender waits for an ACK
+#define POS_FLAG_SLOTTED 0x04   // sent in the sender's TDMA slot
+
+// Link control frame, version 1, 14 bytes (ground station <-> tracker):
+//    0  header  0xC0 | version
+//    1  id      tracker the settings are for, NUL padded to 8
+//    9  sf      spreading factor 7-12
+//   10  power   TX power, dBm
+//   11  flags   LINK_FLAG_*
+//   12  crc     CRC16-CCITT of bytes 0-11
+
+#define LINK_FRAME_MAGIC 0xC0
+#define LINK_FRAME_VERSION 1
+#define LINK_FRAME_LEN 14
+
+#define LINK_FLAG_CONFIRM 0x01  // tracker's reply: settings taken, switching now
+
+// Position ACK frame, version 1, 14 bytes (ground station -> tracker):
+//    0  header  0xA0 | version
+//    1  id      tracker the ACK is for, NUL padded to 8
+//    9  seq     uint16, the position frame being acknowledged
+//   11  mask    bit n: seq - 1 - n was received too
+//   12  crc     CRC16-CCITT of bytes 0-11
+
+#define ACK_FRAME_MAGIC 0xA0
+#define ACK_FRAME_VERSION 1
+#define ACK_FRAME_LEN 14
+
+// Track frame, version 1: several fixes of one tracker, 29-255 bytes.
+// Bytes 0-25 are laid out as in the position frame and carry the first
+// fix; later fixes carry consecutive seqs and reuse its sats and hdop:
+//    0  header  0xD0 | version
+//   26  count   fixes in the frame, first included
+//   27  deltas  per later fix, from the fix before it:
+//               varint seconds, zig-zag varint lat, zig-zag varint lon
+//  end  crc     CRC16-CCITT of everything before it
+
+#define TRACK_FRAME_MAGIC 0xD0
+#define TRACK_FRAME_VERSION 1
+#define TRACK_FRAME_MIN 29
+#define TRACK_FRAME_MAX 255     // SX127x FIFO
+#define TRACK_FIXES_MAX 32
+
+// Relay envelope, version 1: any frame re-broadcast by a relaying tracker.
+// 14 bytes in front of the frame, which keeps its own CRC:
+//    0  header  0xE0 | version
+//    1  ttl     relays the frame may still cross
+//    2  hops    relays crossed so far
+//    3  flags   RELAY_FLAG_*
+//    4  relay   id of the last relay, NUL padded to 8
+//   12  crc     CRC16-CCITT of bytes 0-11
+//   14  frame
+
+#define RELAY_FRAME_MAGIC 0xE0
+#define RELAY_FRAME_VERSION 1
+#define RELAY_HEADER_LEN 14
+
+#define RELAY_FLAG_SLOTTED 0x01 // the relay sent it in its own TDMA slot
+
+enum PosDecodeResult {
+  POS_OK,
+  POS_NOT_FRAME,                // another frame type, or a text packet
+  POS_SHORT,
+  POS_VERSION,                  // newer frame version
+  POS_BAD_CRC
+};
+
+struct PositionFix {
+  char id[POS_ID_LEN + 1];
+  uint16_t seq;
+  int32_t lat;                  // 1e-7 degree
+  int32_t lon;
+  uint32_t epoch;
+  uint8_t satellites;
+  uint8_t hdop;                 // 0.1 units
+  uint8_t flags;
+};
+
+struct LinkCommand {
+  char id[POS_ID_LEN + 1];
+  uint8_t sf;
+  int8_t power;
+  uint8_t flags;
+};
+
+struct RelayHeader {
+  uint8_t ttl;
+  uint8_t hops;
+  uint8_t flags;
+  char relay[POS_ID_LEN + 1];
+};
+
+struct AckFrame {
+  char id[POS_ID_LEN + 1];
+  uint16_t seq;
+  uint8_t mask;
+};
+
+uint16_t crc16(const uint8_t *data, size_t len);
+
+// Fill a fix from receiver values; hdop in hundredths as TinyGPS++ reports it
+void positionSet(PositionFix &fix, const char *id, uint16_t seq, bool valid, double lat, double lon,
+                 uint32_t epoch, uint32_t satellites, int32_t hdopHundredths);
+// Returns POS_FRAME_LEN, or 0 if out is too small
+size_t positionEncode(const PositionFix &fix, uint8_t *out, size_t size);
+PosDecodeResult positionDecode(const uint8_t *in, size_t len, PositionFix &fix);
+
+size_t linkEncode(const LinkCommand &cmd, uint8_t *out, size_t size);
+PosDecodeResult linkDecode(const uint8_t *in, size_t len, LinkCommand &cmd);
+
+// Packs fixes[0..count) until the frame is full; used says how many went in.
+// Returns the frame length, 0 if out is too small for one fix
+size_t trackEncode(const PositionFix *fixes, int count, uint8_t *out, size_t size, int &used);
+// Fills up to max fixes, count says how many
+PosDecodeResult trackDecode(const uint8_t *in, size_t len, PositionFix *fixes, int max, int &count);
+
+// Returns RELAY_HEADER_LEN + len, 0 if out is too small
+size_t relayEncode(const RelayHeader &hdr, const uint8_t *frame, size_t len, uint8_t *out, size_t size);
+// The enclosed frame starts at in + RELAY_HEADER_LEN
+PosDecodeResult relayDecode(const uint8_t *in, size_t len, RelayHeader &hdr);
+
+size_t ackEncode(const AckFrame &ack, uint8_t *out, size_t size);
+PosDecodeResult ackDecode(const uint8_t *in, size_t len, AckFrame &ack);
+
+double positionDegrees(int32_t fixed);
+// Seconds since 1970 for a UTC calendar time
+uint32_t positionEpoch(int year, int month, int day, int hour, int minute, int second);
+// "YYYY-MM-DDTHH:MM:SSZ"
+String positionTimestamp(uint32_t epoch);
+
+// Host edge only: {"soldier_id":..,"latitude":..,...}; deviceType may be NULL
+String positionJson(const PositionFix &fix, const char *deviceType, const char *commMode);
+
+#endif
@@ -0,0 +1,96 @@
+#include "ReportDedup.h"
+#include "PositionFrame.h"
+#include "Config.h"
+
+#define DEDUP_PROBES 16         // slots searched from the hash position
+
+struct DedupEntry {
+  char id[POS_ID_LEN + 1];
+  uint16_t seq;
+  uint8_t via;
+  bool both;                    // the other transport has delivered it too
+  unsigned long arrivedAt;      // first delivery; 0 marks a free slot
+};
+
+static DedupEntry table[REPORT_DEDUP_SLOTS];
+static ReportDedupStats stats = {};
+static portMUX_TYPE dedupMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t keyHash(const char *id, uint16_t seq) {
+  uint32_t hash = 2166136261UL;
+  for (int i = 0; i < POS_ID_LEN && id[i] != '\0'; i++) {
+    hash ^= (uint8_t)id[i];
+    hash *= 16777619UL;
+  }
+  hash ^= seq;
+  hash *= 16777619UL;
+  return hash;
+}
+
+bool reportFirst(const char *id, uint16_t seq, ReportTransport via, unsigned long arrivedAt) {
+  uint32_t home = keyHash(id, seq);
+  unsigned long now = millis();
+
+  portENTER_CRITICAL(&dedupMux);
+  DedupEntry *open = NULL;
+  DedupEntry *oldest = NULL;
+  for (int i = 0; i < DEDUP_PROBES; i++) {
+    DedupEntry &e = table[(home + i) & (REPORT_DEDUP_SLOTS - 1)];
+    bool live = e.arrivedAt != 0 && now - e.arrivedAt < REPORT_DEDUP_TTL;
+    if (!live) {
+      if (open == NULL) open = &e;
+      continue;
+    }
+    if (e.seq == seq && strncmp(e.id, id, POS_ID_LEN) == 0) {
+      stats.duplicates[via]++;
+      if (e.via != via && !e.both) {
+        // The other transport got there first, by this much
+        e.both = true;
+        unsigned long lead = arrivedAt - e.arrivedAt;
+        if ((long)lead < 0) lead = 0;
+        stats.leadCount[e.via]++;
+        stats.leadTotal[e.via] += lead;
+        if (lead > stats.leadMax[e.via]) stats.leadMax[e.via] = lead;
+      }
+      portEXIT_CRITICAL(&dedupMux);
+      return false;
+    }
+    if (oldest == NULL || now - e.arrivedAt > now - oldest->arrivedAt) oldest = &e;
+  }
+
+  // New report: a free slot in the probe window, else the oldest entry there
+  DedupEntry *slot = open;
+  if (slot == NULL) {
+    slot = oldest;
+    stats.evicted++;
+  }
+  memset(slot->id, 0, sizeof(slot->id));
+  strncpy(slot->id, id, POS_ID_LEN);
+  slot->seq = seq;
+  slot->via = via;
+  slot->both = false;
+  slot->arrivedAt = arrivedAt != 0 ? arrivedAt : 1;
+  stats.first[via]++;
+  portEXIT_CRITICAL(&dedupMux);
+  return true;
+}
+
+bool reportParseSms(const String &body, char *id, uint16_t &seq) {
+  if (!body.startsWith("{\"id\":\"")) return false;
+  int start = 7;
+  int end = body.indexOf('"', start);
+  if (end < 0 || end - start > POS_ID_LEN) return false;
+  int n = body.indexOf("\"n\":", end);
+  if (n < 0) return false;
+  memset(id, 0, POS_ID_LEN + 1);
+  body.substring(start, end).toCharArray(id, POS_ID_LEN + 1);
+  seq = (uint16_t)body.substring(n + 4).toInt();
+  return true;
+}
+
+ReportDedupStats reportDedupStats() {
+  portENTER_CRITICAL(&dedupMux);
+  ReportDedupStats copy = stats;
+  portEXIT_CRITICAL(&dedupMux);
+  return copy;
+}
@@ -0,0 +1,35 @@
+#ifndef REPORT_DEDUP_H
+#define REPORT_DEDUP_H
+
+#include <Arduino.h>
+
+// Recent reports keyed by device id and sequence number, so a fix that
+// arrives over LoRa and again by SMS is shown once. Fixed memory: an
+// open-addressing table of REPORT_DEDUP_SLOTS entries, probed a bounded
+// distance, where entries older than REPORT_DEDUP_TTL count as free.
+// Records which transport delivered first and how far ahead it was.
+
+enum ReportTransport {
+  REPORT_VIA_LORA,
+  REPORT_VIA_SMS,
+  REPORT_VIA_COUNT
+};
+
+struct ReportDedupStats {
+  unsigned long first[REPORT_VIA_COUNT];       // reports delivered first by this transport
+  unsigned long duplicates[REPORT_VIA_COUNT];  // copies dropped on this transport
+  unsigned long leadCount[REPORT_VIA_COUNT];   // both arrived, this one first
+  unsigned long leadTotal[REPORT_VIA_COUNT];   // ms ahead of the other transport
+  unsigned long leadMax[REPORT_VIA_COUNT];
+  unsigned long evicted;                       // live entries overwritten (table too small)
+};
+
+// Any task: true the first time id/seq is seen, false for a copy.
+// arrivedAt is millis() when the transport delivered it
+bool reportFirst(const char *id, uint16_t seq, ReportTransport via, unsigned long arrivedAt);
+// SMS form {"id":"..","n":..,...}; false for other text
+bool reportParseSms(const String &body, char *id, uint16_t &seq);
+
+ReportDedupStats reportDedupStats();
+
+#endif
@@ -12,24 +12,370 @@
 
 #define TIMEOUT 60 // Wait for 60 Seconds
 
+// AT command engine sizing
+#define AT_QUEUE_SIZE 4        // commands queued behind the active one
+#define AT_CMD_MAX 96          // longest command line (without CR/LF)
+#define AT_RESPONSE_MAX 1536   // response text kept for the active command
+#define AT_DEFAULT_TIMEOUT (TIMEOUT*1000UL)
+#define AT_RX_RING 512         // raw modem bytes waiting to be framed into lines
+#define AT_LINE_MAX 384        // longest single line handed to the parser
+#define URC_HEADER_MAX 96      // header kept while waiting for a URC body line
+
+// Bring-up step timeouts (ms, from entering the step)
+#define BOOT_AT_TIMEOUT 10000       // UART answers AT
+#define BOOT_SIM_TIMEOUT 15000      // +CPIN: READY or Call Ready
+#define BOOT_NETWORK_TIMEOUT 60000  // +CREG: 1 or 5
+#define BOOT_SMS_TIMEOUT 30000      // SMS Ready or SMS storage answering
+#define BOOT_PROBE_INTERVAL 1000    // re-ask while the event has not been seen
+
+// UART rate negotiation
+#define AT_BAUD_MAX 115200          // fastest rate tried by default
+#define AT_BAUD_ERROR_LIMIT 8       // host framing errors between baudWatch() calls that force a step down
+#define AT_BAUD_PROBE_TIMEOUT 300   // ms per AT while searching for the modem's current rate
+
+// Slow-clock sleep (AT+CSCLK)
+#define AT_WAKE_DTR_DELAY 60        // ms after DTR goes low before the UART answers
+#define AT_WAKE_AT_TIMEOUT 300      // ms for the wake-up "AT" to be answered before it is sent again
+#define AT_WAKE_AT_TRIES 3          // wake-up "AT"s before the held command is sent regardless
+#define AT_SLEEP_IDLE 5000          // CSCLK=2: UART silence after which the module sleeps
+#define AT_SLEEP_HOLD 1000          // CSCLK=1: engine idle time before DTR lets the module sleep
+
+// GPRS data link (one connection on CIPMUX link 0)
+#define IP_SEND_MAX 1024            // bytes per AT+CIPSEND
+#define IP_READ_MAX 160             // bytes per AT+CIPRXGET=3 (hex line must fit AT_LINE_MAX)
+
+// Result of an AT command submitted to the engine
+enum ATResult : int8_t {
+	AT_NONE = -1,      // unknown handle (never submitted)
+	AT_PENDING = 0,    // queued or waiting for a final result code
+	AT_OK,             // OK / SEND OK / SHUT OK
+	AT_ERROR,          // ERROR, +CME ERROR, NO CARRIER, BUSY ...
+	AT_CMS_ERROR,      // +CMS ERROR (SMS layer)
+	AT_PROMPT,         // '>' data prompt (only when the command has no payload)
+	AT_TIMEOUT,        // no final result code within the command timeout
+	AT_EXPIRED         // finished, but the result was recycled before anyone asked
+};
+
+// Completion callback: response is only valid for the duration of the call
+typedef void (*ATCallback)(uint16_t handle, ATResult result, const char* response, void* context);
+
+// Outcome of one recipient in a multi-recipient SMS send
+struct SMSReport {
+	ATResult result;
+	int16_t reference;     // +CMGS message reference, -1 when not sent
+	uint32_t latency;      // ms from AT+CMGS to the final result code
+};
+
+// SMS PDU mode (3GPP TS 23.040 / 23.038)
+#define SMS_PDU_OCTETS 176             // longest TPDU built or parsed, SMSC address included
+#define SMS_PART_DATA 160              // user data of one part: characters (7-bit) or octets
+#define SMS_PARTS_MAX 4                // parts in one concatenated message
+#define SMS_DATA_MAX (SMS_PARTS_MAX*SMS_PART_DATA)
+#define SMS_REASSEMBLY_SLOTS 2         // concatenated messages collected at once
+#define SMS_REASSEMBLY_TIMEOUT 600000  // ms before an incomplete message is dropped
+
+enum SMSCoding : uint8_t {
+	SMS_7BIT,          // GSM default alphabet, ASCII on the API side
+	SMS_8BIT,          // binary data
+	SMS_UCS2           // received only, decoded to ASCII with '?' for the rest
+};
+
+// One received SMS-DELIVER, possibly a part of a concatenated message
+struct SMSPart {
+	char sender[24];
+	SMSCoding coding;
+	uint16_t ref;          // concatenation reference (0 when single)
+	uint8_t total;         // parts in the message, 1 when single
+	uint8_t seq;           // 1-based part number
+	uint16_t length;       // bytes in data; 7-bit/UCS2 text is also NUL terminated
+	uint8_t data[SMS_PART_DATA+1];
+};
+
+// A complete message after reassembly
+struct SMSMessage {
+	char sender[24];
+	SMSCoding coding;
+	uint8_t parts;
+	uint16_t length;
+	uint8_t data[SMS_DATA_MAX+1];
+};
+
+// PDU encoder/decoder, no modem access
+class SMSPdu
+{
+  public:
+	static uint16_t gsmEncode(const char* text, uint16_t length, uint8_t* septets, uint16_t size);
+	static uint16_t gsmLength(const char* text);
+	static uint16_t pack7(const uint8_t* septets, uint16_t count, uint8_t fillBits, uint8_t* out);
+	static void unpack7(const uint8_t* octets, uint8_t fillBits, uint16_t count, uint8_t* septets);
+	// SMS-SUBMIT as hex (with a "00" default SMSC prefix); returns the AT+CMGS length, 0 on error
+	static uint8_t encodeSubmit(const char* number, const uint8_t* units, uint16_t count, SMSCoding coding,
+		uint8_t ref, uint8_t total, uint8_t seq, char* hex, uint16_t hexSize);
+	static bool decodeDeliver(const char* hex, SMSPart* part);
+};
+
+// Collects the parts of concatenated messages until they are complete
+class SMSReassembler
+{
+  private:
+	struct Slot {
+		bool used;
+		char sender[24];
+		uint16_t ref;
+		uint8_t total;
+		uint8_t have;      // bit per received part
+		SMSCoding coding;
+		uint32_t firstAt;
+		uint16_t length[SMS_PARTS_MAX];
+		uint8_t data[SMS_PARTS_MAX][SMS_PART_DATA];
+	};
+	Slot _slots[SMS_REASSEMBLY_SLOTS];
+	uint32_t _dropped=0;
+
+  public:
+	SMSReassembler();
+	bool add(const SMSPart& part, SMSMessage* message);   // true when message is complete
+	uint8_t pending();
+	uint32_t dropped();
+};
+
+enum SleepMode : uint8_t {
+	SLEEP_OFF,         // AT+CSCLK=0, always awake
+	SLEEP_DTR,         // AT+CSCLK=1, sleeps while the host holds DTR high
+	SLEEP_AUTO         // AT+CSCLK=2, sleeps after AT_SLEEP_IDLE of UART silence, woken by "AT"
+};
+
+// GPRS link state, advanced by the connection lines the modem reports
+enum IPState : uint8_t {
+	IP_OFF,            // no PDP context
+	IP_BEARER,         // context up (AT+CIICR), no connection
+	IP_CONNECTING,     // AT+CIPSTART accepted, waiting for CONNECT OK
+	IP_CONNECTED
+};
+
+// Readiness state machine, advanced by observed modem events from poll()
+enum BootStage : uint8_t {
+	BOOT_IDLE,         // bootStart() not called yet
+	BOOT_AT,           // waiting for the UART to answer AT
+	BOOT_SIM,          // waiting for +CPIN: READY / Call Ready
+	BOOT_NETWORK,      // waiting for +CREG: 1 or 5
+	BOOT_SMS,          // waiting for SMS Ready
+	BOOT_READY,
+	BOOT_FAILED,
+	BOOT_STAGES
+};
+
+// Optional blocking wait between polls (e.g. sleep until the UART has a line);
+// returns early when modem output arrives, without it the engine spins on delay(1)
+typedef bool (*ATWaitFn)(uint32_t timeoutMs, void* context);
+
+// Host UART control for baud negotiation: switch the local rate, and
+// (optionally) read a running count of receive framing errors
+typedef void (*ATBaudFn)(uint32_t baud, void* context);
+typedef uint32_t (*ATErrorFn)(void* context);
+
+// Unsolicited result codes routed through the dispatcher
+enum URCType : uint8_t {
+	URC_CMTI,          // +CMTI: "SM",<index>  new SMS stored
+	URC_CMT,           // +CMT: <header> + body line, SMS delivered directly
+	URC_RING,          // RING
+	URC_CREG,          // +CREG: <stat>  registration change
+	URC_CLTS,          // +CLTS: "<time>"  network time update
+	URC_COUNT
+};
+
+// URC handler: body is NULL for single line codes; both only valid during the call
+typedef void (*URCHandler)(URCType type, const char* line, const char* body, void* context);
+
+// Fixed-size ring buffer that splits raw modem output into CR/LF terminated lines
+class ATLineFramer
+{
+  private:
+	char _ring[AT_RX_RING];
+	uint16_t _head=0;
+	uint16_t _tail=0;
+	uint16_t _size=0;
+	uint16_t _lines=0;        // complete lines currently buffered
+
+  public:
+	bool push(char c);
+	bool nextLine(char* line, uint16_t size, uint16_t* len);
+	bool takePrompt();
+	uint16_t space();
+};
+
 class SIM800L		
 {									
   private:
-	int _timeout;
+	struct ATCommand {
+		uint16_t handle;
+		char cmd[AT_CMD_MAX+1];
+		const char* payload;   // sent after '>' followed by Ctrl-Z (caller owned)
+		uint16_t payloadLength;   // non-zero: payload is binary, sent as is without Ctrl-Z
+		bool prompt;           // command answers with a '>' data prompt
+		uint32_t timeout;
+		ATCallback callback;
+		void* context;
+	};
+
+	struct ATOutcome {
+		uint16_t handle;
+		ATResult result;
+	};
+
 	Stream* _serial;
-	String _serialBuffer="";
+	Print* _trace=NULL;         // optional mirror of raw modem traffic
+	ATWaitFn _waitFn=NULL;
+	void* _waitContext=NULL;
+
+	// Baud negotiation (only with baudControl())
+	ATBaudFn _setBaud=NULL;
+	ATErrorFn _baudErrors=NULL;
+	void* _baudContext=NULL;
+	uint32_t _baud=0;           // current rate, 0 when unknown
+	uint32_t _baudLimit=AT_BAUD_MAX;
+	uint32_t _errorMark=0;
+	uint32_t _throughput=0;     // bytes/s over large responses (smoothed)
+	bool _baudBusy=false;       // rate change in progress, hold bring-up probes
 	uint8_t rstpin=0; 			//GSM HARD RESET PIN
 	bool rstDeclair=0; 		// CONFIG BIT
 	//void (*tcp_callback)(const char* _data, const uint16_t len) = NULL;
 	//char* apn,user,password;
 
-	String _readSerial();
+	// Command engine state
+	ATCommand _queue[AT_QUEUE_SIZE];
+	uint8_t _head=0;            // oldest queued command (active once sent)
+	uint8_t _count=0;
+	uint16_t _nextHandle=1;
+	bool _handlesWrapped=false;   // every non-zero handle has been issued
+	ATOutcome _done[AT_QUEUE_SIZE];   // results of recently finished commands, for result()
+	uint8_t _doneNext=0;
+	bool _active=false;         // _queue[_head] has been written to the modem
+	uint32_t _sentAt=0;
+	char _response[AT_RESPONSE_MAX+1];
+	uint16_t _responseLen=0;
+	bool _truncated=false;      // a response line did not fit into _response
+	bool _ring=false;
+	int8_t _cmgf=-1;            // acknowledged AT+CMGF since the last reset (1 text, 0 PDU), -1 unknown
+	uint8_t _concatRef=0;       // reference of the last concatenated message sent
+
+	// Line framing and URC dispatch
+	ATLineFramer _framer;
+	char _line[AT_LINE_MAX+1];
+	struct URCSlot {
+		URCHandler handler;
+		void* context;
+	};
+	URCSlot _urcHandlers[URC_COUNT];
+	int8_t _urcBody=-1;         // URC whose body is the next line
+	char _urcHeader[URC_HEADER_MAX+1];
+
+	// Bring-up state machine
+	BootStage _bootStage=BOOT_IDLE;
+	BootStage _bootFailed=BOOT_IDLE;    // step that timed out
+	uint8_t _bootEvents=0;              // BOOT_EVENT_* bits seen so far
+	uint32_t _bootStart=0;
+	uint32_t _stepStart=0;
+	uint32_t _probeAt=0;
+	uint16_t _bootProbe=0;              // handle of the probe in flight
+	uint32_t _bootAt[BOOT_STAGES];      // ms from bootStart() to the end of each step
+
+	// GPRS link
+	IPState _ipState=IP_OFF;
+	uint32_t _ipSince=0;                // millis() of the last state change
+	uint32_t _ipDrops=0;                // connections lost while connected
+	bool _ipData=false;                 // +CIPRXGET: 1 seen, data waiting in the modem
+	bool _ipUdp=false;
+
+	// Slow-clock sleep: awake is the driver's estimate of the module state
+	SleepMode _sleepMode=SLEEP_OFF;
+	int8_t _dtrPin=-1;
+	bool _awake=true;
+	bool _waking=false;                 // wake-up sent, dispatch held until it completes
+	uint32_t _wakeAt=0;                 // DTR: UART up; AT: answer deadline of the last probe
+	uint8_t _wakeProbes=0;              // wake-up "AT"s written
+	uint8_t _wakeAnswers=0;             // final result codes they drew
+	uint32_t _activityAt=0;             // last UART traffic in either direction
+	uint32_t _awakeSince=0;
+	uint32_t _hourStart=0;
+	uint32_t _awakeHour=0;              // ms awake in the current hour (closed periods only)
+	uint32_t _awakeLastHour=0;
+	uint32_t _wakeups=0;
+
+	// Latency accounting (ms, measured from write to final result code)
+	uint32_t _lastLatency=0;
+	uint32_t _latencyTotal=0;
+	uint32_t _commandCount=0;
+
+	ATCommand* _find(uint16_t handle);
+	void _dispatch();
+	void _processLine(const char* line, uint16_t len);
+	bool _ownsPrefix(const char* prefix);
+	void _bootWatch(const char* line);
+	void _bootPoll();
+	void _bootAdvance();
+	void _ipWatch(const char* line);
+	void _ipSet(IPState state);
+	bool _ipConnect(const char* proto, const char* host, uint16_t port);
+	bool _wakeReady();
+	void _wakeProbe(uint32_t now);
+	void _sleepPoll();
+	void _markAwake(bool awake);
+	void _finish(ATResult result);
+	ATResult _classify(const char* line, uint16_t len);
+	int _field(const char* prefix, uint8_t index);
+	bool _setFormat(bool text);
+	ATResult _sendPDU(const char* number, const uint8_t* data, uint16_t length, SMSCoding coding, int16_t* reference, uint8_t* parts);
+	ATResult _sendText(const char* number, const char* text, int16_t* reference);
 	void _clearSerial();
+	void _idle();
+	void _hostBaud(uint32_t rate);
+	bool _findBaud();
+	bool _switchBaud(uint32_t rate);
+	bool _echoTest();
+	void _negotiateBaud();
   public:
 
   	SIM800L();
     bool begin(Stream &serial);
  	bool begin(Stream &serial,uint8_t pin);
+
+	// Asynchronous command API
+	uint16_t submit(const char* cmd, uint32_t timeout=AT_DEFAULT_TIMEOUT, ATCallback callback=NULL, void* context=NULL, const char* payload=NULL, uint16_t payloadLength=0);
+	void poll();
+	ATResult result(uint16_t handle);
+	ATResult command(const char* cmd, uint32_t timeout=AT_DEFAULT_TIMEOUT, const char* payload=NULL, uint16_t payloadLength=0);
+	const char* response();     // text of the last finished command, valid until the next poll()
+	bool truncated();
+	bool busy();
+	uint32_t lastLatency();
+	uint32_t averageLatency();
+
+	// Bring-up: begin() returns once AT answers, the rest advances inside poll()
+	void bootStart();
+	BootStage bootStage();
+	BootStage bootFailedStage();
+	uint32_t bootTime(BootStage stage);   // ms from bootStart() until the step completed, 0 if not reached
+	bool ready();
+
+	// Baud negotiation: begin() finds the modem's rate, moves it to the fastest
+	// rate (<= maxBaud) that passes an echo test and stores it with AT&W
+	void baudControl(ATBaudFn setBaud, void* context=NULL, ATErrorFn errors=NULL, uint32_t maxBaud=AT_BAUD_MAX, uint32_t currentBaud=9600);
+	uint32_t baud();
+	bool baudWatch();           // call when idle: steps down one rate if framing errors pile up
+	uint32_t throughput();      // achieved bytes/s on large responses, 0 until measured
+
+	// Blocking calls sleep in this instead of delay(1); NULL restores polling
+	void waitWith(ATWaitFn wait, void* context=NULL);
+
+	// Raw traffic mirror (debug console); NULL disables
+	void trace(Print* tap);
+
+	// Unsolicited result codes
+	void onURC(URCType type, URCHandler handler, void* context=NULL);
+	static int intField(const char* line, uint8_t index);
+	static bool textField(const char* line, uint8_t index, char* out, uint16_t size);
+
  	// Methods for calling	
  	bool dialNumber(char* number);
  	bool answerCall(); 
@@ -40,12 +386,18 @@ class SIM800L
 
  	//Methods for sms 
 	bool sendSMS(char* number,char* text);
+	uint8_t sendSMSToMany(const char* const* numbers, uint8_t count, const char* text, SMSReport* reports);
 	String readSMS(uint8_t msgIndex);
+	// PDU mode: long text is split into concatenated parts, 8-bit carries binary data
+	uint8_t sendPDU(const char* number, const uint8_t* data, uint16_t length, SMSCoding coding=SMS_7BIT, SMSReport* report=NULL);
+	bool readPDU(uint8_t msgIndex, SMSPart* part);
+	bool setSMSFormat(bool text);    // cached AT+CMGF, for callers issuing raw +CMGL/+CMGR
 
 	
 	//Methods for network
 	int8_t signalStrength();
 	bool checkNetwork();
+	bool networkHealth(int8_t* rssi, int8_t* stat);    // AT+CSQ;+CREG? (rssi -1 when unknown)
 	String serviceProvider();
 	bool GSMTime(uint8_t *_time);
 	bool enAutoTimeZone();
@@ -53,16 +405,41 @@ class SIM800L
 	//Methods for power
 	bool softReset();
 	bool hardReset();
+	// Slow-clock sleep between jobs: CSCLK=1 with a DTR pin, CSCLK=2 (woken by AT) without.
+	// Queued commands wake the module first; URCs (and RI) still come while it sleeps.
+	bool sleepEnable(int8_t dtrPin=-1);
+	bool sleepDisable();
+	SleepMode sleepMode();
+	bool awake();
+	uint32_t wakeups();
+	uint32_t awakeThisHour();   // ms awake since the current hour started
+	uint32_t awakeLastHour();   // ms awake in the previous full hour
 
-	//Methonds for TCP
+	//Methonds for TCP/UDP (one connection on link 0, quick send mode)
 	//void loop();
 	//void tcpCallBack(void (*callback)(const char* _data, const uint16_t len));
-	bool startGPRS();
-	void tcpConnect(char* host,uint16_t port);
-	bool tcpStatus();
-	int16_t tcpAvailable();
-	void tcpRead(char* buffer,uint16_t length);
-	void tcpSend(char* buffer);
+	bool startGPRS(const char* apn="");
+	bool stopGPRS();
+	bool tcpConnect(const char* host,uint16_t port);   // true once accepted, CONNECT OK arrives later
+	bool udpConnect(const char* host,uint16_t port);   // datagrams to one peer, no handshake on the air
+	bool ipClose();
+	IPState ipState();
+	bool ipUdp();               // the open (or opening) connection is UDP
+	uint32_t ipStateAge();      // ms since the last link state change
+	uint32_t ipDrops();
+	bool ipStatus();            // asks AT+CIPSTATUS and resyncs ipState()
+	bool ipSend(const uint8_t* data,uint16_t length);    // true when the modem buffered the bytes (DATA ACCEPT); one datagram on UDP
+	bool ipAcked(uint32_t* sent,uint32_t* acked);        // TCP only: byte counters since the connection opened
+	bool ipDataPending();       // the modem announced received data
+	int16_t ipAvailable();
+	uint16_t ipRead(uint8_t* buffer,uint16_t length);
+
+	// Names from before UDP support, kept for sketches written against them.
+	// tcpConnect() keeps its name but now reports whether AT+CIPSTART was accepted.
+	bool tcpStatus() { return ipStatus(); }
+	int16_t tcpAvailable() { return ipAvailable(); }
+	uint16_t tcpRead(char* buffer,uint16_t length) { return ipRead((uint8_t*)buffer,length); }
+	bool tcpSend(const char* buffer) { return ipSend((const uint8_t*)buffer,strlen(buffer)); }
 };
 
 #endif 
@@ -3,18 +3,25 @@
 
 #include <Arduino.h>
 #include <TinyGPS++.h>
+#include "PositionFrame.h"
 
 // Logging
 void logToBoth(const String &message);
 
 // GPS Utilities
 String formatGpsTimestamp(TinyGPSDate &d, TinyGPSTime &t);
-String createPayload(double lat, double lon, const String &timestamp, const String &msgId);
+uint32_t gpsEpoch(TinyGPSDate &d, TinyGPSTime &t);
+String createPayload(const PositionFix &fix);
 
 // SMS Utilities
 bool sendSMSToNumber(const char *toNumber, const String &message);
 bool sendSMSToAll(const String &message);
 
+// Load accounting: idle-hook ticks per core and UART line wakeups,
+// reported over the interval since the previous loadReport() call
+void idleMonitorBegin();
+String loadReport();
+
 // Command Processing
 void processKeyboardCommand(String command);
 
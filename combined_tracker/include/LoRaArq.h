@@ -0,0 +1,62 @@
+#ifndef LORA_ARQ_H
+#define LORA_ARQ_H
+
+#include <Arduino.h>
+#include "PositionFrame.h"
+
+// Selective-repeat ARQ for position reports. Every report keeps the seq of
+// its frame; the ground station answers with an ACK frame naming that seq
+// plus a bitmap of the eight before it, so one lost ACK is repaired by the
+// next. Up to LORA_ARQ_WINDOW reports are in flight. An unacknowledged
+// report is sent again after LORA_ACK_TIMEOUT, doubling (with jitter) on
+// each retry, and goes to the SMS fallback after LORA_ARQ_RETRIES.
+//
+// The window is owned by loraTask; only the statistics are shared.
+
+struct ArqFrame {
+  bool used;
+  bool wantAck;                // false: sent once, no ACK expected
+  uint16_t seq;
+  uint8_t data[TRACK_FRAME_MAX];
+  size_t length;
+  String payload;              // SMS form, for the fallback
+  uint8_t tries;               // transmissions so far
+  unsigned long queuedAt;
+  unsigned long sentAt;        // last transmission
+  unsigned long timeout;       // ms after sentAt before the next try
+};
+
+struct ArqStats {
+  unsigned long queued;
+  unsigned long sent;          // first transmissions
+  unsigned long retransmits;
+  unsigned long acked;
+  unsigned long ackFrames;     // ACK frames for this tracker, stale ones included
+  unsigned long escalated;     // out of retries: handed to the SMS fallback
+  unsigned long evicted;       // pushed out of a full window
+  unsigned long rttLast;       // ms, last transmission to its ACK
+  unsigned long rttMax;
+  unsigned long duplicates;    // station: retransmissions of reports already delivered
+  uint8_t inFlight;
+};
+
+// loraTask, tracker. A full window first gives up its oldest report (see arqGiveUp)
+void arqQueue(const uint8_t *frame, size_t len, uint16_t seq, bool wantAck, const String &payload);
+// Next frame due on air (new or retransmission), NULL if none
+ArqFrame *arqDue();
+// The frame from arqDue() went out
+void arqSent(ArqFrame *frame);
+// ACK frame for this tracker; returns the number of reports it released
+int arqAcked(const AckFrame &ack);
+// Reports out of retries or evicted; true while there is one (copied into out)
+bool arqGiveUp(ArqFrame &out);
+// Reports whose ACK timer ran out since the last call (each one a missed ACK)
+int arqTimeouts();
+
+// loraTask, ground station: a report from id arrived. Fills in the ACK to
+// send; false when the report is a retransmission already delivered
+bool arqReceive(const char *id, uint16_t seq, AckFrame &ack);
+
+ArqStats arqStats();
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef LORA_RELAY_H
+#define LORA_RELAY_H
+
+#include <Arduino.h>
+#include "PositionFrame.h"
+
+// Store-and-forward relay for trackers beyond the ground station's range.
+// A relaying tracker re-broadcasts the reports it hears from other
+// trackers, and the station's ACKs for them, in a relay envelope that
+// counts hops down from LORA_RELAY_HOPS. Forwarding waits a random
+// LORA_RELAY_JITTER (and this tracker's TDMA slot); hearing the station's
+// ACK meanwhile cancels it. A copy already forwarded within
+// LORA_RELAY_MEMORY is dropped, and forwarding stops while it has used
+// LORA_RELAY_LOAD percent of the current LORA_RELAY_WINDOW.
+//
+// The queue is owned by loraTask; only the statistics are shared.
+
+#define RELAY_QUEUE 4
+
+struct RelayFrame {
+  bool used;
+  char id[POS_ID_LEN + 1];     // tracker the frame is from (report) or for (ACK)
+  uint16_t seq;
+  bool isAck;
+  uint8_t data[TRACK_FRAME_MAX];
+  size_t length;               // envelope included
+  unsigned long dueAt;
+};
+
+struct RelayStats {
+  unsigned long heard;         // frames offered for forwarding
+  unsigned long forwarded;
+  unsigned long cancelled;     // station's ACK heard before our turn
+  unsigned long duplicates;    // already forwarded within LORA_RELAY_MEMORY
+  unsigned long expired;       // no hops left
+  unsigned long capped;        // refused by the load cap or a full queue
+  unsigned long tooLong;       // frame plus envelope over TRACK_FRAME_MAX
+  uint8_t loadPercent;         // airtime share spent forwarding, this window or the last
+  unsigned long airtimeMs;     // total forwarding airtime
+};
+
+// loraTask, tracker: a frame heard from another tracker (hops 0) or inside
+// an envelope (hdr from it). False when it will not be forwarded
+bool relayOffer(const uint8_t *frame, size_t len, const char *id, uint16_t seq, bool isAck, const RelayHeader *hdr);
+// loraTask: the station ACKed id/seq, its report need not be forwarded
+void relayCancel(const char *id, uint16_t seq, uint8_t mask);
+// Next envelope due on air, NULL if none
+RelayFrame *relayDue();
+void relaySent(RelayFrame *frame, uint32_t airtimeUs);
+
+RelayStats relayStats();
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef LORA_TDMA_H
+#define LORA_TDMA_H
+
+#include <Arduino.h>
+
+// Time-slotted position reports. GPS_SEND_INTERVAL is one frame of
+// LORA_TDMA_SLOTS slots, counted in UTC from 1970, and each tracker sends
+// in the slot its SOLDIER_ID hashes to. Trackers take the time from the
+// NMEA stream; without it (or after LORA_TDMA_HOLDOVER) they send
+// unslotted as before and leave POS_FLAG_SLOTTED clear.
+//
+// The ground station runs no GPS. It follows the frame from the slotted
+// reports it hears and books every packet, good or corrupt, to the slot it
+// arrived in; corrupt frames in a slot are the collision count.
+
+#define TDMA_SLOT_MS (GPS_SEND_INTERVAL / LORA_TDMA_SLOTS)
+
+struct TdmaSlot {
+  uint8_t trackers;            // ids hashing to this slot heard within LORA_ARQ_MEMORY
+  unsigned long reports;       // reports that arrived in this slot
+  unsigned long corrupt;       // rejected frames that arrived in this slot (collisions)
+  unsigned long foreign;       // slotted reports from a tracker that belongs to another slot
+};
+
+struct TdmaStats {
+  bool synced;                 // tracker: GPS time within LORA_TDMA_HOLDOVER
+  unsigned long syncAge;       // ms since the last GPS time
+  bool locked;                 // station: frame start known from a slotted report
+  unsigned long unslotted;     // station: reports sent without GPS time
+  unsigned long unplaced;      // station: packets heard before the frame was known
+};
+
+uint8_t tdmaSlotOf(const char *id);
+uint8_t tdmaOwnSlot();
+
+// gpsTask: a UTC time sentence committed at the given millis()
+void tdmaSync(uint32_t epoch, uint8_t centisecond, unsigned long committedAt);
+bool tdmaSynced();
+// loraTask, tracker: ms until a packet of this airtime may go, 0 for now
+// (always 0 while unsynced)
+unsigned long tdmaWait(uint32_t airtimeUs);
+
+// loraTask, ground station: a report or a corrupt frame ended at receivedAt
+void tdmaHeard(const char *id, bool slotted, size_t len, unsigned long receivedAt);
+void tdmaCorrupt(size_t len, unsigned long receivedAt);
+
+TdmaStats tdmaStats();
+// Per-slot occupancy, out must hold LORA_TDMA_SLOTS
+void tdmaSlots(TdmaSlot *out);
+
+#endif
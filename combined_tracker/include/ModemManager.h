@@ -0,0 +1,113 @@
+#ifndef MODEM_MANAGER_H
+#define MODEM_MANAGER_H
+
+#include <Arduino.h>
+
+// The modem task is the only code that touches the SIM800L UART.
+// Other tasks hand it work through prioritized queues and, if they need
+// the outcome, wait on the returned request.
+
+// Request priority (served highest first)
+enum ModemPriority {
+  MODEM_PRIO_EMERGENCY,   // operator SMS from BT / keyboard
+  MODEM_PRIO_REPORT,      // position reports (LoRa fallback)
+  MODEM_PRIO_INBOX,       // inbox reads and sweeps
+  MODEM_PRIO_DEBUG,       // raw AT passthrough
+  MODEM_PRIO_COUNT
+};
+
+enum ModemRequestType {
+  MODEM_REQ_SMS_ALL,      // text to every RECEIVER_PHONES entry
+  MODEM_REQ_SMS,          // text to one number
+  MODEM_REQ_AT,           // raw command, response copied back
+  MODEM_REQ_INBOX_SWEEP,  // force an inbox sweep now
+  MODEM_REQ_INBOX_LIST    // decoded listing of stored SMS, response copied back
+};
+
+#define MODEM_POOL_SIZE 8
+#define MODEM_TEXT_MAX 200
+#define MODEM_RESPONSE_MAX 512
+
+struct ModemRequest {
+  ModemRequestType type;
+  ModemPriority priority;
+  char number[24];
+  char text[MODEM_TEXT_MAX + 1];
+  char response[MODEM_RESPONSE_MAX + 1];
+  unsigned long queuedAt;
+  SemaphoreHandle_t doneSem;
+  volatile bool inUse;
+  volatile bool done;
+  volatile bool abandoned;    // submitter stopped waiting, modem task frees it
+  bool success;
+};
+
+// SMS intake statistics (written by the modem task only)
+struct SMSIntakeStats {
+  unsigned long latencyCount;   // +CMTI notification-to-display latency (ms)
+  unsigned long latencyLast;
+  unsigned long latencyMax;
+  unsigned long latencyTotal;
+  unsigned long purgeBatches;   // one AT+CMGD=1,1 replaced one AT+CMGD per message
+  unsigned long roundTripsSaved;
+  unsigned long concatParts;    // PDU parts carrying a concatenation header
+  unsigned long concatMessages; // long messages delivered after reassembly
+  unsigned long concatDropped;  // incomplete long messages given up
+  unsigned long undecodable;    // stored PDUs that did not parse, left in storage
+};
+
+// Queue statistics per priority
+struct ModemQueueStats {
+  unsigned long served[MODEM_PRIO_COUNT];
+  unsigned long waitMax[MODEM_PRIO_COUNT];   // longest queue wait (ms)
+  unsigned long rejected;                    // pool or queue full
+  unsigned long smsReports;                  // position reports sent as SMS
+  unsigned long smsReportMs;                 // modem time they took
+  volatile unsigned long ringWakes;          // RI pulses that woke the modem task
+};
+
+// Cached network health, refreshed by the modem task
+struct ModemHealth {
+  int8_t rssi;                  // last +CSQ (0-31), -1 unknown
+  float rssiAvg;                // EWMA of valid samples, -1 before the first
+  int8_t regStat;               // last +CREG <stat>, -1 unknown
+  bool registered;              // home (1) or roaming (5)
+  unsigned long sampledAt;      // millis() of the last sample, 0 never
+  unsigned long samples;
+  unsigned long failures;       // AT+CSQ;+CREG? without OK
+  unsigned long changes;        // registration changes seen
+};
+
+extern SMSIntakeStats smsStats;
+extern ModemQueueStats modemStats;
+
+// Setup (before the tasks are created)
+void modemInit();
+// Optional RI line: wakes the modem task as soon as the module signals an SMS or call
+void modemRingBegin(int pin);
+
+// Any task: returns NULL when the pool or the queue is full
+ModemRequest *modemSubmit(ModemRequestType type, ModemPriority priority, const char *number, const char *text);
+// True once the modem task has finished the request. Only then are its
+// fields the submitter's to read; after a timeout just modemRelease() it.
+bool modemWaitDone(ModemRequest *req, uint32_t timeoutMs);
+// Finished and successful
+bool modemWait(ModemRequest *req, uint32_t timeoutMs);
+void modemRelease(ModemRequest *req);
+bool modemPost(ModemRequestType type, ModemPriority priority, const char *number, const char *text);
+
+// Any task: consistent copy of the health cache, fresh while younger than MODEM_HEALTH_TTL
+ModemHealth modemHealth();
+bool modemHealthFresh(const ModemHealth &health);
+// False until bring-up is complete, or when a fresh sample says the modem is not registered
+bool modemGsmUsable();
+// Bring-up timeline, e.g. "AT 0.4s, SIM 1.5s, NET 4.5s, SMS 6.0s (READY)"
+String modemBootTimeline();
+// Sleep summary, e.g. "AT wake, awake 3.2 min last hour (5%), 41 wakeups"
+String modemSleepReport();
+
+// Modem task only
+void modemAttach();
+void modemService(uint32_t idleMs);
+
+#endif
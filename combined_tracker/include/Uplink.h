@@ -0,0 +1,45 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <Arduino.h>
+
+// Position stream to the ground server over one persistent GPRS
+// connection. Any task queues fixes; the modem task sends them.
+// TCP: batched frames, each fix kept until the server's TCP ACK covers
+// it, so a dropped connection resends instead of losing reports.
+// UDP: one sequence-numbered datagram per fix, fire-and-forget; the
+// server measures loss from the sequence and answers an occasional
+// application ACK request so a dead path is noticed.
+
+struct UplinkStats {
+  unsigned long connects;
+  unsigned long failures;     // GPRS bring-up or connect attempts that failed
+  unsigned long drops;        // established connections lost (incl. ACK stalls)
+  unsigned long frames;
+  unsigned long fixesSent;    // resends after a drop included
+  unsigned long fixesAcked;
+  unsigned long resent;
+  unsigned long overflows;    // fixes refused or evicted because the queue was full
+  unsigned long bytesSent;
+  unsigned long bytesAcked;
+  unsigned long ackRequests;  // UDP application ACKs asked for
+  unsigned long ackReplies;
+  unsigned long ackMissed;
+  unsigned long ackRtt;       // ms, last answered request
+  unsigned long modemMs;      // modem time spent sending and polling ACKs
+  uint8_t queued;             // fixes waiting or unacknowledged
+};
+
+// Any task
+bool uplinkEnabled();         // UPLINK_HOST configured
+bool uplinkQueueFix(double lat, double lon, const String &timestamp);
+bool uplinkConnected();
+void uplinkSetUdp(bool udp);  // takes effect on the next modem cycle (reconnects)
+bool uplinkUdp();
+UplinkStats uplinkStats();
+String uplinkStateName();
+
+// Modem task only
+void uplinkService();
+
+#endif
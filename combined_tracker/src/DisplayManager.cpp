@@ -10,6 +10,8 @@ extern struct GPSData {
   bool isValid;
   uint32_t satellites;
   String timestamp;
+  uint32_t epoch;
+  int32_t hdop;
 } currentGPS;
 
 extern struct SystemStatus {
@@ -193,7 +195,12 @@ void showGSMScreen() {
   snprintf(line, sizeof(line), "Status: %s", systemStatus.networkConnected ? "REG" : "NO REG");
   u8g2.drawStr(0, 25, line);
   
-  snprintf(line, sizeof(line), "Signal: %d/31", systemStatus.signalStrength);
+  // Smoothed +CSQ from the modem health cache, -1 until the first sample
+  if (systemStatus.signalStrength >= 0) {
+    snprintf(line, sizeof(line), "Signal: %d/31", systemStatus.signalStrength);
+  } else {
+    snprintf(line, sizeof(line), "Signal: --/31");
+  }
   u8g2.drawStr(0, 35, line);
   
   if (systemStatus.lastSMSTime > 0) {
@@ -0,0 +1,903 @@
+#include "LoRaManager.h"
+#include "Globals.h"
+#include "Config.h"
+#include "Utils.h"
+#include <LoRa.h>
+#include <SPI.h>
+
+LoRaRxStats loraRxStats = {};
+
+// Packet ring, oldest at ringHead; the RX task pushes, the consumer pops
+static LoRaPacket ring[LORA_RX_RING];
+static uint8_t ringHead = 0;
+static uint8_t ringCount = 0;
+static portMUX_TYPE ringMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t rxTask = NULL;
+static TaskHandle_t rxConsumer = NULL;
+
+// Stamped by the ISR, read by the RX task
+static volatile unsigned long edgeAtMs = 0;
+static volatile unsigned long edgeAtUs = 0;
+
+// Transmit queue, oldest at txHead; any task pushes, the RX task pops
+struct TxItem {
+  uint8_t data[LORA_PACKET_MAX];
+  uint8_t length;               // 0: a settings change (sf, power)
+  uint8_t sf;
+  int8_t power;
+  LoRaPriority priority;
+  uint16_t tag;
+  uint32_t airtimeUs;
+  unsigned long queuedAt;
+};
+
+static TxItem txQueue[LORA_TX_QUEUE];
+static uint8_t txHead = 0;
+static uint8_t txCount = 0;
+static LoRaTxEvent txEvents[LORA_TX_EVENTS];
+static uint8_t eventHead = 0;
+static uint8_t eventCount = 0;
+static LoRaTxStats txStats = {};
+static portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Owned by the RX task: the packet in listen-before-talk or on air
+static TxItem txCurrent;
+static bool txPending = false;
+static bool txActive = false;
+static unsigned long txStartedAt = 0;
+static unsigned long backoffUntil = 0;
+static int lbtAttempt = 0;
+static uint8_t chipSf = LORA_SF_DEFAULT;
+static unsigned long edgesSeen = 0;
+
+// loraMutex with its hold time measured: every other radio user waits it out
+static unsigned long heldSince = 0;
+
+static bool radioTake(TickType_t wait) {
+  if (xSemaphoreTake(loraMutex, wait) != pdTRUE) return false;
+  heldSince = micros();
+  return true;
+}
+
+static void radioGive() {
+  unsigned long held = micros() - heldSince;
+  portENTER_CRITICAL(&txMux);
+  txStats.mutexHolds++;
+  txStats.mutexHoldLastUs = held;
+  txStats.mutexHoldTotalUs += held;
+  if (held > txStats.mutexHoldMaxUs) txStats.mutexHoldMaxUs = held;
+  portEXIT_CRITICAL(&txMux);
+  xSemaphoreGive(loraMutex);
+}
+
+// SPI is not usable from an interrupt on the ESP32, so the ISR only
+// timestamps the edge (RX done, or TX done while a transmit is on air)
+// and hands the work to the RX task
+static void IRAM_ATTR onLoRaDio0() {
+  edgeAtMs = millis();
+  edgeAtUs = micros();
+  loraRxStats.interrupts++;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(rxTask, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void loraRxAttach(TaskHandle_t consumer) {
+  rxTask = xTaskGetCurrentTaskHandle();
+  rxConsumer = consumer;
+  pinMode(LORA_DIO0, INPUT);
+  attachInterrupt(digitalPinToInterrupt(LORA_DIO0), onLoRaDio0, RISING);
+
+  if (radioTake(portMAX_DELAY)) {
+    loraRxResume();
+    radioGive();
+  }
+}
+
+void loraRxResume() {
+  // Continuous RX, DIO0 mapped to RX done
+  LoRa.receive();
+}
+
+static void pushPacket(const LoRaPacket &packet) {
+  portENTER_CRITICAL(&ringMux);
+  uint8_t slot;
+  if (ringCount == LORA_RX_RING) {
+    // Consumer is behind: the newest position report matters more
+    slot = ringHead;
+    ringHead = (ringHead + 1) % LORA_RX_RING;
+    loraRxStats.overwritten++;
+  } else {
+    slot = (ringHead + ringCount) % LORA_RX_RING;
+    ringCount++;
+  }
+  memcpy(ring[slot].data, packet.data, packet.length);
+  ring[slot].length = packet.length;
+  ring[slot].rssi = packet.rssi;
+  ring[slot].snr = packet.snr;
+  ring[slot].receivedAt = packet.receivedAt;
+  if (ringCount > loraRxStats.ringHigh) loraRxStats.ringHigh = ringCount;
+  portEXIT_CRITICAL(&ringMux);
+}
+
+bool loraRxPop(LoRaPacket &packet) {
+  portENTER_CRITICAL(&ringMux);
+  if (ringCount == 0) {
+    portEXIT_CRITICAL(&ringMux);
+    return false;
+  }
+  LoRaPacket &slot = ring[ringHead];
+  memcpy(packet.data, slot.data, slot.length);
+  packet.length = slot.length;
+  packet.rssi = slot.rssi;
+  packet.snr = slot.snr;
+  packet.receivedAt = slot.receivedAt;
+  ringHead = (ringHead + 1) % LORA_RX_RING;
+  ringCount--;
+  portEXIT_CRITICAL(&ringMux);
+  return true;
+}
+
+// Settings for packets queued from now on (written by loraTask only); the
+// radio takes a change when it reaches the head of the transmit queue
+static uint8_t radioSf = LORA_SF_DEFAULT;
+static int8_t radioPower = LORA_POWER_MAX;
+
+void loraRadioSet(uint8_t sf, int8_t power) {
+  LoRa.setSpreadingFactor(sf);   // also sets low data rate optimize
+  LoRa.setTxPower(power);
+  radioSf = sf;
+  radioPower = power;
+  chipSf = sf;
+}
+
+// Duty-cycle limits by sub-band (ETSI EN 300 220 / ERC 70-03)
+struct SubBand {
+  uint32_t low;
+  uint32_t high;
+  uint16_t permille;
+  const char *name;
+};
+
+static const SubBand SUB_BANDS[] = {
+  {433050000, 434790000, 100, "433 MHz band"},
+  {863000000, 865000000, 1, "863-865 MHz"},
+  {865000000, 868000000, 10, "865-868 MHz"},
+  {868000000, 868600000, 10, "868.0-868.6 MHz"},
+  {868700000, 869200000, 1, "868.7-869.2 MHz"},
+  {869400000, 869650000, 100, "869.4-869.65 MHz"},
+  {869700000, 870000000, 10, "869.7-870 MHz"},
+};
+#define SUB_BAND_COUNT (sizeof(SUB_BANDS) / sizeof(SUB_BANDS[0]))
+
+// One bucket per sub-band plus one for frequencies outside the table
+static float bucketMs[SUB_BAND_COUNT + 1];
+static unsigned long bucketAt[SUB_BAND_COUNT + 1];
+static int subBand = SUB_BAND_COUNT;
+static uint16_t dutyPermille = 1000;
+static LoRaDutyStats dutyStats = {};
+static portMUX_TYPE dutyMux = portMUX_INITIALIZER_UNLOCKED;
+
+static float dutyCapacity() {
+  return (float)LORA_DUTY_WINDOW * dutyPermille / 1000.0f;
+}
+
+void loraRadioBegin() {
+  LoRa.setSignalBandwidth(LORA_BW);
+  LoRa.setCodingRate4(LORA_CR);
+  LoRa.setPreambleLength(LORA_PREAMBLE);
+  loraRadioSet(LORA_SF_DEFAULT, LORA_POWER_MAX);
+
+  uint32_t freq = (uint32_t)LORA_FREQ;
+  subBand = SUB_BAND_COUNT;
+  dutyPermille = 1000;
+  for (size_t i = 0; i < SUB_BAND_COUNT; i++) {
+    if (freq >= SUB_BANDS[i].low && freq < SUB_BANDS[i].high) {
+      subBand = i;
+      dutyPermille = SUB_BANDS[i].permille;
+    }
+  }
+  if (LORA_DUTY_PERMILLE > 0) dutyPermille = LORA_DUTY_PERMILLE;
+
+  // Buckets start full: the limit is an average over LORA_DUTY_WINDOW
+  for (size_t i = 0; i <= SUB_BAND_COUNT; i++) {
+    bucketMs[i] = dutyCapacity();
+    bucketAt[i] = millis();
+  }
+  dutyStats.limitPermille = dutyPermille;
+  dutyStats.capacityMs = dutyCapacity();
+}
+
+const char *loraSubBandName() {
+  return subBand < (int)SUB_BAND_COUNT ? SUB_BANDS[subBand].name : "outside the duty-cycle table";
+}
+
+// Semtech SX127x time on air (explicit header, payload CRC off as the library leaves it)
+uint32_t loraAirtime(size_t len) {
+  uint32_t bw = (uint32_t)LORA_BW;
+  int sf = radioSf;
+  // Low data rate optimize, decided the way the library does it
+  int de = (1000 / (bw / (1L << sf))) > 16 ? 1 : 0;
+  float symbolUs = (float)(1L << sf) * 1e6f / bw;
+  int numerator = 8 * (int)len - 4 * sf + 28;
+  int denominator = 4 * (sf - 2 * de);
+  int blocks = numerator > 0 ? (numerator + denominator - 1) / denominator : 0;
+  float symbols = (LORA_PREAMBLE + 4.25f) + 8 + blocks * LORA_CR;
+  return (uint32_t)(symbols * symbolUs);
+}
+
+// Caller holds dutyMux
+static void dutyRefill() {
+  unsigned long now = millis();
+  float capacity = dutyCapacity();
+  bucketMs[subBand] += (now - bucketAt[subBand]) * dutyPermille / 1000.0f;
+  if (bucketMs[subBand] > capacity) bucketMs[subBand] = capacity;
+  bucketAt[subBand] = now;
+}
+
+static float dutyNeed(size_t len, LoRaPriority priority) {
+  float need = loraAirtime(len) / 1000.0f;
+  if (priority == LORA_PRIO_REPORT) need += dutyCapacity() * LORA_DUTY_RESERVE / 100.0f;
+  return need;
+}
+
+unsigned long loraDutyWait(size_t len, LoRaPriority priority) {
+  float need = dutyNeed(len, priority);
+  portENTER_CRITICAL(&dutyMux);
+  dutyRefill();
+  float missing = need - bucketMs[subBand];
+  portEXIT_CRITICAL(&dutyMux);
+  if (missing <= 0) return 0;
+  return (unsigned long)(missing * 1000.0f / dutyPermille) + 1;
+}
+
+// A queued packet that never makes it on air gives its airtime back
+static void dutyRefund(uint32_t airtimeUs) {
+  portENTER_CRITICAL(&dutyMux);
+  dutyRefill();
+  bucketMs[subBand] += airtimeUs / 1000.0f;
+  if (bucketMs[subBand] > dutyCapacity()) bucketMs[subBand] = dutyCapacity();
+  portEXIT_CRITICAL(&dutyMux);
+}
+
+// SX127x registers the library keeps private (caller holds loraMutex)
+#define SX_REG_OP_MODE 0x01
+#define SX_REG_IRQ_FLAGS 0x12
+#define SX_REG_MODEM_STAT 0x18
+#define SX_REG_DIO_MAPPING_1 0x40
+#define SX_MODE_LORA_CAD 0x87          // long range mode | CAD
+#define SX_IRQ_TX_DONE 0x08
+#define SX_IRQ_CAD_DONE 0x04
+#define SX_IRQ_CAD_DETECTED 0x01
+#define SX_STAT_RECEIVING 0x0B         // signal detected, synchronized, header valid
+#define SX_DIO0_TX_DONE 0x40
+
+static LoRaLbtStats lbtStats = {};
+static unsigned long lbtMinuteAt = 0;
+static unsigned long lbtMinuteChecks = 0;
+static unsigned long lbtMinuteBusy = 0;
+static portMUX_TYPE lbtMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t sxTransfer(uint8_t address, uint8_t value) {
+  SPI.beginTransaction(SPISettings(LORA_DEFAULT_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+  digitalWrite(LORA_SS, LOW);
+  SPI.transfer(address);
+  uint8_t response = SPI.transfer(value);
+  digitalWrite(LORA_SS, HIGH);
+  SPI.endTransaction();
+  return response;
+}
+
+static uint8_t sxRead(uint8_t reg) {
+  return sxTransfer(reg & 0x7F, 0x00);
+}
+
+static void sxWrite(uint8_t reg, uint8_t value) {
+  sxTransfer(reg | 0x80, value);
+}
+
+// Caller holds loraMutex; the radio is in continuous receive
+static bool channelBusy() {
+  // A packet already being received: a CAD now would abort it
+  if (sxRead(SX_REG_MODEM_STAT) & SX_STAT_RECEIVING) return true;
+
+  // CAD takes about two symbols; DIO0 stays mapped to RX done, so poll the flag
+  unsigned long symbolMs = ((1UL << chipSf) * 1000UL) / (uint32_t)LORA_BW + 1;
+  sxWrite(SX_REG_IRQ_FLAGS, SX_IRQ_CAD_DONE | SX_IRQ_CAD_DETECTED);
+  sxWrite(SX_REG_OP_MODE, SX_MODE_LORA_CAD);
+  unsigned long start = millis();
+  uint8_t flags = 0;
+  while (!(flags & SX_IRQ_CAD_DONE) && millis() - start <= 4 * symbolMs) {
+    delay(1);
+    flags = sxRead(SX_REG_IRQ_FLAGS);
+  }
+  sxWrite(SX_REG_IRQ_FLAGS, SX_IRQ_CAD_DONE | SX_IRQ_CAD_DETECTED);
+  // A CAD that never finished says nothing; count the channel as busy
+  return !(flags & SX_IRQ_CAD_DONE) || (flags & SX_IRQ_CAD_DETECTED);
+}
+
+static void lbtCount(bool busy) {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&lbtMux);
+  if (now - lbtMinuteAt >= 60000) {
+    lbtStats.lastMinuteChecks = lbtMinuteChecks;
+    lbtStats.lastMinuteBusy = lbtMinuteBusy;
+    lbtMinuteChecks = 0;
+    lbtMinuteBusy = 0;
+    lbtMinuteAt = now;
+  }
+  lbtStats.checks++;
+  lbtMinuteChecks++;
+  if (busy) {
+    lbtStats.busy++;
+    lbtMinuteBusy++;
+  }
+  portEXIT_CRITICAL(&lbtMux);
+}
+
+// Random wait after the n-th busy check: window of airtime << n, capped
+static unsigned long lbtBackoff(uint32_t airtimeUs, int attempt) {
+  unsigned long window = (airtimeUs / 1000 + 1) << attempt;
+  if (window > LORA_LBT_BACKOFF_MAX) window = LORA_LBT_BACKOFF_MAX;
+  return random(window / 2, window + 1);
+}
+
+LoRaLbtStats loraLbtStats() {
+  portENTER_CRITICAL(&lbtMux);
+  LoRaLbtStats copy = lbtStats;
+  portEXIT_CRITICAL(&lbtMux);
+  return copy;
+}
+
+LoRaTxResult loraSend(const uint8_t *data, size_t len, LoRaPriority priority, uint16_t tag) {
+  if (len > LORA_PACKET_MAX) len = LORA_PACKET_MAX;   // what the FIFO would have kept
+
+  // Charged now so loraDutyWait() sees it; refunded if the channel never clears
+  uint32_t airtime = loraAirtime(len);
+  float need = dutyNeed(len, priority);
+  bool fits;
+  portENTER_CRITICAL(&dutyMux);
+  dutyRefill();
+  fits = bucketMs[subBand] >= need;
+  if (fits) {
+    bucketMs[subBand] -= airtime / 1000.0f;
+  } else {
+    dutyStats.deferred[priority]++;
+  }
+  portEXIT_CRITICAL(&dutyMux);
+  if (!fits) return LORA_TX_DEFERRED;
+
+  bool queued;
+  portENTER_CRITICAL(&txMux);
+  queued = txCount < LORA_TX_QUEUE;
+  if (queued) {
+    TxItem &item = txQueue[(txHead + txCount) % LORA_TX_QUEUE];
+    memcpy(item.data, data, len);
+    item.length = len;
+    item.priority = priority;
+    item.tag = tag;
+    item.airtimeUs = airtime;
+    item.queuedAt = millis();
+    txCount++;
+    txStats.queued++;
+    if (txCount > txStats.queueHigh) txStats.queueHigh = txCount;
+  } else {
+    txStats.full++;
+  }
+  portEXIT_CRITICAL(&txMux);
+  if (!queued) {
+    dutyRefund(airtime);
+    return LORA_TX_BUSY;
+  }
+
+  if (rxTask != NULL) xTaskNotifyGive(rxTask);
+  return LORA_TX_SENT;
+}
+
+static bool txPop(TxItem &item) {
+  portENTER_CRITICAL(&txMux);
+  if (txCount == 0) {
+    portEXIT_CRITICAL(&txMux);
+    return false;
+  }
+  TxItem &slot = txQueue[txHead];
+  item.length = slot.length;
+  memcpy(item.data, slot.data, slot.length);
+  item.sf = slot.sf;
+  item.power = slot.power;
+  item.priority = slot.priority;
+  item.tag = slot.tag;
+  item.airtimeUs = slot.airtimeUs;
+  item.queuedAt = slot.queuedAt;
+  txHead = (txHead + 1) % LORA_TX_QUEUE;
+  txCount--;
+  portEXIT_CRITICAL(&txMux);
+  return true;
+}
+
+// RX task: txCurrent is done, tell the consumer how it went
+static void txFinish(LoRaTxResult result) {
+  LoRaTxEvent event;
+  event.priority = txCurrent.priority;
+  event.tag = txCurrent.tag;
+  event.result = result;
+  event.airtimeUs = txCurrent.airtimeUs;
+  event.latencyMs = millis() - txCurrent.queuedAt;
+
+  portENTER_CRITICAL(&txMux);
+  if (eventCount == LORA_TX_EVENTS) {
+    eventHead = (eventHead + 1) % LORA_TX_EVENTS;
+    eventCount--;
+  }
+  txEvents[(eventHead + eventCount) % LORA_TX_EVENTS] = event;
+  eventCount++;
+  if (result == LORA_TX_SENT) {
+    txStats.done++;
+    if (event.latencyMs > txStats.latencyMaxMs) txStats.latencyMaxMs = event.latencyMs;
+  }
+  portEXIT_CRITICAL(&txMux);
+
+  txPending = false;
+  lbtAttempt = 0;
+  if (rxConsumer != NULL) xTaskNotifyGive(rxConsumer);
+}
+
+// RX task, no transmit on air: start the next queued packet, listening first
+static void txStart() {
+  while (true) {
+    if (!txPending) {
+      if (!txPop(txCurrent)) return;
+      txPending = true;
+      backoffUntil = millis();
+    }
+    if ((long)(millis() - backoffUntil) < 0) return;
+    if (!radioTake(portMAX_DELAY)) return;
+
+    if (txCurrent.length == 0) {
+      // Settings change, in order with the packets queued around it
+      LoRa.setSpreadingFactor(txCurrent.sf);
+      LoRa.setTxPower(txCurrent.power);
+      chipSf = txCurrent.sf;
+      loraRxResume();
+      radioGive();
+      txPending = false;
+      continue;
+    }
+
+    if (LORA_LBT) {
+      bool busy = channelBusy();
+      lbtCount(busy);
+      if (busy) {
+        // Back to receive for the backoff: the traffic may well be for us
+        loraRxResume();
+        radioGive();
+        if (++lbtAttempt >= LORA_LBT_TRIES) {
+          portENTER_CRITICAL(&lbtMux);
+          lbtStats.gaveUp++;
+          portEXIT_CRITICAL(&lbtMux);
+          dutyRefund(txCurrent.airtimeUs);
+          txFinish(LORA_TX_CHANNEL);
+          continue;
+        }
+        unsigned long wait = lbtBackoff(txCurrent.airtimeUs, lbtAttempt - 1);
+        portENTER_CRITICAL(&lbtMux);
+        lbtStats.backoffs++;
+        lbtStats.backoffMs += wait;
+        portEXIT_CRITICAL(&lbtMux);
+        backoffUntil = millis() + wait;
+        return;
+      }
+    }
+
+    // DIO0 to TX done for this packet; loraRxResume() maps it back to RX done
+    sxWrite(SX_REG_DIO_MAPPING_1, SX_DIO0_TX_DONE);
+    LoRa.beginPacket();
+    LoRa.write(txCurrent.data, txCurrent.length);
+    LoRa.endPacket(true);
+    radioGive();
+    txActive = true;
+    txStartedAt = millis();
+
+    portENTER_CRITICAL(&dutyMux);
+    dutyStats.sent[txCurrent.priority]++;
+    dutyStats.airtimeLastUs = txCurrent.airtimeUs;
+    dutyStats.airtimeMs += txCurrent.airtimeUs / 1000;
+    portEXIT_CRITICAL(&dutyMux);
+    return;
+  }
+}
+
+// How long the RX task may sleep before it has transmit work
+static TickType_t serviceWait() {
+  long left;
+  if (txActive) {
+    left = (long)(txStartedAt + txCurrent.airtimeUs / 1000 + LORA_TX_OVERDUE - millis());
+  } else if (txPending) {
+    left = (long)(backoffUntil - millis());
+  } else {
+    portENTER_CRITICAL(&txMux);
+    bool queued = txCount > 0;
+    portEXIT_CRITICAL(&txMux);
+    return queued ? 0 : portMAX_DELAY;
+  }
+  return left > 0 ? pdMS_TO_TICKS(left) : 0;
+}
+
+void loraRxService() {
+  static LoRaPacket packet;
+
+  ulTaskNotifyTake(pdTRUE, serviceWait());
+  // Notifications also come from loraSend(); the ISR's counter says how many edges
+  unsigned long interrupts = loraRxStats.interrupts;
+  uint32_t edges = interrupts - edgesSeen;
+  edgesSeen = interrupts;
+  unsigned long atMs = edgeAtMs;
+  unsigned long atUs = edgeAtUs;
+
+  if (txActive) {
+    bool overdue = (long)(millis() - txStartedAt) >= (long)(txCurrent.airtimeUs / 1000 + LORA_TX_OVERDUE);
+    if (edges == 0 && !overdue) return;
+    if (!radioTake(portMAX_DELAY)) return;
+    bool done = (sxRead(SX_REG_IRQ_FLAGS) & SX_IRQ_TX_DONE) != 0;
+    if (done || overdue) {
+      sxWrite(SX_REG_IRQ_FLAGS, SX_IRQ_TX_DONE);
+      loraRxResume();
+      txActive = false;
+    }
+    radioGive();
+    if (txActive) return;
+    if (!done) {
+      portENTER_CRITICAL(&txMux);
+      txStats.overdue++;
+      portEXIT_CRITICAL(&txMux);
+    }
+    txFinish(LORA_TX_SENT);
+    txStart();
+    return;
+  }
+
+  if (edges > 0) {
+    if (!radioTake(portMAX_DELAY)) return;
+    int size = LoRa.parsePacket();
+    if (size > 0) {
+      int length = 0;
+      while (LoRa.available() && length < LORA_PACKET_MAX) {
+        packet.data[length++] = (uint8_t)LoRa.read();
+      }
+      packet.length = length;
+      packet.rssi = LoRa.packetRssi();
+      packet.snr = LoRa.packetSnr();
+      packet.receivedAt = atMs;
+    }
+    // parsePacket() leaves the radio idle (or in single RX); re-arm DIO0
+    loraRxResume();
+    radioGive();
+
+    if (size <= 0) {
+      loraRxStats.empty++;
+    } else {
+      pushPacket(packet);
+      loraRxStats.packets++;
+      if (edges > 1) loraRxStats.missed += edges - 1;
+      loraRxStats.copyLast = micros() - atUs;
+      if (loraRxStats.copyLast > loraRxStats.copyMax) loraRxStats.copyMax = loraRxStats.copyLast;
+      if (rxConsumer != NULL) xTaskNotifyGive(rxConsumer);
+    }
+  }
+
+  txStart();
+}
+
+bool loraTxPop(LoRaTxEvent &event) {
+  portENTER_CRITICAL(&txMux);
+  if (eventCount == 0) {
+    portEXIT_CRITICAL(&txMux);
+    return false;
+  }
+  event = txEvents[eventHead];
+  eventHead = (eventHead + 1) % LORA_TX_EVENTS;
+  eventCount--;
+  portEXIT_CRITICAL(&txMux);
+  return true;
+}
+
+LoRaTxStats loraTxStats() {
+  portENTER_CRITICAL(&txMux);
+  LoRaTxStats copy = txStats;
+  portEXIT_CRITICAL(&txMux);
+  return copy;
+}
+
+void loraDutyDropped(LoRaPriority priority) {
+  portENTER_CRITICAL(&dutyMux);
+  dutyStats.dropped[priority]++;
+  portEXIT_CRITICAL(&dutyMux);
+}
+
+LoRaDutyStats loraDutyStats() {
+  portENTER_CRITICAL(&dutyMux);
+  dutyRefill();
+  LoRaDutyStats copy = dutyStats;
+  copy.tokensMs = bucketMs[subBand];
+  portEXIT_CRITICAL(&dutyMux);
+  return copy;
+}
+
+uint8_t loraSf() {
+  return radioSf;
+}
+
+int8_t loraPower() {
+  return radioPower;
+}
+
+// Adaptive data rate state; the peer table is read by the BT task
+static LoRaAdrPeer peers[LORA_ADR_PEERS];
+static int peerCount = 0;
+static LoRaAdrStats adrStats = {};
+static portMUX_TYPE adrMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Tracker side
+static unsigned long downlinkAt = 0;   // last ACK or assignment from the station
+static int ackMisses = 0;
+
+// SX127x demodulation floor (SNR, dB) for SF7..SF12
+static float snrFloor(uint8_t sf) {
+  return -7.5f - 2.5f * (sf - 7);
+}
+
+LoRaAdrStats loraAdrStats() {
+  portENTER_CRITICAL(&adrMux);
+  LoRaAdrStats copy = adrStats;
+  portEXIT_CRITICAL(&adrMux);
+  return copy;
+}
+
+int loraAdrPeers(LoRaAdrPeer *out, int max) {
+  portENTER_CRITICAL(&adrMux);
+  int n = peerCount < max ? peerCount : max;
+  memcpy(out, peers, n * sizeof(LoRaAdrPeer));
+  portEXIT_CRITICAL(&adrMux);
+  return n;
+}
+
+// Queued behind what was sent on the old settings (a confirmation, above all)
+static void switchRadio(uint8_t sf, int8_t power) {
+  if (sf == radioSf && power == radioPower) return;
+  bool queued;
+  portENTER_CRITICAL(&txMux);
+  queued = txCount < LORA_TX_QUEUE;
+  if (queued) {
+    TxItem &item = txQueue[(txHead + txCount) % LORA_TX_QUEUE];
+    item.length = 0;
+    item.sf = sf;
+    item.power = power;
+    txCount++;
+  }
+  portEXIT_CRITICAL(&txMux);
+  if (!queued) return;
+  if (rxTask != NULL) xTaskNotifyGive(rxTask);
+
+  portENTER_CRITICAL(&adrMux);
+  if (sf != radioSf) adrStats.sfChanges++;
+  if (power != radioPower) adrStats.powerChanges++;
+  portEXIT_CRITICAL(&adrMux);
+  radioSf = sf;
+  radioPower = power;
+}
+
+// Lowest SF and power that keep the margin: weak links get power first, then
+// SF; strong links give up SF first (airtime), then power
+static void adrNeed(LoRaAdrPeer &peer) {
+  int sf = peer.sf;
+  int power = peer.power;
+  float surplus = peer.margin - LORA_ADR_MARGIN;
+  if (surplus < 0) {
+    int steps = (int)ceilf(-surplus / LORA_ADR_STEP);
+    while (steps > 0 && power < LORA_POWER_MAX) {
+      power = min(power + LORA_ADR_STEP, LORA_POWER_MAX);
+      steps--;
+    }
+    while (steps > 0 && sf < LORA_SF_MAX) {
+      sf++;
+      steps--;
+    }
+  } else if (surplus >= LORA_ADR_HYSTERESIS && peer.samples >= LORA_ADR_SAMPLES) {
+    int steps = (int)(surplus / LORA_ADR_STEP);
+    while (steps > 0 && sf > LORA_SF_MIN) {
+      sf--;
+      steps--;
+    }
+    while (steps > 0 && power > LORA_POWER_MIN) {
+      power = max(power - LORA_ADR_STEP, LORA_POWER_MIN);
+      steps--;
+    }
+  }
+  peer.needSf = sf;
+  peer.needPower = power;
+}
+
+bool loraAdrObserve(const char *id, float snr, LinkCommand &cmd) {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&adrMux);
+  int slot = -1;
+  for (int i = 0; i < peerCount; i++) {
+    if (strncmp(peers[i].id, id, POS_ID_LEN) == 0) slot = i;
+  }
+  if (slot < 0) {
+    if (peerCount < LORA_ADR_PEERS) {
+      slot = peerCount++;
+    } else {
+      // Table full: reuse the tracker heard least recently
+      slot = 0;
+      for (int i = 1; i < peerCount; i++) {
+        if (peers[i].heardAt < peers[slot].heardAt) slot = i;
+      }
+    }
+    LoRaAdrPeer &fresh = peers[slot];
+    memset(&fresh, 0, sizeof(fresh));
+    strncpy(fresh.id, id, POS_ID_LEN);
+    fresh.snrAvg = snr;
+    fresh.sf = radioSf;
+    fresh.power = LORA_POWER_MAX;   // unknown trackers are assumed at the defaults
+  }
+
+  LoRaAdrPeer &peer = peers[slot];
+  if (peer.samples > 0) peer.snrAvg += (snr - peer.snrAvg) / LORA_ADR_EWMA;
+  peer.samples++;
+  peer.heardAt = now;
+  peer.margin = peer.snrAvg - snrFloor(peer.sf);
+  adrNeed(peer);
+
+  // The link runs at the SF the weakest active tracker needs
+  uint8_t linkSf = LORA_SF_MIN;
+  for (int i = 0; i < peerCount; i++) {
+    if (now - peers[i].heardAt < LORA_ADR_SILENCE && peers[i].needSf > linkSf) linkSf = peers[i].needSf;
+  }
+
+  bool changed = (linkSf != peer.sf || peer.needPower != peer.power);
+  bool fresh = (linkSf != peer.sentSf || peer.needPower != peer.sentPower);
+  if (fresh) peer.tries = 0;
+  // A change is retried on the next few reports; a tracker that never
+  // confirms (no ADR) only gets the periodic refresh
+  bool due = peer.commandAt == 0 || now - peer.commandAt >= LORA_ADR_REFRESH;
+  bool send = due || (changed && peer.tries < LORA_ADR_FALLBACK);
+  if (send) {
+    memset(&cmd, 0, sizeof(cmd));
+    strncpy(cmd.id, peer.id, POS_ID_LEN);
+    cmd.sf = linkSf;
+    cmd.power = peer.needPower;
+    peer.sentSf = linkSf;
+    peer.sentPower = peer.needPower;
+    if (changed) peer.tries++;
+    peer.commandAt = now;
+    adrStats.commands++;
+  }
+  portEXIT_CRITICAL(&adrMux);
+
+  if (send && changed && fresh) {
+    logToBoth("[ADR] " + String(id) + ": margin " + String(peer.margin, 1) + " dB, SF" + String(peer.sf) + " " +
+              String(peer.power) + " dBm -> SF" + String(cmd.sf) + " " + String(cmd.power) + " dBm");
+  }
+  return send;
+}
+
+void loraAdrConfirmed(const LinkCommand &cmd) {
+  unsigned long now = millis();
+  bool allThere = true;
+  bool known = false;
+  portENTER_CRITICAL(&adrMux);
+  for (int i = 0; i < peerCount; i++) {
+    LoRaAdrPeer &peer = peers[i];
+    if (strncmp(peer.id, cmd.id, POS_ID_LEN) == 0) {
+      known = true;
+      if (cmd.sf != peer.sf || cmd.power != peer.power) {
+        // A power step moves the received SNR by the same amount
+        peer.snrAvg += cmd.power - peer.power;
+        peer.sf = cmd.sf;
+        peer.power = cmd.power;
+        peer.samples = 0;
+      }
+      peer.tries = 0;
+      peer.heardAt = now;
+    }
+    if (now - peer.heardAt < LORA_ADR_SILENCE && peer.sf != cmd.sf) allThere = false;
+  }
+  if (known) adrStats.confirms++;
+  portEXIT_CRITICAL(&adrMux);
+
+  // Trackers switch right after confirming; follow once none is left behind
+  if (known && allThere && cmd.sf != radioSf) {
+    logToBoth("[ADR] Link now SF" + String(cmd.sf));
+    switchRadio(cmd.sf, radioPower);
+  }
+}
+
+void loraAdrAssign(const LinkCommand &cmd) {
+  if (cmd.sf < LORA_SF_MIN || cmd.sf > LORA_SF_MAX || cmd.power < LORA_POWER_MIN || cmd.power > LORA_POWER_MAX) return;
+  downlinkAt = millis();
+  ackMisses = 0;
+
+  // Confirm on the old settings, the station switches when it hears this
+  LinkCommand reply = cmd;
+  reply.flags = LINK_FLAG_CONFIRM;
+  uint8_t frame[LINK_FRAME_LEN];
+  size_t len = linkEncode(reply, frame, sizeof(frame));
+  if (loraSend(frame, len, LORA_PRIO_CONTROL) != LORA_TX_SENT) return;
+
+  portENTER_CRITICAL(&adrMux);
+  adrStats.confirms++;
+  portEXIT_CRITICAL(&adrMux);
+  if (cmd.sf != radioSf || cmd.power != radioPower) {
+    logToBoth("[ADR] Station assigned SF" + String(cmd.sf) + " " + String(cmd.power) + " dBm");
+    switchRadio(cmd.sf, cmd.power);
+  }
+}
+
+static void fallBack(const char *why) {
+  logToBoth("[ADR] " + String(why) + " - back to SF" + String(LORA_SF_DEFAULT) + " " + String(LORA_POWER_MAX) + " dBm");
+  portENTER_CRITICAL(&adrMux);
+  adrStats.fallbacks++;
+  for (int i = 0; i < peerCount; i++) {
+    peers[i].sf = LORA_SF_DEFAULT;
+    peers[i].power = LORA_POWER_MAX;
+    peers[i].samples = 0;
+  }
+  portEXIT_CRITICAL(&adrMux);
+  switchRadio(LORA_SF_DEFAULT, LORA_POWER_MAX);
+}
+
+static bool atDefaults() {
+  return radioSf == LORA_SF_DEFAULT && radioPower == LORA_POWER_MAX;
+}
+
+void loraAdrReport(bool acked) {
+  if (acked) {
+    downlinkAt = millis();
+    ackMisses = 0;
+    return;
+  }
+  ackMisses++;
+  if (ackMisses >= LORA_ADR_FALLBACK && !atDefaults()) {
+    ackMisses = 0;
+    fallBack("ACKs missed");
+  }
+}
+
+void loraAdrPoll(bool station) {
+  static int role = -1;
+  unsigned long now = millis();
+
+  // Tracker and station settings do not carry over a mode switch
+  if (role != (int)station) {
+    if (role != -1 && !atDefaults()) fallBack("Role changed");
+    portENTER_CRITICAL(&adrMux);
+    peerCount = 0;
+    portEXIT_CRITICAL(&adrMux);
+    role = station;
+    downlinkAt = now;
+    ackMisses = 0;
+  }
+
+  if (!station) {
+    if (!atDefaults() && now - downlinkAt >= LORA_ADR_SILENCE) {
+      downlinkAt = now;
+      fallBack("Station silent");
+    }
+    return;
+  }
+
+  // A tracker gone quiet may have lost the link; everyone meets again at the defaults
+  bool expired = false;
+  portENTER_CRITICAL(&adrMux);
+  for (int i = 0; i < peerCount; i++) {
+    if (now - peers[i].heardAt >= LORA_ADR_SILENCE) {
+      peers[i] = peers[--peerCount];
+      i--;
+      expired = true;
+    }
+  }
+  portEXIT_CRITICAL(&adrMux);
+  if (expired && radioSf != LORA_SF_DEFAULT) fallBack("Tracker silent");
+}
@@ -0,0 +1,154 @@
+#include "LoRaRelay.h"
+#include "LoRaTdma.h"
+#include "Config.h"
+
+#define RELAY_MEMORY_SLOTS 16   // frames recently forwarded or queued
+
+struct RelaySeen {
+  char id[POS_ID_LEN + 1];
+  uint16_t seq;
+  bool isAck;
+  unsigned long at;
+};
+
+static RelayFrame queue[RELAY_QUEUE];
+static RelaySeen seen[RELAY_MEMORY_SLOTS];
+static uint8_t seenNext = 0;
+
+static unsigned long windowStart = 0;
+static unsigned long windowAirtime = 0;   // us
+static uint8_t lastLoad = 0;
+
+static RelayStats stats = {};
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void count(unsigned long &counter) {
+  portENTER_CRITICAL(&statsMux);
+  counter++;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+// Roll the load window; returns the share (%) of it spent forwarding so far
+static uint8_t load() {
+  unsigned long now = millis();
+  if (now - windowStart >= LORA_RELAY_WINDOW) {
+    lastLoad = windowAirtime / 10 / LORA_RELAY_WINDOW;
+    windowStart = now;
+    windowAirtime = 0;
+  }
+  uint8_t current = windowAirtime / 10 / LORA_RELAY_WINDOW;
+  uint8_t shown = current > lastLoad ? current : lastLoad;
+  portENTER_CRITICAL(&statsMux);
+  stats.loadPercent = shown;
+  portEXIT_CRITICAL(&statsMux);
+  return current;
+}
+
+static RelaySeen *findSeen(const char *id, uint16_t seq, bool isAck) {
+  unsigned long now = millis();
+  for (int i = 0; i < RELAY_MEMORY_SLOTS; i++) {
+    RelaySeen &s = seen[i];
+    if (s.at != 0 && now - s.at < LORA_RELAY_MEMORY && s.seq == seq && s.isAck == isAck &&
+        strncmp(s.id, id, POS_ID_LEN) == 0) {
+      return &s;
+    }
+  }
+  return NULL;
+}
+
+bool relayOffer(const uint8_t *frame, size_t len, const char *id, uint16_t seq, bool isAck, const RelayHeader *hdr) {
+  count(stats.heard);
+  uint8_t ttl = hdr != NULL ? hdr->ttl : LORA_RELAY_HOPS;
+  if (ttl == 0) {
+    count(stats.expired);
+    return false;
+  }
+  if (findSeen(id, seq, isAck) != NULL) {
+    count(stats.duplicates);
+    return false;
+  }
+  if (RELAY_HEADER_LEN + len > TRACK_FRAME_MAX) {
+    count(stats.tooLong);
+    return false;
+  }
+  if (load() >= LORA_RELAY_LOAD) {
+    count(stats.capped);
+    return false;
+  }
+
+  RelayFrame *slot = NULL;
+  for (int i = 0; i < RELAY_QUEUE; i++) {
+    if (!queue[i].used) {
+      slot = &queue[i];
+      break;
+    }
+  }
+  if (slot == NULL) {
+    count(stats.capped);
+    return false;
+  }
+
+  RelayHeader out = {};
+  out.ttl = ttl - 1;
+  out.hops = (hdr != NULL ? hdr->hops : 0) + 1;
+  if (tdmaSynced()) out.flags |= RELAY_FLAG_SLOTTED;
+  strncpy(out.relay, SOLDIER_ID, POS_ID_LEN);
+  slot->length = relayEncode(out, frame, len, slot->data, sizeof(slot->data));
+  memset(slot->id, 0, sizeof(slot->id));
+  strncpy(slot->id, id, POS_ID_LEN);
+  slot->seq = seq;
+  slot->isAck = isAck;
+  slot->dueAt = millis() + random(LORA_RELAY_JITTER);
+  slot->used = true;
+
+  // Remembered from now, so copies from other relays during the jitter are dropped
+  RelaySeen &s = seen[seenNext];
+  seenNext = (seenNext + 1) % RELAY_MEMORY_SLOTS;
+  memset(s.id, 0, sizeof(s.id));
+  strncpy(s.id, id, POS_ID_LEN);
+  s.seq = seq;
+  s.isAck = isAck;
+  s.at = millis();
+  return true;
+}
+
+void relayCancel(const char *id, uint16_t seq, uint8_t mask) {
+  for (int i = 0; i < RELAY_QUEUE; i++) {
+    RelayFrame &f = queue[i];
+    if (!f.used || f.isAck || strncmp(f.id, id, POS_ID_LEN) != 0) continue;
+    uint16_t behind = seq - f.seq;
+    if (behind == 0 || (behind <= 8 && (mask & (1 << (behind - 1))))) {
+      f.used = false;
+      count(stats.cancelled);
+    }
+  }
+}
+
+RelayFrame *relayDue() {
+  unsigned long now = millis();
+  RelayFrame *due = NULL;
+  for (int i = 0; i < RELAY_QUEUE; i++) {
+    RelayFrame &f = queue[i];
+    if (!f.used || (long)(now - f.dueAt) < 0) continue;
+    if (due == NULL || (long)(f.dueAt - due->dueAt) < 0) due = &f;
+  }
+  load();
+  return due;
+}
+
+void relaySent(RelayFrame *frame, uint32_t airtimeUs) {
+  frame->used = false;
+  load();
+  windowAirtime += airtimeUs;
+  portENTER_CRITICAL(&statsMux);
+  stats.forwarded++;
+  stats.airtimeMs += airtimeUs / 1000;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+RelayStats relayStats() {
+  portENTER_CRITICAL(&statsMux);
+  RelayStats copy = stats;
+  portEXIT_CRITICAL(&statsMux);
+  return copy;
+}
@@ -4,15 +4,42 @@
 #include "Utils.h"
 #include "DisplayManager.h"
 #include "KeyboardManager.h"
-#include <LoRa.h>
+#include "ModemManager.h"
+#include "Uplink.h"
+#include "LoRaManager.h"
+#include "LoRaArq.h"
+#include "LoRaTdma.h"
+#include "ReportDedup.h"
+#include "LoRaRelay.h"
+#include "PositionFrame.h"
 
 TaskHandle_t gpsTaskHandle = NULL;
 TaskHandle_t loraTaskHandle = NULL;
-TaskHandle_t smsTaskHandle = NULL;
+TaskHandle_t loraRxTaskHandle = NULL;
+TaskHandle_t modemTaskHandle = NULL;
 TaskHandle_t bluetoothTaskHandle = NULL;
 TaskHandle_t displayTaskHandle = NULL;
 TaskHandle_t keyboardTaskHandle = NULL;
 
+// Time-to-first-report after power-on (ms), the field bring-up metric
+static unsigned long firstReportAt = 0;
+
+// Binary position frames received (ground station)
+static unsigned long framesDecoded = 0;
+static unsigned long framesRejected = 0;
+static unsigned long framesRelayed = 0;
+static uint8_t relayHopsMax = 0;
+
+// BT "gpsraw" window. gpsTask is the only reader of SerialGPS, so it copies
+// the bytes to BT itself rather than the BT task competing for them.
+static volatile unsigned long gpsRawUntil = 0;
+
+static int gpsRead() {
+  int c = SerialGPS.read();
+  if (c >= 0 && gpsRawUntil != 0 && (long)(gpsRawUntil - millis()) > 0) BT.write((uint8_t)c);
+  return c;
+}
+
 void gpsTask(void *parameter) {
   logToBoth("[GPS Task] Started");
   
@@ -28,20 +55,29 @@ void gpsTask(void *parameter) {
         currentGPS.isValid = false;
         currentGPS.satellites = 0;
         currentGPS.timestamp = "";
+        currentGPS.epoch = 0;
+        currentGPS.hdop = -1;
         xSemaphoreGive(gpsMutex);
       }
       
       // Suspend task to save resources
       vTaskDelay(pdMS_TO_TICKS(1000)); // Check mode every second
+      while (SerialGPS.available()) {
+        gpsRead();
+      }
       continue;
     }
     
     // Only parse GPS in TRACKER mode
     if (currentMode == MODE_TRACKER) {
+      // Sleep until a complete NMEA sentence is buffered ('\n' pattern event)
+      SerialGPS.waitLine(GPS_UPDATE_INTERVAL);
       while (SerialGPS.available()) {
-        char c = SerialGPS.read();
+        char c = gpsRead();
         gps.encode(c);
       }
+      // Read before the timestamp below clears it
+      bool timeUpdated = gps.time.isUpdated();
       
       if (xSemaphoreTake(gpsMutex, portMAX_DELAY) == pdTRUE) {
         currentGPS.latitude = gps.location.lat();
@@ -49,8 +85,13 @@ void gpsTask(void *parameter) {
         currentGPS.isValid = gps.location.isValid();
         currentGPS.satellites = gps.satellites.value();
         currentGPS.timestamp = formatGpsTimestamp(gps.date, gps.time);
+        currentGPS.epoch = gpsEpoch(gps.date, gps.time);
+        currentGPS.hdop = gps.hdop.isValid() ? gps.hdop.value() : -1;
         xSemaphoreGive(gpsMutex);
         
+        // TDMA slots run on GPS time, taken when the sentence was committed
+        if (timeUpdated) tdmaSync(currentGPS.epoch, gps.time.centisecond(), millis() - gps.time.age());
+        
         // Debug GPS status every 10 seconds
         if (millis() - lastDebugTime > 10000) {
           lastDebugTime = millis();
@@ -67,267 +108,430 @@ void gpsTask(void *parameter) {
     } else {
       // In GROUND mode, just clear the serial buffer to prevent overflow
       while (SerialGPS.available()) {
-        SerialGPS.read();
+        gpsRead();
+      }
+      vTaskDelay(pdMS_TO_TICKS(GPS_UPDATE_INTERVAL));
+    }
+  }
+}
+
+// ACK mode: a report LoRa could not deliver goes out by SMS instead
+// (queued to the modem task, LoRa keeps running)
+static void gsmFallback(const String &payload) {
+  // Transport choice reads the cached health, no modem round trip here
+  if (uplinkConnected()) {
+    logToBoth("[GSM TX] Report already on the GPRS uplink - SMS fallback skipped");
+  } else if (!modemGsmUsable()) {
+    logToBoth("[GSM TX] Not registered - fallback skipped");
+  } else {
+    logToBoth("[GSM TX] Fallback sending");
+    if (!modemPost(MODEM_REQ_SMS_ALL, MODEM_PRIO_REPORT, NULL, payload.c_str())) {
+      logToBoth("[GSM TX] Modem queue full - report dropped");
+    }
+  }
+}
+
+// Hand one report frame (a single fix or a track) to the ARQ window. The SMS
+// copy and the ACK-mode fallback carry the newest fix
+static void queueReport(const uint8_t *frame, size_t frameLen, const PositionFix *fixes, int count) {
+  const PositionFix &last = fixes[count - 1];
+  String payload = createPayload(last);
+  arqQueue(frame, frameLen, fixes[0].seq, acknowledgmentEnabled, payload);
+  
+  // Send via LoRa
+  logToBoth("[LoRa TX] Sending GPS" + (count > 1 ? " track (" + String(count) + " fixes)" : String("")));
+  if (BT.hasClient()) {
+    BT.println("\n📡 LORA TRANSMIT PACKET");
+    BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+    if (frame[0] == (TRACK_FRAME_MAGIC | TRACK_FRAME_VERSION)) {
+      BT.println("Type: GPS Track, " + String(count) + " fixes #" + String(fixes[0].seq) + "-" + String(last.seq) +
+                 " (binary v" + String(TRACK_FRAME_VERSION) + ")");
+    } else {
+      BT.println("Type: GPS Location (binary v" + String(POS_FRAME_VERSION) + ")");
+    }
+    BT.println("Size: " + String(frameLen) + " bytes, " + String(loraAirtime(frameLen) / 1000.0, 1) + " ms on air");
+    BT.println("Frequency: 433 MHz, SF" + String(loraSf()) + ", " + String(loraPower()) + " dBm");
+    BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+    BT.println("Payload:");
+    BT.println(positionJson(last, DEVICE_TYPE, "LoRa"));
+    BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+  }
+  
+  if (!acknowledgmentEnabled) {
+    // Send via GSM simultaneously (no ACK mode)
+    if (BT.hasClient()) {
+      BT.println("[Mode] No ACK - sending GSM simultaneously");
+    }
+    if (uplinkConnected()) {
+      // The batched GPRS frame replaces one SMS per fix
+      if (BT.hasClient()) {
+        BT.println("[GSM TX] On the GPRS uplink - SMS copy skipped");
+      }
+    } else if (!modemGsmUsable()) {
+      logToBoth("[GSM TX] Not registered - GSM copy skipped");
+    } else {
+      logToBoth("[GSM TX] Sending GPS");
+      if (!modemPost(MODEM_REQ_SMS_ALL, MODEM_PRIO_REPORT, NULL, payload.c_str())) {
+        logToBoth("[GSM TX] Modem queue full - report dropped");
       }
     }
-    
-    vTaskDelay(pdMS_TO_TICKS(GPS_UPDATE_INTERVAL));
   }
 }
 
 void loraTask(void *parameter) {
   logToBoth("[LoRa Task] Started");
   
-  static bool waitingForAck = false;
-  static unsigned long ackWaitStart = 0;
-  static String lastSentPayload = "";
-  
-  // Keep LoRa in receive mode
-  LoRa.idle();
-  LoRa.receive();
+  // Reports held by the duty-cycle budget are logged once
+  static bool deferLogged = false;
   
   while (true) {
-    // Use timeout instead of blocking forever to ensure frequent checks
-    if (xSemaphoreTake(loraMutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-      // Receive LoRa packets
-      int packetSize = LoRa.parsePacket();
-      if (packetSize) {
-        if (BT.hasClient()) {
-          BT.println("[LoRa RX] Packet detected, size: " + String(packetSize));
-        }
-        
-        String incoming = "";
-        while (LoRa.available()) {
-          incoming += (char)LoRa.read();
+    // Sleeps until the LoRa RX task hands over a packet; the timeout only
+    // drives the ACK and send timers below, the radio is never polled
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LORA_UPDATE_INTERVAL));
+    
+    // Transmits finished by the LoRa RX task
+    LoRaTxEvent done;
+    while (loraTxPop(done)) {
+      if (done.result == LORA_TX_CHANNEL) {
+        logToBoth("[LoRa TX] Channel busy - " +
+                  (done.priority == LORA_PRIO_REPORT ? "#" + String(done.tag) + " left to the ARQ timer" : String("packet dropped")));
+      } else if (done.priority == LORA_PRIO_REPORT && BT.hasClient()) {
+        BT.println("[LoRa TX] ✓ Transmission complete (#" + String(done.tag) + ", " + String(done.latencyMs) + " ms)");
+      }
+    }
+    
+    static LoRaPacket packet;
+    while (loraRxPop(packet)) {
+      if (BT.hasClient()) {
+        BT.println("[LoRa RX] Packet detected, size: " + String(packet.length));
+      }
+      
+      // A relayed frame is unwrapped and handled like a direct one, keeping its path
+      RelayHeader hop = {};
+      size_t airLength = packet.length;
+      PosDecodeResult envelope = relayDecode(packet.data, packet.length, hop);
+      bool relayed = envelope == POS_OK;
+      if (relayed) {
+        packet.length -= RELAY_HEADER_LEN;
+        memmove(packet.data, &packet.data[RELAY_HEADER_LEN], packet.length);
+      } else if (envelope != POS_NOT_FRAME) {
+        framesRejected++;
+        logToBoth("[LoRa RX] Relay envelope rejected");
+        continue;
+      }
+      
+      // Position reports arrive as binary frames (one fix, or a track of several);
+      // anything else is text (ACKs, messages)
+      static PositionFix track[TRACK_FIXES_MAX];
+      int trackCount = 0;
+      PositionFix &fix = track[0];
+      LinkCommand link;
+      AckFrame ackFrame;
+      bool duplicate = false;
+      PosDecodeResult decoded = positionDecode(packet.data, packet.length, fix);
+      if (decoded == POS_OK) {
+        trackCount = 1;
+      } else if (decoded == POS_NOT_FRAME) {
+        PosDecodeResult asTrack = trackDecode(packet.data, packet.length, track, TRACK_FIXES_MAX, trackCount);
+        if (asTrack != POS_NOT_FRAME) decoded = asTrack;
+      }
+      String incoming = "";
+      String summary;
+      if (decoded == POS_OK) {
+        // Our own report coming back from a relay
+        if (relayed && strncmp(fix.id, SOLDIER_ID, POS_ID_LEN) == 0) continue;
+        framesDecoded++;
+        if (relayed) {
+          framesRelayed++;
+          if (hop.hops > relayHopsMax) relayHopsMax = hop.hops;
         }
-        incoming.trim();
-        
-        if (incoming.length() > 0) {
-          // Check if this is an ACK message
-          if (incoming.startsWith("ACK:")) {
-            if (waitingForAck) {
-              logToBoth("[LoRa] ACK received");
-              waitingForAck = false;
-              if (displayState.initialized) {
-                displaySuccess("LoRa ACK OK");
-              }
-            }
+        // Sequence history per tracker; a retransmission is ACKed again but not delivered twice
+        duplicate = !arqReceive(fix.id, fix.seq, ackFrame);
+        if (currentMode == MODE_GROUND_STATION) {
+          // Airtime is booked to whoever sent it: the tracker, or the last relay
+          if (relayed) {
+            tdmaHeard(hop.relay, (hop.flags & RELAY_FLAG_SLOTTED) != 0, airLength, packet.receivedAt);
           } else {
-            // Regular message received
-            systemStatus.lastLoRa = incoming;
-            systemStatus.lastLoRaTime = millis();
-            
-            int rssi = LoRa.packetRssi();
-            float snr = LoRa.packetSnr();
-            
-            logToBoth("[LoRa RX] " + incoming);
-            if (BT.hasClient()) {
-              BT.println("\n📡 LORA RECEIVED PACKET");
-              BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-              BT.println("Size: " + String(packetSize) + " bytes");
-              BT.println("RSSI: " + String(rssi) + " dBm");
-              BT.println("SNR: " + String(snr) + " dB");
-              BT.println("Frequency: 433 MHz");
-              BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-              BT.println("Payload:");
-              BT.println(incoming);
-              BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-            }
-            
-            // Only show on display in TRACKER mode
-            if (displayState.initialized && currentMode == MODE_TRACKER) {
-              displayReceivedMessage("LoRa", String(rssi) + "dBm", incoming);
-            }
-            
-            // Send ACK if acknowledgment is enabled
-            if (acknowledgmentEnabled) {
-              delay(100); // Small delay before ACK
-              LoRa.beginPacket();
-              LoRa.print("ACK:" + incoming.substring(0, 20));
-              LoRa.endPacket();
-              LoRa.receive(); // Return to RX mode
-              logToBoth("[LoRa] ACK sent");
-            }
+            tdmaHeard(fix.id, (fix.flags & POS_FLAG_SLOTTED) != 0, airLength, packet.receivedAt);
           }
+        } else if (LORA_RELAY && strncmp(fix.id, SOLDIER_ID, POS_ID_LEN) != 0) {
+          relayOffer(packet.data, packet.length, fix.id, fix.seq, false, relayed ? &hop : NULL);
         }
-      }
-      
-      // Check ACK timeout
-      if (waitingForAck && (millis() - ackWaitStart > LORA_ACK_TIMEOUT)) {
-        logToBoth("[LoRa] ACK timeout - fallback to GSM");
-        waitingForAck = false;
-        
-        if (displayState.initialized) {
-          displayError("LoRa fail, GSM send");
+        // Without ACK mode the same fixes also come in by SMS; keep only the new ones
+        // (the ACK is already built, so track[] may be compacted)
+        int fresh = 0;
+        for (int i = 0; i < trackCount; i++) {
+          if (reportFirst(track[i].id, track[i].seq, REPORT_VIA_LORA, packet.receivedAt)) track[fresh++] = track[i];
         }
-        
-        // Send via GSM as fallback
-        xSemaphoreGive(loraMutex);
-        if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(5000)) == pdTRUE) {
-          logToBoth("[GSM TX] Fallback sending");
-          sendSMSToAll(lastSentPayload);
-          xSemaphoreGive(smsMutex);
+        for (int i = 0; i < fresh; i++) {
+          if (i > 0) incoming += "\n";
+          incoming += positionJson(track[i], NULL, "LoRa");
         }
-        if (xSemaphoreTake(loraMutex, portMAX_DELAY) != pdTRUE) {
-          vTaskDelay(pdMS_TO_TICKS(LORA_UPDATE_INTERVAL));
-          continue;
+        const PositionFix &newest = track[(fresh > 0 ? fresh : trackCount) - 1];
+        summary = String(newest.id) + " #" + String(newest.seq) + " " +
+                  ((newest.flags & POS_FLAG_FIX) ? String(positionDegrees(newest.lat), 5) + "," + String(positionDegrees(newest.lon), 5)
+                                                 : String("no fix"));
+        if (trackCount > 1) summary += " (track of " + String(trackCount) + ")";
+        if (relayed) summary += " via " + String(hop.relay) + " (" + String(hop.hops) + " hop" + (hop.hops > 1 ? "s)" : ")");
+        if (fresh == 0) {
+          // Nothing new, but the sender may still be waiting for its ACK
+          duplicate = true;
+          incoming = summary;
         }
+      } else if (decoded == POS_NOT_FRAME && linkDecode(packet.data, packet.length, link) == POS_OK) {
+        // ADR assignment (station -> tracker) or its confirmation (tracker -> station)
+        if (LORA_ADR) {
+          bool confirm = (link.flags & LINK_FLAG_CONFIRM) != 0;
+          if (currentMode == MODE_GROUND_STATION && confirm) {
+            loraAdrConfirmed(link);
+          } else if (currentMode == MODE_TRACKER && !confirm && strncmp(link.id, SOLDIER_ID, POS_ID_LEN) == 0) {
+            loraAdrAssign(link);
+          }
+        }
+        continue;
+      } else if (decoded == POS_NOT_FRAME && ackDecode(packet.data, packet.length, ackFrame) == POS_OK) {
+        // Report ACK from the ground station; other trackers' ACKs are ignored
+        if (currentMode == MODE_TRACKER && strncmp(ackFrame.id, SOLDIER_ID, POS_ID_LEN) == 0) {
+          int released = arqAcked(ackFrame);
+          if (released > 0) {
+            logToBoth("[LoRa] ACK received for #" + String(ackFrame.seq) +
+                      (released > 1 ? " (+" + String(released - 1) + " earlier)" : String("")));
+            loraAdrReport(true);
+            if (displayState.initialized) {
+              displaySuccess("LoRa ACK OK");
+            }
+          }
+        } else if (LORA_RELAY && currentMode == MODE_TRACKER) {
+          // The station has that report: no need to forward it, but its tracker may be out of range
+          relayCancel(ackFrame.id, ackFrame.seq, ackFrame.mask);
+          relayOffer(packet.data, packet.length, ackFrame.id, ackFrame.seq, true, relayed ? &hop : NULL);
+        }
+        continue;
+      } else if (decoded != POS_NOT_FRAME) {
+        framesRejected++;
+        // Most corrupt frames are two slots overlapping
+        if (currentMode == MODE_GROUND_STATION) tdmaCorrupt(packet.length, packet.receivedAt);
+        logToBoth("[LoRa RX] Position frame rejected (" +
+                  String(decoded == POS_BAD_CRC ? "CRC" : (decoded == POS_SHORT ? "short" : "version")) + ")");
+        continue;
+      } else {
+        incoming.reserve(packet.length);
+        for (int i = 0; i < packet.length; i++) {
+          incoming += (char)packet.data[i];
+        }
+        incoming.trim();
+        summary = incoming;
       }
       
-      // Send GPS data if in tracker mode
-      if (currentMode == MODE_TRACKER && !waitingForAck) {
-        static unsigned long lastSendTime = 0;
-        if (millis() - lastSendTime >= GPS_SEND_INTERVAL) {
-          lastSendTime = millis();
+      if (incoming.length() > 0) {
+        // Text ACKs answer operator messages; reports are ACKed by frame
+        if (decoded == POS_NOT_FRAME && incoming.startsWith("ACK:")) {
+          logToBoth("[LoRa] " + incoming + " received");
+        } else if (duplicate) {
+          logToBoth("[LoRa RX] " + summary + " already received - not shown again");
+        } else {
+          // Regular message received
+          systemStatus.lastLoRa = summary;
+          systemStatus.lastLoRaTime = packet.receivedAt;
           
-          GPSData localGPS;
-          if (xSemaphoreTake(gpsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            localGPS = currentGPS;
-            xSemaphoreGive(gpsMutex);
+          logToBoth("[LoRa RX] " + incoming);
+          if (BT.hasClient()) {
+            BT.println("\n📡 LORA RECEIVED PACKET");
+            BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+            BT.println("Size: " + String(packet.length) + " bytes" +
+                       (decoded != POS_OK ? String("") : trackCount > 1 ? " (track v1, " + String(trackCount) + " fixes)" : String(" (binary v1)")));
+            BT.println("RSSI: " + String(packet.rssi) + " dBm");
+            BT.println("SNR: " + String(packet.snr) + " dB");
+            if (relayed) {
+              BT.println("Path: " + String(hop.hops) + " hop(s), last relay " + String(hop.relay) + " (RSSI/SNR are its link)");
+            }
+            BT.println("Frequency: 433 MHz, SF" + String(loraSf()) + ", " + String(loraPower()) + " dBm");
+            BT.println("Queued: " + String(millis() - packet.receivedAt) + " ms");
+            BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+            BT.println("Payload:");
+            BT.println(incoming);
+            BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
           }
           
-          if (localGPS.isValid) {
-            String msgId = String(millis()) + "-" + String(systemStatus.messageCounter++);
-            String payload = createPayload(localGPS.latitude, localGPS.longitude, 
-                                          localGPS.timestamp, msgId);
-            
-            // Send via LoRa
-            logToBoth("[LoRa TX] Sending GPS");
-            if (BT.hasClient()) {
-              BT.println("\n📡 LORA TRANSMIT PACKET");
-              BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-              BT.println("Type: GPS Location");
-              BT.println("Size: " + String(payload.length()) + " bytes");
-              BT.println("Frequency: 433 MHz");
-              BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-              BT.println("Payload:");
-              BT.println(payload);
-              BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-            }
-            
-            LoRa.beginPacket();
-            LoRa.print(payload);
-            LoRa.endPacket();
-            LoRa.receive(); // Return to RX mode immediately
-            
-            if (BT.hasClient()) {
-              BT.println("[LoRa TX] ✓ Transmission complete");
-            }
-            
-            if (acknowledgmentEnabled) {
-              // Wait for ACK
-              waitingForAck = true;
-              ackWaitStart = millis();
-              lastSentPayload = payload;
-              logToBoth("[LoRa] Waiting for ACK (timeout: 5s)...");
+          // Only show on display in TRACKER mode
+          if (displayState.initialized && currentMode == MODE_TRACKER) {
+            displayReceivedMessage("LoRa", String(packet.rssi) + "dBm", summary);
+          }
+          
+        }
+        
+        if (!(decoded == POS_NOT_FRAME && incoming.startsWith("ACK:"))) {
+          // Frames say whether the sender waits for an ACK; text follows the local setting
+          // Only the ground station ACKs reports: a tracker's ACK would end the ARQ before the station has it
+          bool ackWanted = (decoded == POS_OK) ? currentMode == MODE_GROUND_STATION && (fix.flags & POS_FLAG_ACK) != 0
+                                               : acknowledgmentEnabled;
+          if (ackWanted) {
+            // No turnaround delay: CAD and the preamble outlast the tracker's switch back to receive
+            LoRaTxResult sent;
+            if (decoded == POS_OK) {
+              uint8_t frame[ACK_FRAME_LEN];
+              sent = loraSend(frame, ackEncode(ackFrame, frame, sizeof(frame)), LORA_PRIO_CONTROL);
             } else {
-              // Send via GSM simultaneously (no ACK mode)
-              if (BT.hasClient()) {
-                BT.println("[Mode] No ACK - sending GSM simultaneously");
-              }
-              xSemaphoreGive(loraMutex);
-              if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(5000)) == pdTRUE) {
-                logToBoth("[GSM TX] Sending GPS");
-                sendSMSToAll(payload);
-                xSemaphoreGive(smsMutex);
-              }
-              if (xSemaphoreTake(loraMutex, portMAX_DELAY) != pdTRUE) {
-                vTaskDelay(pdMS_TO_TICKS(LORA_UPDATE_INTERVAL));
-                continue;
-              }
+              String ack = "ACK:" + incoming.substring(0, 20);
+              sent = loraSend((const uint8_t *)ack.c_str(), ack.length(), LORA_PRIO_CONTROL);
             }
+            if (sent == LORA_TX_SENT) {
+              logToBoth("[LoRa] ACK sent");
+            } else if (sent == LORA_TX_DEFERRED) {
+              logToBoth("[LoRa] ACK not sent - duty cycle budget exhausted");
+            } else if (sent == LORA_TX_BUSY) {
+              logToBoth("[LoRa] ACK not sent - transmit queue full");
+            }
+          }
+          
+          // The tracker listens right after its report: assign SF and power now
+          LinkCommand assignment;
+          if (LORA_ADR && decoded == POS_OK && !relayed && currentMode == MODE_GROUND_STATION &&
+              loraAdrObserve(fix.id, packet.snr, assignment)) {
+            uint8_t frame[LINK_FRAME_LEN];
+            loraSend(frame, linkEncode(assignment, frame, sizeof(frame)), LORA_PRIO_CONTROL);
           }
         }
       }
-      
-      xSemaphoreGive(loraMutex);
     }
     
-    vTaskDelay(pdMS_TO_TICKS(LORA_UPDATE_INTERVAL));
-  }
-}
-
-void smsTask(void *parameter) {
-  logToBoth("[SMS Task] Started - Queue mode");
-  
-  static unsigned long checkCount = 0;
-  
-  while (true) {
-    if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-      // Check for stored messages in SIM memory
-      checkCount++;
-      if (BT.hasClient() && (checkCount % 10 == 0)) {
-        BT.println("[SMS] Checking queue (check #" + String(checkCount) + ")...");
-      }
-      
-      SerialSIM.println("AT+CMGL=\"REC UNREAD\""); // List unread messages
-      delay(500); // Wait for response
-      
-      String response = "";
-      unsigned long startTime = millis();
-      while (millis() - startTime < 1000 && SerialSIM.available()) {
-        response += SerialSIM.readString();
-        delay(10);
+    if (LORA_ADR) loraAdrPoll(currentMode == MODE_GROUND_STATION);
+    
+    // Missed ACKs feed ADR; reports out of retries (or pushed out of the window) go by SMS
+    int missed = arqTimeouts();
+    if (missed > 0) {
+      logToBoth("[LoRa] ACK timeout - retrying");
+      while (missed-- > 0) loraAdrReport(false);
+    }
+    ArqFrame lost;
+    while (arqGiveUp(lost)) {
+      if (lost.tries == 0) loraDutyDropped(LORA_PRIO_REPORT);
+      if (!lost.wantAck) continue;   // the SMS copy went out when it was built
+      logToBoth("[LoRa] No ACK for #" + String(lost.seq) + " after " + String(lost.tries) + " tries - fallback to GSM");
+      if (displayState.initialized) {
+        displayError("LoRa fail, GSM send");
       }
-      
-      if (response.indexOf("+CMGL:") != -1) {
-        // Parse multiple messages
-        int index = 0;
-        while (true) {
-          int msgStart = response.indexOf("+CMGL:", index);
-          if (msgStart == -1) break;
-          
-          // Extract message index for deletion
-          int indexStart = msgStart + 7;
-          int indexEnd = response.indexOf(',', indexStart);
-          String msgIndex = response.substring(indexStart, indexEnd);
-          msgIndex.trim();
-          
-          // Extract sender number
-          int phoneStart = response.indexOf('"', indexEnd) + 1;
-          int phoneEnd = response.indexOf('"', phoneStart);
-          String senderNumber = response.substring(phoneStart, phoneEnd);
-          
-          // Extract message body (next line after +CMGL)
-          int bodyStart = response.indexOf('\n', msgStart) + 1;
-          int bodyEnd = response.indexOf('\n', bodyStart);
-          if (bodyEnd == -1) bodyEnd = response.length();
-          String messageBody = response.substring(bodyStart, bodyEnd);
-          messageBody.trim();
+      gsmFallback(lost.payload);
+    }
+    
+    // Send GPS data if in tracker mode (a window of reports may still be awaiting ACKs).
+    // Batching samples every LORA_BATCH_SAMPLE and sends one track frame when the
+    // oldest sample would otherwise wait longer than LORA_BATCH_LATENCY
+    if (currentMode == MODE_TRACKER) {
+      static unsigned long lastSendTime = 0;
+      static PositionFix batch[TRACK_FIXES_MAX];
+      static int batchCount = 0;
+      static unsigned long batchStart = 0;
+      if (millis() - lastSendTime >= (LORA_BATCH ? LORA_BATCH_SAMPLE : GPS_SEND_INTERVAL)) {
+        lastSendTime = millis();
+        
+        GPSData localGPS;
+        if (xSemaphoreTake(gpsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+          localGPS = currentGPS;
+          xSemaphoreGive(gpsMutex);
+        }
+        
+        if (localGPS.isValid) {
+          PositionFix fix;
+          positionSet(fix, SOLDIER_ID, (uint16_t)systemStatus.messageCounter++, true, localGPS.latitude,
+                      localGPS.longitude, localGPS.epoch, localGPS.satellites, localGPS.hdop);
+          if (acknowledgmentEnabled) fix.flags |= POS_FLAG_ACK;
+          if (tdmaSynced()) fix.flags |= POS_FLAG_SLOTTED;
+          if (batchCount == 0) batchStart = millis();
+          batch[batchCount++] = fix;
           
-          if (messageBody.length() > 0 && !messageBody.startsWith("OK") && !messageBody.startsWith("+CMGL")) {
-            systemStatus.lastSMS = messageBody;
-            systemStatus.lastSMSTime = millis();
-            
-            logToBoth("[SMS RX] From: " + senderNumber);
-            logToBoth("[SMS RX] Msg: " + messageBody);
-            
-            if (BT.hasClient()) {
-              BT.println("\n📱 SMS RECEIVED");
-              BT.println("From: " + senderNumber);
-              BT.println("Msg: " + messageBody + "\n");
-            }
-            
-            // Only show on display in TRACKER mode
-            if (displayState.initialized && currentMode == MODE_TRACKER) {
-              displayReceivedMessage("SMS", senderNumber, messageBody);
+          // Every fix also goes to the ground server, batched by the modem task
+          uplinkQueueFix(localGPS.latitude, localGPS.longitude, localGPS.timestamp);
+        }
+        
+        if (batchCount > 0 && (!LORA_BATCH || batchCount == TRACK_FIXES_MAX ||
+                               millis() - batchStart + LORA_BATCH_SAMPLE > LORA_BATCH_LATENCY)) {
+          if (!LORA_BATCH) {
+            uint8_t frame[POS_FRAME_LEN];
+            queueReport(frame, positionEncode(batch[0], frame, sizeof(frame)), batch, 1);
+          } else {
+            // Usually one frame; a batch of large deltas spills into a second
+            int done = 0;
+            while (done < batchCount) {
+              uint8_t frame[TRACK_FRAME_MAX];
+              int used;
+              size_t frameLen = trackEncode(&batch[done], batchCount - done, frame, sizeof(frame), used);
+              queueReport(frame, frameLen, &batch[done], used);
+              done += used;
             }
-            
-            // Delete message after reading
-            delay(100);
-            SerialSIM.println("AT+CMGD=" + msgIndex);
-            delay(200);
           }
-          
-          index = bodyEnd + 1;
-          if (index >= response.length()) break;
+          batchCount = 0;
         }
       }
-      
-      xSemaphoreGive(smsMutex);
     }
     
-    vTaskDelay(pdMS_TO_TICKS(SMS_UPDATE_INTERVAL));
+    // One frame per pass, oldest first: new reports, then retransmissions as their ACK timers run out.
+    // Held outside this tracker's TDMA slot and while the duty-cycle budget is short
+    ArqFrame *due = currentMode == MODE_TRACKER ? arqDue() : NULL;
+    if (due != NULL && tdmaWait(loraAirtime(due->length)) > 0) due = NULL;
+    bool reportSent = false;
+    if (due != NULL) {
+      LoRaTxResult sent = loraSend(due->data, due->length, LORA_PRIO_REPORT, due->seq);
+      if (sent == LORA_TX_SENT) {
+        reportSent = true;
+        uint16_t seq = due->seq;
+        bool wantAck = due->wantAck;
+        arqSent(due);
+        deferLogged = false;
+        
+        if (firstReportAt == 0) {
+          firstReportAt = millis();
+          logToBoth("[Boot] First report " + String(firstReportAt) + " ms after power-on");
+        }
+        
+        if (wantAck && due->tries > 1) {
+          logToBoth("[LoRa] Retransmitted #" + String(seq) + " (try " + String(due->tries) + "), waiting " +
+                    String(due->timeout / 1000) + " s for ACK");
+        } else if (wantAck) {
+          logToBoth("[LoRa] Waiting for ACK (timeout: " + String(LORA_ACK_TIMEOUT / 1000) + "s)...");
+        }
+      } else if (sent == LORA_TX_DEFERRED && !deferLogged) {
+        deferLogged = true;
+        logToBoth("[LoRa] Duty cycle budget low - report held " +
+                  String(loraDutyWait(due->length, LORA_PRIO_REPORT) / 1000) + " s");
+      } else if (sent == LORA_TX_BUSY && BT.hasClient()) {
+        BT.println("[LoRa TX] Transmit queue full - #" + String(due->seq) + " held for the next pass");
+      }
+    }
+    
+    // Forwarding shares this tracker's slot, behind its own reports
+    RelayFrame *relay = (LORA_RELAY && currentMode == MODE_TRACKER && !reportSent) ? relayDue() : NULL;
+    if (relay != NULL && tdmaWait(loraAirtime(relay->length)) == 0) {
+      uint32_t airtime = loraAirtime(relay->length);
+      if (loraSend(relay->data, relay->length, relay->isAck ? LORA_PRIO_CONTROL : LORA_PRIO_REPORT, relay->seq) == LORA_TX_SENT) {
+        logToBoth("[LoRa Relay] Forwarded " + String(relay->isAck ? "ACK for " : "report from ") + String(relay->id) +
+                  " #" + String(relay->seq));
+        relaySent(relay, airtime);
+      }
+    }
+  }
+}
+
+void loraRxTask(void *parameter) {
+  logToBoth("[LoRa RX Task] Started - DIO0 driven");
+  
+  loraRxAttach(loraTaskHandle);
+  
+  while (true) {
+    // Sleeps until DIO0 or a queued transmit: RX done goes to the ring for
+    // loraTask, TX done back to receive and the next packet on the queue
+    loraRxService();
+  }
+}
+
+void modemTask(void *parameter) {
+  logToBoth("[Modem Task] Started - owns SIM800L UART");
+  
+  modemAttach();
+  
+  while (true) {
+    // Serves queued requests by priority, pumps URCs and runs the inbox sweep
+    modemService(SMS_UPDATE_INTERVAL);
   }
 }
 
@@ -394,8 +598,128 @@ void bluetoothTask(void *parameter) {
           BT.println("Sats: " + String(localGPS.satellites));
         }
         
-        BT.println("GSM: " + String(systemStatus.networkConnected ? "OK" : "FAIL"));
-        BT.println("Signal: " + String(systemStatus.signalStrength));
+        // Cached by the modem task; reading it never touches the UART
+        ModemHealth health = modemHealth();
+        BT.println("GSM: " + String(health.registered ? "OK" : "FAIL") + " (CREG " + String(health.regStat) + ")");
+        if (health.sampledAt != 0) {
+          BT.println("Signal: " + String(health.rssi) + " (avg " + String(health.rssiAvg, 1) + ") age " +
+                     String((millis() - health.sampledAt) / 1000) + "s" + (modemHealthFresh(health) ? "" : " STALE"));
+        } else {
+          BT.println("Signal: not sampled yet");
+        }
+        BT.println("Health samples: " + String(health.samples) + ", failed " + String(health.failures) +
+                   ", reg changes " + String(health.changes));
+        BT.println("Modem boot: " + modemBootTimeline());
+        BT.println("Modem sleep: " + modemSleepReport());
+        BT.println(loadReport());
+        BT.println("UART: GPS " + String(SerialGPS.stats().patterns) + " lines, " + String(SerialGPS.stats().overflows) +
+                   " overflows | modem " + String(SerialSIM.stats().patterns) + " lines, " +
+                   String(SerialSIM.stats().overflows) + " overflows, " + String(SerialSIM.stats().frameErrors) + " frame errors");
+        BT.println("LoRa RX: " + String(loraRxStats.packets) + " pkts / " + String(loraRxStats.interrupts) + " IRQs, " +
+                   String(loraRxStats.overwritten) + " overwritten, " + String(loraRxStats.missed) + " missed, " +
+                   String(loraRxStats.empty) + " empty, ring high " + String(loraRxStats.ringHigh) + "/" + String(LORA_RX_RING) +
+                   ", copy " + String(loraRxStats.copyLast) + " us (max " + String(loraRxStats.copyMax) + ")");
+        BT.println("Position frames: " + String(framesDecoded) + " decoded, " + String(framesRejected) + " rejected");
+        LoRaAdrStats adr = loraAdrStats();
+        BT.println("LoRa ADR: " + String(LORA_ADR ? "on" : "off") + ", SF" + String(loraSf()) + " " + String(loraPower()) +
+                   " dBm, " + String(adr.commands) + " assigned, " + String(adr.confirms) + " confirmed, " +
+                   String(adr.sfChanges) + " SF / " + String(adr.powerChanges) + " power changes, " +
+                   String(adr.fallbacks) + " fallbacks");
+        LoRaAdrPeer adrPeers[LORA_ADR_PEERS];
+        int adrCount = loraAdrPeers(adrPeers, LORA_ADR_PEERS);
+        for (int i = 0; i < adrCount; i++) {
+          BT.println("  " + String(adrPeers[i].id) + ": SNR " + String(adrPeers[i].snrAvg, 1) + " dB (margin " +
+                     String(adrPeers[i].margin, 1) + "), SF" + String(adrPeers[i].sf) + " " + String(adrPeers[i].power) +
+                     " dBm, heard " + String((millis() - adrPeers[i].heardAt) / 1000) + " s ago");
+        }
+        LoRaDutyStats duty = loraDutyStats();
+        BT.println("LoRa duty: " + String(duty.limitPermille / 10.0, 1) + "% (" + String(loraSubBandName()) + "), budget " +
+                   String(duty.capacityMs ? duty.tokensMs * 100 / duty.capacityMs : 0) + "% (" + String(duty.tokensMs / 1000) +
+                   " s), " + String(duty.airtimeMs / 1000) + " s on air, last " + String(duty.airtimeLastUs / 1000.0, 1) +
+                   " ms | sent/deferred/dropped: control " + String(duty.sent[LORA_PRIO_CONTROL]) + "/" +
+                   String(duty.deferred[LORA_PRIO_CONTROL]) + "/" + String(duty.dropped[LORA_PRIO_CONTROL]) + ", operator " +
+                   String(duty.sent[LORA_PRIO_OPERATOR]) + "/" + String(duty.deferred[LORA_PRIO_OPERATOR]) + "/" +
+                   String(duty.dropped[LORA_PRIO_OPERATOR]) + ", report " + String(duty.sent[LORA_PRIO_REPORT]) + "/" +
+                   String(duty.deferred[LORA_PRIO_REPORT]) + "/" + String(duty.dropped[LORA_PRIO_REPORT]));
+        LoRaLbtStats lbt = loraLbtStats();
+        BT.println("LoRa LBT: " + String(LORA_LBT ? "on" : "off") + ", " + String(lbt.checks) + " checks, " +
+                   String(lbt.busy) + " busy, " + String(lbt.backoffs) + " backoffs (" + String(lbt.backoffMs / 1000.0, 1) +
+                   " s), " + String(lbt.gaveUp) + " gave up | last minute busy " + String(lbt.lastMinuteBusy) + "/" +
+                   String(lbt.lastMinuteChecks) + " (" +
+                   String(lbt.lastMinuteChecks ? lbt.lastMinuteBusy * 100 / lbt.lastMinuteChecks : 0) + "%)");
+        LoRaTxStats tx = loraTxStats();
+        BT.println("LoRa TX: " + String(tx.queued) + " queued, " + String(tx.done) + " done (" + String(tx.overdue) +
+                   " without TX done), " + String(tx.full) + " refused, queue high " + String(tx.queueHigh) + "/" +
+                   String(LORA_TX_QUEUE) + ", latency max " + String(tx.latencyMaxMs) + " ms | mutex held " +
+                   String(tx.mutexHolds) + "x, avg " + String(tx.mutexHolds ? tx.mutexHoldTotalUs / tx.mutexHolds : 0) +
+                   " us, max " + String(tx.mutexHoldMaxUs) + " us, last " + String(tx.mutexHoldLastUs) + " us");
+        ArqStats arq = arqStats();
+        BT.println("LoRa ARQ: " + String(arq.sent) + " sent, " + String(arq.retransmits) + " retransmitted, " +
+                   String(arq.acked) + " acked, " + String(arq.escalated) + " to SMS, " + String(arq.evicted) +
+                   " evicted, " + String(arq.inFlight) + "/" + String(LORA_ARQ_WINDOW) + " in flight, RTT " +
+                   String(arq.rttLast) + " ms (max " + String(arq.rttMax) + "), " + String(arq.duplicates) +
+                   " duplicates received");
+        TdmaStats tdma = tdmaStats();
+        if (currentMode == MODE_TRACKER) {
+          BT.println("LoRa TDMA: " + String(LORA_TDMA ? "on" : "off") + ", slot " + String(tdmaOwnSlot()) + "/" +
+                     String(LORA_TDMA_SLOTS) + " (" + String(TDMA_SLOT_MS) + " ms), " +
+                     (tdma.synced ? "GPS time " + String(tdma.syncAge / 1000) + " s old" : String("unslotted (no GPS time)")));
+        } else {
+          BT.println("LoRa TDMA: frame " + String(tdma.locked ? "locked" : "not yet heard") + ", " + String(tdma.unslotted) +
+                     " unslotted reports, " + String(tdma.unplaced) + " unplaced");
+          TdmaSlot tdmaSlot[LORA_TDMA_SLOTS];
+          tdmaSlots(tdmaSlot);
+          for (int i = 0; i < LORA_TDMA_SLOTS; i++) {
+            if (tdmaSlot[i].trackers == 0 && tdmaSlot[i].reports == 0 && tdmaSlot[i].corrupt == 0) continue;
+            BT.println("  slot " + String(i) + ": " + String(tdmaSlot[i].trackers) + " trackers" +
+                       String(tdmaSlot[i].trackers > 1 ? " (shared)" : "") + ", " + String(tdmaSlot[i].reports) +
+                       " reports, " + String(tdmaSlot[i].corrupt) + " collisions, " + String(tdmaSlot[i].foreign) +
+                       " off-slot");
+          }
+        }
+        ReportDedupStats dedup = reportDedupStats();
+        BT.println("Report dedup: LoRa first " + String(dedup.first[REPORT_VIA_LORA]) + " (ahead " +
+                   String(dedup.leadCount[REPORT_VIA_LORA] ? dedup.leadTotal[REPORT_VIA_LORA] / dedup.leadCount[REPORT_VIA_LORA] : 0) +
+                   " ms avg, " + String(dedup.leadMax[REPORT_VIA_LORA]) + " max, n=" + String(dedup.leadCount[REPORT_VIA_LORA]) +
+                   "), SMS first " + String(dedup.first[REPORT_VIA_SMS]) + " (ahead " +
+                   String(dedup.leadCount[REPORT_VIA_SMS] ? dedup.leadTotal[REPORT_VIA_SMS] / dedup.leadCount[REPORT_VIA_SMS] : 0) +
+                   " ms avg, " + String(dedup.leadMax[REPORT_VIA_SMS]) + " max, n=" + String(dedup.leadCount[REPORT_VIA_SMS]) +
+                   "), copies dropped " + String(dedup.duplicates[REPORT_VIA_LORA]) + " LoRa / " +
+                   String(dedup.duplicates[REPORT_VIA_SMS]) + " SMS, " + String(dedup.evicted) + " evicted");
+        RelayStats relayed = relayStats();
+        BT.println("LoRa relay: " + String(LORA_RELAY ? "on" : "off") + ", " + String(relayed.forwarded) + " forwarded (" +
+                   String(relayed.airtimeMs / 1000) + " s on air), load " + String(relayed.loadPercent) + "% (cap " +
+                   String(LORA_RELAY_LOAD) + "%), " + String(relayed.cancelled) + " cancelled by ACK, " +
+                   String(relayed.duplicates) + " duplicates, " + String(relayed.expired) + " out of hops, " +
+                   String(relayed.capped) + " capped, " + String(relayed.tooLong) + " too long | received " +
+                   String(framesRelayed) + " relayed reports (max " + String(relayHopsMax) + " hops)");
+        BT.println("First report: " + (firstReportAt ? String(firstReportAt) + " ms" : String("none yet")));
+        BT.println("AT latency: " + String(sim800l.lastLatency()) + " ms (avg " + String(sim800l.averageLatency()) + " ms)");
+        BT.println("Modem UART: " + String(sim800l.baud()) + " baud, " + String(sim800l.throughput()) + " B/s achieved (line max " +
+                   String(sim800l.baud() / 10) + " B/s)");
+        BT.println("SMS purge: " + String(smsStats.purgeBatches) + " batches, " + String(smsStats.roundTripsSaved) + " round trips saved");
+        BT.println("SMS PDU: " + String(smsStats.concatParts) + " parts, " + String(smsStats.concatMessages) + " long msgs, " +
+                   String(smsStats.concatDropped) + " dropped, " + String(smsStats.undecodable) + " undecodable");
+        if (smsStats.latencyCount > 0) {
+          BT.println("SMS latency: " + String(smsStats.latencyLast) + " ms (avg " + String(smsStats.latencyTotal / smsStats.latencyCount) +
+                     ", max " + String(smsStats.latencyMax) + ", n=" + String(smsStats.latencyCount) + ")");
+        }
+        UplinkStats uplink = uplinkStats();
+        BT.println("Uplink: " + uplinkStateName() + ", " + String(uplink.connects) + " connects, " + String(uplink.drops) +
+                   " drops, " + String(uplink.failures) + " failed | " + String(uplink.frames) + " frames, fixes " +
+                   String(uplink.fixesAcked) + "/" + String(uplink.fixesSent) + " acked (" + String(uplink.resent) +
+                   " resent), " + String(uplink.queued) + " queued, " + String(uplink.overflows) + " overflowed");
+        if (uplink.ackRequests > 0) {
+          BT.println("UDP ACKs: " + String(uplink.ackReplies) + "/" + String(uplink.ackRequests) + " answered, " +
+                     String(uplink.ackMissed) + " missed, rtt " + String(uplink.ackRtt) + " ms");
+        }
+        // Modem time per position report, uplink against SMS
+        BT.println("Modem ms/report: uplink " + (uplink.fixesSent ? String(uplink.modemMs / uplink.fixesSent) : String("-")) +
+                   ", SMS " + (modemStats.smsReports ? String(modemStats.smsReportMs / modemStats.smsReports) : String("-")));
+        BT.println("Modem queue: emerg " + String(modemStats.served[MODEM_PRIO_EMERGENCY]) +
+                   " (max wait " + String(modemStats.waitMax[MODEM_PRIO_EMERGENCY]) + " ms), report " +
+                   String(modemStats.served[MODEM_PRIO_REPORT]) + " (max wait " + String(modemStats.waitMax[MODEM_PRIO_REPORT]) +
+                   " ms), debug " + String(modemStats.served[MODEM_PRIO_DEBUG]) + ", rejected " + String(modemStats.rejected));
         BT.println("==============");
       }
       else if (command.startsWith("sms ")) {
@@ -406,18 +730,25 @@ void bluetoothTask(void *parameter) {
             bool loraOk = false;
             bool smsOk = false;
             
-            if (xSemaphoreTake(loraMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-              LoRa.beginPacket();
-              LoRa.print(message);
-              LoRa.endPacket();
-              loraOk = true;
-              xSemaphoreGive(loraMutex);
+            LoRaTxResult sent = loraSend((const uint8_t *)message.c_str(), message.length(), LORA_PRIO_OPERATOR);
+            loraOk = sent == LORA_TX_SENT;
+            if (sent == LORA_TX_DEFERRED) {
+              BT.println("[LoRa] Duty cycle budget exhausted, next slot in " +
+                         String(loraDutyWait(message.length(), LORA_PRIO_OPERATOR) / 1000) + " s");
+            } else if (sent == LORA_TX_BUSY) {
+              BT.println("[LoRa] Transmit queue full, message not sent over LoRa");
             }
             
-            if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(5000)) == pdTRUE) {
-              smsOk = sendSMSToNumber(RECEIVER_PHONES[0], message);
-              xSemaphoreGive(smsMutex);
+            // Operator message jumps ahead of queued reports and inbox work
+            ModemRequest *req = modemSubmit(MODEM_REQ_SMS, MODEM_PRIO_EMERGENCY, RECEIVER_PHONES[0], message.c_str());
+            if (req == NULL) {
+              BT.println("[GSM] Modem busy, message not sent as SMS");
+            } else if (modemWaitDone(req, 30000)) {
+              smsOk = req->success;
+            } else {
+              BT.println("[GSM] SMS timeout, left with the modem task");
             }
+            modemRelease(req);
             
             BT.println(">>> " + String(loraOk && smsOk ? "Sent both" : (loraOk ? "LoRa only" : (smsOk ? "GSM only" : "Failed"))));
           }
@@ -425,26 +756,23 @@ void bluetoothTask(void *parameter) {
       }
       else if (command == "gpsraw" || command == "nmea") {
         BT.println("=== GPS RAW DATA (2 sec) ===");
-        unsigned long startTime = millis();
-        while (millis() - startTime < 2000) {
-          if (SerialGPS.available()) {
-            char c = SerialGPS.read();
-            BT.write(c);
-          }
-          yield();
-        }
+        // gpsTask mirrors what it reads for the next two seconds
+        gpsRawUntil = millis() + 2000;
+        vTaskDelay(pdMS_TO_TICKS(2000 + GPS_UPDATE_INTERVAL));
+        gpsRawUntil = 0;
         BT.println("\n=== END GPS RAW ===");
       }
       else if (command == "checksms" || command == "smscheck") {
         BT.println(">>> Checking SMS queue...");
-        if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-          SerialSIM.println("AT+CMGL=\"ALL\"");
-          delay(1000);
-          while (SerialSIM.available()) {
-            BT.write(SerialSIM.read());
-          }
-          xSemaphoreGive(smsMutex);
+        ModemRequest *req = modemSubmit(MODEM_REQ_INBOX_LIST, MODEM_PRIO_DEBUG, NULL, NULL);
+        if (req == NULL) {
+          BT.println(">>> Modem busy");
+        } else if (modemWaitDone(req, 10000)) {
+          BT.print(req->response);
+        } else {
+          BT.println(">>> Modem timeout");
         }
+        modemRelease(req);
         BT.println(">>> Done");
       }
       else if (command.startsWith("gsm ") || command.startsWith("at ")) {
@@ -454,18 +782,30 @@ void bluetoothTask(void *parameter) {
         
         if (atCommand.length() > 0) {
           BT.println(">>> Sending to GSM: " + atCommand);
-          if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-            SerialSIM.println(atCommand);
-            delay(500);
-            BT.println(">>> Response:");
-            while (SerialSIM.available()) {
-              BT.write(SerialSIM.read());
-            }
-            xSemaphoreGive(smsMutex);
+          ModemRequest *req = modemSubmit(MODEM_REQ_AT, MODEM_PRIO_DEBUG, NULL, atCommand.c_str());
+          if (req == NULL) {
+            BT.println(">>> Modem busy");
+          } else if (modemWaitDone(req, 10000)) {
+            BT.println(">>> Response (" + String(req->success ? "OK" : "ERROR") + "):");
+            BT.print(req->response);
+          } else {
+            BT.println(">>> Modem timeout");
           }
+          modemRelease(req);
           BT.println("\n>>> Done");
         }
       }
+      else if (command == "trace on" || command == "trace off") {
+        // Read-only tap on the modem task's traffic; never writes to the UART
+        bool on = (command == "trace on");
+        sim800l.trace(on ? &BT : NULL);
+        BT.println(">>> Modem trace " + String(on ? "ON" : "OFF"));
+      }
+      else if (command == "uplink udp" || command == "uplink tcp") {
+        uplinkSetUdp(command == "uplink udp");
+        BT.println(">>> Uplink transport " + String(uplinkUdp() ? "UDP" : "TCP") +
+                   (uplinkEnabled() ? "" : " (UPLINK_HOST not set)"));
+      }
       else if (command == "help") {
         BT.println("=== COMMANDS ===");
         BT.println("tracker - Tracker mode");
@@ -475,6 +815,8 @@ void bluetoothTask(void *parameter) {
         BT.println("gpsraw/nmea - Show GPS raw");
         BT.println("checksms - Check SMS queue");
         BT.println("gsm/at <cmd> - Send AT cmd");
+        BT.println("trace on/off - Mirror modem UART");
+        BT.println("uplink udp/tcp - GPRS transport");
         BT.println("================");
       }
       else {
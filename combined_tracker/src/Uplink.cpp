@@ -0,0 +1,402 @@
+#include "Uplink.h"
+#include "Globals.h"
+#include "Config.h"
+#include "Utils.h"
+#include "ModemManager.h"
+
+struct UplinkFix {
+  uint32_t seq;
+  double lat;
+  double lon;
+  char timestamp[24];
+  unsigned long queuedAt;
+};
+
+// Ring of fixes from head: the first inFlight were sent on the current
+// connection and wait for the TCP ACK, the rest wait for a frame
+static UplinkFix fixes[UPLINK_QUEUE];
+static uint8_t head = 0;
+static uint8_t count = 0;
+static uint8_t inFlight = 0;
+static uint32_t nextSeq = 0;
+static UplinkStats stats = {};
+static portMUX_TYPE uplinkMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Frames on the current connection, oldest first; CIPACK counts bytes from the connect
+#define UPLINK_FRAMES_MAX 8
+struct UplinkFrame {
+  uint32_t endByte;
+  uint8_t fixes;
+};
+static UplinkFrame frames[UPLINK_FRAMES_MAX];
+static uint8_t frameCount = 0;
+static uint32_t bytesOnLink = 0;
+static uint32_t ackedOnLink = 0;
+static unsigned long ackProgressAt = 0;   // last time the ACK counter moved (or nothing was owed)
+static volatile bool linkUp = false;
+static volatile bool udpMode = UPLINK_UDP;
+
+// UDP: one application ACK request outstanding at a time
+static uint32_t datagrams = 0;            // sent on the current connection
+static bool ackOutstanding = false;
+static uint32_t ackSeq = 0;
+static unsigned long ackAskedAt = 0;
+static uint8_t ackMisses = 0;             // consecutive unanswered requests
+
+bool uplinkEnabled() {
+  return UPLINK_HOST[0] != '\0';
+}
+
+bool uplinkQueueFix(double lat, double lon, const String &timestamp) {
+  if (!uplinkEnabled()) return false;
+  
+  bool queued = true;
+  portENTER_CRITICAL(&uplinkMux);
+  if (count == UPLINK_QUEUE) {
+    stats.overflows++;
+    if (inFlight == 0) {
+      // Link down for a while: the oldest waiting fix makes room
+      head = (head + 1) % UPLINK_QUEUE;
+      count--;
+    } else {
+      queued = false;
+    }
+  }
+  if (queued) {
+    UplinkFix &fix = fixes[(head + count) % UPLINK_QUEUE];
+    fix.seq = nextSeq++;
+    fix.lat = lat;
+    fix.lon = lon;
+    strncpy(fix.timestamp, timestamp.c_str(), sizeof(fix.timestamp) - 1);
+    fix.timestamp[sizeof(fix.timestamp) - 1] = '\0';
+    fix.queuedAt = millis();
+    count++;
+  }
+  portEXIT_CRITICAL(&uplinkMux);
+  return queued;
+}
+
+bool uplinkConnected() {
+  return linkUp;
+}
+
+void uplinkSetUdp(bool udp) {
+  udpMode = udp;
+}
+
+bool uplinkUdp() {
+  return udpMode;
+}
+
+UplinkStats uplinkStats() {
+  UplinkStats copy;
+  portENTER_CRITICAL(&uplinkMux);
+  copy = stats;
+  copy.queued = count;
+  portEXIT_CRITICAL(&uplinkMux);
+  return copy;
+}
+
+String uplinkStateName() {
+  if (!uplinkEnabled()) return "disabled";
+  switch (sim800l.ipState()) {
+    case IP_BEARER: return "GPRS up";
+    case IP_CONNECTING: return "connecting";
+    case IP_CONNECTED: return sim800l.ipUdp() ? "UDP" : "TCP";
+    default: return "off";
+  }
+}
+
+// Connection gone: everything unacknowledged goes back to waiting
+static void linkLost(bool dropped) {
+  linkUp = false;
+  ackOutstanding = false;
+  portENTER_CRITICAL(&uplinkMux);
+  if (dropped) stats.drops++;
+  stats.resent += inFlight;
+  inFlight = 0;
+  portEXIT_CRITICAL(&uplinkMux);
+  frameCount = 0;
+  if (dropped) {
+    logToBoth("[UPLINK] Connection lost, " + String(uplinkStats().queued) + " fixes queued");
+  }
+}
+
+// Modem time spent on uplink traffic, the per-report cost compared with SMS
+static void chargeModem(unsigned long since) {
+  unsigned long spent = millis() - since;
+  portENTER_CRITICAL(&uplinkMux);
+  stats.modemMs += spent;
+  portEXIT_CRITICAL(&uplinkMux);
+}
+
+// Release the fixes of every frame the server has acknowledged
+static void collectAcks() {
+  uint32_t sent, acked;
+  unsigned long start = millis();
+  bool polled = sim800l.ipAcked(&sent, &acked);
+  chargeModem(start);
+  if (!polled) return;
+  uint32_t progress = (acked > ackedOnLink) ? acked - ackedOnLink : 0;
+  if (progress > 0) {
+    ackedOnLink = acked;
+    ackProgressAt = millis();
+  }
+  
+  uint8_t released = 0;
+  while (frameCount > 0 && frames[0].endByte <= acked) {
+    released += frames[0].fixes;
+    frameCount--;
+    for (int i = 0; i < frameCount; i++) {
+      frames[i] = frames[i + 1];
+    }
+  }
+  
+  portENTER_CRITICAL(&uplinkMux);
+  head = (head + released) % UPLINK_QUEUE;
+  count -= released;
+  inFlight -= released;
+  stats.fixesAcked += released;
+  stats.bytesAcked += progress;
+  portEXIT_CRITICAL(&uplinkMux);
+}
+
+// One frame of up to UPLINK_BATCH fixes:
+//   $TRK,<device>,<fixes>\n then <seq>,<lat>,<lon>,<timestamp>\n per fix
+static void sendBatch() {
+  UplinkFix batch[UPLINK_BATCH];
+  uint8_t n = 0;
+  unsigned long oldest = 0;
+  
+  portENTER_CRITICAL(&uplinkMux);
+  uint8_t waiting = count - inFlight;
+  if (waiting > 0) oldest = fixes[(head + inFlight) % UPLINK_QUEUE].queuedAt;
+  // Full batches right away, a partial one once its oldest fix has waited long enough
+  if (waiting >= UPLINK_BATCH || (waiting > 0 && millis() - oldest >= UPLINK_BATCH_WAIT)) {
+    n = (waiting < UPLINK_BATCH) ? waiting : UPLINK_BATCH;
+    for (int i = 0; i < n; i++) {
+      batch[i] = fixes[(head + inFlight + i) % UPLINK_QUEUE];
+    }
+  }
+  portEXIT_CRITICAL(&uplinkMux);
+  if (n == 0) return;
+  
+  char frame[48 + UPLINK_BATCH * 64];
+  int len = snprintf(frame, sizeof(frame), "$TRK,%s,%u\n", SOLDIER_ID, n);
+  for (int i = 0; i < n; i++) {
+    len += snprintf(frame + len, sizeof(frame) - len, "%lu,%.5f,%.5f,%s\n", (unsigned long)batch[i].seq,
+                    batch[i].lat, batch[i].lon, batch[i].timestamp);
+  }
+  
+  unsigned long start = millis();
+  bool accepted = sim800l.ipSend((const uint8_t *)frame, len);
+  chargeModem(start);
+  if (!accepted) {
+    // Modem refused the data: drop the connection and start over
+    logToBoth("[UPLINK] Send failed, reconnecting");
+    sim800l.ipClose();
+    linkLost(true);
+    return;
+  }
+  
+  if (frameCount == 0) ackProgressAt = millis();
+  bytesOnLink += len;
+  frames[frameCount].endByte = bytesOnLink;
+  frames[frameCount].fixes = n;
+  frameCount++;
+  
+  portENTER_CRITICAL(&uplinkMux);
+  inFlight += n;
+  stats.frames++;
+  stats.fixesSent += n;
+  stats.bytesSent += len;
+  portEXIT_CRITICAL(&uplinkMux);
+}
+
+// UDP beacons, one fix per datagram, released as soon as the modem takes it:
+//   $U,<device>,<seq>,<lat>,<lon>,<timestamp>[,A]\n
+// ",A" asks the server for "ACK,<seq>", every UPLINK_UDP_ACK_EVERY datagrams
+static void sendDatagrams() {
+  // Bounded per cycle so a backlog after an outage does not hold the modem task
+  for (int i = 0; i < UPLINK_BATCH; i++) {
+    UplinkFix fix;
+    portENTER_CRITICAL(&uplinkMux);
+    bool waiting = count > 0;
+    if (waiting) fix = fixes[head];
+    portEXIT_CRITICAL(&uplinkMux);
+    if (!waiting) return;
+    
+    bool askAck = UPLINK_UDP_ACK_EVERY > 0 && !ackOutstanding && (datagrams + 1) % UPLINK_UDP_ACK_EVERY == 0;
+    char datagram[96];
+    int len = snprintf(datagram, sizeof(datagram), "$U,%s,%lu,%.5f,%.5f,%s%s\n", SOLDIER_ID, (unsigned long)fix.seq,
+                       fix.lat, fix.lon, fix.timestamp, askAck ? ",A" : "");
+    
+    unsigned long start = millis();
+    bool accepted = sim800l.ipSend((const uint8_t *)datagram, len);
+    chargeModem(start);
+    if (!accepted) {
+      logToBoth("[UPLINK] Datagram refused, reconnecting");
+      sim800l.ipClose();
+      linkLost(true);
+      return;
+    }
+    
+    datagrams++;
+    if (askAck) {
+      ackOutstanding = true;
+      ackSeq = fix.seq;
+      ackAskedAt = millis();
+    }
+    portENTER_CRITICAL(&uplinkMux);
+    head = (head + 1) % UPLINK_QUEUE;
+    count--;
+    stats.frames++;
+    stats.fixesSent++;
+    stats.bytesSent += len;
+    if (askAck) stats.ackRequests++;
+    portEXIT_CRITICAL(&uplinkMux);
+  }
+}
+
+// Server data: "ACK,<seq>" lines answer UDP ACK requests, anything else is logged
+static void drainIncoming() {
+  char data[IP_READ_MAX + 1];
+  uint16_t n = sim800l.ipRead((uint8_t *)data, IP_READ_MAX);
+  data[n] = '\0';
+  for (char *line = strtok(data, "\r\n"); line != NULL; line = strtok(NULL, "\r\n")) {
+    if (strncmp(line, "ACK,", 4) == 0) {
+      if (ackOutstanding && (uint32_t)strtoul(line + 4, NULL, 10) == ackSeq) {
+        ackOutstanding = false;
+        ackMisses = 0;
+        portENTER_CRITICAL(&uplinkMux);
+        stats.ackReplies++;
+        stats.ackRtt = millis() - ackAskedAt;
+        portEXIT_CRITICAL(&uplinkMux);
+      }
+    } else if (BT.hasClient()) {
+      BT.println("[UPLINK RX] " + String(line));
+    }
+  }
+}
+
+// An unanswered UDP ACK request; several in a row mean the path is dead
+static bool ackExpired() {
+  if (!ackOutstanding || millis() - ackAskedAt < UPLINK_UDP_ACK_WAIT) return false;
+  ackOutstanding = false;
+  ackMisses++;
+  portENTER_CRITICAL(&uplinkMux);
+  stats.ackMissed++;
+  portEXIT_CRITICAL(&uplinkMux);
+  if (ackMisses < UPLINK_UDP_ACK_MISSES) return false;
+  ackMisses = 0;
+  return true;
+}
+
+// Reconnect with exponential backoff; lastAttempt == 0 means never tried
+static unsigned long lastAttempt = 0;
+static unsigned long backoff = 0;
+static uint8_t connectFailures = 0;
+static bool attempting = false;      // AT+CIPSTART accepted, CONNECT OK/FAIL pending
+
+static void attemptFailed() {
+  attempting = false;
+  connectFailures++;
+  backoff = (backoff == 0) ? UPLINK_RETRY_MIN : min((unsigned long)UPLINK_RETRY_MAX, backoff * 2);
+  portENTER_CRITICAL(&uplinkMux);
+  stats.failures++;
+  portEXIT_CRITICAL(&uplinkMux);
+  logToBoth("[UPLINK] Connect failed, retry in " + String(backoff / 1000) + "s");
+}
+
+void uplinkService() {
+  static unsigned long lastAckPoll = 0;
+  
+  if (!uplinkEnabled()) return;
+  
+  IPState state = sim800l.ipState();
+  if (linkUp && state != IP_CONNECTED) {
+    linkLost(true);
+  }
+  
+  // Transport changed from BT: close and reopen with the other protocol
+  if (state == IP_CONNECTED && sim800l.ipUdp() != udpMode) {
+    logToBoth("[UPLINK] Switching to " + String(udpMode ? "UDP" : "TCP"));
+    sim800l.ipClose();
+    linkLost(false);
+    state = sim800l.ipState();
+  }
+  
+  if (state == IP_CONNECTING) {
+    if (sim800l.ipStateAge() < UPLINK_CONNECT_TIMEOUT) return;
+    sim800l.ipClose();
+    state = IP_BEARER;
+  }
+  
+  if (state != IP_CONNECTED) {
+    if (attempting) attemptFailed();   // CONNECT FAIL or no answer in time
+    if (!modemGsmUsable()) return;
+    if (lastAttempt != 0 && millis() - lastAttempt < backoff) return;
+    lastAttempt = millis();
+    
+    // Repeated connect failures on a standing context: rebuild the context
+    if (state == IP_BEARER && connectFailures >= 3) {
+      sim800l.stopGPRS();
+      state = IP_OFF;
+      connectFailures = 0;
+    }
+    if ((state != IP_OFF || sim800l.startGPRS(UPLINK_APN)) &&
+        (udpMode ? sim800l.udpConnect(UPLINK_HOST, UPLINK_PORT) : sim800l.tcpConnect(UPLINK_HOST, UPLINK_PORT))) {
+      attempting = true;
+    } else {
+      attemptFailed();
+    }
+    return;
+  }
+  
+  if (!linkUp) {
+    linkUp = true;
+    attempting = false;
+    connectFailures = 0;
+    backoff = 0;
+    bytesOnLink = 0;
+    ackedOnLink = 0;
+    frameCount = 0;
+    datagrams = 0;
+    portENTER_CRITICAL(&uplinkMux);
+    stats.connects++;
+    portEXIT_CRITICAL(&uplinkMux);
+    logToBoth("[UPLINK] " + String(udpMode ? "UDP" : "TCP") + " to " + String(UPLINK_HOST) + ":" + String(UPLINK_PORT));
+  }
+  
+  if (sim800l.ipDataPending()) {
+    drainIncoming();
+  }
+  
+  if (udpMode) {
+    if (ackExpired()) {
+      // No answer to several requests: rebuild the PDP context, not just the socket
+      logToBoth("[UPLINK] " + String(UPLINK_UDP_ACK_MISSES) + " UDP ACKs missed, restarting GPRS");
+      sim800l.stopGPRS();
+      linkLost(true);
+      return;
+    }
+    sendDatagrams();
+    return;
+  }
+  
+  if (frameCount > 0 && millis() - lastAckPoll >= UPLINK_ACK_POLL) {
+    lastAckPoll = millis();
+    collectAcks();
+    // Bytes owed for too long: the connection is dead even if the modem has not noticed
+    if (frameCount > 0 && millis() - ackProgressAt >= UPLINK_ACK_TIMEOUT) {
+      logToBoth("[UPLINK] No ACK for " + String(UPLINK_ACK_TIMEOUT / 1000) + "s, reconnecting");
+      sim800l.ipClose();
+      linkLost(true);
+      return;
+    }
+  }
+  
+  if (frameCount < UPLINK_FRAMES_MAX) {
+    sendBatch();
+  }
+}
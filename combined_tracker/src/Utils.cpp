@@ -2,7 +2,9 @@
 #include "Globals.h"
 #include "Config.h"
 #include "DisplayManager.h"
-#include <LoRa.h>
+#include "ModemManager.h"
+#include "LoRaManager.h"
+#include "esp_freertos_hooks.h"
 
 const char* RECEIVER_PHONES[NUM_RECEIVERS] = {
   "+918667399071",
@@ -10,7 +12,7 @@ const char* RECEIVER_PHONES[NUM_RECEIVERS] = {
 };
 
 void logToBoth(const String &message) {
-  Serial.println(message);
+  SerialGPS.println(message);
   if (BT.hasClient()) {
     BT.println("[LOG] " + message);
   }
@@ -21,6 +23,53 @@ void logToBoth(const String &message) {
   }
 }
 
+// The idle hook runs once per idle-task pass; the CPU then sleeps until the
+// next interrupt, so calls per second track idle ticks (an estimate, not exact)
+static volatile unsigned long idleCalls[2] = {0, 0};
+
+static bool idleHookCore0() {
+  idleCalls[0]++;
+  return true;
+}
+
+static bool idleHookCore1() {
+  idleCalls[1]++;
+  return true;
+}
+
+void idleMonitorBegin() {
+  esp_register_freertos_idle_hook_for_cpu(idleHookCore0, 0);
+  esp_register_freertos_idle_hook_for_cpu(idleHookCore1, 1);
+}
+
+String loadReport() {
+  static unsigned long lastAt = 0;
+  static unsigned long lastIdle[2] = {0, 0};
+  static unsigned long lastGps = 0;
+  static unsigned long lastModem = 0;
+  
+  unsigned long now = millis();
+  unsigned long elapsed = now - lastAt;
+  if (elapsed == 0) elapsed = 1;
+  unsigned long ticks = elapsed * configTICK_RATE_HZ / 1000;
+  if (ticks == 0) ticks = 1;
+  
+  String report = "Wakeups/s: GPS " + String((SerialGPS.stats().wakeups - lastGps) * 1000.0 / elapsed, 1) +
+                  ", modem " + String((SerialSIM.stats().wakeups - lastModem) * 1000.0 / elapsed, 1) +
+                  " | CPU idle:";
+  for (int core = 0; core < 2; core++) {
+    unsigned long idle = idleCalls[core] - lastIdle[core];
+    lastIdle[core] += idle;
+    unsigned long percent = idle * 100 / ticks;
+    report += " core" + String(core) + " " + String(percent > 100 ? 100 : percent) + "%";
+  }
+  
+  lastGps = SerialGPS.stats().wakeups;
+  lastModem = SerialSIM.stats().wakeups;
+  lastAt = now;
+  return report;
+}
+
 String formatGpsTimestamp(TinyGPSDate &d, TinyGPSTime &t) {
   if (!d.isValid() || !t.isValid()) return String("1970-01-01T00:00:00Z");
   char buf[32];
@@ -29,12 +78,19 @@ String formatGpsTimestamp(TinyGPSDate &d, TinyGPSTime &t) {
   return String(buf);
 }
 
-String createPayload(double lat, double lon, const String &timestamp, const String &msgId) {
+uint32_t gpsEpoch(TinyGPSDate &d, TinyGPSTime &t) {
+  if (!d.isValid() || !t.isValid()) return 0;
+  return positionEpoch(d.year(), d.month(), d.day(), t.hour(), t.minute(), t.second());
+}
+
+// Short SMS text for a fix; LoRa carries the binary frame instead
+String createPayload(const PositionFix &fix) {
   String s = "{";
-  s += "\"id\":\"" + String(SOLDIER_ID) + "\",";
-  s += "\"t\":" + String(lat, 4) + ",";
-  s += "\"g\":" + String(lon, 4) + ",";
-  s += "\"ts\":\"" + timestamp + "\",";
+  s += "\"id\":\"" + String(fix.id) + "\",";
+  s += "\"n\":" + String(fix.seq) + ",";
+  s += "\"t\":" + String(positionDegrees(fix.lat), 4) + ",";
+  s += "\"g\":" + String(positionDegrees(fix.lon), 4) + ",";
+  s += "\"ts\":\"" + positionTimestamp(fix.epoch) + "\"";
   s += "}";
   return s;
 }
@@ -47,18 +103,18 @@ bool sendSMSToNumber(const char *toNumber, const String &message) {
 }
 
 bool sendSMSToAll(const String &message) {
-  bool overallSuccess = false;
+  SMSReport reports[NUM_RECEIVERS];
+  logToBoth("[GSM] Sending to " + String(NUM_RECEIVERS) + " receivers");
+  uint8_t sent = sim800l.sendSMSToMany(RECEIVER_PHONES, NUM_RECEIVERS, message.c_str(), reports);
   for (int i = 0; i < NUM_RECEIVERS; i++) {
-    logToBoth("[GSM] Sending to " + String(RECEIVER_PHONES[i]));
-    if (sendSMSToNumber(RECEIVER_PHONES[i], message)) {
-      logToBoth("[GSM] SMS sent to " + String(RECEIVER_PHONES[i]));
-      overallSuccess = true;
+    if (reports[i].result == AT_OK) {
+      logToBoth("[GSM] SMS sent to " + String(RECEIVER_PHONES[i]) + " (ref " + String(reports[i].reference) +
+                ", " + String(reports[i].latency) + " ms)");
     } else {
       logToBoth("[GSM] SMS failed to " + String(RECEIVER_PHONES[i]));
     }
-    delay(1000);
   }
-  return overallSuccess;
+  return sent > 0;
 }
 
 void processKeyboardCommand(String command) {
@@ -80,18 +136,11 @@ void processKeyboardCommand(String command) {
     bool loraOk = false;
     bool smsOk = false;
     
-    if (xSemaphoreTake(loraMutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-      LoRa.beginPacket();
-      LoRa.print(message);
-      LoRa.endPacket();
-      loraOk = true;
-      xSemaphoreGive(loraMutex);
-    }
+    loraOk = loraSend((const uint8_t *)message.c_str(), message.length(), LORA_PRIO_OPERATOR) == LORA_TX_SENT;
     
-    if (xSemaphoreTake(smsMutex, pdMS_TO_TICKS(5000)) == pdTRUE) {
-      smsOk = sendSMSToNumber(RECEIVER_PHONES[0], message);
-      xSemaphoreGive(smsMutex);
-    }
+    ModemRequest *req = modemSubmit(MODEM_REQ_SMS, MODEM_PRIO_EMERGENCY, RECEIVER_PHONES[0], message.c_str());
+    smsOk = modemWait(req, 30000);
+    modemRelease(req);
     
     if (loraOk || smsOk) {
       displaySuccess("Sent " + String(loraOk && smsOk ? "both" : (loraOk ? "LoRa" : "GSM")));
@@ -11,13 +11,15 @@
 #include "Globals.h"
 #include "Utils.h"
 #include "Tasks.h"
+#include "ModemManager.h"
+#include "LoRaManager.h"
 
 // Global object definitions
 TinyGPSPlus gps;
 BluetoothSerial BT;
 SIM800L sim800l;
-HardwareSerial &SerialGPS = Serial;  // GPS uses Serial 0 (USB Serial)
-HardwareSerial SerialSIM(1);
+UartLineSource SerialGPS(UART_NUM_0);  // GPS uses UART0 (USB Serial), event driven
+UartLineSource SerialSIM(UART_NUM_1, true);  // modem port, "> " send prompt ends a wait
 U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R2, U8X8_PIN_NONE);
 
 // Global data
@@ -29,16 +31,27 @@ bool acknowledgmentEnabled = false;
 // FreeRTOS Mutexes
 SemaphoreHandle_t gpsMutex;
 SemaphoreHandle_t loraMutex;
-SemaphoreHandle_t smsMutex;
 
 // Display and Keyboard State definitions (must be defined here)
 // These are extern in Globals.h but need actual definitions
 DisplayState displayState = DisplayState();  // Initialize with default constructor
 KeyboardState keyboardState = KeyboardState();  // Initialize with default constructor
 
+static bool waitModemLine(uint32_t timeoutMs, void *context) {
+  return static_cast<LineSource *>(context)->waitLine(timeoutMs);
+}
+
+static void setModemBaud(uint32_t baud, void *context) {
+  static_cast<UartLineSource *>(context)->updateBaudRate(baud);
+}
+
+static uint32_t modemFrameErrors(void *context) {
+  return static_cast<UartLineSource *>(context)->stats().frameErrors;
+}
+
 void setup() {
-  Serial.begin(9600);  // Match GPS baud rate (GPS on Serial 0)
-  delay(1000);
+  SerialGPS.begin(9600, GPS_RX_PIN, GPS_TX_PIN);  // Match GPS baud rate (GPS on Serial 0)
+  idleMonitorBegin();
   
   // Initialize Bluetooth
   BT.begin("Combined_Tracker_2");
@@ -49,30 +62,28 @@ void setup() {
   logToBoth("GPS on Serial 0");
   
   // Initialize SIM800L
-  SerialSIM.begin(9600, SERIAL_8N1, SIM_RX_PIN, SIM_TX_PIN);
-  delay(2000);
+  // begin() returns as soon as the UART answers; SIM, network and SMS
+  // readiness are tracked by the modem task (SMS settings applied there)
+  SerialSIM.begin(MODEM_BAUD_INITIAL, SIM_RX_PIN, SIM_TX_PIN);
+  // Blocking AT commands sleep until the modem sends a line
+  sim800l.waitWith(waitModemLine, &SerialSIM);
+  // begin() finds the modem's rate and moves both ends to the fastest stable one
+  sim800l.baudControl(setModemBaud, &SerialSIM, modemFrameErrors, MODEM_BAUD_MAX, MODEM_BAUD_INITIAL);
   
   if (sim800l.begin(SerialSIM)) {
-    logToBoth("SIM800L OK");
-    systemStatus.networkConnected = sim800l.checkNetwork();
-    systemStatus.signalStrength = sim800l.signalStrength();
+    logToBoth("SIM800L OK (" + String(sim800l.bootTime(BOOT_AT)) + " ms, " + String(sim800l.baud()) + " baud)");
   } else {
     logToBoth("SIM800L FAIL");
   }
-  
-  SerialSIM.println("AT+CMGF=1");
-  delay(200);
-  // Store SMS in SIM memory instead of forwarding immediately
-  SerialSIM.println("AT+CNMI=2,0,0,0,0"); // Changed from 2,1 to 2,0 (no forward)
-  delay(200);
-  SerialSIM.println("AT+CPMS=\"SM\",\"SM\",\"SM\""); // Use SIM storage
-  delay(200);
+  // RI pulses (SMS, calls) wake the modem task even while the module sleeps
+  modemRingBegin(SIM_RI_PIN);
   
   // Initialize LoRa
   SPI.begin();
   LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO0);
   if (LoRa.begin(LORA_FREQ)) {
     logToBoth("LoRa OK");
+    loraRadioBegin();
     systemStatus.loraConnected = true;
   } else {
     logToBoth("LoRa FAIL");
@@ -81,6 +92,8 @@ void setup() {
   
   // Initialize system
   systemStatus.messageCounter = 0;
+  systemStatus.networkConnected = false;  // filled in by the modem health sampler
+  systemStatus.signalStrength = -1;
   systemStatus.lastSMSTime = 0;
   systemStatus.lastLoRaTime = 0;
   
@@ -88,6 +101,8 @@ void setup() {
   currentGPS.latitude = 0.0;
   currentGPS.longitude = 0.0;
   currentGPS.satellites = 0;
+  currentGPS.epoch = 0;
+  currentGPS.hdop = -1;
   
   // Initialize Display and Keyboard
   Wire.begin(I2C_SDA, I2C_SCL);
@@ -100,12 +115,19 @@ void setup() {
   // Create mutexes
   gpsMutex = xSemaphoreCreateMutex();
   loraMutex = xSemaphoreCreateMutex();
-  smsMutex = xSemaphoreCreateMutex();
+  
+  // Modem request queues (the modem task is the only SIM800L UART user)
+  modemInit();
   
   // Create FreeRTOS tasks
   xTaskCreatePinnedToCore(gpsTask, "GPS", 4096, NULL, 2, &gpsTaskHandle, 0);
   xTaskCreatePinnedToCore(loraTask, "LoRa", 4096, NULL, 2, &loraTaskHandle, 1);
-  xTaskCreatePinnedToCore(smsTask, "SMS", 4096, NULL, 1, &smsTaskHandle, 0);
+  // Highest priority: empties the radio FIFO right after DIO0, before the next packet lands.
+  // It attaches DIO0 itself, so without a radio neither the task nor the interrupt exists.
+  if (systemStatus.loraConnected) {
+    xTaskCreatePinnedToCore(loraRxTask, "LoRaRx", 3072, NULL, 3, &loraRxTaskHandle, 1);
+  }
+  xTaskCreatePinnedToCore(modemTask, "Modem", 6144, NULL, 1, &modemTaskHandle, 0);
   xTaskCreatePinnedToCore(bluetoothTask, "BT", 4096, NULL, 1, &bluetoothTaskHandle, 1);
   xTaskCreatePinnedToCore(displayTask, "Display", 4096, NULL, 1, &displayTaskHandle, 1);
   xTaskCreatePinnedToCore(keyboardTask, "Keyboard", 4096, NULL, 1, &keyboardTaskHandle, 0);
@@ -118,10 +140,10 @@ void setup() {
   BT.println("All operations will be logged");
   BT.println("\n--- Configuration ---");
   BT.println("GPS: Serial 0 @ 9600");
-  BT.println("GSM: Serial 1 @ 9600");
+  BT.println("GSM: Serial 1 @ " + String(sim800l.baud()));
   BT.println("LoRa: " + String(LORA_FREQ / 1E6) + " MHz");
   BT.println("GPS Send Interval: " + String(GPS_SEND_INTERVAL / 1000) + "s");
-  BT.println("SMS Check Interval: " + String(SMS_UPDATE_INTERVAL / 1000) + "s");
+  BT.println("SMS Intake: +CMTI, sweep every " + String(SMS_SWEEP_INTERVAL / 1000) + "s");
   BT.println("ACK Mode: " + String(acknowledgmentEnabled ? "ON" : "OFF"));
   BT.println("\nType 'help' for commands");
   BT.println("=====================\n");
@@ -0,0 +1,89 @@
+// Scripted SIM800L at the other end of a Stream. Every line the driver writes
+// ('\n' or Ctrl-Z terminated) goes to onLine, which answers with say().
+// A reply can be held back with a delay, so it arrives split or late.
+#ifndef FAKE_MODEM_H
+#define FAKE_MODEM_H
+
+#include <Arduino.h>
+#include <deque>
+#include <functional>
+#include <string>
+
+class FakeModem : public Stream {
+public:
+  std::function<void(FakeModem &modem, const std::string &line)> onLine;
+  std::string written;    // everything the driver sent, in order
+
+  // Queue output, readable afterMs after the output still pending before it (or now)
+  void say(const std::string &text, unsigned long afterMs = 0) {
+    unsigned long at = millis();
+    if (!_pending.empty() && (long)(_pending.back().at - at) > 0) at = _pending.back().at;
+    _pending.push_back({at + afterMs, text});
+  }
+
+  // Answer as a powered, registered module with SMS ready; false if line is not a command
+  bool answerReady(const std::string &line) {
+    if (line.compare(0, 2, "AT") != 0) return false;
+    if (line.compare(0, 8, "AT+CPIN?") == 0) say("\r\n+CPIN: READY\r\n\r\nOK\r\n");
+    else if (line.compare(0, 8, "AT+CREG?") == 0) say("\r\n+CREG: 1,1\r\n\r\nOK\r\n");
+    else if (line.compare(0, 8, "AT+CPMS?") == 0) say("\r\n+CPMS: \"SM\",0,30,\"SM\",0,30,\"SM\",0,30\r\n\r\nOK\r\n");
+    else say("\r\nOK\r\n");
+    return true;
+  }
+
+  // Lines written since the last call, terminators stripped, '|' separated
+  std::string takeCommands() {
+    std::string commands = _commands;
+    _commands.clear();
+    return commands;
+  }
+
+  int available() override {
+    release();
+    return _rx.size();
+  }
+  int read() override {
+    release();
+    if (_rx.empty()) return -1;
+    uint8_t c = _rx.front();
+    _rx.pop_front();
+    return c;
+  }
+  int peek() override {
+    release();
+    return _rx.empty() ? -1 : (uint8_t)_rx.front();
+  }
+  size_t write(uint8_t c) override {
+    written += (char)c;
+    _line += (char)c;
+    if (c == '\n' || c == 0x1A) {
+      std::string line = _line;
+      _line.clear();
+      size_t end = line.find_last_not_of("\r\n\x1A");
+      _commands += line.substr(0, end == std::string::npos ? 0 : end + 1) + "|";
+      if (onLine) onLine(*this, line);
+    }
+    return 1;
+  }
+  using Print::write;
+
+private:
+  struct Output {
+    unsigned long at;
+    std::string text;
+  };
+
+  void release() {
+    while (!_pending.empty() && (long)(millis() - _pending.front().at) >= 0) {
+      _rx.insert(_rx.end(), _pending.front().text.begin(), _pending.front().text.end());
+      _pending.pop_front();
+    }
+  }
+
+  std::deque<Output> _pending;
+  std::deque<char> _rx;
+  std::string _line;
+  std::string _commands;
+};
+
+#endif
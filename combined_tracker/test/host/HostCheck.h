@@ -0,0 +1,20 @@
+// Minimal assertions for the host tests: report the failing line, exit non-zero
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      exit(1); \
+    } \
+  } while (0)
+
+#define RUN(test) do { \
+    test(); \
+    printf("ok   %s\n", #test); \
+  } while (0)
+
+#endif
@@ -0,0 +1,27 @@
+#include <Arduino.h>
+#include <random>
+
+static unsigned long nowUs = 0;
+static std::mt19937 generator(1);
+
+unsigned long millis() { return nowUs / 1000; }
+unsigned long micros() { return nowUs; }
+void delay(unsigned long ms) { nowUs += ms * 1000UL; }
+void delayMicroseconds(unsigned int us) { nowUs += us; }
+void yield() {}
+void hostAdvance(unsigned long ms) { nowUs += ms * 1000UL; }
+
+long random(long howbig) { return howbig > 0 ? random(0, howbig) : 0; }
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return std::uniform_int_distribution<long>(howsmall, howbig - 1)(generator);
+}
+void randomSeed(unsigned long seed) { generator.seed(seed); }
+uint32_t esp_random() { return generator(); }
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return HIGH; }
+int digitalPinToInterrupt(int pin) { return pin; }
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+void detachInterrupt(uint8_t) {}
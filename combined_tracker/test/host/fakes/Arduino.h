@@ -0,0 +1,165 @@
+// Host stand-in for the parts of the ESP32 Arduino core the tested sources use.
+// Time is a simulated clock: millis() only moves through delay() and hostAdvance().
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define IRAM_ATTR
+#define F(text) (text)
+
+using std::min;
+using std::max;
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+uint32_t esp_random();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+
+// Host only: move the simulated clock
+void hostAdvance(unsigned long ms);
+
+class String {
+public:
+  String() {}
+  String(const char *text) : _s(text ? text : "") {}
+  String(const std::string &text) : _s(text) {}
+  explicit String(char c) : _s(1, c) {}
+  String(int value) : _s(std::to_string(value)) {}
+  String(unsigned int value) : _s(std::to_string(value)) {}
+  String(long value) : _s(std::to_string(value)) {}
+  String(unsigned long value) : _s(std::to_string(value)) {}
+  String(double value, unsigned char decimals = 2) { format(value, decimals); }
+  String(float value, unsigned char decimals = 2) { format(value, decimals); }
+
+  unsigned int length() const { return _s.size(); }
+  const char *c_str() const { return _s.c_str(); }
+  bool reserve(unsigned int size) { _s.reserve(size); return true; }
+  char charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+
+  int indexOf(char c, unsigned int from = 0) const { return found(_s.find(c, from)); }
+  int indexOf(const String &text, unsigned int from = 0) const { return found(_s.find(text._s, from)); }
+  int lastIndexOf(char c) const { return found(_s.rfind(c)); }
+  int lastIndexOf(const String &text) const { return found(_s.rfind(text._s)); }
+  String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    return from < _s.size() ? String(_s.substr(from, to - from)) : String();
+  }
+  bool startsWith(const String &prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+  bool endsWith(const String &suffix) const {
+    return _s.size() >= suffix._s.size() && _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+  }
+  bool equals(const String &other) const { return _s == other._s; }
+  void toCharArray(char *buffer, unsigned int size) const {
+    if (size == 0) return;
+    strncpy(buffer, _s.c_str(), size - 1);
+    buffer[size - 1] = '\0';
+  }
+  long toInt() const { return atol(_s.c_str()); }
+  float toFloat() const { return atof(_s.c_str()); }
+
+  void trim() {
+    size_t start = _s.find_first_not_of(" \t\r\n");
+    size_t end = _s.find_last_not_of(" \t\r\n");
+    _s = start == std::string::npos ? std::string() : _s.substr(start, end - start + 1);
+  }
+  void toUpperCase() { for (char &c : _s) c = toupper((unsigned char)c); }
+  void toLowerCase() { for (char &c : _s) c = tolower((unsigned char)c); }
+  void replace(const String &from, const String &to) {
+    if (from._s.empty()) return;
+    for (size_t at = _s.find(from._s); at != std::string::npos; at = _s.find(from._s, at + to._s.size())) {
+      _s.replace(at, from._s.size(), to._s);
+    }
+  }
+  void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+
+  String &operator+=(const String &other) { _s += other._s; return *this; }
+  String &operator+=(const char *text) { _s += text; return *this; }
+  String &operator+=(char c) { _s += c; return *this; }
+  bool operator==(const String &other) const { return _s == other._s; }
+  bool operator==(const char *text) const { return _s == text; }
+  bool operator!=(const String &other) const { return _s != other._s; }
+  bool operator!=(const char *text) const { return _s != text; }
+
+  friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+  friend String operator+(const String &a, const char *b) { return String(a._s + b); }
+  friend String operator+(const char *a, const String &b) { return String(a + b._s); }
+  friend String operator+(const String &a, char b) { return String(a._s + b); }
+
+private:
+  static int found(size_t at) { return at == std::string::npos ? -1 : (int)at; }
+  void format(double value, unsigned char decimals) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    _s = buf;
+  }
+
+  std::string _s;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+  }
+  size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  size_t print(const char *text) { return write(text); }
+  size_t print(const String &text) { return write(text.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value) { return print(String(value)); }
+  size_t print(unsigned int value) { return print(String(value)); }
+  size_t print(long value) { return print(String(value)); }
+  size_t print(unsigned long value) { return print(String(value)); }
+  size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+  template <typename T> size_t println(const T &value) { return print(value) + println(); }
+  size_t println() { return write("\r\n"); }
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+#endif
@@ -0,0 +1,18 @@
+// Host Bluetooth SPP: no client ever connects, output is discarded
+#ifndef HOST_BLUETOOTH_SERIAL_H
+#define HOST_BLUETOOTH_SERIAL_H
+
+#include <Arduino.h>
+
+class BluetoothSerial : public Stream {
+public:
+  bool begin(const String &) { return true; }
+  bool hasClient() { return false; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t) override { return 1; }
+  using Print::write;
+};
+
+#endif
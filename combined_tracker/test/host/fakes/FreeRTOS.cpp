@@ -0,0 +1,109 @@
+#include <Arduino.h>
+#include <deque>
+#include <vector>
+
+namespace {
+
+struct Queue {
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+// Nothing else can run while a host "task" waits: an empty wait just lets time pass
+void waitOut(TickType_t ticks) {
+  if (ticks != portMAX_DELAY) delay(ticks);
+}
+
+uint32_t notifications = 0;
+int currentTask = 0;
+
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  return new Queue{length, itemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t) {
+  Queue *queue = (Queue *)handle;
+  if (queue->items.size() >= queue->length) return pdFALSE;
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void *item, BaseType_t *woken) {
+  if (woken) *woken = pdFALSE;
+  return xQueueSend(handle, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t wait) {
+  Queue *queue = (Queue *)handle;
+  if (queue->items.empty()) {
+    waitOut(wait);
+    return pdFALSE;
+  }
+  if (queue->itemSize > 0) memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t handle) {
+  ((Queue *)handle)->items.clear();
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+  return ((Queue *)handle)->items.size();
+}
+
+// Binary semaphores and mutexes are one-slot queues
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+  xSemaphoreGive(mutex);
+  return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+  return xQueueReceive(semaphore, NULL, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  return xQueueSend(semaphore, NULL, 0);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+
+TickType_t xTaskGetTickCount() {
+  return millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return &currentTask;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t) {
+  notifications++;
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+  if (woken) *woken = pdFALSE;
+  xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+  if (notifications == 0) {
+    waitOut(wait);
+    return 0;
+  }
+  uint32_t count = notifications;
+  notifications = clear ? 0 : notifications - 1;
+  return count;
+}
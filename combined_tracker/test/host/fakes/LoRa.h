@@ -0,0 +1,33 @@
+// Host LoRa library: a radio that receives nothing and sends into the void.
+// Register-level work (CAD, IRQ flags) goes over the SPI fake instead.
+#ifndef HOST_LORA_H
+#define HOST_LORA_H
+
+#include <Arduino.h>
+
+#define LORA_DEFAULT_SPI_FREQUENCY 8E6
+
+class LoRaClass : public Stream {
+public:
+  int begin(long) { return 0; }
+  void setSpreadingFactor(int) {}
+  void setSignalBandwidth(long) {}
+  void setCodingRate4(int) {}
+  void setPreambleLength(long) {}
+  void setTxPower(int) {}
+  void receive(int = 0) {}
+  int beginPacket(int = 0) { return 1; }
+  int endPacket(bool = false) { return 1; }
+  int parsePacket(int = 0) { return 0; }
+  int packetRssi() { return -120; }
+  float packetSnr() { return 0; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t) override { return 1; }
+  using Print::write;
+};
+
+extern LoRaClass LoRa;
+
+#endif
@@ -0,0 +1,30 @@
+// Host SPI bus: each transaction's bytes go to the device a test attaches
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include <Arduino.h>
+#include <functional>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+struct SPISettings {
+  SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass {
+public:
+  // Host only: byte index within the transaction and the byte sent; returns the byte read
+  std::function<uint8_t(int index, uint8_t out)> device;
+
+  void beginTransaction(const SPISettings &) { _index = 0; }
+  uint8_t transfer(uint8_t out) { return device ? device(_index++, out) : 0; }
+  void endTransaction() {}
+
+private:
+  int _index = 0;
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,29 @@
+// Host TinyGPS++: the types the shared headers name, never a fix
+#ifndef HOST_TINYGPS_PLUS_H
+#define HOST_TINYGPS_PLUS_H
+
+#include <Arduino.h>
+
+struct TinyGPSDate {
+  bool isValid() { return false; }
+  uint16_t year() { return 0; }
+  uint8_t month() { return 0; }
+  uint8_t day() { return 0; }
+};
+
+struct TinyGPSTime {
+  bool isValid() { return false; }
+  uint8_t hour() { return 0; }
+  uint8_t minute() { return 0; }
+  uint8_t second() { return 0; }
+  uint8_t centisecond() { return 0; }
+};
+
+class TinyGPSPlus {
+public:
+  bool encode(char) { return false; }
+  TinyGPSDate date;
+  TinyGPSTime time;
+};
+
+#endif
@@ -0,0 +1,10 @@
+// Host U8g2: the display type the shared headers name, draws nothing
+#ifndef HOST_U8G2LIB_H
+#define HOST_U8G2LIB_H
+
+#include <Arduino.h>
+
+class U8G2_SSD1306_128X64_NONAME_F_HW_I2C {
+};
+
+#endif
@@ -0,0 +1,5 @@
+#include <LoRa.h>
+#include <SPI.h>
+
+LoRaClass LoRa;
+SPIClass SPI;
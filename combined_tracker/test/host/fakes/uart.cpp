@@ -0,0 +1,21 @@
+#include <Arduino.h>
+#include "driver/uart.h"
+
+esp_err_t uart_driver_install(uart_port_t, int, int, int queueSize, QueueHandle_t *queue, int) {
+  if (queue) *queue = xQueueCreate(queueSize, sizeof(uart_event_t));
+  return ESP_OK;
+}
+esp_err_t uart_param_config(uart_port_t, const uart_config_t *) { return ESP_OK; }
+esp_err_t uart_set_pin(uart_port_t, int, int, int, int) { return ESP_OK; }
+esp_err_t uart_set_baudrate(uart_port_t, uint32_t) { return ESP_OK; }
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t, char, uint8_t, int, int, int) { return ESP_OK; }
+esp_err_t uart_pattern_queue_reset(uart_port_t, int) { return ESP_OK; }
+int uart_pattern_pop_pos(uart_port_t) { return -1; }
+esp_err_t uart_get_buffered_data_len(uart_port_t, size_t *size) {
+  *size = 0;
+  return ESP_OK;
+}
+int uart_read_bytes(uart_port_t, void *, uint32_t, TickType_t) { return 0; }
+int uart_write_bytes(uart_port_t, const void *, size_t size) { return size; }
+esp_err_t uart_flush_input(uart_port_t) { return ESP_OK; }
+esp_err_t uart_wait_tx_done(uart_port_t, TickType_t) { return ESP_OK; }
@@ -0,0 +1,253 @@
+// AT command engine against a scripted modem: replies split across reads,
+// URCs interleaved with a command's response, command timeouts, and time to
+// completion against the fixed-delay reads the driver used before
+#include "FakeModem.h"
+#include "HostCheck.h"
+#include "SIM800L.h"
+
+static int urcCount[URC_COUNT];
+static std::string urcLast[URC_COUNT];
+
+static void onURC(URCType type, const char *line, const char *body, void *) {
+  urcCount[type]++;
+  urcLast[type] = body ? body : line;
+}
+
+// begin() and the bring-up probes, so the queue is empty when a test starts
+static void startReady(SIM800L &sim, FakeModem &modem) {
+  for (int i = 0; i < URC_COUNT; i++) {
+    urcCount[i] = 0;
+    urcLast[i].clear();
+    sim.onURC((URCType)i, onURC);
+  }
+  CHECK(sim.begin(modem));
+  unsigned long start = millis();
+  while (!sim.ready() && millis() - start < 5000) {
+    sim.poll();
+    delay(1);
+  }
+  CHECK(sim.ready());
+  modem.takeCommands();
+}
+
+static void splitReply() {
+  FakeModem modem;
+  SIM800L sim;
+  modem.onLine = [](FakeModem &m, const std::string &line) {
+    if (line == "AT+CSQ\r\n") {
+      m.say("\r\n+CS");
+      m.say("Q: 17,0\r", 30);
+      m.say("\n\r\nO", 30);
+      m.say("K\r\n", 30);
+    } else {
+      m.answerReady(line);
+    }
+  };
+  startReady(sim, modem);
+
+  unsigned long start = millis();
+  CHECK(sim.command("AT+CSQ", 2000) == AT_OK);
+  CHECK(millis() - start >= 90);
+  CHECK(strcmp(sim.response(), "+CSQ: 17,0\nOK\n") == 0);
+  CHECK(!sim.truncated());
+
+  // A URC split the same way is still delivered once, whole
+  modem.say("\r\n+CMT");
+  modem.say("I: \"SM\",", 20);
+  modem.say("7\r\n", 20);
+  for (int i = 0; i < 60; i++) {
+    sim.poll();
+    delay(1);
+  }
+  CHECK(urcCount[URC_CMTI] == 1);
+  CHECK(urcLast[URC_CMTI] == "+CMTI: \"SM\",7");
+}
+
+static void urcDuringCommand() {
+  FakeModem modem;
+  SIM800L sim;
+  modem.onLine = [](FakeModem &m, const std::string &line) {
+    if (line == "AT+COPS?\r\n") {
+      m.say("\r\n+CMTI: \"SM\",3\r\n");
+      m.say("\r\n+COPS: 0,0,\"TEST NET\"\r\n");
+      m.say("\r\n+CMT: \"+15550001\",\"\",\"24/05/06,12:00:00+22\"\r\nhello there\r\n");
+      m.say("RING\r\n\r\nOK\r\n", 10);
+    } else if (line == "AT+CREG?\r\n") {
+      // Answer to the command, not the +CREG URC
+      m.say("\r\n+CREG: 1,5\r\n\r\nOK\r\n");
+    } else {
+      m.answerReady(line);
+    }
+  };
+  startReady(sim, modem);
+
+  CHECK(sim.command("AT+COPS?", 2000) == AT_OK);
+  CHECK(strcmp(sim.response(), "+COPS: 0,0,\"TEST NET\"\nOK\n") == 0);
+  CHECK(urcCount[URC_CMTI] == 1 && urcLast[URC_CMTI] == "+CMTI: \"SM\",3");
+  CHECK(urcCount[URC_CMT] == 1 && urcLast[URC_CMT] == "hello there");
+  CHECK(urcCount[URC_RING] == 1);
+  CHECK(sim.incomingCall());
+
+  int cregBefore = urcCount[URC_CREG];
+  CHECK(sim.command("AT+CREG?", 2000) == AT_OK);
+  CHECK(strcmp(sim.response(), "+CREG: 1,5\nOK\n") == 0);
+  CHECK(urcCount[URC_CREG] == cregBefore);
+
+  // The same line with no command asking for it is the URC
+  modem.say("\r\n+CREG: 2\r\n");
+  sim.poll();
+  CHECK(urcCount[URC_CREG] == cregBefore + 1);
+}
+
+static void timeouts() {
+  FakeModem modem;
+  SIM800L sim;
+  bool silent = false;
+  modem.onLine = [&silent](FakeModem &m, const std::string &line) {
+    if (silent) return;
+    if (line == "AT+CSQ\r\n") m.say("\r\n+CSQ: 9,0\r\n\r\nOK\r\n", 100);
+    else m.answerReady(line);
+  };
+  startReady(sim, modem);
+
+  // No answer at all
+  silent = true;
+  unsigned long start = millis();
+  CHECK(sim.command("AT+CGATT?", 500) == AT_TIMEOUT);
+  unsigned long waited = millis() - start;
+  CHECK(waited >= 500 && waited < 520);
+  silent = false;
+
+  // The engine is usable straight after, and a slow answer inside the timeout is fine
+  CHECK(sim.command("AT+CSQ", 500) == AT_OK);
+  CHECK(strcmp(sim.response(), "+CSQ: 9,0\nOK\n") == 0);
+  CHECK(sim.command("AT+CSQ", 50) == AT_TIMEOUT);
+  // Its late OK lands while nothing is active and is not taken by the next command
+  delay(100);
+  sim.poll();
+  CHECK(sim.command("AT+CGATT?", 500) == AT_OK);
+  CHECK(strcmp(sim.response(), "OK\n") == 0);
+
+  // Asynchronous: a queued command's timeout starts when it is sent, not when queued
+  silent = true;
+  uint16_t first = sim.submit("AT+CGATT?", 300);
+  uint16_t second = sim.submit("AT+CGATT?", 300);
+  CHECK(first != 0 && second != 0);
+  start = millis();
+  while (sim.result(first) == AT_PENDING) {
+    sim.poll();
+    delay(1);
+  }
+  CHECK(sim.result(first) == AT_TIMEOUT);
+  CHECK(sim.result(second) == AT_PENDING);
+  while (sim.result(second) == AT_PENDING) {
+    sim.poll();
+    delay(1);
+  }
+  CHECK(sim.result(second) == AT_TIMEOUT);
+  CHECK(millis() - start >= 600);
+
+  // A full queue refuses more work instead of overwriting it
+  uint16_t handles[AT_QUEUE_SIZE];
+  for (int i = 0; i < AT_QUEUE_SIZE; i++) {
+    handles[i] = sim.submit("AT", 100);
+    CHECK(handles[i] != 0);
+  }
+  CHECK(sim.submit("AT", 100) == 0);
+}
+
+// The driver before the engine: the first byte awaited in 10 ms steps, then
+// Stream::readString(), which only returns once Arduino's default Stream
+// timeout (1000 ms) passes without another byte
+static std::string legacyCommand(FakeModem &modem, const char *cmd) {
+  while (modem.available()) modem.read();
+  modem.print(cmd);
+  modem.print("\r\n");
+  for (int waited = 0; !modem.available() && waited < 60 * 100; waited++) delay(10);
+  std::string text;
+  unsigned long last = millis();
+  while (millis() - last < 1000) {
+    int c = modem.read();
+    if (c < 0) {
+      delay(1);
+      continue;
+    }
+    text += (char)c;
+    last = millis();
+  }
+  return text;
+}
+
+static void completionTiming() {
+  FakeModem modem;
+  SIM800L sim;
+  modem.onLine = [](FakeModem &m, const std::string &line) {
+    if (line == "AT+CSQ\r\n") {
+      m.say("\r\n+CSQ: 17,0\r\n\r\nOK\r\n", 80);
+    } else if (line == "AT+COPS?\r\n") {
+      // The operator name first, the OK well after it
+      m.say("\r\n+COPS: 0,0,\"TEST NET\"\r\n", 300);
+      m.say("\r\nOK\r\n", 400);
+    } else {
+      m.answerReady(line);
+    }
+  };
+  startReady(sim, modem);
+
+  // Done on the final result code, against a fixed second of silence on top of it
+  const struct {
+    const char *cmd;
+    unsigned long answerMs;
+  } cases[] = {{"AT+CSQ", 80}, {"AT+COPS?", 700}};
+  for (const auto &c : cases) {
+    unsigned long start = millis();
+    CHECK(sim.command(c.cmd, 2000) == AT_OK);
+    unsigned long engine = millis() - start;
+    CHECK(engine >= c.answerMs && engine <= c.answerMs + 5);
+    CHECK(sim.lastLatency() == engine);
+
+    start = millis();
+    std::string legacy = legacyCommand(modem, c.cmd);
+    unsigned long old = millis() - start;
+    CHECK(legacy.find("\r\nOK\r\n") != std::string::npos);
+    CHECK(old >= c.answerMs + 1000 && old <= c.answerMs + 1020);
+  }
+}
+
+// Four blocking commands from a completion callback, finishing while
+// command() waits, push its entry out of the result ring
+static void nestedIntoCommand(uint16_t, ATResult, const char *, void *context) {
+  SIM800L *sim = static_cast<SIM800L *>(context);
+  for (int i = 0; i < AT_QUEUE_SIZE; i++) CHECK(sim->command("AT+CSQ", 500) == AT_OK);
+}
+
+static void resultsKept() {
+  FakeModem modem;
+  SIM800L sim;
+  modem.onLine = [](FakeModem &m, const std::string &line) {
+    if (line == "AT+CGATT?\r\n") m.say("\r\nERROR\r\n", 20);
+    else if (line == "AT+CSQ\r\n") m.say("\r\n+CSQ: 17,0\r\n\r\nOK\r\n", 20);
+    else m.answerReady(line);
+  };
+  startReady(sim, modem);
+
+  uint16_t first = sim.submit("AT", 500, nestedIntoCommand, &sim);
+  CHECK(first != 0);
+  CHECK(sim.command("AT+CGATT?", 500) == AT_ERROR);
+  std::string commands = modem.takeCommands();
+  CHECK(commands == "AT|AT+CGATT?|AT+CSQ|AT+CSQ|AT+CSQ|AT+CSQ|");
+
+  // Asked too late, a result is reported gone, not unknown
+  CHECK(sim.result(first) == AT_EXPIRED);
+  CHECK(sim.result(0) == AT_NONE);
+  CHECK(sim.result(first + 1000) == AT_NONE);
+}
+
+int main() {
+  RUN(splitReply);
+  RUN(urcDuringCommand);
+  RUN(timeouts);
+  RUN(completionTiming);
+  RUN(resultsKept);
+  return 0;
+}
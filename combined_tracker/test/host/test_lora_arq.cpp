@@ -0,0 +1,244 @@
+// Selective-repeat ARQ between a tracker and the station over a lossy link:
+// a full window on air without waiting, a lost report repaired while the
+// rest are released by one ACK bitmap, lost ACKs answered by duplicates the
+// station suppresses, escalation to SMS, and a long random-loss run.
+#include "HostCheck.h"
+#include "Config.h"
+#include "LoRaArq.h"
+#include <random>
+#include <set>
+
+static uint16_t nextSeq = 100;
+
+static uint16_t queueReport(const char *payload = "") {
+  uint8_t frame[POS_FRAME_LEN] = {0};
+  uint16_t seq = nextSeq++;
+  arqQueue(frame, sizeof(frame), seq, true, payload);
+  return seq;
+}
+
+// The next frame the tracker puts on air within ms; -1 if none
+static int transmit(unsigned long ms = LORA_ARQ_GAP) {
+  for (unsigned long waited = 0; waited <= ms; waited += 10) {
+    ArqFrame *frame = arqDue();
+    if (frame != NULL) {
+      int seq = frame->seq;
+      arqSent(frame);
+      return seq;
+    }
+    delay(10);
+  }
+  return -1;
+}
+
+// The station's ACK for a report, through the frame codec
+static AckFrame stationAck(const char *id, uint16_t seq, bool *fresh) {
+  AckFrame ack, heard;
+  *fresh = arqReceive(id, seq, ack);
+  uint8_t frame[ACK_FRAME_LEN];
+  CHECK(ackEncode(ack, frame, sizeof(frame)) == ACK_FRAME_LEN);
+  CHECK(ackDecode(frame, sizeof(frame), heard) == POS_OK);
+  return heard;
+}
+
+static void windowOnAir() {
+  // A backlog goes out one per LORA_ARQ_GAP, not one per round trip
+  uint16_t first = queueReport();
+  for (int i = 1; i < LORA_ARQ_WINDOW; i++) queueReport();
+  unsigned long start = millis();
+  for (int i = 0; i < LORA_ARQ_WINDOW; i++) {
+    CHECK(transmit() == first + i);
+  }
+  CHECK(millis() - start <= (LORA_ARQ_WINDOW - 1) * (LORA_ARQ_GAP + 10));
+  CHECK(transmit() == -1);
+  CHECK(arqStats().inFlight == LORA_ARQ_WINDOW);
+
+  // One ACK naming the newest with the others in its bitmap releases all
+  AckFrame ack = {};
+  strcpy(ack.id, "T0");
+  ack.seq = first + LORA_ARQ_WINDOW - 1;
+  ack.mask = (1 << (LORA_ARQ_WINDOW - 1)) - 1;
+  CHECK(arqAcked(ack) == LORA_ARQ_WINDOW);
+  CHECK(arqStats().inFlight == 0);
+}
+
+static void lostReportRepaired() {
+  ArqStats before = arqStats();
+  uint16_t a = queueReport(), b = queueReport(), c = queueReport(), d = queueReport();
+  bool fresh;
+
+  // b is lost on air, and so are the ACKs of a and c
+  CHECK(transmit() == a);
+  stationAck("T1", a, &fresh);
+  CHECK(fresh);
+  CHECK(transmit() == b);
+  CHECK(transmit() == c);
+  stationAck("T1", c, &fresh);
+  CHECK(transmit() == d);
+  AckFrame ack = stationAck("T1", d, &fresh);
+  CHECK(fresh && ack.seq == d && ack.mask == 0x05);   // c and a, not b
+
+  CHECK(arqAcked(ack) == 3);
+  CHECK(arqStats().inFlight == 1);
+
+  // Only b is sent again, once its timer runs out
+  CHECK(transmit(LORA_ACK_TIMEOUT) == b);
+  CHECK(arqTimeouts() == 1);
+  ack = stationAck("T1", b, &fresh);
+  CHECK(fresh);
+  CHECK(arqAcked(ack) == 1);
+
+  ArqStats after = arqStats();
+  CHECK(after.retransmits - before.retransmits == 1);
+  CHECK(after.acked - before.acked == 4 && after.inFlight == 0);
+  CHECK(after.duplicates == before.duplicates);
+}
+
+static void duplicateSuppressed() {
+  ArqStats before = arqStats();
+  uint16_t seq = queueReport();
+  bool fresh;
+
+  // Delivered, but the ACK is lost: the retry reaches the station again
+  CHECK(transmit() == seq);
+  stationAck("T2", seq, &fresh);
+  CHECK(fresh);
+  CHECK(transmit(LORA_ACK_TIMEOUT + 100) == seq);
+  AckFrame ack = stationAck("T2", seq, &fresh);
+  CHECK(!fresh);
+  CHECK(arqStats().duplicates - before.duplicates == 1);
+
+  // The duplicate is still acknowledged, which ends the retries
+  CHECK(arqAcked(ack) == 1);
+  CHECK(transmit(4 * LORA_ACK_TIMEOUT) == -1);
+  arqTimeouts();
+}
+
+static void escalatedAfterRetries() {
+  ArqStats before = arqStats();
+  uint16_t seq = queueReport("LOC 28.6,77.2");
+
+  // Retries back off 1x, 2x, 4x LORA_ACK_TIMEOUT, plus up to half of it in jitter
+  CHECK(transmit() == seq);
+  unsigned long sentAt = millis();
+  unsigned long timeout = LORA_ACK_TIMEOUT;
+  for (int retry = 1; retry <= LORA_ARQ_RETRIES; retry++) {
+    CHECK(transmit(8 * LORA_ACK_TIMEOUT) == seq);
+    unsigned long gap = millis() - sentAt;
+    CHECK(gap >= timeout && gap <= timeout + (retry > 1 ? LORA_ACK_TIMEOUT / 2 : 0) + 10);
+    sentAt = millis();
+    timeout *= 2;
+  }
+
+  // Nothing on air after the last retry; the report goes to the SMS fallback
+  CHECK(transmit(timeout + LORA_ACK_TIMEOUT) == -1);
+  ArqFrame lost;
+  CHECK(arqGiveUp(lost));
+  CHECK(lost.seq == seq && lost.payload == "LOC 28.6,77.2");
+  CHECK(!arqGiveUp(lost));
+  CHECK(arqTimeouts() == LORA_ARQ_RETRIES + 1);
+
+  ArqStats after = arqStats();
+  CHECK(after.escalated - before.escalated == 1);
+  CHECK(after.retransmits - before.retransmits == LORA_ARQ_RETRIES);
+  CHECK(after.inFlight == 0);
+}
+
+static void evictedWhenFull() {
+  ArqStats before = arqStats();
+  uint16_t oldest = queueReport();
+  for (int i = 1; i < LORA_ARQ_WINDOW; i++) {
+    delay(10);
+    queueReport();
+  }
+  delay(10);
+  uint16_t newest = queueReport();
+
+  ArqFrame lost;
+  CHECK(arqGiveUp(lost) && lost.seq == oldest);
+  CHECK(arqStats().evicted - before.evicted == 1);
+
+  for (int i = 1; i <= LORA_ARQ_WINDOW; i++) {
+    CHECK(transmit() == oldest + i);
+  }
+  AckFrame ack = {};
+  strcpy(ack.id, "T3");
+  ack.seq = newest;
+  ack.mask = 0xFF;
+  CHECK(arqAcked(ack) == LORA_ARQ_WINDOW);
+}
+
+// Reports every 10 s over a link losing frames and ACKs independently.
+// Every report is acknowledged or escalated, none reaches the station's
+// application twice, and without loss nothing is sent twice.
+static void lossyLink(const char *id, double loss) {
+  ArqStats before = arqStats();
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> draw(0, 1);
+  std::set<uint16_t> delivered;
+  int made = 0, escalated = 0, deliveredTwice = 0;
+  bool ackOnAir = false;
+  AckFrame ack;
+  unsigned long ackAt = 0;
+  unsigned long nextReport = millis();
+  unsigned long end = millis() + 300 * 10000UL + 200000;
+
+  while ((long)(millis() - end) < 0) {
+    delay(50);
+    if (made < 300 && (long)(millis() - nextReport) >= 0) {
+      queueReport();
+      made++;
+      nextReport += 10000;
+    }
+    if (ackOnAir && (long)(millis() - ackAt) >= 0) {
+      ackOnAir = false;
+      if (draw(rng) >= loss) arqAcked(ack);
+    }
+    arqTimeouts();
+    ArqFrame lost;
+    while (arqGiveUp(lost)) escalated++;
+
+    ArqFrame *frame = arqDue();
+    if (frame == NULL) continue;
+    uint16_t seq = frame->seq;
+    arqSent(frame);
+    if (draw(rng) < loss) continue;
+    AckFrame reply;
+    bool fresh = arqReceive(id, seq, reply);
+    if (fresh != (delivered.count(seq) == 0)) deliveredTwice++;
+    delivered.insert(seq);
+    if (!ackOnAir) {
+      ack = reply;
+      ackOnAir = true;
+      ackAt = millis() + 300;
+    }
+  }
+
+  ArqStats after = arqStats();
+  CHECK(deliveredTwice == 0);
+  CHECK(after.inFlight == 0);
+  CHECK((int)(after.acked - before.acked) + escalated == made);
+  if (loss == 0) {
+    CHECK(escalated == 0 && after.retransmits == before.retransmits);
+  } else {
+    CHECK(after.retransmits > before.retransmits);
+    CHECK(after.duplicates > before.duplicates);
+    CHECK((int)delivered.size() > made * 9 / 10);
+  }
+}
+
+static void randomLoss() {
+  lossyLink("T4", 0);
+  lossyLink("T5", 0.1);
+  lossyLink("T6", 0.3);
+}
+
+int main() {
+  RUN(windowOnAir);
+  RUN(lostReportRepaired);
+  RUN(duplicateSuppressed);
+  RUN(escalatedAfterRetries);
+  RUN(evictedWhenFull);
+  RUN(randomLoss);
+  return 0;
+}
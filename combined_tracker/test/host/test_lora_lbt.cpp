@@ -0,0 +1,309 @@
+// Listen before talk: the RX task's channel check and random exponential
+// backoff, against an SX127x register model whose CAD result the test sets,
+// then the same backoff rule on a channel shared by 8 and 16 trackers
+#include "HostCheck.h"
+#include "Globals.h"
+#include "Config.h"
+#include "LoRaManager.h"
+#include <SPI.h>
+#include <deque>
+#include <vector>
+
+// Globals LoRaManager.cpp links against
+SemaphoreHandle_t loraMutex;
+
+void logToBoth(const String &) {}
+
+#define REG_OP_MODE 0x01
+#define REG_IRQ_FLAGS 0x12
+#define REG_MODEM_STAT 0x18
+#define REG_DIO_MAPPING_1 0x40
+#define MODE_CAD 0x87
+#define IRQ_TX_DONE 0x08
+#define IRQ_CAD_DONE 0x04
+#define IRQ_CAD_DETECTED 0x01
+#define STAT_RECEIVING 0x0B
+
+// The radio: each CAD takes the next scripted result (busy when true), or
+// finds the channel clear once the script runs out
+static uint8_t regs[128];
+static uint8_t address;
+static std::deque<bool> cadScript;
+static bool cadFinishes = true;
+static std::vector<unsigned long> cadAt;    // when each CAD started
+static int transmits = 0;
+
+static uint8_t radio(int index, uint8_t out) {
+  if (index == 0) {
+    address = out;
+    return 0;
+  }
+  uint8_t reg = address & 0x7F;
+  if (!(address & 0x80)) return regs[reg];
+  if (reg == REG_IRQ_FLAGS) {
+    regs[reg] &= ~out;   // write 1 to clear
+  } else {
+    regs[reg] = out;
+  }
+  if (reg == REG_OP_MODE && out == MODE_CAD) {
+    cadAt.push_back(millis());
+    bool busy = !cadScript.empty() && cadScript.front();
+    if (!cadScript.empty()) cadScript.pop_front();
+    if (cadFinishes) regs[REG_IRQ_FLAGS] |= IRQ_CAD_DONE | (busy ? IRQ_CAD_DETECTED : 0);
+  }
+  if (reg == REG_DIO_MAPPING_1 && out == 0x40) {
+    // About to go on air; done by the time the RX task looks
+    transmits++;
+    regs[REG_IRQ_FLAGS] |= IRQ_TX_DONE;
+  }
+  return 0;
+}
+
+// Run the RX task until the packet tagged tag is reported
+static LoRaTxEvent sendOne(uint16_t tag) {
+  uint8_t frame[POS_FRAME_LEN] = {0};
+  CHECK(loraSend(frame, sizeof(frame), LORA_PRIO_CONTROL, tag) == LORA_TX_SENT);
+  LoRaTxEvent event = {};
+  for (int pass = 0; pass < 100; pass++) {
+    loraRxService();
+    if (loraTxPop(event)) {
+      CHECK(event.tag == tag);
+      return event;
+    }
+  }
+  CHECK(false);
+  return event;
+}
+
+// Backoff window after the n-th busy check, as the milliseconds the RX task waits
+static unsigned long window(int n) {
+  unsigned long w = (loraAirtime(POS_FRAME_LEN) / 1000 + 1) << n;
+  return w > LORA_LBT_BACKOFF_MAX ? LORA_LBT_BACKOFF_MAX : w;
+}
+
+static void clearChannel() {
+  LoRaLbtStats before = loraLbtStats();
+  cadAt.clear();
+  LoRaTxEvent event = sendOne(1);
+  CHECK(event.result == LORA_TX_SENT);
+  CHECK(cadAt.size() == 1 && transmits == 1);
+  LoRaLbtStats after = loraLbtStats();
+  CHECK(after.checks - before.checks == 1);
+  CHECK(after.busy == before.busy && after.backoffs == before.backoffs);
+}
+
+static void backoffWindows() {
+  // Busy for all but the last check: windows of one airtime, doubling
+  for (int i = 0; i < LORA_LBT_TRIES - 1; i++) cadScript.push_back(true);
+  cadAt.clear();
+  LoRaLbtStats before = loraLbtStats();
+  LoRaTxEvent event = sendOne(2);
+  CHECK(event.result == LORA_TX_SENT);
+  CHECK(cadAt.size() == LORA_LBT_TRIES);
+  unsigned long total = 0;
+  for (int n = 0; n < LORA_LBT_TRIES - 1; n++) {
+    // The wait starts once the CAD (polled every 1 ms) is done
+    unsigned long wait = cadAt[n + 1] - cadAt[n] - 1;
+    CHECK(wait >= window(n) / 2 && wait <= window(n));
+    total += wait;
+  }
+  LoRaLbtStats after = loraLbtStats();
+  CHECK(after.backoffs - before.backoffs == LORA_LBT_TRIES - 1);
+  CHECK(after.backoffMs - before.backoffMs == total);
+}
+
+static void backoffCapped() {
+  // At SF12 a position frame takes 1.6 s: the second window already hits LORA_LBT_BACKOFF_MAX
+  loraRadioSet(12, LORA_POWER_MAX);
+  CHECK(window(0) < LORA_LBT_BACKOFF_MAX && window(1) == LORA_LBT_BACKOFF_MAX);
+  for (int i = 0; i < LORA_LBT_TRIES - 1; i++) cadScript.push_back(true);
+  cadAt.clear();
+  CHECK(sendOne(3).result == LORA_TX_SENT);
+  for (int n = 0; n < LORA_LBT_TRIES - 1; n++) {
+    unsigned long wait = cadAt[n + 1] - cadAt[n] - 1;
+    CHECK(wait >= window(n) / 2 && wait <= window(n));
+  }
+  loraRadioSet(LORA_SF_DEFAULT, LORA_POWER_MAX);
+}
+
+static void backoffDistribution() {
+  // First backoffs spread evenly over the upper half of the window, so
+  // trackers that heard the same packet do not all come back together
+  const int SAMPLES = 2000;
+  unsigned long low = window(0) / 2, high = window(0);
+  int bins[4] = {0};
+  double sum = 0;
+  for (int i = 0; i < SAMPLES; i++) {
+    cadScript.push_back(true);
+    cadAt.clear();
+    CHECK(sendOne(100).result == LORA_TX_SENT);
+    CHECK(cadAt.size() == 2);
+    unsigned long wait = cadAt[1] - cadAt[0] - 1;
+    CHECK(wait >= low && wait <= high);
+    bins[std::min(3UL, (wait - low) * 4 / (high - low + 1))]++;
+    sum += wait;
+  }
+  for (int b = 0; b < 4; b++) {
+    CHECK(bins[b] > SAMPLES / 4 * 8 / 10 && bins[b] < SAMPLES / 4 * 12 / 10);
+  }
+  double mean = sum / SAMPLES;
+  CHECK(mean > (low + high) / 2.0 - 1 && mean < (low + high) / 2.0 + 1);
+}
+
+static void gaveUp() {
+  // Busy on every check: dropped after LORA_LBT_TRIES, airtime refunded
+  float tokens = loraDutyStats().tokensMs;
+  LoRaLbtStats before = loraLbtStats();
+  int sent = transmits;
+  for (int i = 0; i < LORA_LBT_TRIES; i++) cadScript.push_back(true);
+  cadAt.clear();
+  CHECK(sendOne(4).result == LORA_TX_CHANNEL);
+  CHECK(transmits == sent && cadAt.size() == LORA_LBT_TRIES);
+  LoRaLbtStats after = loraLbtStats();
+  CHECK(after.gaveUp - before.gaveUp == 1);
+  CHECK(after.busy - before.busy == LORA_LBT_TRIES);
+  CHECK(after.backoffs - before.backoffs == LORA_LBT_TRIES - 1);
+  CHECK(loraDutyStats().tokensMs >= tokens);
+}
+
+static void receivingIsBusy() {
+  // A packet arriving: no CAD (it would abort the reception), back off
+  regs[REG_MODEM_STAT] = STAT_RECEIVING;
+  uint8_t frame[POS_FRAME_LEN] = {0};
+  LoRaLbtStats before = loraLbtStats();
+  cadAt.clear();
+  CHECK(loraSend(frame, sizeof(frame), LORA_PRIO_CONTROL, 5) == LORA_TX_SENT);
+  loraRxService();
+  CHECK(cadAt.empty());
+  CHECK(loraLbtStats().busy - before.busy == 1);
+  regs[REG_MODEM_STAT] = 0;
+  LoRaTxEvent event = {};
+  for (int pass = 0; pass < 10 && !loraTxPop(event); pass++) loraRxService();
+  CHECK(event.tag == 5 && event.result == LORA_TX_SENT);
+  CHECK(cadAt.size() == 1);
+}
+
+static void cadTimeout() {
+  // A CAD that never reports done counts as busy
+  cadFinishes = false;
+  LoRaLbtStats before = loraLbtStats();
+  int sent = transmits;
+  uint8_t frame[POS_FRAME_LEN] = {0};
+  CHECK(loraSend(frame, sizeof(frame), LORA_PRIO_CONTROL, 6) == LORA_TX_SENT);
+  loraRxService();
+  CHECK(loraLbtStats().busy - before.busy == 1 && transmits == sent);
+  cadFinishes = true;
+  LoRaTxEvent event = {};
+  for (int pass = 0; pass < 10 && !loraTxPop(event); pass++) loraRxService();
+  CHECK(event.tag == 6 && event.result == LORA_TX_SENT);
+}
+
+// Trackers sharing one channel, all in range of each other. Each sends a
+// position frame per GPS_SEND_INTERVAL within a second of the GPS fix that
+// triggers it, so reports bunch up. With LBT a tracker runs a CAD first and
+// backs off by the driver's rule while anyone is on air; without, it sends
+// at once. Packets overlapping on air are lost to collision.
+struct ChannelRun {
+  int offered;
+  int collided;
+  int gaveUp;
+};
+
+static ChannelRun channel(int nodes, bool lbt) {
+  enum { IDLE, WAITING, CAD };
+  struct Node {
+    int state;
+    unsigned long until;
+    int attempt;
+  };
+  // Two symbols at SF7/125 kHz, rounded up to the simulation's 1 ms step
+  const unsigned long CAD_MS = 3;
+  const unsigned long AIRTIME_MS = loraAirtime(POS_FRAME_LEN) / 1000 + 1;
+  const int FRAMES = 300;
+
+  std::vector<Node> node(nodes, Node{IDLE, 0, 0});
+  std::vector<std::pair<unsigned long, unsigned long>> onAir;   // start, end
+  ChannelRun run = {0, 0, 0};
+  auto busy = [&](unsigned long from, unsigned long to) {
+    // Every packet takes the same airtime, so the latest ones end last
+    for (auto it = onAir.rbegin(); it != onAir.rend() && it->second > from; ++it) {
+      if (it->first < to && it->second > from) return true;
+    }
+    return false;
+  };
+
+  for (unsigned long t = 0; t < (unsigned long)FRAMES * GPS_SEND_INTERVAL; t++) {
+    if (t % GPS_SEND_INTERVAL == 0) {
+      for (Node &n : node) {
+        n.state = WAITING;
+        n.until = t + random(0, 1000);
+        n.attempt = 0;
+        run.offered++;
+      }
+    }
+    std::vector<unsigned long> starting;
+    for (Node &n : node) {
+      if (n.state == IDLE || n.until != t) continue;
+      if (!lbt) {
+        starting.push_back(t);
+        n.state = IDLE;
+      } else if (n.state == WAITING) {
+        n.state = CAD;
+        n.until = t + CAD_MS;
+      } else if (!busy(t - CAD_MS, t)) {
+        // Clear: on air from the end of the CAD
+        starting.push_back(t);
+        n.state = IDLE;
+      } else if (++n.attempt >= LORA_LBT_TRIES) {
+        run.gaveUp++;
+        n.state = IDLE;
+      } else {
+        n.state = WAITING;
+        n.until = t + random(window(n.attempt - 1) / 2, window(n.attempt - 1) + 1);
+      }
+    }
+    // Trackers deciding in the same millisecond cannot hear each other
+    for (unsigned long start : starting) onAir.push_back({start, start + AIRTIME_MS});
+  }
+
+  std::vector<bool> lost(onAir.size(), false);
+  for (size_t i = 0; i < onAir.size(); i++) {
+    for (size_t j = i + 1; j < onAir.size() && onAir[j].first < onAir[i].second; j++) {
+      lost[i] = lost[j] = true;
+    }
+  }
+  for (bool l : lost) run.collided += l;
+  CHECK((int)onAir.size() + run.gaveUp == run.offered);
+  return run;
+}
+
+static void sharedChannel() {
+  for (int nodes : {8, 16}) {
+    ChannelRun aloha = channel(nodes, false);
+    ChannelRun lbt = channel(nodes, true);
+    CHECK(aloha.gaveUp == 0);
+    double alohaRate = (double)aloha.collided / aloha.offered;
+    double lbtRate = (double)lbt.collided / lbt.offered;
+    // Collisions only among trackers whose CADs end together
+    CHECK(lbtRate < alohaRate / 4);
+    // And more reports get through, the ones given up counted as lost
+    CHECK(lbt.offered - lbt.collided - lbt.gaveUp > aloha.offered - aloha.collided);
+  }
+}
+
+int main() {
+  loraMutex = xSemaphoreCreateMutex();
+  SPI.device = radio;
+  loraRadioBegin();
+  loraRxAttach(NULL);
+
+  RUN(clearChannel);
+  RUN(backoffWindows);
+  RUN(backoffCapped);
+  RUN(backoffDistribution);
+  RUN(gaveUp);
+  RUN(receivingIsBusy);
+  RUN(cadTimeout);
+  RUN(sharedChannel);
+  return 0;
+}
@@ -0,0 +1,199 @@
+// TDMA slots: where a synced tracker may send, and the station's slot
+// bookkeeping over simulated frames in which every tracker sends once.
+// Overlapping packets on the simulated channel reach the station corrupt.
+#include "HostCheck.h"
+#include "Config.h"
+#include "LoRaManager.h"
+#include "LoRaTdma.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// LoRaManager.cpp stand-in: a 28-byte position frame at SF7/125 kHz
+#define FRAME_AIRTIME_US 61696
+uint32_t loraAirtime(size_t) { return FRAME_AIRTIME_US; }
+
+#define AIRTIME_MS (FRAME_AIRTIME_US / 1000 + 1)
+// Room for any prefix plus an int; the ids made here stay within POS_ID_LEN
+#define ID_BUF 16
+// Last opening in a slot at which a position frame still ends before the guard
+#define LATEST_START (TDMA_SLOT_MS - 2 * LORA_TDMA_GUARD - AIRTIME_MS)
+
+static void slotHash() {
+  int count[LORA_TDMA_SLOTS] = {0};
+  char id[ID_BUF];
+  for (int i = 0; i < 800; i++) {
+    snprintf(id, sizeof(id), "T%d", i);
+    count[tdmaSlotOf(id)]++;
+  }
+  for (int s = 0; s < LORA_TDMA_SLOTS; s++) {
+    CHECK(count[s] > 800 / LORA_TDMA_SLOTS / 2 && count[s] < 800 / LORA_TDMA_SLOTS * 3 / 2);
+  }
+  CHECK(tdmaOwnSlot() == tdmaSlotOf(SOLDIER_ID));
+}
+
+static void trackerWindow() {
+  // No GPS time yet: send right away, unslotted
+  CHECK(!tdmaSynced() && tdmaWait(FRAME_AIRTIME_US) == 0);
+
+  // 1700000000 s is a multiple of the 5 s frame: the frame starts now
+  tdmaSync(1700000000, 0, millis());
+  CHECK(tdmaSynced());
+  unsigned long frame = millis();
+  uint32_t open = tdmaOwnSlot() * TDMA_SLOT_MS + LORA_TDMA_GUARD;
+
+  // Clear to send exactly from the opening until the packet would run into the guard
+  for (unsigned long t = 0; t < GPS_SEND_INTERVAL; t += 10) {
+    delay(frame + t - millis());
+    unsigned long wait = tdmaWait(FRAME_AIRTIME_US);
+    bool inWindow = t >= open && t <= open + LATEST_START;
+    CHECK((wait == 0) == inWindow);
+    // Outside it, the wait ends at the next opening
+    if (!inWindow) CHECK((t + wait) % GPS_SEND_INTERVAL == open);
+  }
+
+  // A packet longer than the slot still goes, at the opening
+  delay(frame + GPS_SEND_INTERVAL + open - millis());
+  CHECK(tdmaWait(2000000) == 0);
+
+  // Without GPS time for LORA_TDMA_HOLDOVER the tracker falls back to unslotted
+  delay(LORA_TDMA_HOLDOVER);
+  CHECK(!tdmaSynced() && tdmaWait(FRAME_AIRTIME_US) == 0);
+  CHECK(tdmaStats().syncAge >= LORA_TDMA_HOLDOVER);
+}
+
+struct Packet {
+  const char *id;
+  bool slotted;
+  unsigned long start;
+  bool collided;
+};
+
+// The station hears every packet as it ends; packets overlapping on air are corrupt
+static void air(std::vector<Packet> &packets) {
+  std::sort(packets.begin(), packets.end(), [](const Packet &a, const Packet &b) { return a.start < b.start; });
+  for (size_t i = 0; i < packets.size(); i++) {
+    for (size_t j = i + 1; j < packets.size() && packets[j].start < packets[i].start + AIRTIME_MS; j++) {
+      packets[i].collided = packets[j].collided = true;
+    }
+  }
+  for (const Packet &p : packets) {
+    delay(p.start + AIRTIME_MS - millis());
+    if (p.collided) {
+      tdmaCorrupt(POS_FRAME_LEN, millis());
+    } else {
+      tdmaHeard(p.id, p.slotted, POS_FRAME_LEN, millis());
+    }
+  }
+}
+
+static void slottedFrames() {
+  // ids[s] sends in slot s, and ids[LORA_TDMA_SLOTS] shares slot 0
+  static char ids[LORA_TDMA_SLOTS + 1][ID_BUF];
+  int found = 0;
+  for (int n = 0; found < LORA_TDMA_SLOTS + 1; n++) {
+    char id[ID_BUF];
+    snprintf(id, sizeof(id), "BSF%d", n);
+    int slot = tdmaSlotOf(id);
+    if (ids[slot][0] == '\0') {
+      strcpy(ids[slot], id);
+      found++;
+    } else if (slot == 0 && ids[LORA_TDMA_SLOTS][0] == '\0') {
+      strcpy(ids[LORA_TDMA_SLOTS], id);
+      found++;
+    }
+  }
+
+  // Each sends once a frame at a random point of its window, give or take
+  // the NMEA latency the guard is there for
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int> within(0, LATEST_START);
+  std::uniform_int_distribution<int> latency(-LORA_TDMA_GUARD / 2, LORA_TDMA_GUARD / 2);
+  unsigned long frame = millis() + GPS_SEND_INTERVAL;
+  auto sendFrames = [&](int frames) {
+    for (int f = 0; f < frames; f++, frame += GPS_SEND_INTERVAL) {
+      std::vector<Packet> packets;
+      for (int i = 0; i <= LORA_TDMA_SLOTS; i++) {
+        unsigned long start = frame + tdmaSlotOf(ids[i]) * TDMA_SLOT_MS + LORA_TDMA_GUARD + within(rng) + latency(rng);
+        packets.push_back({ids[i], true, start, false});
+      }
+      air(packets);
+    }
+  };
+
+  // The station locks on the first report and settles within a few frames
+  sendFrames(10);
+  TdmaSlot settled[LORA_TDMA_SLOTS];
+  tdmaSlots(settled);
+  const int FRAMES = 100;
+  sendFrames(FRAMES);
+
+  TdmaStats stats = tdmaStats();
+  CHECK(stats.locked && stats.unslotted == 0 && stats.unplaced == 0);
+  TdmaSlot slots[LORA_TDMA_SLOTS];
+  tdmaSlots(slots);
+  for (int s = 0; s < LORA_TDMA_SLOTS; s++) {
+    unsigned long reports = slots[s].reports - settled[s].reports;
+    unsigned long corrupt = slots[s].corrupt - settled[s].corrupt;
+    CHECK(slots[s].foreign == settled[s].foreign);
+    CHECK(reports + corrupt == (unsigned long)FRAMES * (s == 0 ? 2 : 1));
+    CHECK(slots[s].trackers == (s == 0 ? 2 : 1));
+    // Only the shared slot ever collides
+    if (s != 0) CHECK(corrupt == 0);
+  }
+  CHECK(slots[0].corrupt > 0);
+
+  // A tracker whose clock is a slot late is booked foreign where it lands
+  // and does not drag the frame with it
+  std::vector<Packet> late = {{ids[1], true, frame + 2 * TDMA_SLOT_MS + LORA_TDMA_GUARD, false}};
+  air(late);
+  std::vector<Packet> onTime = {{ids[3], true, frame + GPS_SEND_INTERVAL + 3 * TDMA_SLOT_MS + LORA_TDMA_GUARD, false}};
+  air(onTime);
+  TdmaSlot after[LORA_TDMA_SLOTS];
+  tdmaSlots(after);
+  CHECK(after[2].foreign == 1 && after[2].reports == slots[2].reports + 1);
+  CHECK(after[3].foreign == 0 && after[3].reports == slots[3].reports + 1);
+}
+
+// The same trackers without GPS time, sending anywhere in the frame
+static void unslottedFrames() {
+  TdmaSlot before[LORA_TDMA_SLOTS];
+  tdmaSlots(before);
+  unsigned long corruptBefore = 0;
+  for (int s = 0; s < LORA_TDMA_SLOTS; s++) corruptBefore += before[s].corrupt;
+
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<int> anywhere(0, GPS_SEND_INTERVAL - AIRTIME_MS);
+  unsigned long frame = millis() + GPS_SEND_INTERVAL;
+  const int FRAMES = 100;
+  static char ids[LORA_TDMA_SLOTS + 1][ID_BUF];
+  for (int i = 0; i <= LORA_TDMA_SLOTS; i++) snprintf(ids[i], sizeof(ids[i]), "U%d", i);
+  for (int f = 0; f < FRAMES; f++, frame += GPS_SEND_INTERVAL) {
+    std::vector<Packet> packets;
+    for (int i = 0; i <= LORA_TDMA_SLOTS; i++) {
+      packets.push_back({ids[i], false, frame + anywhere(rng), false});
+    }
+    air(packets);
+  }
+
+  TdmaSlot after[LORA_TDMA_SLOTS];
+  tdmaSlots(after);
+  unsigned long corrupt = 0;
+  for (int s = 0; s < LORA_TDMA_SLOTS; s++) corrupt += after[s].corrupt;
+  CHECK(tdmaStats().unslotted == (unsigned long)FRAMES * (LORA_TDMA_SLOTS + 1) - (corrupt - corruptBefore));
+  // Collisions now land in every part of the frame
+  int slotsHit = 0;
+  for (int s = 0; s < LORA_TDMA_SLOTS; s++) {
+    if (after[s].corrupt > before[s].corrupt) slotsHit++;
+  }
+  CHECK(slotsHit > LORA_TDMA_SLOTS / 2);
+  CHECK(corrupt - corruptBefore > before[0].corrupt);
+}
+
+int main() {
+  RUN(slotHash);
+  RUN(trackerWindow);
+  RUN(slottedFrames);
+  RUN(unslottedFrames);
+  return 0;
+}
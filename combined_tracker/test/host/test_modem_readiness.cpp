@@ -0,0 +1,173 @@
+// Modem task bring-up and network supervision against a scripted module that
+// boots slowly, loses registration, and reboots without its SIM
+#include "FakeModem.h"
+#include "HostCheck.h"
+#include "Globals.h"
+#include "Config.h"
+#include "DisplayManager.h"
+#include "ModemManager.h"
+#include "Utils.h"
+
+// Globals ModemManager.cpp links against
+SIM800L sim800l;
+BluetoothSerial BT;
+UartLineSource SerialSIM(UART_NUM_1, true);
+SystemStatus systemStatus;
+OperatingMode currentMode = MODE_TRACKER;
+DisplayState displayState;
+
+static std::string logged;
+static int smsSent = 0;
+
+void logToBoth(const String &message) { logged += std::string(message.c_str()) + "\n"; }
+void displayReceivedMessage(String, String, String) {}
+bool sendSMSToNumber(const char *, const String &) { return ++smsSent > 0; }
+bool sendSMSToAll(const String &) { return ++smsSent > 0; }
+void uplinkService() {}
+
+// The module: answers nothing for 800 ms after power-up, the SIM is busy
+// until 1.5 s, registration completes at 4 s and SMS storage at 6 s
+static FakeModem modem;
+static unsigned long poweredAt = 0;
+static bool simInserted = true;
+static int registration = 1;     // +CREG <stat> once the network search is over
+
+static int regStat() {
+  return millis() - poweredAt < 4000 ? 2 : registration;
+}
+
+static void answer(FakeModem &m, const std::string &line) {
+  unsigned long up = millis() - poweredAt;
+  if (up < 800) return;
+  if (line.compare(0, 11, "AT+CFUN=1,1") == 0) {
+    m.say("\r\nOK\r\n");
+    poweredAt = millis() + 1;
+  } else if (line.compare(0, 8, "AT+CPIN?") == 0) {
+    if (!simInserted) m.say("\r\n+CPIN: NOT INSERTED\r\n\r\nOK\r\n");
+    else if (up < 1500) m.say("\r\n+CME ERROR: 14\r\n");
+    else m.say("\r\n+CPIN: READY\r\n\r\nOK\r\n");
+  } else if (line.compare(0, 8, "AT+CREG?") == 0) {
+    m.say("\r\n+CREG: 1," + std::to_string(regStat()) + "\r\n\r\nOK\r\n");
+  } else if (line.compare(0, 13, "AT+CSQ;+CREG?") == 0) {
+    m.say("\r\n+CSQ: 18,0\r\n\r\n+CREG: 1," + std::to_string(regStat()) + "\r\n\r\nOK\r\n");
+  } else if (line.compare(0, 8, "AT+CPMS?") == 0) {
+    m.say(up < 6000 ? "\r\n+CMS ERROR: 302\r\n" : "\r\n+CPMS: \"SM\",0,30,\"SM\",0,30,\"SM\",0,30\r\n\r\nOK\r\n");
+  } else {
+    m.answerReady(line);
+  }
+}
+
+static void runFor(unsigned long ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) modemService(10);
+}
+
+static bool runUntil(bool (*done)(), unsigned long limitMs) {
+  unsigned long start = millis();
+  while (!done()) {
+    if (millis() - start >= limitMs) return false;
+    modemService(10);
+  }
+  return true;
+}
+
+static bool isReady() { return sim800l.ready(); }
+static bool isFailed() { return sim800l.bootStage() == BOOT_FAILED; }
+static bool isRegistered() { return modemHealth().registered; }
+
+static void bringUp() {
+  modem.onLine = answer;
+  SerialSIM.begin(MODEM_BAUD_INITIAL, SIM_RX_PIN, SIM_TX_PIN);
+  modemInit();
+  CHECK(sim800l.begin(modem));
+  modemAttach();
+  CHECK(sim800l.bootTime(BOOT_AT) >= 800);
+
+  // Work submitted before the modem is ready waits in its queue
+  ModemRequest *sms = modemSubmit(MODEM_REQ_SMS, MODEM_PRIO_EMERGENCY, "+15550001", "test");
+  CHECK(sms != NULL);
+  CHECK(!modemGsmUsable());
+
+  CHECK(runUntil(isReady, 20000));
+  CHECK(sim800l.bootTime(BOOT_SIM) >= 1500);
+  CHECK(sim800l.bootTime(BOOT_NETWORK) >= 4000);
+  CHECK(sim800l.bootTime(BOOT_SMS) >= 6000);
+  String timeline = modemBootTimeline();
+  CHECK(timeline.startsWith("AT ") && timeline.indexOf(", SIM ") > 0 && timeline.endsWith("(READY)"));
+
+  // Configured once ready, then the queued SMS goes out
+  runFor(100);
+  CHECK(modem.written.find("AT+CNMI=2,1,0,0,0\r\n") != std::string::npos);
+  CHECK(modemWait(sms, 0) && sms->success && smsSent == 1);
+  modemRelease(sms);
+  CHECK(isRegistered());
+  CHECK(systemStatus.networkConnected);
+  CHECK(modemGsmUsable());
+}
+
+static void registrationLost() {
+  unsigned long changes = modemHealth().changes;
+  modem.say("\r\n+CREG: 2\r\n");
+  runFor(50);
+  ModemHealth health = modemHealth();
+  CHECK(!health.registered && health.regStat == 2);
+  CHECK(health.changes == changes + 1);
+  CHECK(!systemStatus.networkConnected);
+  CHECK(!modemGsmUsable());
+  CHECK(logged.find("[GSM] Registration: 2 (not registered)") != std::string::npos);
+
+  // The periodic AT+CSQ;+CREG? sample keeps agreeing while the network is gone
+  registration = 3;
+  runFor(MODEM_HEALTH_INTERVAL_SLEEP + 1000);
+  CHECK(modemHealth().regStat == 3);
+  CHECK(!modemGsmUsable());
+}
+
+static void registrationRecovered() {
+  // Found again by the next sample, even without a URC
+  registration = 5;
+  CHECK(runUntil(isRegistered, MODEM_HEALTH_INTERVAL_SLEEP + 1000));
+  CHECK(modemHealth().regStat == 5);
+  CHECK(systemStatus.networkConnected);
+  CHECK(modemGsmUsable());
+
+  // And by a URC, straight away
+  modem.say("\r\n+CREG: 2\r\n");
+  runFor(50);
+  CHECK(!isRegistered());
+  modem.say("\r\n+CREG: 1\r\n");
+  runFor(50);
+  CHECK(isRegistered() && modemGsmUsable());
+}
+
+static void bringUpRetried() {
+  // The module reboots and the SIM is gone: bring-up fails at the SIM step
+  simInserted = false;
+  sim800l.softReset();
+  CHECK(runUntil(isFailed, BOOT_AT_TIMEOUT + 5000));
+  CHECK(sim800l.bootFailedStage() == BOOT_SIM);
+  CHECK(!modemGsmUsable());
+  runFor(100);
+  CHECK(modemBootTimeline().endsWith("(FAILED at SIM)"));
+
+  // A soft reset follows after MODEM_BOOT_RETRY; with the SIM back it comes up
+  simInserted = true;
+  modem.takeCommands();
+  unsigned long failedAt = millis();
+  CHECK(runUntil(isReady, MODEM_BOOT_RETRY + 20000));
+  CHECK(millis() - failedAt >= MODEM_BOOT_RETRY);
+  runFor(100);
+  std::string commands = modem.takeCommands();
+  size_t reset = commands.find("AT+CFUN=1,1|");
+  CHECK(reset != std::string::npos);
+  CHECK(commands.find("AT+CNMI=2,1,0,0,0|", reset) != std::string::npos);
+  CHECK(modemGsmUsable());
+}
+
+int main() {
+  RUN(bringUp);
+  RUN(registrationLost);
+  RUN(registrationRecovered);
+  RUN(bringUpRetried);
+  return 0;
+}
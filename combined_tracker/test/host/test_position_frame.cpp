@@ -0,0 +1,188 @@
+// Binary position and track frames: round trips through the codec, CRC
+// rejection, track frame sizes, and time on air against the JSON payload
+// the trackers used to send
+#include "HostCheck.h"
+#include "Config.h"
+#include "PositionFrame.h"
+#include "LoRaManager.h"
+
+// Globals LoRaManager.cpp links against
+SemaphoreHandle_t loraMutex;
+
+void logToBoth(const String &) {}
+
+static bool sameFix(const PositionFix &a, const PositionFix &b) {
+  return strcmp(a.id, b.id) == 0 && a.seq == b.seq && a.lat == b.lat && a.lon == b.lon &&
+         a.epoch == b.epoch && a.satellites == b.satellites && a.hdop == b.hdop && a.flags == b.flags;
+}
+
+static void roundTrip() {
+  uint32_t epoch = positionEpoch(2026, 3, 14, 9, 26, 53);
+  CHECK(positionTimestamp(epoch) == "2026-03-14T09:26:53Z");
+
+  PositionFix fix, back;
+  positionSet(fix, SOLDIER_ID, 65535, true, 28.6139391, 77.2090212, epoch, 9, 94);
+  uint8_t frame[POS_FRAME_LEN];
+  CHECK(positionEncode(fix, frame, sizeof(frame)) == POS_FRAME_LEN);
+  // Never mistaken for a JSON or "ACK:" text packet
+  CHECK(frame[0] != '{' && frame[0] != 'A');
+  CHECK(positionDecode(frame, sizeof(frame), back) == POS_OK);
+  CHECK(sameFix(fix, back));
+  CHECK(back.lat == 286139391 && back.lon == 772090212);
+  CHECK(back.hdop == 9 && (back.flags & POS_FLAG_FIX));
+
+  // Southern and western hemispheres, rounded to the nearest 1e-7 degree
+  positionSet(fix, "T1", 1, true, -33.86785, -151.20732, epoch, 4, -1);
+  CHECK(fix.lat == -338678500 && fix.lon == -1512073200 && fix.hdop == POS_HDOP_UNKNOWN);
+  positionEncode(fix, frame, sizeof(frame));
+  CHECK(positionDecode(frame, sizeof(frame), back) == POS_OK && sameFix(fix, back));
+
+  // No fix: position zero and the flag clear
+  positionSet(fix, "T2", 2, false, 28.6, 77.2, 0, 0, 9999);
+  CHECK(fix.lat == 0 && fix.lon == 0 && !(fix.flags & POS_FLAG_FIX));
+  CHECK(fix.hdop == POS_HDOP_UNKNOWN - 1);
+  positionEncode(fix, frame, sizeof(frame));
+  CHECK(positionDecode(frame, sizeof(frame), back) == POS_OK && sameFix(fix, back));
+
+  // Ids longer than POS_ID_LEN travel cut short
+  positionSet(fix, "LONGTRACKER", 3, true, 1, 1, epoch, 5, 100);
+  positionEncode(fix, frame, sizeof(frame));
+  CHECK(positionDecode(frame, sizeof(frame), back) == POS_OK && strcmp(back.id, "LONGTRAC") == 0);
+
+  CHECK(positionEncode(fix, frame, POS_FRAME_LEN - 1) == 0);
+}
+
+static void crcRejects() {
+  PositionFix fix, back;
+  positionSet(fix, SOLDIER_ID, 42, true, 28.6139391, 77.2090212, positionEpoch(2026, 1, 1, 0, 0, 0), 7, 120);
+  uint8_t frame[POS_FRAME_LEN];
+  positionEncode(fix, frame, sizeof(frame));
+
+  // Every single-bit error is caught; in the header it changes the frame type or version
+  for (int bit = 0; bit < POS_FRAME_LEN * 8; bit++) {
+    frame[bit / 8] ^= 1 << (bit % 8);
+    PosDecodeResult result = positionDecode(frame, sizeof(frame), back);
+    CHECK(bit < 8 ? result != POS_OK : result == POS_BAD_CRC);
+    frame[bit / 8] ^= 1 << (bit % 8);
+  }
+  // And every two-bit error within a field
+  for (int byte = 1; byte < POS_FRAME_LEN; byte++) {
+    for (int bit = 0; bit < 7; bit++) {
+      frame[byte] ^= 3 << bit;
+      CHECK(positionDecode(frame, sizeof(frame), back) == POS_BAD_CRC);
+      frame[byte] ^= 3 << bit;
+    }
+  }
+  CHECK(positionDecode(frame, sizeof(frame), back) == POS_OK);
+
+  CHECK(positionDecode(frame, POS_FRAME_LEN - 1, back) == POS_SHORT);
+  const uint8_t text[] = "{\"soldier_id\":\"BSF1875\"}";
+  CHECK(positionDecode(text, sizeof(text) - 1, back) == POS_NOT_FRAME);
+  frame[0] = POS_FRAME_MAGIC | (POS_FRAME_VERSION + 1);
+  CHECK(positionDecode(frame, sizeof(frame), back) == POS_VERSION);
+}
+
+// count fixes one step apart, starting at fixes[0]
+static void walk(PositionFix *fixes, int count, uint32_t seconds, int32_t dLat, int32_t dLon) {
+  positionSet(fixes[0], "T3", 500, true, 28.6, 77.2, positionEpoch(2026, 5, 1, 12, 0, 0), 8, 90);
+  for (int i = 1; i < count; i++) {
+    fixes[i] = fixes[i - 1];
+    fixes[i].seq++;
+    fixes[i].epoch += seconds;
+    fixes[i].lat += dLat;
+    fixes[i].lon += dLon;
+  }
+}
+
+static void trackSizes() {
+  PositionFix fixes[TRACK_FIXES_MAX + 8], back[TRACK_FIXES_MAX];
+  uint8_t frame[TRACK_FRAME_MAX + 16];
+  int used, count;
+
+  // One fix: the position frame plus the count byte
+  walk(fixes, 1, 1, 0, 0);
+  CHECK(trackEncode(fixes, 1, frame, sizeof(frame), used) == TRACK_FRAME_MIN && used == 1);
+  CHECK(trackDecode(frame, TRACK_FRAME_MIN, back, TRACK_FIXES_MAX, count) == POS_OK);
+  CHECK(count == 1 && sameFix(fixes[0], back[0]));
+
+  // Walking pace, a fix a second: 1 byte of time, 2 of lat (+100), 1 of lon (-50)
+  for (int n = 2; n <= TRACK_FIXES_MAX; n++) {
+    walk(fixes, n, 1, 100, -50);
+    size_t len = trackEncode(fixes, n, frame, sizeof(frame), used);
+    CHECK(len == TRACK_FRAME_MIN + 4 * (size_t)(n - 1) && used == n);
+    CHECK(trackDecode(frame, len, back, TRACK_FIXES_MAX, count) == POS_OK && count == n);
+    for (int i = 0; i < n; i++) CHECK(sameFix(fixes[i], back[i]));
+  }
+  // The 32 fixes of the full frame take less airtime than five position frames
+  CHECK(loraAirtime(TRACK_FRAME_MIN + 4 * (TRACK_FIXES_MAX - 1)) < 5 * loraAirtime(POS_FRAME_LEN));
+
+  // Never more than TRACK_FIXES_MAX
+  walk(fixes, TRACK_FIXES_MAX + 8, 1, 100, -50);
+  CHECK(trackEncode(fixes, TRACK_FIXES_MAX + 8, frame, sizeof(frame), used) == TRACK_FRAME_MIN + 4 * (TRACK_FIXES_MAX - 1));
+  CHECK(used == TRACK_FIXES_MAX);
+
+  // Large jumps, 11 bytes a fix: the frame stops short of the FIFO size
+  walk(fixes, TRACK_FIXES_MAX, 100000, 100000000, -100000000);
+  size_t len = trackEncode(fixes, TRACK_FIXES_MAX, frame, sizeof(frame), used);
+  CHECK(len == TRACK_FRAME_MIN + 11 * (size_t)(used - 1));
+  CHECK(len <= TRACK_FRAME_MAX && len + 11 > TRACK_FRAME_MAX && used == 21);
+  CHECK(trackDecode(frame, len, back, TRACK_FIXES_MAX, count) == POS_OK && count == used);
+  for (int i = 0; i < used; i++) CHECK(sameFix(fixes[i], back[i]));
+
+  // The decoder fills no more than it is given room for
+  CHECK(trackDecode(frame, len, back, 4, count) == POS_OK && count == 4);
+
+  // Corruption anywhere, the count and the deltas included, is caught
+  for (size_t i = 1; i < len; i++) {
+    frame[i] ^= 0x10;
+    CHECK(trackDecode(frame, len, back, TRACK_FIXES_MAX, count) == POS_BAD_CRC);
+    frame[i] ^= 0x10;
+  }
+  CHECK(trackDecode(frame, TRACK_FRAME_MIN - 1, back, TRACK_FIXES_MAX, count) == POS_SHORT);
+  CHECK(trackEncode(fixes, 2, frame, TRACK_FRAME_MIN - 1, used) == 0 && used == 0);
+}
+
+// gps_tracker's LoRa payload before the binary frame, field for field
+static String legacyJson(double lat, double lon, uint32_t epoch, unsigned long uptime, int counter) {
+  String s = "{";
+  s += "\"soldier_id\":\"" + String(SOLDIER_ID) + "\",";
+  s += "\"device_type\":\"" + String(DEVICE_TYPE) + "\",";
+  s += "\"latitude\":" + String(lat, 6) + ",";
+  s += "\"longitude\":" + String(lon, 6) + ",";
+  s += "\"communication_mode\":\"\",";
+  s += "\"timestamp\":\"" + positionTimestamp(epoch) + "\",";
+  s += "\"message_id\":\"" + String(uptime) + "-" + String(counter) + "\"";
+  s += "}";
+  return s;
+}
+
+static void airtimeAgainstJson() {
+  uint32_t epoch = positionEpoch(2026, 5, 1, 12, 0, 0);
+  String json = legacyJson(28.613939, 77.209021, epoch, 3600000, 360);
+  PositionFix fix;
+  positionSet(fix, SOLDIER_ID, 360, true, 28.613939, 77.209021, epoch, 8, 90);
+  // The host still gets the JSON, rendered from the frame by the station
+  CHECK(positionJson(fix, DEVICE_TYPE, "LoRa").length() > json.length());
+
+  // A fifth of the bytes, under a third of the time on air at every SF
+  CHECK(json.length() > 5 * POS_FRAME_LEN);
+  for (int sf = 7; sf <= 12; sf++) {
+    loraRadioSet(sf, LORA_POWER_MAX);
+    uint32_t frameUs = loraAirtime(POS_FRAME_LEN);
+    uint32_t jsonUs = loraAirtime(json.length());
+    CHECK(frameUs * 3 < jsonUs);
+    if (sf == 7) CHECK(frameUs == 61696);
+  }
+  loraRadioSet(LORA_SF_DEFAULT, LORA_POWER_MAX);
+}
+
+int main() {
+  loraMutex = xSemaphoreCreateMutex();
+  loraRadioSet(LORA_SF_DEFAULT, LORA_POWER_MAX);
+
+  RUN(roundTrip);
+  RUN(crcRejects);
+  RUN(trackSizes);
+  RUN(airtimeAgainstJson);
+  return 0;
+}
@@ -0,0 +1,172 @@
+// SMS intake driven by +CMTI: the notification makes the modem task read the
+// message with AT+CMGR and hand it to the display, with no AT+CMGL polling
+// in between the slow safety sweeps
+#include "FakeModem.h"
+#include "HostCheck.h"
+#include "Globals.h"
+#include "Config.h"
+#include "DisplayManager.h"
+#include "ModemManager.h"
+#include "Utils.h"
+#include <map>
+#include <vector>
+
+// Globals ModemManager.cpp links against
+SIM800L sim800l;
+BluetoothSerial BT;
+UartLineSource SerialSIM(UART_NUM_1, true);
+SystemStatus systemStatus;
+OperatingMode currentMode = MODE_TRACKER;
+DisplayState displayState;
+
+struct Shown {
+  std::string sender;
+  std::string text;
+  unsigned long at;
+};
+static std::vector<Shown> shown;
+
+void logToBoth(const String &) {}
+void displayReceivedMessage(String source, String sender, String text) {
+  CHECK(source == "SMS");
+  shown.push_back({sender.c_str(), text.c_str(), millis()});
+}
+bool sendSMSToNumber(const char *, const String &) { return true; }
+bool sendSMSToAll(const String &) { return true; }
+void uplinkService() {}
+
+// "hellohello" from 27838890001 (3GPP TS 23.040 example)
+#define HELLO_PDU "07917283010010F5040BC87238880900F10000993092516195800AE8329BFD4697D9EC37"
+#define HELLO_TPDU_LEN 32
+// How long the module takes to answer AT+CMGR
+#define READ_MS 150
+
+// Storage holds what the test puts there; AT+CMGL lists none of it unread,
+// so only +CMTI can bring a message in
+static FakeModem modem;
+static std::map<int, std::string> storage;
+static int listings = 0;
+static unsigned long lastListing = 0;
+
+static void answer(FakeModem &m, const std::string &line) {
+  if (line.compare(0, 8, "AT+CMGR=") == 0) {
+    auto found = storage.find(atoi(line.c_str() + 8));
+    if (found == storage.end()) {
+      m.say("\r\nOK\r\n", READ_MS);
+    } else {
+      m.say("\r\n+CMGR: 0,," + std::to_string(HELLO_TPDU_LEN) + "\r\n" + found->second + "\r\n\r\nOK\r\n", READ_MS);
+    }
+  } else if (line.compare(0, 7, "AT+CMGL") == 0) {
+    listings++;
+    lastListing = millis();
+    m.say("\r\nOK\r\n");
+  } else if (line.compare(0, 11, "AT+CMGD=1,1") == 0) {
+    storage.clear();
+    m.say("\r\nOK\r\n");
+  } else if (line.compare(0, 8, "AT+CMGD=") == 0) {
+    storage.erase(atoi(line.c_str() + 8));
+    m.say("\r\nOK\r\n");
+  } else {
+    m.answerReady(line);
+  }
+}
+
+static void runFor(unsigned long ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) modemService(10);
+}
+
+static bool isReady() { return sim800l.ready(); }
+
+static void bringUp() {
+  modem.onLine = answer;
+  displayState.initialized = true;
+  SerialSIM.begin(MODEM_BAUD_INITIAL, SIM_RX_PIN, SIM_TX_PIN);
+  modemInit();
+  CHECK(sim800l.begin(modem));
+  modemAttach();
+  unsigned long start = millis();
+  while (!isReady()) {
+    CHECK(millis() - start < 20000);
+    modemService(10);
+  }
+  // The first safety sweep runs straight after bring-up
+  runFor(1000);
+  CHECK(listings > 0);
+  CHECK(modem.written.find("AT+CNMI=2,1,0,0,0\r\n") != std::string::npos);
+  modem.takeCommands();
+}
+
+static void notifiedRead() {
+  storage[3] = HELLO_PDU;
+  unsigned long notified = millis();
+  modem.say("\r\n+CMTI: \"SM\",3\r\n");
+  runFor(1000);
+
+  // Read by index as soon as the notification arrives, shown, then purged
+  CHECK(shown.size() == 1);
+  CHECK(shown[0].sender == "27838890001" && shown[0].text == "hellohello");
+  CHECK(shown[0].at - notified >= READ_MS && shown[0].at - notified < READ_MS + 50);
+  std::string commands = modem.takeCommands();
+  size_t read = commands.find("AT+CMGR=3|");
+  CHECK(read != std::string::npos);
+  CHECK(commands.find("AT+CMGD=1,1|", read) != std::string::npos);
+  CHECK(commands.find("AT+CMGL") == std::string::npos);
+  CHECK(storage.empty());
+
+  // Timed from the URC, which the modem task takes in within its 10 ms wait
+  CHECK(smsStats.latencyCount == 1);
+  CHECK(smsStats.latencyLast >= READ_MS && smsStats.latencyLast <= shown[0].at - notified);
+  CHECK(smsStats.latencyMax == smsStats.latencyLast);
+}
+
+static void burstRead() {
+  // Three at once: each waits for the reads before it, all within a second
+  for (int index = 5; index <= 7; index++) storage[index] = HELLO_PDU;
+  unsigned long notified = millis();
+  modem.say("\r\n+CMTI: \"SM\",5\r\n\r\n+CMTI: \"SM\",6\r\n\r\n+CMTI: \"SM\",7\r\n");
+  runFor(2000);
+
+  CHECK(shown.size() == 4);
+  CHECK(shown[3].at - notified >= 3 * READ_MS && shown[3].at - notified < 1000);
+  CHECK(smsStats.latencyCount == 4);
+  CHECK(smsStats.latencyMax >= 3 * READ_MS && smsStats.latencyMax <= shown[3].at - notified);
+  CHECK(smsStats.latencyTotal >= (1 + 1 + 2 + 3) * READ_MS);
+  std::string commands = modem.takeCommands();
+  CHECK(commands.find("AT+CMGR=5|AT+CMGR=6|AT+CMGR=7|AT+CMGD=1,1|") != std::string::npos);
+  // One purge for the three
+  CHECK(smsStats.purgeBatches == 2 && smsStats.roundTripsSaved == 2);
+}
+
+static void noPolling() {
+  // Nothing listed between sweeps, where AT+CMGL used to go out every 3 s
+  runFor(SMS_SWEEP_INTERVAL + 1000);
+  CHECK(millis() - lastListing < SMS_SWEEP_INTERVAL);
+  unsigned long sweepAt = lastListing;
+  int before = listings;
+  modem.takeCommands();
+  runFor(SMS_SWEEP_INTERVAL - (millis() - sweepAt) - 500);
+  CHECK(listings == before);
+  CHECK(modem.takeCommands().find("AT+CMGL") == std::string::npos);
+
+  // Over ten minutes, one sweep a minute
+  int start = listings;
+  unsigned long sweeps = 0;
+  for (int minute = 0; minute < 10; minute++) {
+    unsigned long last = lastListing;
+    runFor(SMS_SWEEP_INTERVAL);
+    if (lastListing != last) sweeps++;
+  }
+  CHECK(sweeps == 10);
+  // Each sweep lists the read messages and then the unread ones
+  CHECK(listings - start == 2 * 10);
+  CHECK(smsStats.latencyCount == 4);
+}
+
+int main() {
+  RUN(bringUp);
+  RUN(notifiedRead);
+  RUN(burstRead);
+  RUN(noPolling);
+  return 0;
+}
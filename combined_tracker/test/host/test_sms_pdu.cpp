@@ -0,0 +1,107 @@
+// SMS PDU codec: the 3GPP TS 23.040 "hellohello" example, concatenated
+// messages reassembled from their UDH, and UCS2 text. The multi-part and
+// UCS2 vectors were built independently of the codec.
+#include "HostCheck.h"
+#include "SIM800L.h"
+
+#define SENDER "+15550001234"
+
+// Three parts, 8-bit reference 0x5A: "Grid 4Q " "north [ridge], " "hold at 0600."
+static const char *const GRID_PARTS[] = {
+  "00440B915155001032F40000425021516500400F0500035A03018EF23419448B8200",
+  "00440B915155001032F4000042502151650040180500035A0302DC6F391D0DDAF0E469F2B9BCF1B140",
+  "00440B915155001032F4000042502151650040140500035A0303D06F361914A683603618CC05",
+};
+// Two parts, 16-bit reference 0x1234: "Second " "message"
+static const char *const SECOND_PARTS[] = {
+  "00440B915155001032F40000425021516500400F06080412340201D3F2F8ED268300",
+  "00440B915155001032F40000425021516500400F06080412340202EDF27C1E3E9701",
+};
+
+static void threeGppExample() {
+  uint8_t septets[32];
+  uint16_t count = SMSPdu::gsmEncode("hellohello", 10, septets, sizeof(septets));
+  CHECK(count == 10);
+  uint8_t packed[16];
+  CHECK(SMSPdu::pack7(septets, count, 0, packed) == 9);
+
+  char hex[SMS_PDU_OCTETS * 2 + 1];
+  uint8_t length = SMSPdu::encodeSubmit("+46708251358", septets, count, SMS_7BIT, 0, 1, 1, hex, sizeof(hex));
+  CHECK(strcmp(hex, "0001000B916407281553F800000AE8329BFD4697D9EC37") == 0);
+  CHECK(length == 22);   // AT+CMGS counts the TPDU without the SMSC octet
+
+  SMSPart part;
+  CHECK(SMSPdu::decodeDeliver("07917283010010F5040BC87238880900F10000993092516195800AE8329BFD4697D9EC37", &part));
+  CHECK(part.coding == SMS_7BIT);
+  CHECK(part.total == 1 && part.seq == 1);
+  CHECK(part.length == 10 && strcmp((const char *)part.data, "hellohello") == 0);
+  CHECK(strcmp(part.sender, "27838890001") == 0);
+}
+
+static void concatenated() {
+  SMSReassembler reassembler;
+  SMSMessage message;
+  SMSPart part;
+
+  // Out of order, with a second message interleaved
+  CHECK(SMSPdu::decodeDeliver(GRID_PARTS[2], &part));
+  CHECK(part.ref == 0x5A && part.total == 3 && part.seq == 3);
+  CHECK(strcmp((const char *)part.data, "hold at 0600.") == 0);
+  CHECK(!reassembler.add(part, &message));
+
+  CHECK(SMSPdu::decodeDeliver(SECOND_PARTS[1], &part));
+  CHECK(part.ref == 0x1234 && part.total == 2 && part.seq == 2);
+  CHECK(!reassembler.add(part, &message));
+  CHECK(reassembler.pending() == 2);
+
+  CHECK(SMSPdu::decodeDeliver(GRID_PARTS[0], &part));
+  CHECK(!reassembler.add(part, &message));
+  CHECK(SMSPdu::decodeDeliver(GRID_PARTS[1], &part));
+  CHECK(strcmp((const char *)part.data, "north [ridge], ") == 0);
+  CHECK(reassembler.add(part, &message));
+  CHECK(message.parts == 3 && strcmp(message.sender, SENDER) == 0);
+  CHECK(strcmp((const char *)message.data, "Grid 4Q north [ridge], hold at 0600.") == 0);
+  CHECK(message.length == strlen("Grid 4Q north [ridge], hold at 0600."));
+
+  CHECK(SMSPdu::decodeDeliver(SECOND_PARTS[0], &part));
+  CHECK(reassembler.add(part, &message));
+  CHECK(strcmp((const char *)message.data, "Second message") == 0);
+  CHECK(reassembler.pending() == 0);
+
+  // A message whose other parts never come is given up after the timeout
+  CHECK(SMSPdu::decodeDeliver(GRID_PARTS[0], &part));
+  CHECK(!reassembler.add(part, &message));
+  hostAdvance(SMS_REASSEMBLY_TIMEOUT + 1);
+  CHECK(SMSPdu::decodeDeliver(SECOND_PARTS[0], &part));
+  CHECK(!reassembler.add(part, &message));
+  CHECK(reassembler.dropped() == 1);
+  CHECK(reassembler.pending() == 1);
+}
+
+static void ucs2() {
+  SMSPart part;
+  CHECK(SMSPdu::decodeDeliver("00040B915155001032F40008425021516500401A00520061006C006C007900200061007400200030003600300030", &part));
+  CHECK(part.coding == SMS_UCS2 && part.total == 1);
+  CHECK(strcmp(part.sender, SENDER) == 0);
+  CHECK(strcmp((const char *)part.data, "Rally at 0600") == 0);
+
+  // Outside ASCII ("é", "€") becomes '?'
+  CHECK(SMSPdu::decodeDeliver("00040B915155001032F40008425021516500400C00480069002000E920AC0021", &part));
+  CHECK(part.length == 6 && strcmp((const char *)part.data, "Hi ?" "?!") == 0);
+}
+
+static void malformed() {
+  SMSPart part;
+  // User data shorter than its length says, odd hex, not hex
+  CHECK(!SMSPdu::decodeDeliver("00040B915155001032F40000425021516500400AE8329BFD", &part));
+  CHECK(!SMSPdu::decodeDeliver("00040B915155001032F4000042502151650040", &part));
+  CHECK(!SMSPdu::decodeDeliver("0004ZZ", &part));
+}
+
+int main() {
+  RUN(threeGppExample);
+  RUN(concatenated);
+  RUN(ucs2);
+  RUN(malformed);
+  return 0;
+}
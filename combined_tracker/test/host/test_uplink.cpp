@@ -0,0 +1,170 @@
+// TCP uplink against a scripted modem: connect backoff while the server
+// refuses, CIPQSEND frames released as CIPACK reports them delivered, and
+// resending after the connection drops or stops being acknowledged.
+// Built with UPLINK_HOST set, see CMakeLists.txt.
+#include "FakeModem.h"
+#include "HostCheck.h"
+#include "Globals.h"
+#include "Config.h"
+#include "ModemManager.h"
+#include "Uplink.h"
+#include "Utils.h"
+#include <vector>
+
+// Globals Uplink.cpp links against
+SIM800L sim800l;
+BluetoothSerial BT;
+
+static std::string logged;
+
+void logToBoth(const String &message) { logged += std::string(message.c_str()) + "\n"; }
+bool modemGsmUsable() { return true; }
+
+// The server end: refuses connections until accepting is set, and has
+// received (sent) and acknowledged (acked) bytes as CIPACK reports them
+static FakeModem modem;
+static bool accepting = false;
+static uint32_t sent = 0;
+static uint32_t acked = 0;
+static std::vector<unsigned long> connectAt;
+static std::vector<std::string> framesSent;
+static size_t sendLength = 0;    // > 0 while the modem takes CIPSEND data
+static std::string sendData;
+
+static void answer(FakeModem &m, const std::string &line) {
+  if (sendLength > 0) {
+    sendData += line;
+    if (sendData.size() < sendLength) return;
+    sent += sendData.size();
+    framesSent.push_back(sendData);
+    sendLength = 0;
+    sendData.clear();
+    m.say("\r\nDATA ACCEPT:0," + std::to_string(framesSent.back().size()) + "\r\n");
+  } else if (line.compare(0, 11, "AT+CIPSTART") == 0) {
+    connectAt.push_back(millis());
+    m.say(accepting ? "\r\nOK\r\n\r\n0, CONNECT OK\r\n" : "\r\nOK\r\n\r\n0, CONNECT FAIL\r\n", 200);
+  } else if (line.compare(0, 13, "AT+CIPSEND=0,") == 0) {
+    sendLength = atoi(line.c_str() + 13);
+    m.say("\r\n> ");
+  } else if (line.compare(0, 11, "AT+CIPACK=0") == 0) {
+    m.say("\r\n+CIPACK: " + std::to_string(sent) + "," + std::to_string(acked) + ",0\r\n\r\nOK\r\n");
+  } else if (line.compare(0, 11, "AT+CIPCLOSE") == 0) {
+    m.say("\r\n0, CLOSE OK\r\n");
+  } else if (line.compare(0, 10, "AT+CIPSHUT") == 0) {
+    m.say("\r\nSHUT OK\r\n");
+  } else {
+    m.answerReady(line);
+  }
+}
+
+static void runFor(unsigned long ms) {
+  unsigned long end = millis() + ms;
+  while ((long)(millis() - end) < 0) {
+    sim800l.poll();
+    uplinkService();
+    delay(10);
+  }
+}
+
+static void queueFixes(int n) {
+  for (int i = 0; i < n; i++) {
+    CHECK(uplinkQueueFix(28.6 + i * 0.001, 77.2, "2026-10-16 10:00:0" + String(i)));
+  }
+}
+
+static void connectBackoff() {
+  modem.onLine = answer;
+  CHECK(sim800l.begin(modem));
+  CHECK(uplinkEnabled());
+  queueFixes(6);
+
+  runFor(40000);
+  std::string commands = modem.takeCommands();
+  // GPRS brought up in quick send mode before the first connect
+  CHECK(commands.find("AT+CIPQSEND=1") < commands.find("AT+CIPSTART"));
+  // Retries 5 s, 10 s, then 20 s after the context was rebuilt
+  CHECK(connectAt.size() == 4);
+  unsigned long backoff = UPLINK_RETRY_MIN;
+  for (size_t i = 1; i < connectAt.size(); i++) {
+    unsigned long gap = connectAt[i] - connectAt[i - 1];
+    CHECK(gap >= backoff && gap < backoff + 1000);
+    backoff *= 2;
+  }
+  size_t last = commands.rfind("AT+CIPSTART");
+  CHECK(commands.find("AT+CIPSHUT", commands.rfind("AT+CIPSTART", last - 1)) < last);
+
+  UplinkStats stats = uplinkStats();
+  CHECK(stats.connects == 0 && stats.failures == 4);
+  CHECK(stats.fixesSent == 0 && stats.queued == 6);
+  CHECK(!uplinkConnected());
+}
+
+static void framesReleasedOnAck() {
+  accepting = true;
+  runFor(45000);
+  UplinkStats stats = uplinkStats();
+  CHECK(uplinkConnected() && stats.connects == 1);
+  CHECK(connectAt.size() == 5 && connectAt[4] - connectAt[3] >= 8 * UPLINK_RETRY_MIN);
+
+  // A full batch and the rest, which has waited longer than UPLINK_BATCH_WAIT
+  CHECK(framesSent.size() == 2);
+  CHECK(framesSent[0].compare(0, 15, "$TRK," SOLDIER_ID ",4\n") == 0);
+  CHECK(framesSent[0].find("\n0,28.60000,77.20000,2026-10-16 10:00:00\n") != std::string::npos);
+  CHECK(framesSent[1].compare(0, 15, "$TRK," SOLDIER_ID ",2\n") == 0);
+  CHECK(stats.fixesSent == 6 && stats.fixesAcked == 0 && stats.queued == 6);
+
+  // The server acknowledges the first frame, then the second
+  acked = framesSent[0].size();
+  runFor(UPLINK_ACK_POLL + 100);
+  stats = uplinkStats();
+  CHECK(stats.fixesAcked == 4 && stats.queued == 2);
+  acked = sent;
+  runFor(UPLINK_ACK_POLL + 100);
+  stats = uplinkStats();
+  CHECK(stats.fixesAcked == 6 && stats.queued == 0);
+  CHECK(stats.bytesAcked == sent && stats.bytesSent == sent);
+
+  // Nothing owed, nothing polled
+  modem.takeCommands();
+  runFor(3 * UPLINK_ACK_POLL);
+  CHECK(modem.takeCommands().find("AT+CIPACK") == std::string::npos);
+}
+
+static void resendAfterDrop() {
+  queueFixes(4);
+  runFor(1000);
+  CHECK(framesSent.size() == 3 && uplinkStats().fixesSent == 10);
+
+  // The connection drops before the frame was acknowledged; a new
+  // connection counts its bytes from zero
+  modem.say("\r\n0, CLOSED\r\n");
+  sent = acked = 0;
+  runFor(5000);
+  UplinkStats stats = uplinkStats();
+  CHECK(stats.drops == 1 && stats.connects == 2);
+  CHECK(stats.resent == 4 && stats.fixesSent == 14);
+  CHECK(framesSent.size() == 4 && framesSent[3] == framesSent[2]);
+
+  acked = sent;
+  runFor(UPLINK_ACK_POLL + 100);
+  stats = uplinkStats();
+  CHECK(stats.fixesAcked == 10 && stats.queued == 0);
+}
+
+static void reconnectWhenAcksStall() {
+  queueFixes(4);
+  logged.clear();
+  runFor(UPLINK_ACK_TIMEOUT + UPLINK_ACK_POLL + 1000);
+  UplinkStats stats = uplinkStats();
+  CHECK(logged.find("No ACK") != std::string::npos);
+  CHECK(stats.drops == 2 && stats.connects == 3);
+  CHECK(stats.resent == 8 && stats.queued == 4);
+}
+
+int main() {
+  RUN(connectBackoff);
+  RUN(framesReleasedOnAck);
+  RUN(resendAfterDrop);
+  RUN(reconnectWhenAcksStall);
+  return 0;
+}
@@ -0,0 +1,327 @@
+#include "PositionFrame.h"
+
+static void putU16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void putU32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static uint16_t getU16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+  return v;
+}
+
+// LEB128 varint; returns bytes written, 0 if it does not fit
+static size_t putVarint(uint8_t *p, size_t room, uint32_t v) {
+  size_t n = 0;
+  do {
+    if (n >= room) return 0;
+    uint8_t b = v & 0x7F;
+    v >>= 7;
+    p[n++] = v ? (b | 0x80) : b;
+  } while (v);
+  return n;
+}
+
+// Returns bytes read, 0 if truncated or longer than 5 bytes
+static size_t getVarint(const uint8_t *p, size_t room, uint32_t &v) {
+  v = 0;
+  for (size_t n = 0; n < room && n < 5; n++) {
+    v |= (uint32_t)(p[n] & 0x7F) << (7 * n);
+    if (!(p[n] & 0x80)) return n + 1;
+  }
+  return 0;
+}
+
+// Small signed deltas to small unsigned values: 0, -1, 1, -2 -> 0, 1, 2, 3
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)((v >> 1) ^ (0U - (v & 1)));
+}
+
+uint16_t crc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static int32_t toFixed(double degrees) {
+  double scaled = degrees * 1e7;
+  return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+double positionDegrees(int32_t fixed) {
+  return fixed / 1e7;
+}
+
+void positionSet(PositionFix &fix, const char *id, uint16_t seq, bool valid, double lat, double lon,
+                 uint32_t epoch, uint32_t satellites, int32_t hdopHundredths) {
+  memset(&fix, 0, sizeof(fix));
+  strncpy(fix.id, id, POS_ID_LEN);
+  fix.seq = seq;
+  if (valid) {
+    fix.lat = toFixed(lat);
+    fix.lon = toFixed(lon);
+    fix.flags |= POS_FLAG_FIX;
+  }
+  fix.epoch = epoch;
+  fix.satellites = satellites > 255 ? 255 : satellites;
+  if (hdopHundredths < 0) {
+    fix.hdop = POS_HDOP_UNKNOWN;
+  } else {
+    int32_t tenths = (hdopHundredths + 5) / 10;
+    fix.hdop = tenths >= POS_HDOP_UNKNOWN ? POS_HDOP_UNKNOWN - 1 : tenths;
+  }
+}
+
+size_t positionEncode(const PositionFix &fix, uint8_t *out, size_t size) {
+  if (size < POS_FRAME_LEN) return 0;
+  out[0] = POS_FRAME_MAGIC | POS_FRAME_VERSION;
+  memset(&out[1], 0, POS_ID_LEN);
+  memcpy(&out[1], fix.id, strnlen(fix.id, POS_ID_LEN));
+  putU16(&out[9], fix.seq);
+  putU32(&out[11], (uint32_t)fix.lat);
+  putU32(&out[15], (uint32_t)fix.lon);
+  putU32(&out[19], fix.epoch);
+  out[23] = fix.satellites;
+  out[24] = fix.hdop;
+  out[25] = fix.flags;
+  putU16(&out[26], crc16(out, 26));
+  return POS_FRAME_LEN;
+}
+
+PosDecodeResult positionDecode(const uint8_t *in, size_t len, PositionFix &fix) {
+  if (len < 1 || (in[0] & 0xF0) != POS_FRAME_MAGIC) return POS_NOT_FRAME;
+  if ((in[0] & 0x0F) != POS_FRAME_VERSION) return POS_VERSION;
+  if (len < POS_FRAME_LEN) return POS_SHORT;
+  if (getU16(&in[26]) != crc16(in, 26)) return POS_BAD_CRC;
+
+  memcpy(fix.id, &in[1], POS_ID_LEN);
+  fix.id[POS_ID_LEN] = '\0';
+  fix.seq = getU16(&in[9]);
+  fix.lat = (int32_t)getU32(&in[11]);
+  fix.lon = (int32_t)getU32(&in[15]);
+  fix.epoch = getU32(&in[19]);
+  fix.satellites = in[23];
+  fix.hdop = in[24];
+  fix.flags = in[25];
+  return POS_OK;
+}
+
+size_t linkEncode(const LinkCommand &cmd, uint8_t *out, size_t size) {
+  if (size < LINK_FRAME_LEN) return 0;
+  out[0] = LINK_FRAME_MAGIC | LINK_FRAME_VERSION;
+  memset(&out[1], 0, POS_ID_LEN);
+  memcpy(&out[1], cmd.id, strnlen(cmd.id, POS_ID_LEN));
+  out[9] = cmd.sf;
+  out[10] = (uint8_t)cmd.power;
+  out[11] = cmd.flags;
+  putU16(&out[12], crc16(out, 12));
+  return LINK_FRAME_LEN;
+}
+
+PosDecodeResult linkDecode(const uint8_t *in, size_t len, LinkCommand &cmd) {
+  if (len < 1 || (in[0] & 0xF0) != LINK_FRAME_MAGIC) return POS_NOT_FRAME;
+  if ((in[0] & 0x0F) != LINK_FRAME_VERSION) return POS_VERSION;
+  if (len < LINK_FRAME_LEN) return POS_SHORT;
+  if (getU16(&in[12]) != crc16(in, 12)) return POS_BAD_CRC;
+
+  memcpy(cmd.id, &in[1], POS_ID_LEN);
+  cmd.id[POS_ID_LEN] = '\0';
+  cmd.sf = in[9];
+  cmd.power = (int8_t)in[10];
+  cmd.flags = in[11];
+  return POS_OK;
+}
+
+size_t trackEncode(const PositionFix *fixes, int count, uint8_t *out, size_t size, int &used) {
+  used = 0;
+  if (count < 1 || size < TRACK_FRAME_MIN) return 0;
+  if (size > TRACK_FRAME_MAX) size = TRACK_FRAME_MAX;
+
+  // Same layout as a position frame up to the flags
+  positionEncode(fixes[0], out, size);
+  out[0] = TRACK_FRAME_MAGIC | TRACK_FRAME_VERSION;
+  size_t len = 27;
+  used = 1;
+  if (count > TRACK_FIXES_MAX) count = TRACK_FIXES_MAX;
+  while (used < count) {
+    const PositionFix &prev = fixes[used - 1];
+    const PositionFix &fix = fixes[used];
+    uint8_t delta[15];
+    size_t n = putVarint(delta, 5, fix.epoch >= prev.epoch ? fix.epoch - prev.epoch : 0);
+    // Differences wrap (the antimeridian), decoding wraps back
+    n += putVarint(&delta[n], 5, zigzag((int32_t)((uint32_t)fix.lat - (uint32_t)prev.lat)));
+    n += putVarint(&delta[n], 5, zigzag((int32_t)((uint32_t)fix.lon - (uint32_t)prev.lon)));
+    if (len + n + 2 > size) break;
+    memcpy(&out[len], delta, n);
+    len += n;
+    used++;
+  }
+  out[26] = used;
+  putU16(&out[len], crc16(out, len));
+  return len + 2;
+}
+
+PosDecodeResult trackDecode(const uint8_t *in, size_t len, PositionFix *fixes, int max, int &count) {
+  count = 0;
+  if (len < 1 || (in[0] & 0xF0) != TRACK_FRAME_MAGIC) return POS_NOT_FRAME;
+  if ((in[0] & 0x0F) != TRACK_FRAME_VERSION) return POS_VERSION;
+  if (len < TRACK_FRAME_MIN) return POS_SHORT;
+  if (getU16(&in[len - 2]) != crc16(in, len - 2)) return POS_BAD_CRC;
+  if (max < 1) return POS_OK;
+
+  PositionFix &first = fixes[0];
+  memcpy(first.id, &in[1], POS_ID_LEN);
+  first.id[POS_ID_LEN] = '\0';
+  first.seq = getU16(&in[9]);
+  first.lat = (int32_t)getU32(&in[11]);
+  first.lon = (int32_t)getU32(&in[15]);
+  first.epoch = getU32(&in[19]);
+  first.satellites = in[23];
+  first.hdop = in[24];
+  first.flags = in[25];
+  count = 1;
+
+  int total = in[26];
+  size_t pos = 27;
+  size_t end = len - 2;
+  while (count < total) {
+    uint32_t dt, dlat, dlon;
+    size_t n1 = getVarint(&in[pos], end - pos, dt);
+    if (n1 == 0) return POS_SHORT;
+    pos += n1;
+    size_t n2 = getVarint(&in[pos], end - pos, dlat);
+    if (n2 == 0) return POS_SHORT;
+    pos += n2;
+    size_t n3 = getVarint(&in[pos], end - pos, dlon);
+    if (n3 == 0) return POS_SHORT;
+    pos += n3;
+    if (count >= max) break;
+    fixes[count] = fixes[count - 1];
+    fixes[count].seq++;
+    fixes[count].epoch += dt;
+    fixes[count].lat = (int32_t)((uint32_t)fixes[count].lat + (uint32_t)unzigzag(dlat));
+    fixes[count].lon = (int32_t)((uint32_t)fixes[count].lon + (uint32_t)unzigzag(dlon));
+    count++;
+  }
+  return POS_OK;
+}
+
+size_t relayEncode(const RelayHeader &hdr, const uint8_t *frame, size_t len, uint8_t *out, size_t size) {
+  if (size < RELAY_HEADER_LEN + len) return 0;
+  out[0] = RELAY_FRAME_MAGIC | RELAY_FRAME_VERSION;
+  out[1] = hdr.ttl;
+  out[2] = hdr.hops;
+  out[3] = hdr.flags;
+  memset(&out[4], 0, POS_ID_LEN);
+  memcpy(&out[4], hdr.relay, strnlen(hdr.relay, POS_ID_LEN));
+  putU16(&out[12], crc16(out, 12));
+  memmove(&out[RELAY_HEADER_LEN], frame, len);
+  return RELAY_HEADER_LEN + len;
+}
+
+PosDecodeResult relayDecode(const uint8_t *in, size_t len, RelayHeader &hdr) {
+  if (len < 1 || (in[0] & 0xF0) != RELAY_FRAME_MAGIC) return POS_NOT_FRAME;
+  if ((in[0] & 0x0F) != RELAY_FRAME_VERSION) return POS_VERSION;
+  if (len <= RELAY_HEADER_LEN) return POS_SHORT;
+  if (getU16(&in[12]) != crc16(in, 12)) return POS_BAD_CRC;
+
+  hdr.ttl = in[1];
+  hdr.hops = in[2];
+  hdr.flags = in[3];
+  memcpy(hdr.relay, &in[4], POS_ID_LEN);
+  hdr.relay[POS_ID_LEN] = '\0';
+  return POS_OK;
+}
+
+size_t ackEncode(const AckFrame &ack, uint8_t *out, size_t size) {
+  if (size < ACK_FRAME_LEN) return 0;
+  out[0] = ACK_FRAME_MAGIC | ACK_FRAME_VERSION;
+  memset(&out[1], 0, POS_ID_LEN);
+  memcpy(&out[1], ack.id, strnlen(ack.id, POS_ID_LEN));
+  putU16(&out[9], ack.seq);
+  out[11] = ack.mask;
+  putU16(&out[12], crc16(out, 12));
+  return ACK_FRAME_LEN;
+}
+
+PosDecodeResult ackDecode(const uint8_t *in, size_t len, AckFrame &ack) {
+  if (len < 1 || (in[0] & 0xF0) != ACK_FRAME_MAGIC) return POS_NOT_FRAME;
+  if ((in[0] & 0x0F) != ACK_FRAME_VERSION) return POS_VERSION;
+  if (len < ACK_FRAME_LEN) return POS_SHORT;
+  if (getU16(&in[12]) != crc16(in, 12)) return POS_BAD_CRC;
+
+  memcpy(ack.id, &in[1], POS_ID_LEN);
+  ack.id[POS_ID_LEN] = '\0';
+  ack.seq = getU16(&in[9]);
+  ack.mask = in[11];
+  return POS_OK;
+}
+
+uint32_t positionEpoch(int year, int month, int day, int hour, int minute, int second) {
+  // Days from 1970-01-01 in the proleptic Gregorian calendar (March-based year)
+  int y = year - (month <= 2);
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = (long)era * 146097 + doe - 719468;
+  if (days < 0) return 0;
+  return (uint32_t)days * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+String positionTimestamp(uint32_t epoch) {
+  uint32_t days = epoch / 86400UL;
+  uint32_t rest = epoch % 86400UL;
+  // Inverse of positionEpoch()
+  long z = (long)days + 719468;
+  long era = z / 146097;
+  long doe = z - era * 146097;
+  long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  long mp = (5 * doy + 2) / 153;
+  int day = doy - (153 * mp + 2) / 5 + 1;
+  int month = mp < 10 ? mp + 3 : mp - 9;
+  int year = yoe + era * 400 + (month <= 2);
+
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02dZ", year, month, day,
+           (int)(rest / 3600), (int)(rest / 60 % 60), (int)(rest % 60));
+  return String(buf);
+}
+
+String positionJson(const PositionFix &fix, const char *deviceType, const char *commMode) {
+  String s = "{";
+  s += "\"soldier_id\":\"" + String(fix.id) + "\",";
+  if (deviceType != NULL) s += "\"device_type\":\"" + String(deviceType) + "\",";
+  if (fix.flags & POS_FLAG_FIX) {
+    s += "\"latitude\":" + String(positionDegrees(fix.lat), 6) + ",";
+    s += "\"longitude\":" + String(positionDegrees(fix.lon), 6) + ",";
+  } else {
+    s += "\"status\":\"no_fix\",";
+  }
+  s += "\"communication_mode\":\"" + String(commMode) + "\",";
+  s += "\"timestamp\":\"" + positionTimestamp(fix.epoch) + "\",";
+  s += "\"message_id\":\"" + String(fix.id) + "-" + String(fix.seq) + "\",";
+  s += "\"satellites\":" + String(fix.satellites);
+  if (fix.hdop != POS_HDOP_UNKNOWN) s += ",\"hdop\":" + String(fix.hdop / 10.0, 1);
+  s += "}";
+  return s;
+}
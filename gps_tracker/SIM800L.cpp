@@ -2,189 +2,1914 @@
 
 ////////////////////////////////////////////////////PRIVATE DEFINITION////////////////////////////////////////////////////
 
-String SIM800L::_readSerial()
+// Final result codes that terminate a command (prefix match)
+static const struct
 {
-	_timeout=0;
-	while(!_serial->available() && _timeout<(TIMEOUT*100)) 
+	const char* text;
+	ATResult result;
+} FINAL_CODES[] = {
+	{"OK",          AT_OK},
+	{"SEND OK",     AT_OK},
+	{"SHUT OK",     AT_OK},
+	{"DATA ACCEPT", AT_OK},
+	{"0, CLOSE OK", AT_OK},   // AT+CIPCLOSE in multi-connection mode has no OK
+	{"ERROR",       AT_ERROR},
+	{"+CME ERROR",  AT_ERROR},
+	{"+CMS ERROR",  AT_CMS_ERROR},
+	{"SEND FAIL",   AT_ERROR},
+	{"NO CARRIER",  AT_ERROR},
+	{"NO DIALTONE", AT_ERROR},
+	{"NO ANSWER",   AT_ERROR},
+	{"BUSY",        AT_ERROR},
+};
+
+// Unsolicited result codes, matched by prefix; hasBody codes take the next line as payload
+static const struct
+{
+	const char* prefix;
+	URCType type;
+	bool hasBody;
+} URC_TABLE[] = {
+	{"+CMTI:", URC_CMTI, false},
+	{"+CMT:",  URC_CMT,  true},
+	{"RING",   URC_RING, false},
+	{"+CREG:", URC_CREG, false},
+	{"+CLTS:", URC_CLTS, false},
+};
+
+// Rates tried by baud negotiation, fastest first (all supported by AT+IPR)
+static const uint32_t BAUD_RATES[]={115200,57600,38400,19200,9600};
+#define BAUD_RATE_COUNT (sizeof(BAUD_RATES)/sizeof(BAUD_RATES[0]))
+
+// Command with a long echo and a multi-line answer, used to verify a new rate
+#define BAUD_ECHO_TEST "AT+CGMI;+CGMM;+CGMR"
+
+// Readiness events seen during bring-up
+#define BOOT_EVENT_ALIVE   0x01   // AT answered OK
+#define BOOT_EVENT_SIM     0x02   // +CPIN: READY or Call Ready
+#define BOOT_EVENT_NETWORK 0x04   // +CREG: 1 (home) or 5 (roaming)
+#define BOOT_EVENT_SMS     0x08   // SMS Ready or SMS storage answered
+#define BOOT_EVENT_NO_SIM  0x10   // +CPIN other than READY, waiting will not help
+
+// Locate field <index> of a "+XXX: a,"b,c",d" line, commas inside quotes do not split
+static const char* _locateField(const char* line, uint8_t index)
+{
+	const char* p=strchr(line,':');
+	p=(p!=NULL) ? p+1 : line;
+	bool quoted=false;
+	while(index>0 && *p!='\0' && *p!='\n')
+	{
+		if(*p=='"')
+		{
+			quoted=!quoted;
+		}
+		else if(*p==',' && !quoted)
+		{
+			index--;
+		}
+		p++;
+	}
+	if(index>0)
+	{
+		return NULL;
+	}
+	while(*p==' ')
+	{
+		p++;
+	}
+	return p;
+}
+
+SIM800L::ATCommand* SIM800L::_find(uint16_t handle)
+{
+	for(uint8_t i=0;i<_count;i++)
+	{
+		ATCommand* cmd=&_queue[(_head+i)%AT_QUEUE_SIZE];
+		if(cmd->handle==handle)
+		{
+			return cmd;
+		}
+	}
+	return NULL;
+}
+
+void SIM800L::_dispatch()
+{
+	ATCommand &cmd=_queue[_head];
+	_responseLen=0;
+	_response[0]='\0';
+	_truncated=false;
+	_serial->print(cmd.cmd);
+	_serial->print(F("\r\n"));
+	if(_trace)
+	{
+		_trace->print(cmd.cmd);
+		_trace->print(F("\r\n"));
+	}
+	_sentAt=millis();
+	_activityAt=_sentAt;
+	_active=true;
+}
+
+ATResult SIM800L::_classify(const char* line, uint16_t len)
+{
+	for(uint8_t i=0;i<sizeof(FINAL_CODES)/sizeof(FINAL_CODES[0]);i++)
+	{
+		uint16_t n=strlen(FINAL_CODES[i].text);
+		if(len>=n && strncmp(line,FINAL_CODES[i].text,n)==0)
+		{
+			// "OK" must be the whole line, the rest may carry a code or reference
+			if(FINAL_CODES[i].result==AT_OK && n==2 && len!=2)
+			{
+				continue;
+			}
+			return FINAL_CODES[i].result;
+		}
+	}
+	return AT_PENDING;
+}
+
+bool SIM800L::_ownsPrefix(const char* prefix)
+{
+	// "+CREG: 0,1" answers AT+CREG? and is not the +CREG URC
+	if(!_active)
+	{
+		return false;
+	}
+	uint8_t n=strlen(prefix);
+	if(prefix[n-1]==':')
+	{
+		n--;
+	}
+	for(const char* p=_queue[_head].cmd;*p!='\0';p++)
+	{
+		if(strncmp(p,prefix,n)==0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void SIM800L::_processLine(const char* line, uint16_t len)
+{
+	if(_urcBody>=0)
+	{
+		URCType type=(URCType)_urcBody;
+		_urcBody=-1;
+		if(_urcHandlers[type].handler)
+		{
+			_urcHandlers[type].handler(type,_urcHeader,line,_urcHandlers[type].context);
+		}
+		return;
+	}
+	if(len==0)
+	{
+		return;
+	}
+	if(_bootStage!=BOOT_IDLE)
+	{
+		_bootWatch(line);
+	}
+	_ipWatch(line);
+
+	for(uint8_t i=0;i<sizeof(URC_TABLE)/sizeof(URC_TABLE[0]);i++)
+	{
+		if(strncmp(line,URC_TABLE[i].prefix,strlen(URC_TABLE[i].prefix))==0 && !_ownsPrefix(URC_TABLE[i].prefix))
+		{
+			URCType type=URC_TABLE[i].type;
+			if(URC_TABLE[i].hasBody)
+			{
+				strncpy(_urcHeader,line,URC_HEADER_MAX);
+				_urcHeader[URC_HEADER_MAX]='\0';
+				_urcBody=type;
+				return;
+			}
+			if(type==URC_RING)
+			{
+				_ring=true;
+			}
+			if(_urcHandlers[type].handler)
+			{
+				_urcHandlers[type].handler(type,line,NULL,_urcHandlers[type].context);
+			}
+			return;
+		}
+	}
+
+	if(!_active)
+	{
+		if(_waking && _classify(line,len)!=AT_PENDING)
+		{
+			_wakeAnswers++;   // a wake-up "AT" answered
+		}
+		return; // echo or leftovers nobody is waiting for
+	}
+
+	if(_responseLen+len+1<=AT_RESPONSE_MAX)
+	{
+		memcpy(_response+_responseLen,line,len);
+		_responseLen+=len;
+		_response[_responseLen++]='\n';
+		_response[_responseLen]='\0';
+	}
+	else
+	{
+		_truncated=true;
+	}
+
+	ATResult result=_classify(line,len);
+	if(result!=AT_PENDING)
+	{
+		_finish(result);
+	}
+}
+
+void SIM800L::_finish(ATResult result)
+{
+	ATCommand cmd=_queue[_head];
+	_head=(_head+1)%AT_QUEUE_SIZE;
+	_count--;
+	_active=false;
+
+	_lastLatency=millis()-_sentAt;
+	_latencyTotal+=_lastLatency;
+	_commandCount++;
+
+	// Achieved throughput, only meaningful when the answer dominates the round trip
+	if(_responseLen>=128 && _lastLatency>0)
+	{
+		uint32_t rate=(uint32_t)_responseLen*1000UL/_lastLatency;
+		_throughput=(_throughput==0) ? rate : (_throughput*3+rate)/4;
+	}
+
+	_done[_doneNext].handle=cmd.handle;
+	_done[_doneNext].result=result;
+	_doneNext=(_doneNext+1)%AT_QUEUE_SIZE;
+
+	if(cmd.callback)
+	{
+		cmd.callback(cmd.handle,result,_response,cmd.context);
+	}
+}
+
+int SIM800L::_field(const char* prefix, uint8_t index)
+{
+	const char* p=strstr(_response,prefix);
+	if(p==NULL)
+	{
+		return -1;
+	}
+	return intField(p,index);
+}
+
+void SIM800L::_clearSerial()
+{
+	while(_serial->available())
+	{
+		_serial->read();
+	}
+}
+
+void SIM800L::_idle()
+{
+	// Bounded so command timeouts are still noticed while the modem is silent
+	if(_waitFn)
+	{
+		_waitFn(20,_waitContext);
+	}
+	else
+	{
+		delay(1);
+	}
+}
+
+////////////////////////////////////////////////////LINE FRAMER///////////////////////////////////////////////////////////
+
+bool ATLineFramer::push(char c)
+{
+	if(_size>=AT_RX_RING)
+	{
+		return false;
+	}
+	_ring[_head]=c;
+	_head=(_head+1)%AT_RX_RING;
+	_size++;
+	if(c=='\n')
+	{
+		_lines++;
+	}
+	return true;
+}
+
+bool ATLineFramer::nextLine(char* line, uint16_t size, uint16_t* len)
+{
+	// A full ring without a terminator is flushed as one (truncated) line
+	if(_lines==0 && _size<AT_RX_RING)
+	{
+		return false;
+	}
+	uint16_t n=0;
+	while(_size>0)
+	{
+		char c=_ring[_tail];
+		_tail=(_tail+1)%AT_RX_RING;
+		_size--;
+		if(c=='\n')
+		{
+			_lines--;
+			break;
+		}
+		if(c!='\r' && n<size-1)
+		{
+			line[n++]=c;
+		}
+	}
+	line[n]='\0';
+	*len=n;
+	return true;
+}
+
+bool ATLineFramer::takePrompt()
+{
+	// The data prompt "> " is never followed by a line terminator
+	if(_lines>0 || _size==0 || _ring[_tail]!='>')
+	{
+		return false;
+	}
+	_tail=(_tail+1)%AT_RX_RING;
+	_size--;
+	if(_size>0 && _ring[_tail]==' ')
+	{
+		_tail=(_tail+1)%AT_RX_RING;
+		_size--;
+	}
+	return true;
+}
+
+uint16_t ATLineFramer::space()
+{
+	return AT_RX_RING-_size;
+}
+
+/////////////////////////////////////////////////INSTANT/INIT DEFINITION/////////////////////////////////////////////////
+
+SIM800L::SIM800L(void)
+{
+	_response[0]='\0';
+	memset(_urcHandlers,0,sizeof(_urcHandlers));
+}
+
+bool SIM800L::begin(Stream &serial) // begin Definition with Serial port assignment
+{
+	_serial = &serial;
+	_clearSerial();
+	if(_setBaud)
+	{
+		// The modem may have been stored at another rate by an earlier negotiation
+		_findBaud();
+	}
+	bootStart();
+
+	// Only wait for the UART; SIM, network and SMS readiness follow in poll()
+	while(_bootStage==BOOT_AT)
+	{
+		poll();
+		_idle();
+		yield();
+	}
+	if(_bootStage==BOOT_FAILED)
+	{
+		return false;
+	}
+	if(_setBaud)
+	{
+		_negotiateBaud();
+	}
+	return true;
+}
+
+bool SIM800L::begin(Stream &serial,uint8_t pin) // begin Definition with Serial port and reset pin assignment
+{
+	rstpin=pin;
+	pinMode(rstpin,OUTPUT);
+	digitalWrite(rstpin,LOW);
+	rstDeclair=true;
+	return begin(serial);
+}
+
+////////////////////////////////////////////////////COMMAND ENGINE////////////////////////////////////////////////////////
+
+uint16_t SIM800L::submit(const char* cmd, uint32_t timeout, ATCallback callback, void* context, const char* payload, uint16_t payloadLength)
+{
+	if(_count>=AT_QUEUE_SIZE || strlen(cmd)>AT_CMD_MAX)
+	{
+		return 0;
+	}
+
+	ATCommand &slot=_queue[(_head+_count)%AT_QUEUE_SIZE];
+	slot.handle=_nextHandle++;
+	if(_nextHandle==0)
+	{
+		_nextHandle=1;
+		_handlesWrapped=true;
+	}
+	strcpy(slot.cmd,cmd);
+	slot.payload=payload;
+	slot.payloadLength=(payload!=NULL) ? payloadLength : 0;
+	slot.prompt=(payload!=NULL || strstr(cmd,"+CMGS")!=NULL || strstr(cmd,"+CMGW")!=NULL || strstr(cmd,"+CIPSEND")!=NULL);
+	slot.timeout=timeout;
+	slot.callback=callback;
+	slot.context=context;
+	_count++;
+	return slot.handle;
+}
+
+void SIM800L::poll()
+{
+	// Start the next command only here, so the previous response survives until now;
+	// a sleeping module is woken first and the command waits for the UART to come up
+	if(!_active && _count>0 && _wakeReady())
+	{
+		_dispatch();
+	}
+
+	uint16_t len;
+	do
+	{
+		while(_serial->available() && _framer.space()>0)
+		{
+			_activityAt=millis();
+			if(_sleepMode==SLEEP_AUTO && !_awake)
+			{
+				_markAwake(true);   // woke up on its own to deliver a URC
+			}
+			char c=(char)_serial->read();
+			_framer.push(c);
+			if(_trace)
+			{
+				_trace->write((uint8_t)c);
+			}
+		}
+		while(_framer.nextLine(_line,sizeof(_line),&len))
+		{
+			_processLine(_line,len);
+		}
+		if(_active && _queue[_head].prompt && _framer.takePrompt())
+		{
+			ATCommand &cmd=_queue[_head];
+			if(cmd.payload==NULL)
+			{
+				_finish(AT_PROMPT);
+			}
+			else if(cmd.payloadLength>0)
+			{
+				// Fixed length send (AT+CIPSEND=<n>,<length>): no terminator, any byte value
+				_serial->write((const uint8_t*)cmd.payload,cmd.payloadLength);
+				if(_trace)
+				{
+					_trace->print('<');
+					_trace->print(cmd.payloadLength);
+					_trace->print(F(" bytes>\r\n"));
+				}
+				cmd.payload=NULL;
+				cmd.prompt=false;
+			}
+			else
+			{
+				_serial->print(cmd.payload);
+				_serial->write(0x1A); // Ctrl-Z terminates the payload
+				if(_trace)
+				{
+					_trace->print(cmd.payload);
+					_trace->print(F("<^Z>\r\n"));
+				}
+				cmd.payload=NULL;
+				cmd.prompt=false;
+			}
+		}
+	}
+	while(_serial->available());
+
+	if(_active && millis()-_sentAt>_queue[_head].timeout)
+	{
+		_finish(AT_TIMEOUT);
+	}
+
+	_bootPoll();
+	_sleepPoll();
+}
+
+ATResult SIM800L::result(uint16_t handle)
+{
+	if(_find(handle)!=NULL)
+	{
+		return AT_PENDING;
+	}
+	for(uint8_t i=0;i<AT_QUEUE_SIZE;i++)
+	{
+		if(_done[i].handle==handle && handle!=0)
+		{
+			return _done[i].result;
+		}
+	}
+	if(handle!=0 && (_handlesWrapped || handle<_nextHandle))
+	{
+		return AT_EXPIRED;
+	}
+	return AT_NONE;
+}
+
+// command() keeps its result on its own stack, out of reach of the _done ring
+static void commandDone(uint16_t, ATResult result, const char*, void* context)
+{
+	*(ATResult*)context=result;
+}
+
+ATResult SIM800L::command(const char* cmd, uint32_t timeout, const char* payload, uint16_t payloadLength)
+{
+	uint32_t start=millis();
+	ATResult state=AT_PENDING;
+	while(submit(cmd,timeout,commandDone,&state,payload,payloadLength)==0)
+	{
+		// Queue full of asynchronous work, let it drain first
+		if(millis()-start>timeout)
+		{
+			return AT_TIMEOUT;
+		}
+		poll();
+		_idle();
+	}
+
+	// Set by _finish(), however many other commands finish while we wait
+	while(true)
+	{
+		poll();
+		if(state!=AT_PENDING)
+		{
+			return state;
+		}
+		_idle();
+	}
+}
+
+const char* SIM800L::response()
+{
+	return _response;
+}
+
+bool SIM800L::truncated()
+{
+	return _truncated;
+}
+
+bool SIM800L::busy()
+{
+	return _count>0;
+}
+
+uint32_t SIM800L::lastLatency()
+{
+	return _lastLatency;
+}
+
+uint32_t SIM800L::averageLatency()
+{
+	if(_commandCount==0)
+	{
+		return 0;
+	}
+	return _latencyTotal/_commandCount;
+}
+
+////////////////////////////////////////////////////BRING-UP/////////////////////////////////////////////////////////////
+
+void SIM800L::bootStart()
+{
+	_bootStage=BOOT_AT;
+	_bootFailed=BOOT_IDLE;
+	_bootEvents=0;
+	_bootProbe=0;
+	_cmgf=-1;
+	_ipSet(IP_OFF);   // a (re)booting modem has no PDP context
+	// nor AT+CSCLK: it boots awake, keep DTR low until sleep is enabled again
+	if(_sleepMode==SLEEP_DTR)
+	{
+		digitalWrite(_dtrPin,LOW);
+	}
+	_markAwake(true);
+	_sleepMode=SLEEP_OFF;
+	_waking=false;
+	memset(_bootAt,0,sizeof(_bootAt));
+	_bootStart=millis();
+	_stepStart=_bootStart;
+	_probeAt=0;
+}
+
+BootStage SIM800L::bootStage()
+{
+	return _bootStage;
+}
+
+BootStage SIM800L::bootFailedStage()
+{
+	return _bootFailed;
+}
+
+uint32_t SIM800L::bootTime(BootStage stage)
+{
+	return (stage<BOOT_STAGES) ? _bootAt[stage] : 0;
+}
+
+bool SIM800L::ready()
+{
+	return _bootStage==BOOT_READY;
+}
+
+void SIM800L::_bootWatch(const char* line)
+{
+	if(strncmp(line,"+CPIN:",6)==0)
+	{
+		const char* state=line+6;
+		while(*state==' ')
+		{
+			state++;
+		}
+		if(strncmp(state,"READY",5)==0)
+		{
+			_bootEvents|=BOOT_EVENT_SIM;
+		}
+		else if(strncmp(state,"NOT READY",9)!=0)
+		{
+			_bootEvents|=BOOT_EVENT_NO_SIM; // NOT INSERTED, SIM PIN, SIM PUK ...
+		}
+	}
+	else if(strcmp(line,"Call Ready")==0)
+	{
+		_bootEvents|=BOOT_EVENT_SIM;
+	}
+	else if(strcmp(line,"SMS Ready")==0)
+	{
+		_bootEvents|=BOOT_EVENT_SMS;
+	}
+	else if(strncmp(line,"+CREG:",6)==0)
+	{
+		// "+CREG: <n>,<stat>" answers AT+CREG?, the URC is "+CREG: <stat>"
+		int stat=intField(line,_ownsPrefix("+CREG:") ? 1 : 0);
+		if(stat==1 || stat==5)
+		{
+			_bootEvents|=BOOT_EVENT_NETWORK;
+		}
+		else
+		{
+			_bootEvents&=~BOOT_EVENT_NETWORK;
+		}
+	}
+}
+
+void SIM800L::_bootAdvance()
+{
+	_bootAt[_bootStage]=millis()-_bootStart;
+	_bootStage=(BootStage)(_bootStage+1);
+	_stepStart=millis();
+	_probeAt=0;
+	if(_bootStage==BOOT_READY)
+	{
+		_bootAt[BOOT_READY]=_bootAt[BOOT_SMS];
+	}
+}
+
+void SIM800L::_bootPoll()
+{
+	if(_bootStage==BOOT_IDLE || _bootStage>=BOOT_READY)
+	{
+		return;
+	}
+
+	if(_bootProbe!=0)
+	{
+		ATResult probe=result(_bootProbe);
+		if(probe==AT_PENDING)
+		{
+			return;
+		}
+		_bootProbe=0;
+		if(probe==AT_OK && _bootStage==BOOT_AT)
+		{
+			_bootEvents|=BOOT_EVENT_ALIVE;
+			// Echo off, registration and network time URCs on; queued behind nothing
+			submit("ATE0",2000);
+			submit("AT+CREG=1",2000);
+			submit("AT+CLTS=1",2000);
+		}
+		else if(probe==AT_OK && _bootStage==BOOT_SMS)
+		{
+			_bootEvents|=BOOT_EVENT_SMS;
+		}
+	}
+
+	// Advance as far as the events seen so far allow (a warm modem is ready at once)
+	static const uint8_t NEEDS[]={0,BOOT_EVENT_ALIVE,BOOT_EVENT_SIM,BOOT_EVENT_NETWORK,BOOT_EVENT_SMS};
+	while(_bootStage<BOOT_READY && (_bootEvents&NEEDS[_bootStage]))
+	{
+		_bootAdvance();
+	}
+	if(_bootStage==BOOT_READY)
+	{
+		return;
+	}
+
+	static const uint32_t TIMEOUTS[]={0,BOOT_AT_TIMEOUT,BOOT_SIM_TIMEOUT,BOOT_NETWORK_TIMEOUT,BOOT_SMS_TIMEOUT};
+	if(millis()-_stepStart>TIMEOUTS[_bootStage] || (_bootStage==BOOT_SIM && (_bootEvents&BOOT_EVENT_NO_SIM)))
+	{
+		_bootFailed=_bootStage;
+		_bootStage=BOOT_FAILED;
+		return;
+	}
+
+	// Ask again only while the link is idle, never between a caller's commands.
+	// A silent UART is retried as soon as the short AT probe times out.
+	if(_count==0 && !_baudBusy && (_bootStage==BOOT_AT || _probeAt==0 || millis()-_probeAt>=BOOT_PROBE_INTERVAL))
+	{
+		static const char* const PROBES[]={NULL,"AT","AT+CPIN?","AT+CREG?","AT+CPMS?"};
+		_probeAt=millis();
+		_bootProbe=submit(PROBES[_bootStage],(_bootStage==BOOT_AT) ? 500 : 2000);
+	}
+}
+
+////////////////////////////////////////////////////BAUD NEGOTIATION/////////////////////////////////////////////////////
+
+void SIM800L::baudControl(ATBaudFn setBaud, void* context, ATErrorFn errors, uint32_t maxBaud, uint32_t currentBaud)
+{
+	_setBaud=setBaud;
+	_baudContext=context;
+	_baudErrors=errors;
+	_baudLimit=maxBaud;
+	_baud=currentBaud;
+}
+
+uint32_t SIM800L::baud()
+{
+	return _baud;
+}
+
+uint32_t SIM800L::throughput()
+{
+	return _throughput;
+}
+
+void SIM800L::_hostBaud(uint32_t rate)
+{
+	_setBaud(rate,_baudContext);
+	_baud=rate;
+	_clearSerial();
+	_framer=ATLineFramer(); // drop half a line received at the old rate
+}
+
+bool SIM800L::_findBaud()
+{
+	// Current host rate first, then every supported rate until BOOT_AT_TIMEOUT
+	uint32_t start=millis();
+	if(command("AT",AT_BAUD_PROBE_TIMEOUT)==AT_OK)
+	{
+		return true;
+	}
+	while(millis()-start<BOOT_AT_TIMEOUT)
+	{
+		for(uint8_t i=0;i<BAUD_RATE_COUNT;i++)
+		{
+			_hostBaud(BAUD_RATES[i]);
+			if(command("AT",AT_BAUD_PROBE_TIMEOUT)==AT_OK)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool SIM800L::_echoTest()
+{
+	// Echo on: the modem must return our exact command text and a full answer, three times
+	uint32_t errors=_baudErrors ? _baudErrors(_baudContext) : 0;
+	bool passed=(command("ATE1",1000)==AT_OK);
+	for(uint8_t i=0;i<3 && passed;i++)
+	{
+		passed=(command(BAUD_ECHO_TEST,1000)==AT_OK && strstr(_response,BAUD_ECHO_TEST)!=NULL);
+	}
+	if(command("ATE0",1000)!=AT_OK)
+	{
+		passed=false;
+	}
+	if(_baudErrors && _baudErrors(_baudContext)!=errors)
+	{
+		passed=false; // clean looking text, but the UART saw framing errors
+	}
+	return passed;
+}
+
+bool SIM800L::_switchBaud(uint32_t rate)
+{
+	uint32_t old=_baud;
+	char cmd[20];
+	_baudBusy=true;
+	snprintf(cmd,sizeof(cmd),"AT+IPR=%lu",(unsigned long)rate);
+	// OK still arrives at the old rate, the modem switches right after it
+	if(command(cmd,2000)!=AT_OK)
+	{
+		_baudBusy=false;
+		return false;
+	}
+	_hostBaud(rate);
+	if(_echoTest())
+	{
+		_baudBusy=false;
+		return true;
+	}
+
+	// Not stable: ask for the old rate (the modem may still understand us), then resync
+	snprintf(cmd,sizeof(cmd),"AT+IPR=%lu",(unsigned long)old);
+	command(cmd,1000);
+	_hostBaud(old);
+	if(command("AT",AT_BAUD_PROBE_TIMEOUT)!=AT_OK)
+	{
+		_findBaud();
+	}
+	_baudBusy=false;
+	return false;
+}
+
+void SIM800L::_negotiateBaud()
+{
+	for(uint8_t i=0;i<BAUD_RATE_COUNT;i++)
+	{
+		uint32_t rate=BAUD_RATES[i];
+		if(rate>_baudLimit)
+		{
+			continue;
+		}
+		if(rate<=_baud)
+		{
+			break; // already at the fastest verified rate
+		}
+		if(_switchBaud(rate))
+		{
+			command("AT&W",5000); // keep the rate across modem power cycles
+			break;
+		}
+	}
+	_errorMark=_baudErrors ? _baudErrors(_baudContext) : 0;
+}
+
+bool SIM800L::baudWatch()
+{
+	if(_setBaud==NULL || _baudErrors==NULL || _count>0)
+	{
+		return false;
+	}
+	uint32_t errors=_baudErrors(_baudContext);
+	uint32_t fresh=errors-_errorMark;
+	_errorMark=errors;
+	if(fresh<AT_BAUD_ERROR_LIMIT)
+	{
+		return false;
+	}
+
+	// Framing errors at this rate: cap negotiation below it and step down
+	for(uint8_t i=0;i<BAUD_RATE_COUNT;i++)
+	{
+		uint32_t rate=BAUD_RATES[i];
+		if(rate>=_baud)
+		{
+			continue;
+		}
+		_baudLimit=rate;
+		if(_switchBaud(rate))
+		{
+			command("AT&W",5000);
+			_errorMark=_baudErrors(_baudContext);
+			return true;
+		}
+	}
+	return false;
+}
+
+void SIM800L::waitWith(ATWaitFn wait, void* context)
+{
+	_waitFn=wait;
+	_waitContext=context;
+}
+
+void SIM800L::trace(Print* tap)
+{
+	_trace=tap;
+}
+
+void SIM800L::onURC(URCType type, URCHandler handler, void* context)
+{
+	if(type<URC_COUNT)
+	{
+		_urcHandlers[type].handler=handler;
+		_urcHandlers[type].context=context;
+	}
+}
+
+int SIM800L::intField(const char* line, uint8_t index)
+{
+	const char* p=_locateField(line,index);
+	if(p==NULL)
+	{
+		return -1;
+	}
+	if(*p=='"')
+	{
+		p++;
+	}
+	return atoi(p);
+}
+
+bool SIM800L::textField(const char* line, uint8_t index, char* out, uint16_t size)
+{
+	const char* p=_locateField(line,index);
+	if(p==NULL || size==0)
+	{
+		return false;
+	}
+	char end=',';
+	if(*p=='"')
+	{
+		end='"';
+		p++;
+	}
+	uint16_t n=0;
+	while(*p!='\0' && *p!=end && *p!='\n' && n<size-1)
+	{
+		out[n++]=*p++;
+	}
+	out[n]='\0';
+	return true;
+}
+
+
+////////////////////////////////////////////////////SLEEP/////////////////////////////////////////////////////////////////
+
+void SIM800L::_markAwake(bool awake)
+{
+	if(awake==_awake)
+	{
+		return;
+	}
+	uint32_t now=millis();
+	if(awake)
+	{
+		_awakeSince=now;
+		_wakeups++;
+	}
+	else
+	{
+		_awakeHour+=now-_awakeSince;
+	}
+	_awake=awake;
+}
+
+// True when the next command may be written; otherwise a wake-up is under way
+bool SIM800L::_wakeReady()
+{
+	if(_sleepMode==SLEEP_OFF)
+	{
+		return true;
+	}
+	uint32_t now=millis();
+	if(_waking)
+	{
+		if(_sleepMode==SLEEP_AUTO)
+		{
+			// Every probe's answer must be in before the held command goes out,
+			// or a late OK would be taken as its result
+			bool expired=(int32_t)(now-_wakeAt)>=0;
+			if(_wakeAnswers>0 && (_wakeAnswers>=_wakeProbes || expired))
+			{
+				_waking=false;
+				return true;
+			}
+			if(!expired)
+			{
+				return false;
+			}
+			if(_wakeProbes<AT_WAKE_AT_TRIES)
+			{
+				_wakeProbe(now);
+				return false;
+			}
+			// Never answered; the held command finds out with its own timeout
+			_waking=false;
+			return true;
+		}
+		if((int32_t)(now-_wakeAt)<0)
+		{
+			return false;
+		}
+		_waking=false;
+		return true;
+	}
+	if(_awake)
+	{
+		return true;
+	}
+
+	_markAwake(true);
+	_waking=true;
+	if(_sleepMode==SLEEP_DTR)
+	{
+		digitalWrite(_dtrPin,LOW);
+		_wakeAt=now+AT_WAKE_DTR_DELAY;
+	}
+	else
+	{
+		_wakeProbes=0;
+		_wakeAnswers=0;
+		_wakeProbe(now);
+	}
+	return false;
+}
+
+// Wakes the UART; the first characters are lost while the module comes up
+void SIM800L::_wakeProbe(uint32_t now)
+{
+	_serial->print(F("AT\r\n"));
+	if(_trace)
+	{
+		_trace->print(F("AT\r\n"));
+	}
+	_wakeProbes++;
+	_activityAt=now;
+	_wakeAt=now+AT_WAKE_AT_TIMEOUT;
+}
+
+void SIM800L::_sleepPoll()
+{
+	if(_sleepMode==SLEEP_OFF)
+	{
+		return;
+	}
+	uint32_t now=millis();
+	if(_awake && !_waking && _count==0)
+	{
+		if(_sleepMode==SLEEP_DTR && now-_activityAt>=AT_SLEEP_HOLD)
+		{
+			digitalWrite(_dtrPin,HIGH);
+			_markAwake(false);
+		}
+		else if(_sleepMode==SLEEP_AUTO && now-_activityAt>=AT_SLEEP_IDLE)
+		{
+			_markAwake(false);   // the module's own idle timer has run out
+		}
+	}
+
+	if(now-_hourStart>=3600000UL)
+	{
+		if(_awake)
+		{
+			_awakeHour+=now-_awakeSince;
+			_awakeSince=now;
+		}
+		_awakeLastHour=_awakeHour;
+		_awakeHour=0;
+		_hourStart=now;
+	}
+}
+
+bool SIM800L::sleepEnable(int8_t dtrPin)
+{
+	if(dtrPin>=0)
+	{
+		pinMode(dtrPin,OUTPUT);
+		digitalWrite(dtrPin,LOW);
+	}
+	if(command(dtrPin>=0 ? "AT+CSCLK=1" : "AT+CSCLK=2",2000)!=AT_OK)
+	{
+		return false;
+	}
+	uint32_t now=millis();
+	_dtrPin=dtrPin;
+	_sleepMode=(dtrPin>=0) ? SLEEP_DTR : SLEEP_AUTO;
+	_awake=true;
+	_waking=false;
+	_awakeSince=now;
+	_activityAt=now;
+	_hourStart=now;
+	_awakeHour=0;
+	_awakeLastHour=0;
+	_wakeups=0;
+	return true;
+}
+
+bool SIM800L::sleepDisable()
+{
+	if(_sleepMode==SLEEP_OFF)
+	{
+		return true;
+	}
+	// Sent through the normal wake path
+	if(command("AT+CSCLK=0",2000)!=AT_OK)
+	{
+		return false;
+	}
+	_markAwake(true);
+	_sleepMode=SLEEP_OFF;
+	return true;
+}
+
+SleepMode SIM800L::sleepMode()
+{
+	return _sleepMode;
+}
+
+bool SIM800L::awake()
+{
+	return _awake;
+}
+
+uint32_t SIM800L::wakeups()
+{
+	return _wakeups;
+}
+
+uint32_t SIM800L::awakeThisHour()
+{
+	return _awakeHour+(_awake ? millis()-_awakeSince : 0);
+}
+
+uint32_t SIM800L::awakeLastHour()
+{
+	return _awakeLastHour;
+}
+
+////////////////////////////////////////////////////GPRS LINK////////////////////////////////////////////////////////////
+
+void SIM800L::_ipSet(IPState state)
+{
+	if(state!=_ipState)
+	{
+		if(_ipState==IP_CONNECTED)
+		{
+			_ipData=false;
+		}
+		_ipState=state;
+		_ipSince=millis();
+	}
+}
+
+// Connection lines arrive unsolicited (CLOSED, PDP DEACT) or well after the
+// command that caused them (CONNECT OK follows the OK of AT+CIPSTART)
+void SIM800L::_ipWatch(const char* line)
+{
+	if(strncmp(line,"0, ",3)==0)
+	{
+		const char* event=line+3;
+		if(strcmp(event,"CONNECT OK")==0 || strcmp(event,"ALREADY CONNECT")==0)
+		{
+			_ipSet(IP_CONNECTED);
+		}
+		else if(strcmp(event,"CLOSED")==0 || strcmp(event,"CLOSE OK")==0 || strcmp(event,"CONNECT FAIL")==0)
+		{
+			if(_ipState==IP_CONNECTED && strcmp(event,"CLOSED")==0)
+			{
+				_ipDrops++;   // closed by the peer or the network, not by ipClose()
+			}
+			if(_ipState!=IP_OFF)
+			{
+				_ipSet(IP_BEARER);
+			}
+		}
+	}
+	else if(strncmp(line,"+PDP: DEACT",11)==0)
+	{
+		if(_ipState==IP_CONNECTED)
+		{
+			_ipDrops++;
+		}
+		_ipSet(IP_OFF);
+	}
+	else if(strncmp(line,"+CIPRXGET: 1,0",14)==0)
+	{
+		_ipData=true;
+	}
+}
+
+////////////////////////////////////////////////////PDU CODEC////////////////////////////////////////////////////////////
+
+// GSM 03.38 default alphabet: ASCII characters that need another code or the escape table
+static const char GSM_ESCAPED[]="^{}\\[~]|";
+static const uint8_t GSM_ESCAPE_CODES[]={0x14,0x28,0x29,0x2F,0x3C,0x3D,0x3E,0x40};
+
+static bool _gsmSame(uint8_t c)
+{
+	// Code points shared by ASCII and the default alphabet
+	return c=='\n' || c=='\r' || (c>=0x20 && c<=0x23) || (c>=0x25 && c<=0x3F) || (c>=0x41 && c<=0x5A) || (c>=0x61 && c<=0x7A);
+}
+
+// Septets for one ASCII character: 1, or 2 with the 0x1B escape
+static uint8_t _gsmChar(char c, uint8_t* code)
+{
+	if(_gsmSame(c))
+	{
+		code[0]=c;
+		return 1;
+	}
+	switch(c)
+	{
+		case '@': code[0]=0x00; return 1;
+		case '$': code[0]=0x02; return 1;
+		case '_': code[0]=0x11; return 1;
+	}
+	const char* escaped=strchr(GSM_ESCAPED,c);
+	if(c!='\0' && escaped!=NULL)
+	{
+		code[0]=0x1B;
+		code[1]=GSM_ESCAPE_CODES[escaped-GSM_ESCAPED];
+		return 2;
+	}
+	code[0]='?';
+	return 1;
+}
+
+// Septets back to ASCII, '?' for characters outside ASCII
+static uint16_t _gsmDecode(const uint8_t* septets, uint16_t count, char* text)
+{
+	uint16_t length=0;
+	for(uint16_t i=0;i<count;i++)
+	{
+		uint8_t s=septets[i];
+		char c='?';
+		if(s==0x1B && i+1<count)
+		{
+			s=septets[++i];
+			for(uint8_t e=0;e<sizeof(GSM_ESCAPE_CODES);e++)
+			{
+				if(GSM_ESCAPE_CODES[e]==s)
+				{
+					c=GSM_ESCAPED[e];
+				}
+			}
+		}
+		else if(_gsmSame(s))
+		{
+			c=s;
+		}
+		else if(s==0x00)
+		{
+			c='@';
+		}
+		else if(s==0x02)
+		{
+			c='$';
+		}
+		else if(s==0x11)
+		{
+			c='_';
+		}
+		text[length++]=c;
+	}
+	text[length]='\0';
+	return length;
+}
+
+static int8_t _hexNibble(char c)
+{
+	if(c>='0' && c<='9') return c-'0';
+	if(c>='A' && c<='F') return c-'A'+10;
+	if(c>='a' && c<='f') return c-'a'+10;
+	return -1;
+}
+
+uint16_t SMSPdu::gsmEncode(const char* text, uint16_t length, uint8_t* septets, uint16_t size)
+{
+	uint16_t count=0;
+	for(uint16_t i=0;i<length;i++)
+	{
+		uint8_t code[2];
+		uint8_t n=_gsmChar(text[i],code);
+		if(count+n>size)
+		{
+			break;
+		}
+		memcpy(septets+count,code,n);
+		count+=n;
+	}
+	return count;
+}
+
+uint16_t SMSPdu::gsmLength(const char* text)
+{
+	uint16_t count=0;
+	uint8_t code[2];
+	while(*text)
+	{
+		count+=_gsmChar(*text++,code);
+	}
+	return count;
+}
+
+uint16_t SMSPdu::pack7(const uint8_t* septets, uint16_t count, uint8_t fillBits, uint8_t* out)
+{
+	// Septets go in LSB first; fill bits pad the start after a user data header
+	uint32_t acc=0;
+	uint8_t bits=fillBits;
+	uint16_t n=0;
+	for(uint16_t i=0;i<count;i++)
+	{
+		acc|=(uint32_t)(septets[i]&0x7F)<<bits;
+		bits+=7;
+		while(bits>=8)
+		{
+			out[n++]=acc&0xFF;
+			acc>>=8;
+			bits-=8;
+		}
+	}
+	if(bits>0)
+	{
+		out[n++]=acc&0xFF;
+	}
+	return n;
+}
+
+void SMSPdu::unpack7(const uint8_t* octets, uint8_t fillBits, uint16_t count, uint8_t* septets)
+{
+	for(uint16_t i=0;i<count;i++)
+	{
+		uint16_t bit=fillBits+i*7;
+		uint8_t shift=bit%8;
+		uint16_t value=octets[bit/8]>>shift;
+		if(shift>1)
+		{
+			value|=octets[bit/8+1]<<(8-shift);
+		}
+		septets[i]=value&0x7F;
+	}
+}
+
+uint8_t SMSPdu::encodeSubmit(const char* number, const uint8_t* units, uint16_t count, SMSCoding coding,
+	uint8_t ref, uint8_t total, uint8_t seq, char* hex, uint16_t hexSize)
+{
+	uint8_t pdu[SMS_PDU_OCTETS];
+	uint16_t n=0;
+	bool concat=(total>1);
+	if(coding==SMS_UCS2)
+	{
+		return 0; // receive only
+	}
+
+	pdu[n++]=concat ? 0x41 : 0x01;   // SMS-SUBMIT, UDHI when a header follows
+	pdu[n++]=0x00;                     // message reference set by the modem
+
+	// Destination address: digit count, type, swapped BCD
+	uint8_t type=0x81;
+	if(*number=='+')
+	{
+		type=0x91;
+		number++;
+	}
+	uint8_t digits=strlen(number);
+	if(digits==0 || digits>20)
+	{
+		return 0;
+	}
+	pdu[n++]=digits;
+	pdu[n++]=type;
+	for(uint8_t i=0;i<digits;i+=2)
+	{
+		if(number[i]<'0' || number[i]>'9' || (i+1<digits && (number[i+1]<'0' || number[i+1]>'9')))
+		{
+			return 0;
+		}
+		uint8_t high=(i+1<digits) ? number[i+1]-'0' : 0x0F;
+		pdu[n++]=(high<<4)|(number[i]-'0');
+	}
+
+	pdu[n++]=0x00;                               // PID
+	pdu[n++]=(coding==SMS_8BIT) ? 0x04 : 0x00;   // DCS
+
+	// Concatenation header: IEI 00, 8-bit reference
+	const uint8_t udh[6]={0x05,0x00,0x03,ref,total,seq};
+	uint8_t udhLength=concat ? sizeof(udh) : 0;
+	if(coding==SMS_7BIT)
+	{
+		uint8_t fill=concat ? (7-(udhLength*8)%7)%7 : 0;
+		uint8_t udhSeptets=(udhLength*8+fill)/7;
+		if(udhSeptets+count>SMS_PART_DATA)
+		{
+			return 0;
+		}
+		pdu[n++]=udhSeptets+count;               // UDL in septets
+		memcpy(pdu+n,udh,udhLength);
+		n+=udhLength;
+		n+=pack7(units,count,fill,pdu+n);
+	}
+	else
+	{
+		if(udhLength+count>140)
+		{
+			return 0;
+		}
+		pdu[n++]=udhLength+count;                // UDL in octets
+		memcpy(pdu+n,udh,udhLength);
+		n+=udhLength;
+		memcpy(pdu+n,units,count);
+		n+=count;
+	}
+
+	if(hexSize<2*n+3)
+	{
+		return 0;
+	}
+	static const char HEX_DIGITS[]="0123456789ABCDEF";
+	hex[0]='0';   // no SMSC, the modem uses the SIM's
+	hex[1]='0';
+	for(uint16_t i=0;i<n;i++)
+	{
+		hex[2+2*i]=HEX_DIGITS[pdu[i]>>4];
+		hex[3+2*i]=HEX_DIGITS[pdu[i]&0x0F];
+	}
+	hex[2+2*n]='\0';
+	return n;
+}
+
+bool SMSPdu::decodeDeliver(const char* hex, SMSPart* part)
+{
+	uint8_t pdu[SMS_PDU_OCTETS];
+	uint16_t length=0;
+	while(length<sizeof(pdu))
+	{
+		int8_t high=_hexNibble(hex[0]);
+		int8_t low=(high<0) ? -1 : _hexNibble(hex[1]);
+		if(low<0)
+		{
+			break;
+		}
+		pdu[length++]=(high<<4)|low;
+		hex+=2;
+	}
+
+	uint16_t p=0;
+	if(length<1 || pdu[0]+1u>length)
+	{
+		return false;
+	}
+	p+=pdu[0]+1;                      // SMSC address
+	if(p+2>length || (pdu[p]&0x03)!=0x00)
+	{
+		return false;                 // not an SMS-DELIVER
+	}
+	bool udhi=(pdu[p++]&0x40)!=0;
+
+	// Originating address
+	uint8_t digits=pdu[p++];
+	uint8_t type=pdu[p++];
+	uint8_t octets=(digits+1)/2;
+	if(p+octets+10>length)
+	{
+		return false;
+	}
+	uint8_t s=0;
+	if((type&0x70)==0x50)
+	{
+		// Alphanumeric sender, digits counts semi-octets of packed septets
+		uint8_t septets[24];
+		uint8_t count=digits*4/7;
+		if(count>sizeof(part->sender)-1)
+		{
+			count=sizeof(part->sender)-1;
+		}
+		unpack7(pdu+p,0,count,septets);
+		char text[2*sizeof(septets)+1];
+		_gsmDecode(septets,count,text);
+		strncpy(part->sender,text,sizeof(part->sender)-1);
+		part->sender[sizeof(part->sender)-1]='\0';
+	}
+	else
+	{
+		if((type&0x70)==0x10)
+		{
+			part->sender[s++]='+';
+		}
+		for(uint8_t i=0;i<digits && s<sizeof(part->sender)-1;i++)
+		{
+			uint8_t d=(i&1) ? pdu[p+i/2]>>4 : pdu[p+i/2]&0x0F;
+			if(d<=9)
+			{
+				part->sender[s++]='0'+d;
+			}
+		}
+		part->sender[s]='\0';
+	}
+	p+=octets;
+
+	p++;                              // PID
+	uint8_t dcs=pdu[p++];
+	if((dcs&0x80)==0x00)
+	{
+		uint8_t alphabet=(dcs>>2)&0x03;   // general data coding groups
+		part->coding=(alphabet==1) ? SMS_8BIT : (alphabet==2) ? SMS_UCS2 : SMS_7BIT;
+	}
+	else if((dcs&0xF0)==0xF0)
+	{
+		part->coding=(dcs&0x04) ? SMS_8BIT : SMS_7BIT;
+	}
+	else if((dcs&0xF0)==0xE0)
+	{
+		part->coding=SMS_UCS2;
+	}
+	else if((dcs&0xF0)==0xC0 || (dcs&0xF0)==0xD0)
+	{
+		part->coding=SMS_7BIT;
+	}
+	else
+	{
+		part->coding=SMS_8BIT;
+	}
+	p+=7;                             // service centre time stamp
+
+	uint8_t udl=pdu[p++];
+	const uint8_t* ud=pdu+p;
+	uint16_t udOctets=length-p;
+	uint16_t needed=(part->coding==SMS_7BIT) ? (udl*7+7)/8 : udl;
+	if(needed>udOctets)
+	{
+		return false;
+	}
+
+	part->ref=0;
+	part->total=1;
+	part->seq=1;
+	uint8_t udhBytes=0;
+	if(udhi && udOctets>0)
+	{
+		udhBytes=ud[0]+1;
+		if(udhBytes>needed)
+		{
+			return false;
+		}
+		for(uint8_t i=1;i+1<udhBytes;i+=2+ud[i+1])
+		{
+			const uint8_t* ie=ud+i;
+			if(i+2+ie[1]>udhBytes)
+			{
+				break;
+			}
+			if(ie[0]==0x00 && ie[1]==3)
+			{
+				part->ref=ie[2];
+				part->total=ie[3];
+				part->seq=ie[4];
+			}
+			else if(ie[0]==0x08 && ie[1]==4)
+			{
+				part->ref=(ie[2]<<8)|ie[3];
+				part->total=ie[4];
+				part->seq=ie[5];
+			}
+		}
+	}
+
+	if(part->coding==SMS_7BIT)
+	{
+		uint8_t fill=udhBytes ? (7-(udhBytes*8)%7)%7 : 0;
+		uint8_t skip=udhBytes ? (udhBytes*8+fill)/7 : 0;
+		if(skip>udl || udl-skip>SMS_PART_DATA)
+		{
+			return false;
+		}
+		uint8_t septets[SMS_PART_DATA];
+		unpack7(ud+udhBytes,fill,udl-skip,septets);
+		part->length=_gsmDecode(septets,udl-skip,(char*)part->data);
+	}
+	else if(part->coding==SMS_8BIT)
+	{
+		part->length=udl-udhBytes;
+		memcpy(part->data,ud+udhBytes,part->length);
+		part->data[part->length]='\0';
+	}
+	else
+	{
+		part->length=0;
+		for(uint8_t i=udhBytes;i+1<udl;i+=2)
+		{
+			uint16_t code=(ud[i]<<8)|ud[i+1];
+			part->data[part->length++]=(code<0x80) ? code : '?';
+		}
+		part->data[part->length]='\0';
+	}
+	return true;
+}
+
+SMSReassembler::SMSReassembler()
+{
+	memset(_slots,0,sizeof(_slots));
+}
+
+bool SMSReassembler::add(const SMSPart& part, SMSMessage* message)
+{
+	uint32_t now=millis();
+	for(uint8_t i=0;i<SMS_REASSEMBLY_SLOTS;i++)
+	{
+		if(_slots[i].used && now-_slots[i].firstAt>SMS_REASSEMBLY_TIMEOUT)
+		{
+			_slots[i].used=false;
+			_dropped++;
+		}
+	}
+
+	if(part.total<=1 || part.total>SMS_PARTS_MAX || part.seq==0 || part.seq>part.total)
+	{
+		// Single message, or a header this reassembler cannot hold: deliver as it is
+		strcpy(message->sender,part.sender);
+		message->coding=part.coding;
+		message->parts=1;
+		message->length=part.length;
+		memcpy(message->data,part.data,part.length);
+		message->data[part.length]='\0';
+		return true;
+	}
+
+	Slot* slot=NULL;
+	Slot* oldest=&_slots[0];
+	for(uint8_t i=0;i<SMS_REASSEMBLY_SLOTS && slot==NULL;i++)
+	{
+		Slot& candidate=_slots[i];
+		if(candidate.used && candidate.ref==part.ref && candidate.total==part.total && strcmp(candidate.sender,part.sender)==0)
+		{
+			slot=&candidate;
+		}
+		else if(!candidate.used || (oldest->used && candidate.firstAt<oldest->firstAt))
+		{
+			oldest=&candidate;
+		}
+	}
+	if(slot==NULL)
 	{
-		delay(10);
-		yield();
-		_timeout++;
+		if(oldest->used)
+		{
+			_dropped++;   // all slots busy, the oldest message is given up
+		}
+		slot=oldest;
+		slot->used=true;
+		strcpy(slot->sender,part.sender);
+		slot->ref=part.ref;
+		slot->total=part.total;
+		slot->have=0;
+		slot->coding=part.coding;
+		slot->firstAt=now;
 	}
-	if(_serial->available())
+
+	uint8_t index=part.seq-1;
+	slot->length[index]=part.length;
+	memcpy(slot->data[index],part.data,part.length);
+	slot->have|=1<<index;
+	if(slot->have!=(1<<slot->total)-1)
 	{
-		return _serial->readString();
+		return false;
 	}
 
-	return "";
+	strcpy(message->sender,slot->sender);
+	message->coding=slot->coding;
+	message->parts=slot->total;
+	message->length=0;
+	for(uint8_t i=0;i<slot->total;i++)
+	{
+		memcpy(message->data+message->length,slot->data[i],slot->length[i]);
+		message->length+=slot->length[i];
+	}
+	message->data[message->length]='\0';
+	slot->used=false;
+	return true;
 }
 
-void SIM800L::_clearSerial()
+uint8_t SMSReassembler::pending()
 {
-	if(_serial->available())
+	uint8_t count=0;
+	for(uint8_t i=0;i<SMS_REASSEMBLY_SLOTS;i++)
 	{
-		_serial->readString();
+		count+=_slots[i].used;
 	}
+	return count;
 }
 
-/////////////////////////////////////////////////INSTANT/INIT DEFINITION/////////////////////////////////////////////////
-
-SIM800L::SIM800L(void)
+uint32_t SMSReassembler::dropped()
 {
-  _serialBuffer.reserve(1500); //reserve memory to prevent fragmention
+	return _dropped;
 }
 
-bool SIM800L::begin(Stream &serial) // begin Definition with Serial port assignment
+////////////////////////////////////////////////////PUBLIC DEFINITION////////////////////////////////////////////////////
+/*void SIM800L::tcpCallBack(void (*callback)(const char* _data, const uint16_t len))
 {
-	_serial = &serial;
-	delay(1000);
-	yield();
-	_clearSerial();
+    this->tcp_callback = callback;
+}*/
 
-	_serial->print(F("AT\r\n"));
-	_serialBuffer=_readSerial();
-	if ( (_serialBuffer.indexOf("OK") )!=-1 )
+bool SIM800L::startGPRS(const char* apn)
+{
+	char _tempBuff[AT_CMD_MAX+1]={0};
+	command("AT+CIPSHUT",65000);
+	_ipSet(IP_OFF);
+	// One connection on link 0, DATA ACCEPT instead of waiting for SEND OK, received data kept in the modem
+	if(command("AT+CIPMUX=1")!=AT_OK || command("AT+CIPQSEND=1")!=AT_OK || command("AT+CIPRXGET=1")!=AT_OK)
 	{
-		yield();
-		_clearSerial();
-		_serial->print(F("ATE0\r\n"));
-		_serialBuffer=_readSerial();
-		if ((_serialBuffer.indexOf("OK"))!=-1 )
-		{	
-			return enAutoTimeZone();
-		}
-		else 
-		{
-			return false;
-		}
+		return false;
+	}
+	snprintf(_tempBuff,sizeof(_tempBuff),"AT+CSTT=\"%s\"",apn);
+	if(command(_tempBuff)!=AT_OK)
+	{
+		return false;
+	}
+	if(command("AT+CIICR",85000)!=AT_OK)
+	{
+		return false;
+	}
+	if(command("AT+CIFSR;E0")!=AT_OK)
+	{
+		return false;
 	}
-	else 
+	if(command("AT+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\"")!=AT_OK)
 	{
 		return false;
 	}
+
+	_ipSet(IP_BEARER);
+	return true;
 }
 
-bool SIM800L::begin(Stream &serial,uint8_t pin) // begin Definition with Serial port and reset pin assignment
+bool SIM800L::stopGPRS()
 {
-	rstpin=pin;
-	pinMode(rstpin,OUTPUT);
-	digitalWrite(rstpin,LOW);
-	rstDeclair=true;
-	begin(serial);
+	bool shut=(command("AT+CIPSHUT",65000)==AT_OK);
+	_ipSet(IP_OFF);
+	return shut;
 }
 
+bool SIM800L::tcpConnect(const char* host,uint16_t port)
+{
+	return _ipConnect("TCP",host,port);
+}
 
-////////////////////////////////////////////////////PUBLIC DEFINITION////////////////////////////////////////////////////
-/*void SIM800L::tcpCallBack(void (*callback)(const char* _data, const uint16_t len))
+bool SIM800L::udpConnect(const char* host,uint16_t port)
 {
-    this->tcp_callback = callback;
-}*/
+	return _ipConnect("UDP",host,port);
+}
 
-bool SIM800L::startGPRS()
+bool SIM800L::_ipConnect(const char* proto, const char* host, uint16_t port)
 {
-	_clearSerial();
-	_serial->print(F("AT+CIPSHUT\r\n"));
-	delay(200);
-	_serial->print(F("AT+CIPMUX=1\r\n"));
-	delay(200);
-	_serial->print(F("AT+CIPQSEND=1\r\n"));
-	delay(200);
-	_serial->print(F("AT+CIPRXGET=1\r\n"));
-	delay(200);
-	_serial->print(F("AT+CSTT=\"\"\r\n"));
-	delay(200);
-	_clearSerial();
-	_serial->println("AT+CIICR");
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("OK"))==-1 )
+	char _tempBuff[AT_CMD_MAX+1]={0};
+	if(_ipState==IP_OFF)
 	{
-		return false;  
+		return false;
 	}
-	_clearSerial();
-	_serial->println("AT+CIFSR;E0");
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("ERROR")) != -1 )
+	snprintf(_tempBuff,sizeof(_tempBuff),"AT+CIPSTART=0,\"%s\",\"%s\",\"%u\"",proto,host,port);
+	_ipUdp=(strcmp(proto,"UDP")==0);
+	// Set before sending: CONNECT OK may arrive right behind the OK
+	_ipSet(IP_CONNECTING);
+	if(command(_tempBuff,10000)!=AT_OK)
 	{
-		return false;  
+		if(_ipState==IP_CONNECTING)
+		{
+			_ipSet(IP_BEARER);
+		}
+		return _ipState==IP_CONNECTED;
 	}
+	return true;
+}
 
-	_clearSerial();
-	_serial->println("AT+CDNSCFG=\"8.8.8.8\",\"8.8.4.4\"");
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("OK")) == -1 )
+bool SIM800L::ipClose()
+{
+	bool closed=(command("AT+CIPCLOSE=0,1",5000)==AT_OK);
+	if(_ipState!=IP_OFF)
 	{
-		return false;  
+		_ipSet(IP_BEARER);
 	}
-	
-	return true;
+	return closed;
 }
 
-void SIM800L::tcpConnect(char* host,uint16_t port)
+IPState SIM800L::ipState()
 {
-	uint32_t tempTime=0;
-	char _tempBuff[50]={0};
-	sprintf(_tempBuff,"AT+CIPSTART=0,\"TCP\",\"%s\",\"%d\"\r\n",host,port);
-	_serial->print(_tempBuff);
+	return _ipState;
 }
 
-bool SIM800L::tcpStatus()
+bool SIM800L::ipUdp()
 {
-	_clearSerial();
-	_serial->print(F("AT+CIPSTATUS=0\r\n"));
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("+CIPSTATUS:") )!=-1 )
+	return _ipUdp;
+}
+
+uint32_t SIM800L::ipStateAge()
+{
+	return millis()-_ipSince;
+}
+
+uint32_t SIM800L::ipDrops()
+{
+	return _ipDrops;
+}
+
+bool SIM800L::ipStatus()
+{
+	if(command("AT+CIPSTATUS=0")==AT_OK && strstr(_response,"+CIPSTATUS:")!=NULL)
 	{
-		if((_serialBuffer.indexOf("CONNECTED") )!=-1 )
-		{
-			return true;
-		}
-		else
+		bool connected=(strstr(_response,"\"CONNECTED\"")!=NULL);
+		if(!connected && _ipState==IP_CONNECTED)
 		{
-			return false;
+			_ipDrops++;   // lost without a CLOSED line
+			_ipSet(IP_BEARER);
 		}
+		return connected;
 	}
+	return false;
 }
 
-int16_t SIM800L::tcpAvailable()
+bool SIM800L::ipSend(const uint8_t* data,uint16_t length)
 {
-	_clearSerial();
-	_serial->print(F("AT+CIPRXGET=4,0\r\n"));
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("+CIPRXGET: 4,0,") )!= -1)
+	char _tempBuff[30]={0};
+	if(_ipState!=IP_CONNECTED || length==0 || length>IP_SEND_MAX)
 	{
-		return _serialBuffer.substring(_serialBuffer.indexOf("+CIPRXGET: 4,0,")+15,_serialBuffer.indexOf("\r",_serialBuffer.indexOf("+CIPRXGET: 4,0,")+15)).toInt();
+		return false;
 	}
-
-	return -1;
+	snprintf(_tempBuff,sizeof(_tempBuff),"AT+CIPSEND=0,%u",length);
+	// Quick send mode answers DATA ACCEPT once buffered; delivery shows up in ipAcked()
+	return command(_tempBuff,10000,(const char*)data,length)==AT_OK;
 }
 
-void SIM800L::tcpRead(char* buffer,uint16_t length)
+bool SIM800L::ipAcked(uint32_t* sent,uint32_t* acked)
 {
-	char _tempBuff[30]={0};
-	sprintf(_tempBuff,"AT+CIPRXGET=2,0,%d\r\n",length);
-	_clearSerial();
-	_serial->print(_tempBuff);
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("+CIPRXGET: 2,0,"))!=-1 )
+	// +CIPACK: <txlen>,<acklen>,<nacklen>
+	if(command("AT+CIPACK=0",5000)!=AT_OK)
 	{
-		uint16_t dataindex = _serialBuffer.indexOf('\n',_serialBuffer.indexOf(",",_serialBuffer.indexOf("+CIPRXGET: 2,0,")))+1;
+		return false;
+	}
+	int tx=_field("+CIPACK:",0);
+	int ack=_field("+CIPACK:",1);
+	if(tx<0 || ack<0)
+	{
+		return false;
+	}
+	*sent=tx;
+	*acked=ack;
+	return true;
+}
+
+bool SIM800L::ipDataPending()
+{
+	return _ipData;
+}
 
-		memset(_tempBuff,'\0',sizeof(_tempBuff));
-		for(uint16_t i=0;i<length;i++)
+int16_t SIM800L::ipAvailable()
+{
+	if(command("AT+CIPRXGET=4,0")==AT_OK)
+	{
+		int16_t available=_field("+CIPRXGET:",2);
+		if(available==0)
 		{
-			buffer[i]=_serialBuffer[i+dataindex];
+			_ipData=false;
 		}
+		return available;
 	}
+
+	return -1;
 }
 
-void SIM800L::tcpSend(char* buffer)
+uint16_t SIM800L::ipRead(uint8_t* buffer,uint16_t length)
 {
-	_clearSerial();
-	_serial->print("AT+CIPSEND=0\r\n");
-	delay(500);
-	_serial->print(buffer);
-	_clearSerial();
-	_serial->write (0x1A); // command for send data;
+	char _tempBuff[30]={0};
+	if(length>IP_READ_MAX)
+	{
+		length=IP_READ_MAX;
+	}
+	// Hex mode keeps CR/LF in the data from being taken as line ends
+	snprintf(_tempBuff,sizeof(_tempBuff),"AT+CIPRXGET=3,0,%u",length);
+	if(command(_tempBuff)!=AT_OK)
+	{
+		return 0;
+	}
+	const char* header=strstr(_response,"+CIPRXGET: 3,0,");
+	const char* data=header ? strchr(header,'\n') : NULL;
+	if(data==NULL)
+	{
+		return 0;
+	}
+	if(intField(header,3)==0)
+	{
+		_ipData=false;   // nothing left in the modem
+	}
+	data++;
+	uint16_t count=0;
+	while(count<length)
+	{
+		int8_t high=_hexNibble(data[0]);
+		int8_t low=(high<0) ? -1 : _hexNibble(data[1]);
+		if(low<0)
+		{
+			break;
+		}
+		buffer[count++]=(high<<4)|low;
+		data+=2;
+	}
+	return count;
 }
 
 /*void SIM800L::loop()
@@ -221,129 +1946,241 @@ bool SIM800L::available()
 
 bool SIM800L::incomingCall()
 {
-	_serialBuffer=_readSerial();
-	if ( (_serialBuffer.indexOf("RING") )!=-1 )
-	{
-		return true;
-	}
-	else 
+	poll();
+	bool ring=_ring;
+	_ring=false;
+	return ring;
+}
+
+bool SIM800L::dialNumber(char* number)
+{
+	char _tempBuff[AT_CMD_MAX+1]={0};
+	snprintf(_tempBuff,sizeof(_tempBuff),"ATD%s;",number);
+	return command(_tempBuff)==AT_OK;
+}
+
+bool SIM800L::answerCall()
+{
+	return command("ATA")==AT_OK;
+}
+
+bool SIM800L::hangoffCall()
+{
+	return command("ATH")==AT_OK;
+}
+
+int8_t SIM800L::callStatus()
+{
+	if(command("AT+CLCC")==AT_OK && strstr(_response,"+CLCC: ")!=NULL)
 	{
-		return false;
+		return _field("+CLCC:",2);
 	}
+	return -1;
 }
 
-bool SIM800L::dialNumber(char* number)
+bool SIM800L::sendSMS(char* number,char* text)
 {
-	_clearSerial();
-	_serial->print (F("ATD"));
-	_serial->print (number);
-	_serial->print (F(";\r\n"));
-	_serialBuffer=_readSerial();
-	if ( (_serialBuffer.indexOf("OK") )!=-1 )
+	int16_t reference;
+	if(SMSPdu::gsmLength(text)>SMS_PART_DATA)
 	{
-		return true;  
+		// Text mode would be cut at 160 characters by the network
+		return sendPDU(number,(const uint8_t*)text,strlen(text),SMS_7BIT)>0;
 	}
-	else 
+	if(!_setFormat(true)) //set sms to text mode
 	{
 		return false;
 	}
+	return _sendText(number,text,&reference)==AT_OK;
 }
 
-bool SIM800L::answerCall()
+uint8_t SIM800L::sendSMSToMany(const char* const* numbers, uint8_t count, const char* text, SMSReport* reports)
 {
-	_clearSerial();
-	_serial->print(F("ATA\r\n"));
-	_serialBuffer=_readSerial();
-	if ( (_serialBuffer.indexOf("OK") )!=-1 )
+	uint8_t sent=0;
+	for(uint8_t i=0;i<count;i++)
 	{
-		return true;  
+		reports[i].result=AT_NONE;
+		reports[i].reference=-1;
+		reports[i].latency=0;
 	}
-	else 
+	// Longer than one part: concatenated PDU messages instead of text mode
+	bool concat=(SMSPdu::gsmLength(text)>SMS_PART_DATA);
+	if(!_setFormat(!concat))
 	{
-		return false;
+		return 0;
+	}
+
+	// Keep the radio link up between messages instead of releasing it after each one
+	bool linkHeld=(command("AT+CMMS=2",2000)==AT_OK);
+	for(uint8_t i=0;i<count;i++)
+	{
+		uint32_t start=millis();
+		uint8_t parts;
+		if(concat)
+		{
+			reports[i].result=_sendPDU(numbers[i],(const uint8_t*)text,strlen(text),SMS_7BIT,&reports[i].reference,&parts);
+		}
+		else
+		{
+			reports[i].result=_sendText(numbers[i],text,&reports[i].reference);
+		}
+		reports[i].latency=millis()-start;
+		if(reports[i].result==AT_OK)
+		{
+			sent++;
+		}
+	}
+	if(linkHeld)
+	{
+		command("AT+CMMS=0",2000);
 	}
+	return sent;
 }
 
-bool SIM800L::hangoffCall()
+bool SIM800L::_setFormat(bool text)
 {
-	_clearSerial();
-	_serial->print(F("ATH\r\n"));
-	_serialBuffer=_readSerial();
-	if ( (_serialBuffer.indexOf("OK") )!=-1 )
+	if(_cmgf!=(text ? 1 : 0))
+	{
+		_cmgf=(command(text ? "AT+CMGF=1" : "AT+CMGF=0",5000)==AT_OK) ? (text ? 1 : 0) : -1;
+	}
+	return _cmgf==(text ? 1 : 0);
+}
+
+bool SIM800L::setSMSFormat(bool text)
+{
+	return _setFormat(text);
+}
+
+ATResult SIM800L::_sendPDU(const char* number, const uint8_t* data, uint16_t length, SMSCoding coding, int16_t* reference, uint8_t* parts)
+{
+	uint8_t units[SMS_DATA_MAX];
+	uint16_t count;
+	uint16_t perPart;
+	*reference=-1;
+	*parts=0;
+	if(coding==SMS_7BIT)
 	{
-		return true;  
+		count=SMSPdu::gsmEncode((const char*)data,length,units,sizeof(units));
+		perPart=(count>SMS_PART_DATA) ? 153 : SMS_PART_DATA;   // 7 septets go to the concatenation header
 	}
-	else 
+	else if(coding==SMS_8BIT)
 	{
-		return false;
+		count=(length<sizeof(units)) ? length : sizeof(units);
+		memcpy(units,data,count);
+		perPart=(count>140) ? 134 : 140;
+	}
+	else
+	{
+		return AT_ERROR;
+	}
+
+	// Split without cutting a 7-bit escape pair in half
+	uint16_t starts[SMS_PARTS_MAX+1];
+	uint8_t total=0;
+	uint16_t pos=0;
+	while(pos<count || total==0)
+	{
+		if(total==SMS_PARTS_MAX)
+		{
+			return AT_ERROR; // too long for SMS_PARTS_MAX parts
+		}
+		starts[total++]=pos;
+		uint16_t end=(count-pos>perPart) ? pos+perPart : count;
+		if(coding==SMS_7BIT && end<count && units[end-1]==0x1B)
+		{
+			end--;
+		}
+		pos=end;
+		if(count==0)
+		{
+			break;
+		}
+	}
+	starts[total]=count;
+
+	uint8_t ref=(total>1) ? ++_concatRef : 0;
+	char hex[2*SMS_PDU_OCTETS+3];
+	char cmd[20];
+	ATResult result=AT_OK;
+	for(uint8_t i=0;i<total && result==AT_OK;i++)
+	{
+		uint8_t octets=SMSPdu::encodeSubmit(number,units+starts[i],starts[i+1]-starts[i],coding,ref,total,i+1,hex,sizeof(hex));
+		if(octets==0)
+		{
+			return AT_ERROR;
+		}
+		snprintf(cmd,sizeof(cmd),"AT+CMGS=%u",octets);
+		result=command(cmd,20000,hex);
+		if(result==AT_OK)
+		{
+			*reference=_field("+CMGS:",0);
+			(*parts)++;
+		}
 	}
+	return result;
 }
 
-int8_t SIM800L::callStatus()
+uint8_t SIM800L::sendPDU(const char* number, const uint8_t* data, uint16_t length, SMSCoding coding, SMSReport* report)
 {
-	_clearSerial();
-	_serial->print (F("AT+CLCC\r\n"));
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("+CLCC: ") )!=-1)
+	int16_t reference=-1;
+	uint8_t parts=0;
+	uint32_t start=millis();
+	ATResult result=_setFormat(false) ? _sendPDU(number,data,length,coding,&reference,&parts) : AT_ERROR;
+	if(report)
+	{
+		report->result=result;
+		report->reference=reference;
+		report->latency=millis()-start;
+	}
+	return (result==AT_OK) ? parts : 0;
+}
+
+bool SIM800L::readPDU(uint8_t msgIndex, SMSPart* part)
+{
+	char cmd[20];
+	if(!_setFormat(false))
 	{
-		return _serialBuffer.substring(_serialBuffer.indexOf("+CLCC: ")+11,_serialBuffer.indexOf("+CLCC: ")+13).toInt();
-	}  
-	else if( (_serialBuffer.indexOf("OK") )!=-1 )
+		return false;
+	}
+	snprintf(cmd,sizeof(cmd),"AT+CMGR=%d",msgIndex);
+	if(command(cmd,5000)!=AT_OK)
 	{
-		return -1;  
+		return false;
 	}
+	// +CMGR: <stat>,[<alpha>],<length> then the PDU on its own line
+	const char* header=strstr(_response,"+CMGR:");
+	const char* pdu=header ? strchr(header,'\n') : NULL;
+	return pdu!=NULL && SMSPdu::decodeDeliver(pdu+1,part);
 }
 
-bool SIM800L::sendSMS(char* number,char* text)
+ATResult SIM800L::_sendText(const char* number, const char* text, int16_t* reference)
 {
-	uint32_t tempTime=0;
-	_serial->print (F("AT+CMGF=1\r")); //set sms to text mode  
-	_serialBuffer=_readSerial();
-	_serial->print (F("AT+CMGS=\""));  // command to prepare sms
-	_serial->print (number);           
-	_serial->print (F("\"\r"));       
-	_serialBuffer=_readSerial(); 
-	_serial->print (text);
-	_serial->print ("\r"); 
-	
-	delay(100);
-	_clearSerial();
-	_serial->write (0x1A); // command for send sms
+	char _tempBuff[AT_CMD_MAX+1]={0};
+	snprintf(_tempBuff,sizeof(_tempBuff),"AT+CMGS=\"%s\"",number); // command to prepare sms
 
-	tempTime=millis();
-	while(millis()-tempTime <= 20000) // Wait for SMS sent response for 1 minute(Maximum response time of AT+CMGS is 1 min)
+	// Text goes out on the '>' prompt; AT+CMGS may take a while to confirm
+	ATResult result=command(_tempBuff,20000,text);
+	*reference=-1;
+	if(result==AT_OK)
 	{
-		if(available())
+		*reference=_field("+CMGS:",0);
+		if(*reference<0)
 		{
-			_serialBuffer=_readSerial();
-			if (((_serialBuffer.indexOf("+CMGS") ) != -1 ) )
-			{
-				return true;
-			}
+			result=AT_ERROR;
 		}
 	}
-
-	return false;
+	return result;
 }
 
 String SIM800L::readSMS(uint8_t msgIndex)
 {
-	_serial->print (F("AT+CMGF=1\r")); //set sms to text mode  
-	_serialBuffer=_readSerial(); 
-	if ((_serialBuffer.indexOf("ERR"))!=-1) // CHECK IF ERROR
+	char _tempBuff[20]={0};
+	if(_setFormat(true)) //set sms to text mode
 	{
-		_serial->print (F("AT+CMGR="));
-		_serial->print (msgIndex);
-		_serial->print ("\r");
-		_serialBuffer=_readSerial();
-		if (_serialBuffer.indexOf("CMGR:")!=-1)
+		snprintf(_tempBuff,sizeof(_tempBuff),"AT+CMGR=%d",msgIndex);
+		if(command(_tempBuff)==AT_OK && strstr(_response,"CMGR:")!=NULL)
 		{
-			return _serialBuffer;
+			return String(_response);
 		}
-		else
-		{
-			return ""; 
-		}   
 	}
 
 	return "";
@@ -351,120 +2188,105 @@ String SIM800L::readSMS(uint8_t msgIndex)
 
 int8_t SIM800L::signalStrength()
 {
-	if(checkNetwork())
-	{
-		_clearSerial();
-		_serial->print (F("AT+CSQ\r\n"));
-		_serialBuffer=_readSerial();
-		if((_serialBuffer.indexOf("+CSQ: ") )!=-1)
-		{
-			return _serialBuffer.substring(_serialBuffer.indexOf("+CSQ: ")+6,_serialBuffer.indexOf(",")).toInt();
-		} 
-		else
-		{
-			return -1;
-		}
-	}
-	else
+	// +CSQ answers with or without registration; 99 means not detectable
+	if(command("AT+CSQ",5000)==AT_OK)
 	{
-		return -1;
+		int rssi=_field("+CSQ:",0);
+		return (rssi>=0 && rssi<=31) ? rssi : -1;
 	}
+	return -1;
 }
 
 bool SIM800L::checkNetwork()
 {
-	_clearSerial();
-	_serial->print (F("AT+CREG?\r\n"));
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("+CREG: ") )!=-1)
+	if(command("AT+CREG?")==AT_OK)
 	{
-		return _serialBuffer.substring(_serialBuffer.indexOf("+CREG: ")+9,_serialBuffer.indexOf("+CREG: ")+11).toInt();
-	}  
-	else
+		return _field("+CREG:",1)>0;
+	}
+	return 0;
+}
+
+bool SIM800L::networkHealth(int8_t* rssi, int8_t* stat)
+{
+	// Both reports in one round trip
+	if(command("AT+CSQ;+CREG?",5000)!=AT_OK)
 	{
-		return 0;  
+		return false;
 	}
+	int csq=_field("+CSQ:",0);
+	*rssi=(csq>=0 && csq<=31) ? csq : -1;
+	*stat=_field("+CREG:",1);
+	return true;
 }
 
 String SIM800L::serviceProvider()
 {
-	if(checkNetwork())
+	// +CSPN? fails with +CME ERROR when unregistered, no separate CREG check needed
+	if(command("AT+CSPN?",5000)==AT_OK)
 	{
-		_clearSerial();
-		_serial->print (F("AT+CSPN?\r\n"));
-		_serialBuffer=_readSerial();
-		if((_serialBuffer.indexOf("+CSPN: ") )!=-1)
+		const char* index1=strchr(_response,'"');
+		const char* index2=index1 ? strchr(index1+1,'"') : NULL;
+		if(index2!=NULL)
 		{
-			uint8_t index1=_serialBuffer.indexOf("\"");
-			uint8_t index2=_serialBuffer.indexOf("\"",index1+1);
-			return _serialBuffer.substring(index1+1,index2);
-		} 
-		else
-		{
-			return "No network";
+			String provider="";
+			for(const char* p=index1+1;p<index2;p++)
+			{
+				provider+=*p;
+			}
+			return provider;
 		}
 	}
-	else
-	{
-		return "No network";
-	}	
+	return "No network";
 }
 
 bool SIM800L::GSMTime(uint8_t *_time)
 {
-	_clearSerial();
-	_serial->print (F("AT+CCLK?\r\n"));
-	_serialBuffer=_readSerial();
-	if((_serialBuffer.indexOf("+CCLK: ") )!=-1)
-	{
-		_serialBuffer = _serialBuffer.substring(_serialBuffer.indexOf("\"")+1,_serialBuffer.lastIndexOf("\"")-1);  
-
-		_time[0]=_serialBuffer.substring(0,_serialBuffer.indexOf("/")).toInt();
-		_time[1]=_serialBuffer.substring(_serialBuffer.indexOf("/")+1,_serialBuffer.lastIndexOf("/")).toInt();
-		_time[2]=_serialBuffer.substring(_serialBuffer.lastIndexOf("/")+1,_serialBuffer.indexOf(",")).toInt();
-		_time[3]=_serialBuffer.substring(_serialBuffer.indexOf(",")+1,_serialBuffer.indexOf(":")).toInt();
-		_time[4]=_serialBuffer.substring(_serialBuffer.indexOf(":")+1,_serialBuffer.lastIndexOf(":")).toInt();
-		_time[5]=_serialBuffer.substring(_serialBuffer.lastIndexOf(":")+1,_serialBuffer.indexOf("+")).toInt();
-		return 1;
-	}  
-	else
+	int year,month,day,hour,minute,second;
+	if(command("AT+CCLK?")==AT_OK)
 	{
-		memset(_time,0xFF,sizeof(_time));
-		return 0;  
+		const char* p=strstr(_response,"+CCLK: \"");
+		if(p!=NULL && sscanf(p,"+CCLK: \"%d/%d/%d,%d:%d:%d",&year,&month,&day,&hour,&minute,&second)==6)
+		{
+			_time[0]=year;
+			_time[1]=month;
+			_time[2]=day;
+			_time[3]=hour;
+			_time[4]=minute;
+			_time[5]=second;
+			return 1;
+		}
 	}
+	memset(_time,0xFF,6);
+	return 0;
 }
 
 bool SIM800L::enAutoTimeZone()
 {
-	_clearSerial();
-	_serial->print(F("AT+CFUN=1\r\n"));
-	delay(2000);
-	_clearSerial();
-	_serial->print(F("AT+COPS=2\r\n"));//DE REGISTER
-	delay(2000);
-	_clearSerial();
-	_serial->print(F("AT+CLTS=1\r\n"));//AUTOMATIC TIME ZONE UPDATE ENABLE
-	delay(2000);
-	_clearSerial();
-	_serial->print(F("AT+COPS=0\r\n"));//REGISTER NETWORK
-	delay(6000);
-	_serialBuffer=_readSerial();
-	if ((_serialBuffer.indexOf("ERR"))!=-1) // CHECK IF ERROR
+	// Network time is only sent on registration, so re-register after enabling it.
+	// Each step waits for its own final result code instead of a fixed sleep.
+	if(command("AT+CLTS=1",5000)!=AT_OK)//AUTOMATIC TIME ZONE UPDATE ENABLE
 	{
-		softReset(); // SOFT-RESET GSM IF ERROR 
-		delay(5000);
 		return false;
 	}
-	else
+	command("AT+COPS=2",10000);//DE REGISTER
+	ATResult result=command("AT+COPS=0");//REGISTER NETWORK
+	if (result==AT_ERROR || result==AT_CMS_ERROR) // CHECK IF ERROR
 	{
-		return true;
+		softReset(); // SOFT-RESET GSM IF ERROR
+		return false;
 	}
+	return true;
 }
 
 bool SIM800L::softReset()
 {
 	_clearSerial();
-	_serial->print (F("AT+CFUN=1,1\r\n"));
+	_cmgf=-1;
+	command("AT+CFUN=1,1",10000);
+	if(_bootStage!=BOOT_IDLE)
+	{
+		bootStart(); // the module reboots, readiness starts over
+	}
 	return 1;
 }
 
@@ -472,9 +2294,14 @@ bool SIM800L::hardReset()
 {
 	if(rstDeclair)
 	{
+		_cmgf=-1;
 		digitalWrite(rstpin,HIGH);
 		delay(500);
 		digitalWrite(rstpin,LOW);
+		if(_bootStage!=BOOT_IDLE)
+		{
+			bootStart();
+		}
 
 		return 1;
 	}
@@ -482,4 +2309,4 @@ bool SIM800L::hardReset()
 	{
 		return 0;
 	}
-}
\ No newline at end of file
+}
@@ -10,6 +10,7 @@
 #include <LoRa.h>
 #include "BluetoothSerial.h"
 #include "SIM800L.h"
+#include "PositionFrame.h"
 
 // --- Configuration ---
 // ROLE: set to true for sender, false for receiver
@@ -147,15 +148,6 @@ bool checkLoRaConnection() {
   return LoRa.begin(LORA_FREQ);
 }
 
-// Helper: format GPS timestamp as ISO8601 Z (UTC)
-String formatGpsTimestamp(TinyGPSDate &d, TinyGPSTime &t) {
-  if (!d.isValid() || !t.isValid()) return String("1970-01-01T00:00:00Z");
-  char buf[32];
-  snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02dZ",
-    d.year(), d.month(), d.day(), t.hour(), t.minute(), t.second());
-  return String(buf);
-}
-
 // Minimal helper to extract simple string values from a JSON-like payload
 String extractJsonValue(const String &payload, const String &key) {
   String pattern = String("\"") + key + "\":\"";
@@ -212,12 +204,12 @@ bool sendSMS(const char *toNumber, const String &message) {
 
 
 
-// Send payload via LoRa (no ACK needed)
-void sendViaLoRa(const String &payload) {
+// Send a binary position frame via LoRa (no ACK needed)
+void sendViaLoRa(const uint8_t *frame, size_t len) {
   if (loraConnected && checkLoRaConnection()) {
-    logToBoth("[LoRa] Sending data");
+    logToBoth("[LoRa] Sending " + String(len) + " byte frame");
     LoRa.beginPacket();
-    LoRa.print(payload);
+    LoRa.write(frame, len);
     LoRa.endPacket();
     logToBoth("[LoRa] Data sent");
   } else {
@@ -225,20 +217,6 @@ void sendViaLoRa(const String &payload) {
   }
 }
 
-// Create JSON payload string for sending; message_id included for ACKs
-String createPayload(double lat, double lon, const String &timestamp, const String &msgId) {
-  String s = "{";
-  s += "\"soldier_id\":\"" + String(SOLDIER_ID) + "\",";
-  s += "\"device_type\":\"" + String(DEVICE_TYPE) + "\",";
-  s += "\"latitude\":" + String(lat, 6) + ",";
-  s += "\"longitude\":" + String(lon, 6) + ",";
-  s += "\"communication_mode\":\"\","; // will be set by receiver
-  s += "\"timestamp\":\"" + timestamp + "\",";
-  s += "\"message_id\":\"" + msgId + "\"";
-  s += "}";
-  return s;
-}
-
 // Print to Bluetooth Serial in required format (ensures communication_mode set)
 void publishToBluetooth(const String &jsonPayload, const char *commMode) {
   // Build output by replacing or inserting communication_mode
@@ -264,71 +242,96 @@ void publishToBluetooth(const String &jsonPayload, const char *commMode) {
   logToBoth("[BT] " + out);
 }
 
-// Receiver: process an incoming LoRa packet and reply ACK
+// Receiver: process an incoming LoRa packet (binary frame, or JSON from older trackers)
 void handleLoRaReceive() {
   int packetSize = LoRa.parsePacket();
   if (packetSize) {
-    String incoming = "";
-    while (LoRa.available()) incoming += (char)LoRa.read();
-    incoming.trim();
-    logToBoth("[LoRa RX] " + incoming);
-    publishToBluetooth(incoming, "Lora");
-  }
-}
-
-// Read lines from SIM and handle incoming SMS notifications (CMT)
-void handleSimIncoming() {
-  static bool waitingForBody = false;
-  static String smsHeader = "";
-  
-  while (SerialSIM.available()) {
-    String line = SerialSIM.readStringUntil('\n');
-    line.trim();
-    if (line.length() == 0) continue;
+    uint8_t packet[256];
+    int len = 0;
+    while (LoRa.available() && len < (int)sizeof(packet)) packet[len++] = LoRa.read();
     
-    logToBoth("[SIM] " + line);
+    // Reports relayed by combined trackers: decode the enclosed frame
+    RelayHeader hop;
+    PosDecodeResult envelope = relayDecode(packet, len, hop);
+    if (envelope == POS_OK) {
+      len -= RELAY_HEADER_LEN;
+      memmove(packet, &packet[RELAY_HEADER_LEN], len);
+    }
     
-    if (line.startsWith("+CMT:")) {
-      // SMS notification header - extract sender info
-      smsHeader = line;
-      waitingForBody = true;
-      logToBoth("Incoming SMS detected");
-      continue;
+    PositionFix fix;
+    static PositionFix track[TRACK_FIXES_MAX];
+    int trackCount = 0;
+    PosDecodeResult decoded = (envelope == POS_OK || envelope == POS_NOT_FRAME) ? positionDecode(packet, len, fix) : envelope;
+    if (decoded == POS_NOT_FRAME) {
+      PosDecodeResult asTrack = trackDecode(packet, len, track, TRACK_FIXES_MAX, trackCount);
+      if (asTrack != POS_NOT_FRAME) decoded = asTrack;
+    } else if (decoded == POS_OK) {
+      track[0] = fix;
+      trackCount = 1;
     }
     
-    if (waitingForBody) {
-      String body = line;
-      body.trim();
-      
-      // Print SMS details to Serial and Bluetooth
-      logToBoth("=== INCOMING SMS ===");
-      logToBoth("Header: " + smsHeader);
-      logToBoth("Message: " + body);
-      logToBoth("==================");
-      
-      // Check if it's a JSON payload (tracker message)
-      if (body.indexOf("soldier_id") != -1 || body.indexOf("latitude") != -1) {
-        publishToBluetooth(body, "GSM");
-        logToBoth("SMS contains tracker data");
-        BT.println(">>> TRACKER DATA RECEIVED VIA SMS");
-      } else {
-        // Regular SMS - could be guiding message or other
-        logToBoth("Regular SMS received");
-        BT.println(">>> GUIDING MESSAGE: " + body);
-        
-        // If in sender mode, this is a guiding message for this tracker
-        if (ROLE_IS_SENDER) {
-          BT.println(">>> INSTRUCTION RECEIVED: " + body);
-          logToBoth("Received instruction: " + body);
-        }
+    if (decoded == POS_OK) {
+      logToBoth("[LoRa RX] Frame " + String(track[0].id) + " #" + String(track[0].seq) +
+                (trackCount > 1 ? "-" + String(track[trackCount - 1].seq) : String("")) + " (" + String(len) + " bytes)" +
+                (envelope == POS_OK ? " via " + String(hop.relay) : String("")));
+      // One device type per fleet; it is not carried in the frame. A track is published fix by fix
+      for (int i = 0; i < trackCount; i++) {
+        publishToBluetooth(positionJson(track[i], DEVICE_TYPE, ""), "Lora");
       }
-      
-      waitingForBody = false;
-      smsHeader = "";
+    } else if (decoded == POS_NOT_FRAME &&
+               ((packet[0] & 0xF0) == LINK_FRAME_MAGIC || (packet[0] & 0xF0) == ACK_FRAME_MAGIC)) {
+      // Link control (ADR) and report ACKs between combined trackers and stations;
+      // this sketch stays on the defaults and sends without ACKs
+    } else if (decoded != POS_NOT_FRAME) {
+      logToBoth("[LoRa RX] Corrupt position frame dropped (" + String(len) + " bytes)");
+    } else {
+      String incoming = "";
+      for (int i = 0; i < len; i++) incoming += (char)packet[i];
+      incoming.trim();
+      logToBoth("[LoRa RX] " + incoming);
+      publishToBluetooth(incoming, "Lora");
     }
   }
 }
 
+// Handle incoming SMS notifications (+CMT), dispatched by sim800l.poll()
+void handleSimIncoming(URCType type, const char *header, const char *text, void *context) {
+  String smsHeader = header;
+  String body = text;
+  body.trim();
+  if (body.length() == 0) return;
+  
+  logToBoth("Incoming SMS detected");
+  
+  // Print SMS details to Serial and Bluetooth
+  logToBoth("=== INCOMING SMS ===");
+  logToBoth("Header: " + smsHeader);
+  logToBoth("Message: " + body);
+  logToBoth("==================");
+  
+  // Check if it's a JSON payload (tracker message)
+  if (body.indexOf("soldier_id") != -1 || body.indexOf("latitude") != -1) {
+    publishToBluetooth(body, "GSM");
+    logToBoth("SMS contains tracker data");
+    BT.println(">>> TRACKER DATA RECEIVED VIA SMS");
+  } else {
+    // Regular SMS - could be guiding message or other
+    logToBoth("Regular SMS received");
+    BT.println(">>> GUIDING MESSAGE: " + body);
+    
+    // If in sender mode, this is a guiding message for this tracker
+    if (ROLE_IS_SENDER) {
+      BT.println(">>> INSTRUCTION RECEIVED: " + body);
+      logToBoth("Received instruction: " + body);
+    }
+  }
+}
+
+// Lets SIM800L::begin() move the modem UART to a faster rate
+void setSimBaud(uint32_t baud, void *context) {
+  SerialSIM.updateBaudRate(baud);
+}
+
 void setup() {
   Serial.begin(115200);
   delay(100);
@@ -344,6 +347,7 @@ void setup() {
   // SIM serial and SIM800L driver initialization
   SerialSIM.begin(9600, SERIAL_8N1, SIM_RX_PIN, SIM_TX_PIN);
   delay(1000);
+  sim800l.baudControl(setSimBaud);  // negotiated up to 115200, stored with AT&W
   
   // Initialize SIM800L driver
   if (sim800l.begin(SerialSIM)) {
@@ -365,8 +369,8 @@ void setup() {
   }
 
   // Configure SMS notifications for incoming messages
-  SerialSIM.println("AT+CNMI=2,1,0,0,0"); // Enable SMS notifications
-  delay(200);
+  sim800l.onURC(URC_CMT, handleSimIncoming);
+  sim800l.command("AT+CNMI=2,2,0,0,0", 2000); // Deliver SMS directly as +CMT
   
   // Check network status
   if (sim800l.checkNetwork()) {
@@ -401,7 +405,7 @@ void loop() {
 
   // Always handle incoming LoRa and SIM messages (receiver path)
   handleLoRaReceive();
-  handleSimIncoming();
+  sim800l.poll();
 
   if (ROLE_IS_SENDER) {
     // Show live GPS status every 10 seconds
@@ -419,49 +423,35 @@ void loop() {
     if (millis() - lastSendTime >= 10000) { // Send every 10 seconds
       lastSendTime = millis();
       
-      if (gps.location.isValid() && gps.date.isValid() && gps.time.isValid()) {
-      double lat = gps.location.lat();
-      double lon = gps.location.lng();
-      String ts = formatGpsTimestamp(gps.date, gps.time);
-      String msgId = String(millis()) + "-" + String(messageCounter++);
-      String payload = createPayload(lat, lon, ts, msgId);
-
-      logToBoth("[Payload] " + payload);
-
-      // Send on both LoRa and GSM simultaneously
-      logToBoth("[Send] Transmitting on both LoRa and GSM");
-      
-      // Send via LoRa
-      sendViaLoRa(payload);
-      
-      // Send via GSM
-      bool smsOk = sendSMS(payload);
-      logToBoth(smsOk ? "[GSM] SMS sent to receivers" : "[GSM] All SMS sends failed");
-      
-      // Publish locally for confirmation
-      publishToBluetooth(payload, "Both");
-    } else {
-      // No GPS fix - send "no fix" message
-      String ts = "1970-01-01T00:00:00Z";
-      String msgId = String(millis()) + "-" + String(messageCounter++);
-      String payload = createPayload(0.0, 0.0, ts, msgId);
-      payload.replace("\"latitude\":0.000000,\"longitude\":0.000000", "\"status\":\"no_fix\"");
+      bool valid = gps.location.isValid() && gps.date.isValid() && gps.time.isValid();
+      PositionFix fix;
+      positionSet(fix, SOLDIER_ID, (uint16_t)messageCounter++, valid, gps.location.lat(), gps.location.lng(),
+                  valid ? positionEpoch(gps.date.year(), gps.date.month(), gps.date.day(),
+                                        gps.time.hour(), gps.time.minute(), gps.time.second()) : 0,
+                  gps.satellites.value(), gps.hdop.isValid() ? gps.hdop.value() : -1);
+      uint8_t frame[POS_FRAME_LEN];
+      size_t frameLen = positionEncode(fix, frame, sizeof(frame));
+      // SMS readers and the BT host get JSON; communication_mode is set by the receiver
+      String payload = positionJson(fix, DEVICE_TYPE, "");
       
-      logToBoth("[No GPS Fix] " + payload);
+      logToBoth(String(valid ? "[Payload] " : "[No GPS Fix] ") + payload);
       
       // Send on both LoRa and GSM simultaneously
-      logToBoth("[Send] Transmitting no fix on both LoRa and GSM");
+      logToBoth(valid ? "[Send] Transmitting on both LoRa and GSM" : "[Send] Transmitting no fix on both LoRa and GSM");
       
       // Send via LoRa
-      sendViaLoRa(payload);
+      sendViaLoRa(frame, frameLen);
       
       // Send via GSM
       bool smsOk = sendSMS(payload);
-      logToBoth(smsOk ? "[GSM] No fix SMS sent to receivers" : "[GSM] All no fix SMS sends failed");
+      if (valid) {
+        logToBoth(smsOk ? "[GSM] SMS sent to receivers" : "[GSM] All SMS sends failed");
+      } else {
+        logToBoth(smsOk ? "[GSM] No fix SMS sent to receivers" : "[GSM] All no fix SMS sends failed");
+      }
       
       // Publish locally for confirmation
       publishToBluetooth(payload, "Both");
-      }
     }
   }
   
@@ -31,6 +31,11 @@ String lastLoRa = "";
 unsigned long lastLoRaTime = 0;
 bool loraConnected = false;
 
+// Lets SIM800L::begin() move the modem UART to a faster rate
+void setSimBaud(uint32_t baud, void *context) {
+  SerialSIM.updateBaudRate(baud);
+}
+
 void setup() {
   Serial.begin(115200);
   delay(1000);
@@ -42,6 +47,7 @@ void setup() {
   // Initialize SIM800L serial
   SerialSIM.begin(9600, SERIAL_8N1, SIM_RX_PIN, SIM_TX_PIN);
   delay(2000);
+  sim800l.baudControl(setSimBaud);  // negotiated up to 115200, stored with AT&W
   
   // Initialize SIM800L driver
   if (sim800l.begin(SerialSIM)) {
@@ -55,10 +61,9 @@ void setup() {
   }
   
   // Configure SMS notifications
-  SerialSIM.println("AT+CMGF=1"); // Text mode
-  delay(200);
-  SerialSIM.println("AT+CNMI=2,1,0,0,0"); // Enable SMS notifications
-  delay(200);
+  sim800l.onURC(URC_CMT, handleIncomingSMS);
+  sim800l.command("AT+CMGF=1", 2000); // Text mode
+  sim800l.command("AT+CNMI=2,2,0,0,0", 2000); // Deliver SMS directly as +CMT
   
   // Check network
   if (sim800l.checkNetwork()) {
@@ -93,8 +98,8 @@ void loop() {
   // Handle Bluetooth commands
   handleBluetoothCommands();
   
-  // Handle incoming SMS
-  handleIncomingSMS();
+  // Handle incoming SMS (+CMT is dispatched to handleIncomingSMS)
+  sim800l.poll();
   
   // Handle incoming LoRa
   handleIncomingLoRa();
@@ -142,64 +147,38 @@ void showStatus() {
   BT.println("============================");
 }
 
-// Handle incoming SMS messages
-void handleIncomingSMS() {
-  static bool waitingForBody = false;
-  static String smsHeader = "";
-  static String senderNumber = "";
+// Handle incoming SMS messages (+CMT URC from the SIM800L driver)
+void handleIncomingSMS(URCType type, const char *header, const char *text, void *context) {
+  // SMS header: +CMT: "+1234567890","","21/12/11,14:30:15+00"
+  char sender[32];
+  SIM800L::textField(header, 0, sender, sizeof(sender));
+  String senderNumber = sender;
+  String messageBody = text;
+  messageBody.trim();
+  if (messageBody.length() == 0) return;
   
-  while (SerialSIM.available()) {
-    String line = SerialSIM.readStringUntil('\n');
-    line.trim();
-    if (line.length() == 0) continue;
-    
-    // Debug: show raw SIM responses
-    Serial.println("[SIM] " + line);
-    
-    if (line.startsWith("+CMT:")) {
-      // SMS header: +CMT: "+1234567890","","21/12/11,14:30:15+00"
-      smsHeader = line;
-      waitingForBody = true;
-      
-      // Extract sender number
-      int firstQuote = line.indexOf('"');
-      int secondQuote = line.indexOf('"', firstQuote + 1);
-      if (firstQuote != -1 && secondQuote != -1) {
-        senderNumber = line.substring(firstQuote + 1, secondQuote);
-      }
-      
-      Serial.println("SMS incoming from: " + senderNumber);
-      continue;
-    }
-    
-    if (waitingForBody && line.length() > 0) {
-      String messageBody = line;
-      messageBody.trim();
-      
-      // Store last SMS info
-      lastSMS = messageBody;
-      lastSMSTime = millis();
-      
-      // Display SMS on Bluetooth
-      BT.println("");
-      BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-      BT.println("📱 NEW SMS RECEIVED");
-      BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-      BT.println("From: " + senderNumber);
-      BT.println("Time: " + getTimeStamp());
-      BT.println("Message:");
-      BT.println("\"" + messageBody + "\"");
-      BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-      BT.println("");
-      
-      // Also log to Serial
-      Serial.println("SMS from " + senderNumber + ": " + messageBody);
-      
-      waitingForBody = false;
-      smsHeader = "";
-      senderNumber = "";
-    }
-  }
+  // Debug: show raw SIM notification
+  Serial.println("[SIM] " + String(header));
+  Serial.println("SMS incoming from: " + senderNumber);
+  
+  // Store last SMS info
+  lastSMS = messageBody;
+  lastSMSTime = millis();
+  
+  // Display SMS on Bluetooth
+  BT.println("");
+  BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+  BT.println("📱 NEW SMS RECEIVED");
+  BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+  BT.println("From: " + senderNumber);
+  BT.println("Time: " + getTimeStamp());
+  BT.println("Message:");
+  BT.println("\"" + messageBody + "\"");
+  BT.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+  BT.println("");
+  
+  // Also log to Serial
+  Serial.println("SMS from " + senderNumber + ": " + messageBody);
 }
 
 // Get timestamp string
@@ -23,6 +23,11 @@ BluetoothSerial BT;
 
 unsigned long lastSMSTime = 0;
 
+// Lets SIM800L::begin() move the modem UART to a faster rate
+void setSimBaud(uint32_t baud, void *context) {
+  SerialSIM.updateBaudRate(baud);
+}
+
 void setup() {
   Serial.begin(115200);
   delay(1000);
@@ -38,6 +43,7 @@ void setup() {
   // Initialize SIM800L serial
   SerialSIM.begin(9600, SERIAL_8N1, SIM_RX_PIN, SIM_TX_PIN);
   delay(2000);
+  sim800l.baudControl(setSimBaud);  // negotiated up to 115200, stored with AT&W
   
   // Initialize SIM800L module
   if (sim800l.begin(SerialSIM)) {